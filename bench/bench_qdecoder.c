@@ -0,0 +1,375 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * qDecoder micro-benchmarks.
+ *
+ * @file bench_qdecoder.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include "qbench.h"
+#include "qdecoder.h"
+#include "internal.h"
+
+#define NKEYS   (4096)
+
+static char *keys[NKEYS];
+static char tmpdir[64];
+static FILE *devnull;
+
+typedef struct {
+    int size;
+    qentry_t *list;
+} entryarg_t;
+
+typedef struct {
+    qentry_t *params;
+    const char *body;
+    size_t bodylen;
+    FILE *in;
+    bool disk;
+} parsearg_t;
+
+static void bench_put(long n, void *arg);
+static void bench_get(long n, void *arg);
+static void bench_remove(long n, void *arg);
+static void bench_urlencode(long n, void *arg);
+static void bench_urldecode(long n, void *arg);
+static void bench_parse(long n, void *arg);
+static void bench_session_new(long n, void *arg);
+static void bench_session_load(long n, void *arg);
+static void bench_download(long n, void *arg);
+static qentry_t *make_params(const char *method, const char *contenttype,
+                             size_t contentlength);
+static char *make_urlencoded(int pairs, int valuelen, size_t *len);
+static char *make_multipart(size_t filesize, size_t *len);
+static qentry_t *new_request(qcgictx_t *ctx, qentry_t *params);
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw);
+
+int main(int argc, char **argv)
+{
+    qbench_init(argc, argv);
+
+    int i;
+    for (i = 0; i < NKEYS; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%d", i);
+        keys[i] = strdup(key);
+    }
+    snprintf(tmpdir, sizeof(tmpdir), "/tmp/qbench-XXXXXX");
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    devnull = fopen("/dev/null", "w");
+
+    // qentry_t
+    int sizes[] = { 16, 256, 4096 };
+    for (i = 0; i < 3; i++) {
+        char name[64];
+        entryarg_t arg = { sizes[i], qEntry() };
+        int j;
+        for (j = 0; j < sizes[i]; j++) arg.list->putstr(arg.list, keys[j], "value", false);
+
+        snprintf(name, sizeof(name), "qentry/put/n=%d", sizes[i]);
+        qbench_run(name, 0, bench_put, &arg);
+        snprintf(name, sizeof(name), "qentry/get/n=%d", sizes[i]);
+        qbench_run(name, 0, bench_get, &arg);
+        snprintf(name, sizeof(name), "qentry/remove/n=%d", sizes[i]);
+        qbench_run(name, 0, bench_remove, &arg);
+        arg.list->free(arg.list);
+    }
+
+    // URL encoding
+    char *bin = (char *)malloc(1024);
+    for (i = 0; i < 1024; i++) bin[i] = (i % 4 == 0) ? (char)(i & 0xff) : 'a' + (i % 26);
+    qbench_run("urlencode/1KB", 1024, bench_urlencode, bin);
+    char *encoded = _q_urlencode(bin, 1024);
+    qbench_run("urldecode/1KB", strlen(encoded), bench_urldecode, encoded);
+
+    // request parsing
+    size_t len;
+    char *query = make_urlencoded(20, 16, &len);
+    parsearg_t get = { make_params("GET", NULL, 0), NULL, 0, NULL, false };
+    get.params->putstr(get.params, "QUERY_STRING", query, true);
+    qbench_run("parse/urlencoded/get", len, bench_parse, &get);
+    get.params->free(get.params);
+    free(query);
+
+    char *form = make_urlencoded(200, 16, &len);
+    parsearg_t post = { make_params("POST", "application/x-www-form-urlencoded", len),
+                        form, len, NULL, false };
+    qbench_run("parse/urlencoded/post", len, bench_parse, &post);
+    post.params->free(post.params);
+    free(form);
+
+    char *cookie = make_urlencoded(20, 16, &len);
+    for (i = 0; cookie[i] != '\0'; i++) if (cookie[i] == '&') cookie[i] = ';';
+    parsearg_t cookies = { make_params("GET", NULL, 0), NULL, 0, NULL, false };
+    cookies.params->putstr(cookies.params, "HTTP_COOKIE", cookie, true);
+    qbench_run("parse/cookie", len, bench_parse, &cookies);
+    cookies.params->free(cookies.params);
+    free(cookie);
+
+    size_t filesizes[] = { 4 * 1024, 1024 * 1024 };
+    for (i = 0; i < 2; i++) {
+        char name[64];
+        char *body = make_multipart(filesizes[i], &len);
+        parsearg_t mp = { make_params("POST", "multipart/form-data; boundary=QBENCHBOUNDARY", len),
+                          body, len, NULL, false };
+        snprintf(name, sizeof(name), "parse/multipart/memory/%zuKB", filesizes[i] / 1024);
+        qbench_run(name, len, bench_parse, &mp);
+        mp.disk = true;
+        snprintf(name, sizeof(name), "parse/multipart/disk/%zuKB", filesizes[i] / 1024);
+        qbench_run(name, len, bench_parse, &mp);
+        mp.params->free(mp.params);
+        free(body);
+    }
+
+    // sessions
+    qbench_run("session/new", 0, bench_session_new, NULL);
+    qbench_run("session/load+save", 0, bench_session_load, NULL);
+
+    // downloads
+    char path[128];
+    snprintf(path, sizeof(path), "%s/download.bin", tmpdir);
+    FILE *fp = fopen(path, "w");
+    for (i = 0; i < 1024; i++) fwrite(bin, 1, 1024, fp);
+    fclose(fp);
+    qbench_run("download/1MB", 1024 * 1024, bench_download, path);
+
+    free(bin);
+    free(encoded);
+    for (i = 0; i < NKEYS; i++) free(keys[i]);
+    fclose(devnull);
+    nftw(tmpdir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return qbench_done();
+}
+
+static void bench_put(long n, void *arg)
+{
+    entryarg_t *e = (entryarg_t *)arg;
+    long done = 0;
+    while (done < n) {
+        qentry_t *list = qEntry();
+        int i;
+        for (i = 0; i < e->size && done < n; i++, done++) {
+            list->putstr(list, keys[i], "value", false);
+        }
+        list->free(list);
+    }
+}
+
+static void bench_get(long n, void *arg)
+{
+    entryarg_t *e = (entryarg_t *)arg;
+    long i;
+    for (i = 0; i < n; i++) {
+        if (e->list->getstr(e->list, keys[i % e->size], false) == NULL) abort();
+    }
+}
+
+static void bench_remove(long n, void *arg)
+{
+    entryarg_t *e = (entryarg_t *)arg;
+    long i;
+    for (i = 0; i < n; i++) {
+        const char *key = keys[i % e->size];
+        e->list->remove(e->list, key);
+        e->list->putstr(e->list, key, "value", false);  // for the next round
+    }
+}
+
+static void bench_urlencode(long n, void *arg)
+{
+    long i;
+    for (i = 0; i < n; i++) free(_q_urlencode(arg, 1024));
+}
+
+static void bench_urldecode(long n, void *arg)
+{
+    const char *encoded = (const char *)arg;
+    size_t len = strlen(encoded);
+    char *buf = (char *)malloc(len + 1);
+    long i;
+    for (i = 0; i < n; i++) {
+        memcpy(buf, encoded, len + 1);
+        _q_urldecode(buf);
+    }
+    free(buf);
+}
+
+static void bench_parse(long n, void *arg)
+{
+    parsearg_t *p = (parsearg_t *)arg;
+    FILE *in = (p->bodylen > 0) ? fmemopen((void *)p->body, p->bodylen, "r") : NULL;
+    qcgictx_t ctx = { p->params, in, devnull };
+    long i;
+    for (i = 0; i < n; i++) {
+        if (in != NULL) rewind(in);
+        qentry_t *req = NULL;
+        if (p->disk == true) req = qcgireq_setoption(NULL, true, tmpdir, 0);
+        req = qcgireq_parse_ctx(&ctx, req, 0);
+        if (p->disk == true) {
+            const char *savepath = req->getstr(req, "file.savepath", false);
+            if (savepath != NULL) unlink(savepath);
+        }
+        req->free(req);
+    }
+    if (in != NULL) fclose(in);
+}
+
+static void bench_session_new(long n, void *arg)
+{
+    qentry_t *params = make_params("GET", NULL, 0);
+    params->putstr(params, "REMOTE_ADDR", "127.0.0.1", true);
+    qcgictx_t ctx = { params, NULL, devnull };
+    long i;
+    for (i = 0; i < n; i++) {
+        qentry_t *req = new_request(&ctx, params);
+        qentry_t *sess = qcgisess_init(req, tmpdir);
+        sess->putstr(sess, "user", "qdecoder", true);
+        sess->putint(sess, "visits", 1, true);
+        qcgisess_save(sess);
+        qcgisess_destroy(sess);
+        req->free(req);
+    }
+    params->free(params);
+}
+
+static void bench_session_load(long n, void *arg)
+{
+    qentry_t *params = make_params("GET", NULL, 0);
+    params->putstr(params, "REMOTE_ADDR", "127.0.0.1", true);
+    qcgictx_t ctx = { params, NULL, devnull };
+
+    qentry_t *req = new_request(&ctx, params);
+    qentry_t *sess = qcgisess_init(req, tmpdir);
+    qcgisess_save(sess);
+    char cookie[128];
+    snprintf(cookie, sizeof(cookie), "QSESSIONID=%s", qcgisess_getid(sess));
+    sess->free(sess);
+    req->free(req);
+    params->putstr(params, "HTTP_COOKIE", cookie, true);
+
+    long i;
+    for (i = 0; i < n; i++) {
+        req = new_request(&ctx, params);
+        sess = qcgisess_init(req, tmpdir);
+        sess->putint(sess, "visits", sess->getint(sess, "visits") + 1, true);
+        qcgisess_save(sess);
+        if (i == n - 1) qcgisess_destroy(sess);
+        else sess->free(sess);
+        req->free(req);
+    }
+    params->free(params);
+}
+
+static void bench_download(long n, void *arg)
+{
+    qentry_t *params = make_params("GET", NULL, 0);
+    qcgictx_t ctx = { params, NULL, devnull };
+    long i;
+    for (i = 0; i < n; i++) {
+        qentry_t *req = new_request(&ctx, params);
+        qcgires_download(req, (const char *)arg, "application/octet-stream");
+        req->free(req);
+    }
+    params->free(params);
+}
+
+static qentry_t *make_params(const char *method, const char *contenttype,
+                             size_t contentlength)
+{
+    qentry_t *params = qEntry();
+    params->putstr(params, "REQUEST_METHOD", method, true);
+    if (contenttype != NULL) {
+        params->putstr(params, "CONTENT_TYPE", contenttype, true);
+        params->putint(params, "CONTENT_LENGTH", (int)contentlength, true);
+    }
+    return params;
+}
+
+// "k0=vvv%20vvv&k1=..." with a few escapes in every value.
+static char *make_urlencoded(int pairs, int valuelen, size_t *len)
+{
+    char *str = (char *)malloc(pairs * (valuelen * 3 + 16) + 1);
+    char *p = str;
+    int i, j;
+    for (i = 0; i < pairs; i++) {
+        p += sprintf(p, "%sk%d=", (i > 0) ? "&" : "", i);
+        for (j = 0; j < valuelen; j++) {
+            if (j % 8 == 7) p += sprintf(p, "%%20");
+            else *p++ = 'a' + (j % 26);
+        }
+    }
+    *p = '\0';
+    *len = p - str;
+    return str;
+}
+
+// two fields and a binary file.
+static char *make_multipart(size_t filesize, size_t *len)
+{
+    char *body = (char *)malloc(filesize + 1024);
+    char *p = body;
+    p += sprintf(p, "--QBENCHBOUNDARY\r\n"
+                 "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+                 "benchmark\r\n"
+                 "--QBENCHBOUNDARY\r\n"
+                 "Content-Disposition: form-data; name=\"comment\"\r\n\r\n"
+                 "synthetic multipart body\r\n"
+                 "--QBENCHBOUNDARY\r\n"
+                 "Content-Disposition: form-data; name=\"file\"; filename=\"data.bin\"\r\n"
+                 "Content-Type: application/octet-stream\r\n\r\n");
+    size_t i;
+    for (i = 0; i < filesize; i++) *p++ = (char)((i * 7 + (i >> 8)) & 0xff);
+    p += sprintf(p, "\r\n--QBENCHBOUNDARY--\r\n");
+    *len = p - body;
+    return body;
+}
+
+static qentry_t *new_request(qcgictx_t *ctx, qentry_t *params)
+{
+    ctx->params = params;
+    return qcgireq_parse_ctx(ctx, NULL, 0);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw)
+{
+    return remove(path);
+}
@@ -0,0 +1,252 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * Replays requests recorded by qcgireq_setcapture() or QDECODER_CAPTURE
+ * through qcgireq_parse_ctx() in a tight loop and reports the latency.
+ *
+ * Usage: bench_replay [-n iterations] [-t threads] [-j] capture-file
+ *
+ * @file bench_replay.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "qdecoder.h"
+
+typedef struct {
+    char *vars;         // "NAME\0VALUE\0" pairs
+    size_t varslen;
+    char *body;
+    size_t bodylen;
+} record_t;
+
+typedef struct {
+    pthread_t tid;
+    long first;         // iterations of this thread
+    long count;
+    int64_t *latency;   // ns, shared array
+} worker_t;
+
+static record_t *records;
+static int nrecords;
+static FILE *devnull;
+
+static bool load(const char *path);
+static void *replay(void *arg);
+static int64_t nsec(void);
+static int compare(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+    long iterations = 0;
+    int nthreads = 1;
+    bool json = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:j")) != -1) {
+        if (opt == 'n') iterations = atol(optarg);
+        else if (opt == 't') nthreads = atoi(optarg);
+        else if (opt == 'j') json = true;
+        else optind = argc + 1;
+    }
+    if (optind != argc - 1 || nthreads < 1) {
+        fprintf(stderr, "Usage: %s [-n iterations] [-t threads] [-j] capture-file\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsetenv("QDECODER_CAPTURE");  // don't capture the replay
+    if (load(argv[optind]) == false) return EXIT_FAILURE;
+    if (iterations <= 0) iterations = (nrecords > 100000) ? nrecords : 100000;
+    devnull = fopen("/dev/null", "w");
+
+    int64_t *latency = (int64_t *)malloc(sizeof(int64_t) * iterations);
+    worker_t *workers = (worker_t *)calloc(nthreads, sizeof(worker_t));
+    if (latency == NULL || workers == NULL || devnull == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    int64_t start = nsec();
+    long first = 0;
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        workers[i].first = first;
+        workers[i].count = iterations / nthreads + ((i < iterations % nthreads) ? 1 : 0);
+        workers[i].latency = latency;
+        first += workers[i].count;
+        if (pthread_create(&workers[i].tid, NULL, replay, &workers[i]) != 0) {
+            fprintf(stderr, "Can't create a thread.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < nthreads; i++) pthread_join(workers[i].tid, NULL);
+    double elapsed = (double)(nsec() - start) / 1e9;
+
+    qsort(latency, iterations, sizeof(int64_t), compare);
+    double pct[] = { 50, 90, 99, 99.9 };
+    double us[5];
+    for (i = 0; i < 4; i++) {
+        long idx = (long)(pct[i] / 100 * iterations);
+        if (idx >= iterations) idx = iterations - 1;
+        us[i] = latency[idx] / 1000.0;
+    }
+    us[4] = latency[iterations - 1] / 1000.0;
+
+    if (json == true) {
+        printf("{\"name\":\"replay\",\"version\":\"%s\",\"records\":%d,"
+               "\"iterations\":%ld,\"threads\":%d,\"req_per_s\":%.0f,"
+               "\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,"
+               "\"p999_us\":%.2f,\"max_us\":%.2f}\n",
+               _Q_VERSION, nrecords, iterations, nthreads,
+               iterations / elapsed, us[0], us[1], us[2], us[3], us[4]);
+    } else {
+        printf("records %d, iterations %ld, threads %d, %.2f s, %.0f req/s\n",
+               nrecords, iterations, nthreads, elapsed, iterations / elapsed);
+        printf("latency us: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+               us[0], us[1], us[2], us[3], us[4]);
+    }
+
+    for (i = 0; i < nrecords; i++) {
+        free(records[i].vars);
+        free(records[i].body);
+    }
+    free(records);
+    free(latency);
+    free(workers);
+    fclose(devnull);
+    return EXIT_SUCCESS;
+}
+
+static uint32_t get_uint32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static bool load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    int size = 0;
+    unsigned char hdr[16];
+    while (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)) {
+        if (memcmp(hdr, "QCAP", 4) != 0 || hdr[4] != 1) {
+            fprintf(stderr, "%s: not a capture file.\n", path);
+            fclose(fp);
+            return false;
+        }
+        if (nrecords == size) {
+            size = (size > 0) ? size * 2 : 64;
+            records = (record_t *)realloc(records, sizeof(record_t) * size);
+            if (records == NULL) return false;
+        }
+        record_t *r = &records[nrecords];
+        r->varslen = get_uint32(hdr + 8);
+        r->bodylen = get_uint32(hdr + 12);
+        r->vars = (char *)malloc(r->varslen + 1);
+        r->body = (char *)malloc(r->bodylen + 1);
+        if (r->vars == NULL || r->body == NULL ||
+            fread(r->vars, 1, r->varslen, fp) != r->varslen ||
+            fread(r->body, 1, r->bodylen, fp) != r->bodylen) {
+            fprintf(stderr, "%s: truncated record.\n", path);
+            free(r->vars);
+            free(r->body);
+            break;
+        }
+        nrecords++;
+    }
+    fclose(fp);
+
+    if (nrecords == 0) {
+        fprintf(stderr, "%s: no records.\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void *replay(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+
+    // lists aren't shared among threads
+    qentry_t **params = (qentry_t **)malloc(sizeof(qentry_t *) * nrecords);
+    int i;
+    for (i = 0; i < nrecords; i++) {
+        params[i] = qEntry();
+        const char *p = records[i].vars, *end = p + records[i].varslen;
+        while (p < end) {
+            const char *value = p + strlen(p) + 1;
+            if (value >= end) break;
+            params[i]->putstr(params[i], p, value, true);
+            p = value + strlen(value) + 1;
+        }
+    }
+
+    long n;
+    for (n = 0; n < w->count; n++) {
+        long k = w->first + n;
+        record_t *r = &records[k % nrecords];
+        qcgictx_t ctx = { params[k % nrecords], NULL, devnull };
+        if (r->bodylen > 0) ctx.in = fmemopen(r->body, r->bodylen, "r");
+        else ctx.in = fopen("/dev/null", "r");
+
+        int64_t start = nsec();
+        qentry_t *req = qcgireq_parse_ctx(&ctx, NULL, 0);
+        req->free(req);
+        w->latency[k] = nsec() - start;
+        fclose(ctx.in);
+    }
+
+    for (i = 0; i < nrecords; i++) params[i]->free(params[i]);
+    free(params);
+    return NULL;
+}
+
+static int64_t nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,191 @@
+/******************************************************************************
+ * qbench - C Micro Benchmark Framework
+ *
+ * Copyright (c) 2014-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * qbench C micro-benchmark harness.
+ *
+ * Each benchmark runs its operation in growing batches until a batch takes
+ * the target time, then reports the last batch. Allocations are counted by
+ * wrapping malloc() on glibc, elsewhere they are reported as unavailable.
+ *
+ * @file qbench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "qbench.h"
+#include "qdecoder.h"
+
+static bool _json = false;
+static long _mintime = 500;     // ms a batch should take
+static const char *_filter = NULL;
+static int _count = 0;
+static long _nallocs = 0;
+
+#if defined(__GLIBC__)
+#define QBENCH_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    _nallocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    _nallocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    _nallocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+static int64_t _nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Parse the command line.
+ *
+ * Usage: program [-j] [-t msec] [pattern]
+ *   -j        one JSON object per line, for tracking across releases
+ *   -t msec   target time of a batch, 500 by default
+ *   pattern   run only benchmarks with this in their name
+ */
+void qbench_init(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "jt:")) != -1) {
+        if (opt == 'j') {
+            _json = true;
+        } else if (opt == 't') {
+            _mintime = atol(optarg);
+            if (_mintime <= 0) _mintime = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-j] [-t msec] [pattern]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind < argc) _filter = argv[optind];
+
+    if (_json == false) {
+        printf("qDecoder %s micro-benchmarks\n", _Q_VERSION);
+        printf("%-36s %12s %12s %10s %10s\n", "name", "iterations", "ns/op",
+               "MB/s", "allocs/op");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Measure a benchmark and print the result.
+ *
+ * @param name      benchmark name
+ * @param bytes     bytes processed by one operation, 0 if it doesn't apply
+ * @param fn        runs the operation the given number of times
+ * @param arg       user pointer passed to fn
+ */
+void qbench_run(const char *name, size_t bytes, qbench_fn_t fn, void *arg)
+{
+    if (_filter != NULL && strstr(name, _filter) == NULL) return;
+
+    long n = 1;
+    int64_t elapsed;
+    long allocs;
+    while (true) {
+        long before = _nallocs;
+        int64_t start = _nsec();
+        fn(n, arg);
+        elapsed = _nsec() - start;
+        allocs = _nallocs - before;
+        if (elapsed >= _mintime * 1000000LL || n >= 1000000000L) break;
+
+        // aim a bit past the target, growing at most 100 times a round
+        long next = (elapsed > 0) ?
+                    (long)((double)n * _mintime * 1200000.0 / elapsed) : n * 100;
+        if (next > n * 100) next = n * 100;
+        if (next <= n) next = n + 1;
+        n = next;
+    }
+
+    double nsop = (double)elapsed / n;
+    double mbs = (bytes > 0) ? (double)bytes * n / (1024.0 * 1024.0) /
+                               ((double)elapsed / 1e9) : 0;
+    double allocsop = (double)allocs / n;
+#ifndef QBENCH_ALLOCS
+    allocsop = -1;
+#endif
+
+    if (_json == true) {
+        printf("{\"name\":\"%s\",\"version\":\"%s\",\"iterations\":%ld,"
+               "\"ns_per_op\":%.1f", name, _Q_VERSION, n, nsop);
+        if (bytes > 0) printf(",\"mb_per_s\":%.2f", mbs);
+        else printf(",\"mb_per_s\":null");
+        if (allocsop >= 0) printf(",\"allocs_per_op\":%.2f}\n", allocsop);
+        else printf(",\"allocs_per_op\":null}\n");
+    } else {
+        char mbsstr[32] = "-", allocstr[32] = "-";
+        if (bytes > 0) snprintf(mbsstr, sizeof(mbsstr), "%.2f", mbs);
+        if (allocsop >= 0) snprintf(allocstr, sizeof(allocstr), "%.2f", allocsop);
+        printf("%-36s %12ld %12.1f %10s %10s\n", name, n, nsop, mbsstr, allocstr);
+    }
+    fflush(stdout);
+    _count++;
+}
+
+/**
+ * Finish the run.
+ *
+ * @return  exit code of the program
+ */
+int qbench_done(void)
+{
+    if (_json == false) printf("%d benchmarks.\n", _count);
+    return (_count > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
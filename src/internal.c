@@ -26,6 +26,9 @@
  * POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 
+#ifdef _WIN32
+#define _CRT_RAND_S /* rand_s() */
+#endif
 #ifdef ENABLE_FASTCGI
 #include "fcgi_stdio.h"
 #else
@@ -33,16 +36,22 @@
 #endif
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <string.h>
 #include <unistd.h>
-#include <libgen.h>
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 #include "qdecoder.h"
 #include "internal.h"
 
@@ -50,6 +59,15 @@
 #include "compat/msw_missing.h"
 #endif
 
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+#include <sys/random.h>
+#define HAVE_GETRANDOM
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+      defined(__NetBSD__)
+#define HAVE_ARC4RANDOM
+#endif
+
 // Change two hex characters to one hex value.
 char _q_x2c(char hex_up, char hex_low)
 {
@@ -67,7 +85,7 @@ char *_q_makeword(char *str, char stop)
     int  len, i;
 
     for (len = 0; ((str[len] != stop) && (str[len])); len++);
-    word = (char *)malloc(sizeof(char) * (len + 1));
+    word = (char *)Q_MALLOC(sizeof(char) * (len + 1));
 
     for (i = 0; i < len; i++) word[i] = str[i];
     word[i] = '\0';
@@ -101,15 +119,15 @@ char *_q_urlencode(const void *bin, size_t size)
     }; // 0 means must be encoded.
 
     if (bin == NULL) return NULL;
-    if (size == 0) return strdup("");
+    if (size == 0) return Q_STRDUP("");
 
     // malloc buffer
-    char *pszEncStr = (char *)malloc((size * 3) + 1);
+    char *pszEncStr = (char *)Q_MALLOC((size * 3) + 1);
     if (pszEncStr == NULL) return NULL;
 
     char *pszEncPt = pszEncStr;
-    char *pBinPt = (char *)bin;
-    const char *pBinEnd = (bin + size - 1);
+    const unsigned char *pBinPt = (const unsigned char *)bin;
+    const unsigned char *pBinEnd = pBinPt + size - 1;
     for (; pBinPt <= pBinEnd; pBinPt++) {
         if (URLCHARTBL[(int)(*pBinPt)] != 0) {
             *pszEncPt++ = *pBinPt;
@@ -184,7 +202,7 @@ char *_q_fgetline(FILE *fp, size_t initsize)
 {
     size_t memsize = initsize;
 
-    char *str = (char *)malloc(memsize);
+    char *str = (char *)Q_MALLOC(memsize);
     if (str == NULL) return NULL;
 
     char *ptr;
@@ -193,7 +211,7 @@ char *_q_fgetline(FILE *fp, size_t initsize)
         int c = fgetc(fp);
         if (c == EOF) {
             if (readsize == 0) {
-                free(str);
+                Q_FREE(str);
                 return NULL;
             }
             break;
@@ -203,14 +221,14 @@ char *_q_fgetline(FILE *fp, size_t initsize)
         readsize++;
         if (readsize == memsize) {
             memsize *= 2;
-            char *strtmp = (char *)malloc(memsize);
+            char *strtmp = (char *)Q_MALLOC(memsize);
             if (strtmp == NULL) {
-                free(str);
+                Q_FREE(str);
                 return NULL;
             }
 
             memcpy(strtmp, str, readsize);
-            free(str);
+            Q_FREE(str);
             str = strtmp;
             ptr = str + readsize;
         }
@@ -232,6 +250,16 @@ int _q_unlink(const char *pathname)
     return unlink(pathname);
 }
 
+/* win32 compatible */
+int _q_mkdir(const char *pathname, mode_t mode)
+{
+#if defined(__MINGW32__) && defined(_WIN32) && !defined(__CYGWIN__)
+    return mkdir(pathname);
+#else
+    return mkdir(pathname, mode);
+#endif
+}
+
 char *_q_strcpy(char *dst, size_t size, const char *src)
 {
     if (dst == NULL || size == 0 || src == NULL) return dst;
@@ -270,13 +298,21 @@ char *_q_strunchar(char *str, char head, char tail)
     return str;
 }
 
+/*
+ * Same as basename() but reentrant, it doesn't touch the argument nor use
+ * static storage.
+ */
 char *_q_filename(const char *filepath)
 {
-    char *path = strdup(filepath);
-    char *bname = basename(path);
-    char *filename = strdup(bname);
-    free(path);
-    return filename;
+    const char *end = filepath + strlen(filepath);
+    while (end > filepath + 1 && end[-1] == '/') end--;  // trailing slashes
+    if (end == filepath) return Q_STRDUP(".");
+
+    const char *begin = end;
+    while (begin > filepath && begin[-1] != '/') begin--;
+    if (begin == end) return Q_STRDUP("/");
+
+    return Q_STRNDUP(begin, end - begin);
 }
 
 off_t _q_filesize(const char *filepath)
@@ -347,3 +383,487 @@ bool _q_countsave(const char *filepath, int number)
     if (updated > 0) return true;
     return false;
 }
+
+/*
+ * Cryptographically secure random bytes. Every thread keeps a small pool
+ * filled by the kernel so a session id doesn't cost a system call. The pool
+ * is discarded in a forked child, otherwise parent and child would hand out
+ * the same bytes.
+ */
+#define QRAND_POOL_SIZE (512)
+static __thread unsigned char _rand_pool[QRAND_POOL_SIZE];
+static __thread size_t _rand_avail = 0;
+
+#ifndef _WIN32
+static pthread_once_t _rand_once = PTHREAD_ONCE_INIT;
+
+static void _rand_atfork_child(void)
+{
+    _rand_avail = 0;
+}
+
+static void _rand_init(void)
+{
+    pthread_atfork(NULL, NULL, _rand_atfork_child);
+}
+#endif
+
+static bool _rand_fill(void *buf, size_t size)
+{
+#if defined(HAVE_GETRANDOM)
+    unsigned char *p = (unsigned char *)buf;
+    while (size > 0) {
+        ssize_t n = getrandom(p, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+#elif defined(HAVE_ARC4RANDOM)
+    arc4random_buf(buf, size);
+    return true;
+#elif defined(_WIN32)
+    unsigned char *p = (unsigned char *)buf;
+    while (size > 0) {
+        unsigned int r;
+        if (rand_s(&r) != 0) return false;
+        size_t n = (size < sizeof(r)) ? size : sizeof(r);
+        memcpy(p, &r, n);
+        p += n;
+        size -= n;
+    }
+    return true;
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) return false;
+    unsigned char *p = (unsigned char *)buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            close(fd);
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    close(fd);
+    return true;
+#endif
+}
+
+bool _q_randbytes(void *buf, size_t size)
+{
+#ifndef _WIN32
+    pthread_once(&_rand_once, _rand_init);
+#endif
+    if (size > sizeof(_rand_pool)) return _rand_fill(buf, size);
+
+    if (_rand_avail < size) {
+        if (_rand_fill(_rand_pool, sizeof(_rand_pool)) == false) return false;
+        _rand_avail = sizeof(_rand_pool);
+    }
+
+    // hand out from the end of the pool and wipe what has been used.
+    unsigned char *p = _rand_pool + (_rand_avail - size);
+    memcpy(buf, p, size);
+    memset(p, 0, size);
+    _rand_avail -= size;
+    return true;
+}
+
+/*
+ * RFC 4648 base32 in lower case without padding. The output is safe for
+ * cookie values and case-insensitive file systems. The out buffer must be
+ * at least ((size * 8 + 4) / 5) + 1 bytes.
+ */
+size_t _q_base32encode(char *out, const void *bin, size_t size)
+{
+    static const char B32TBL[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+    const unsigned char *p = (const unsigned char *)bin;
+    unsigned int acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        acc = (acc << 8) | p[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            out[n++] = B32TBL[(acc >> bits) & 0x1F];
+        }
+    }
+    if (bits > 0) out[n++] = B32TBL[(acc << (5 - bits)) & 0x1F];
+    out[n] = '\0';
+
+    return n;
+}
+
+/*
+ * RFC 4648 base64url without padding.
+ * The out buffer must be at least ((size + 2) / 3 * 4) + 1 bytes.
+ */
+size_t _q_base64urlencode(char *out, const void *bin, size_t size)
+{
+    static const char B64TBL[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    const unsigned char *p = (const unsigned char *)bin;
+    size_t n = 0;
+    size_t i;
+    for (i = 0; i + 3 <= size; i += 3) {
+        uint32_t v = ((uint32_t)p[i] << 16) | ((uint32_t)p[i+1] << 8) | p[i+2];
+        out[n++] = B64TBL[(v >> 18) & 0x3F];
+        out[n++] = B64TBL[(v >> 12) & 0x3F];
+        out[n++] = B64TBL[(v >> 6) & 0x3F];
+        out[n++] = B64TBL[v & 0x3F];
+    }
+    if (size - i == 1) {
+        uint32_t v = (uint32_t)p[i] << 16;
+        out[n++] = B64TBL[(v >> 18) & 0x3F];
+        out[n++] = B64TBL[(v >> 12) & 0x3F];
+    } else if (size - i == 2) {
+        uint32_t v = ((uint32_t)p[i] << 16) | ((uint32_t)p[i+1] << 8);
+        out[n++] = B64TBL[(v >> 18) & 0x3F];
+        out[n++] = B64TBL[(v >> 12) & 0x3F];
+        out[n++] = B64TBL[(v >> 6) & 0x3F];
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
+/*
+ * Decode base64url string of given length.
+ * The out buffer must be at least (len * 3 / 4) bytes.
+ * Returns the number of decoded bytes, or -1 on malformed input.
+ */
+ssize_t _q_base64urldecode(void *out, const char *str, size_t len)
+{
+    unsigned char *o = (unsigned char *)out;
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        int c = (unsigned char)str[i], v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-') v = 62;
+        else if (c == '_') v = 63;
+        else return -1;
+
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            o[n++] = (unsigned char)(acc >> bits);
+        }
+    }
+    if (bits >= 6) return -1; // a dangling character
+
+    return (ssize_t)n;
+}
+
+/*
+ * SHA-256 (FIPS 180-4) and HMAC-SHA256 (RFC 2104).
+ */
+static const uint32_t SHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void _sha256_block(uint32_t state[8], const unsigned char *block)
+{
+    uint32_t w[64];
+    int i;
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4+1] << 16) |
+               ((uint32_t)block[i*4+2] << 8) | (uint32_t)block[i*4+3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t S1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + S1 + ch + SHA256K[i] + w[i];
+        uint32_t S0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = S0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void _q_sha256_init(_q_sha256_t *ctx)
+{
+    static const uint32_t H0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->count = 0;
+}
+
+void _q_sha256_update(_q_sha256_t *ctx, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t used = (size_t)(ctx->count % 64);
+    ctx->count += size;
+
+    if (used > 0) {
+        size_t fill = 64 - used;
+        if (size < fill) {
+            memcpy(ctx->buf + used, p, size);
+            return;
+        }
+        memcpy(ctx->buf + used, p, fill);
+        _sha256_block(ctx->state, ctx->buf);
+        p += fill;
+        size -= fill;
+    }
+    for (; size >= 64; p += 64, size -= 64) _sha256_block(ctx->state, p);
+    if (size > 0) memcpy(ctx->buf, p, size);
+}
+
+void _q_sha256_final(_q_sha256_t *ctx, unsigned char digest[32])
+{
+    uint64_t bits = ctx->count * 8;
+    unsigned char pad[64 + 8];
+    size_t used = (size_t)(ctx->count % 64);
+    size_t padlen = (used < 56) ? (56 - used) : (120 - used);
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    int i;
+    for (i = 0; i < 8; i++) pad[padlen + i] = (unsigned char)(bits >> (56 - i * 8));
+    _q_sha256_update(ctx, pad, padlen + 8);
+
+    for (i = 0; i < 8; i++) {
+        digest[i*4]   = (unsigned char)(ctx->state[i] >> 24);
+        digest[i*4+1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i*4+2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i*4+3] = (unsigned char)(ctx->state[i]);
+    }
+    memset(ctx, 0, sizeof(_q_sha256_t));
+}
+
+void _q_hmac_sha256(unsigned char mac[32], const void *key, size_t keylen,
+                    const void *data, size_t size)
+{
+    unsigned char k[64], ipad[64], opad[64];
+    _q_sha256_t ctx;
+
+    memset(k, 0, sizeof(k));
+    if (keylen > sizeof(k)) {
+        _q_sha256_init(&ctx);
+        _q_sha256_update(&ctx, key, keylen);
+        _q_sha256_final(&ctx, k);
+    } else {
+        memcpy(k, key, keylen);
+    }
+
+    int i;
+    for (i = 0; i < 64; i++) {
+        ipad[i] = k[i] ^ 0x36;
+        opad[i] = k[i] ^ 0x5c;
+    }
+
+    unsigned char inner[32];
+    _q_sha256_init(&ctx);
+    _q_sha256_update(&ctx, ipad, sizeof(ipad));
+    _q_sha256_update(&ctx, data, size);
+    _q_sha256_final(&ctx, inner);
+
+    _q_sha256_init(&ctx);
+    _q_sha256_update(&ctx, opad, sizeof(opad));
+    _q_sha256_update(&ctx, inner, sizeof(inner));
+    _q_sha256_final(&ctx, mac);
+
+    memset(k, 0, sizeof(k));
+    memset(ipad, 0, sizeof(ipad));
+    memset(opad, 0, sizeof(opad));
+}
+
+// compare in constant time, for MACs.
+bool _q_memeq(const void *s1, const void *s2, size_t size)
+{
+    const volatile unsigned char *p1 = (const volatile unsigned char *)s1;
+    const volatile unsigned char *p2 = (const volatile unsigned char *)s2;
+    unsigned char diff = 0;
+    size_t i;
+    for (i = 0; i < size; i++) diff |= p1[i] ^ p2[i];
+    return (diff == 0);
+}
+
+// CRC-32 (IEEE 802.3), zlib compatible. start with crc = 0.
+uint32_t _q_crc32(uint32_t crc, const void *buf, size_t size)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    const unsigned char *p = (const unsigned char *)buf;
+
+    crc = ~crc;
+    while (size-- > 0) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+/*
+ * Request context accessors, NULL or unset members fall back to the CGI
+ * process environment.
+ */
+const char *_q_ctxenv(const qcgictx_t *ctx, const char *name)
+{
+    if (ctx == NULL || ctx->params == NULL) return getenv(name);
+    return ctx->params->getstr(ctx->params, name, false);
+}
+
+FILE *_q_ctxin(const qcgictx_t *ctx)
+{
+    return (ctx != NULL && ctx->in != NULL) ? ctx->in : stdin;
+}
+
+FILE *_q_ctxout(const qcgictx_t *ctx)
+{
+    return (ctx != NULL && ctx->out != NULL) ? ctx->out : stdout;
+}
+
+/*
+ * Build an environ style array of "name=value" strings from CGI variables.
+ * Returns NULL on a memory error. Free with _q_freeenv().
+ */
+char **_q_makeenv(qentry_t *params)
+{
+    int num = params->size(params);
+    char **envp = (char **)Q_CALLOC(num + 1, sizeof(char *));
+    if (envp == NULL) return NULL;
+
+    int i = 0;
+    qentobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    while (i < num && params->getnext(params, &obj, NULL, false) == true) {
+        size_t len = strlen(obj.name) + 1 + obj.size;
+        envp[i] = (char *)Q_MALLOC(len);
+        if (envp[i] == NULL) {
+            _q_freeenv(envp);
+            return NULL;
+        }
+        snprintf(envp[i], len, "%s=%s", obj.name, (char *)obj.data);
+        i++;
+    }
+
+    return envp;
+}
+
+void _q_freeenv(char **envp)
+{
+    if (envp == NULL) return;
+    char **env;
+    for (env = envp; *env != NULL; env++) Q_FREE(*env);
+    Q_FREE(envp);
+}
+
+#ifndef _WIN32
+/*
+ * Open a listening socket. addr is "unix:/path/to/socket", "host:port",
+ * "[ipv6]:port" or ":port" for every address. With reuseport, TCP sockets
+ * are bound with SO_REUSEPORT so that several processes can listen on the
+ * same port. Returns the socket or -1.
+ */
+int _q_listen(const char *addr, int backlog, bool reuseport)
+{
+    if (addr == NULL) return -1;
+    if (backlog <= 0) backlog = SOMAXCONN;
+
+    if (!strncmp(addr, "unix:", CONST_STRLEN("unix:"))) {
+        const char *path = addr + CONST_STRLEN("unix:");
+        struct sockaddr_un sun;
+        if (strlen(path) >= sizeof(sun.sun_path)) return -1;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+
+        // remove a stale socket left by a previous run
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 ||
+            listen(fd, backlog) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const char *colon = strrchr(addr, ':');
+    if (colon == NULL || colon[1] == '\0') return -1;
+    char host[256];
+    size_t hostlen = colon - addr;
+    if (hostlen >= sizeof(host)) return -1;
+    memcpy(host, addr, hostlen);
+    host[hostlen] = '\0';
+    _q_strunchar(host, '[', ']');
+
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    bool any = (host[0] == '\0' || !strcmp(host, "*"));
+    if (getaddrinfo(any ? NULL : host, colon + 1, &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+        if (reuseport == true) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        }
+#endif
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+            listen(fd, backlog) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+#endif
@@ -29,6 +29,9 @@
 #ifndef _QINTERNAL_H
 #define _QINTERNAL_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 /*
  * Internal Macros
  */
@@ -38,16 +41,63 @@
 #define DEBUG(fms, args...)
 #endif  /* BUILD_DEBUG */
 
+/*
+ * Static tracepoints of the "qdecoder" provider, for perf and bpftrace.
+ * A probe is a single nop until attached. Compiled out without <sys/sdt.h>
+ * or with DISABLE_TRACE (configure --disable-trace).
+ */
+#if defined(__has_include) && !defined(DISABLE_TRACE)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define Q_TRACE_ENABLED
+#endif
+#endif
+
+#ifdef Q_TRACE_ENABLED
+#define Q_TRACE1(name, a)           DTRACE_PROBE1(qdecoder, name, a)
+#define Q_TRACE2(name, a, b)        DTRACE_PROBE2(qdecoder, name, a, b)
+#define Q_TRACE3(name, a, b, c)     DTRACE_PROBE3(qdecoder, name, a, b, c)
+#else
+#define Q_TRACE1(name, a)
+#define Q_TRACE2(name, a, b)
+#define Q_TRACE3(name, a, b, c)
+#endif  /* Q_TRACE_ENABLED */
+
 /*
  * Macro Functions
  */
 #define CONST_STRLEN(x)     (sizeof(x) - 1)
 
+#if defined(__APPLE__)
+#define Q_STAT_MTIME_NSEC(st)   ((st).st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+#define Q_STAT_MTIME_NSEC(st)   (0L)
+#else
+#define Q_STAT_MTIME_NSEC(st)   ((st).st_mtim.tv_nsec)
+#endif
+
+/*
+ * Memory allocation, routed to the allocator of qdecoder_set_allocator()
+ * once one is set. Memory of these is released only with Q_FREE().
+ */
+#define Q_MALLOC(size)          \
+    (_q_allocactive ? _q_malloc(size) : malloc(size))
+#define Q_CALLOC(nmemb, size)   \
+    (_q_allocactive ? _q_calloc(nmemb, size) : calloc(nmemb, size))
+#define Q_REALLOC(ptr, size)    \
+    (_q_allocactive ? _q_realloc(ptr, size) : realloc(ptr, size))
+#define Q_STRDUP(str)           \
+    (_q_allocactive ? _q_strdup(str) : strdup(str))
+#define Q_STRNDUP(str, n)       \
+    (_q_allocactive ? _q_strndup(str, n) : strndup(str, n))
+#define Q_FREE(ptr)             \
+    (_q_allocactive ? _q_free(ptr) : free(ptr))
+
 #define DYNAMIC_VSPRINTF(s, f)                                          \
     do {                                                                \
         size_t _strsize;                                                \
         for(_strsize = 1024; ; _strsize *= 2) {                         \
-            s = (char*)malloc(_strsize);                                \
+            s = (char*)Q_MALLOC(_strsize);                              \
             if(s == NULL) {                                             \
                 DEBUG("DYNAMIC_VSPRINTF(): can't allocate memory.");    \
                 break;                                                  \
@@ -57,7 +107,7 @@
             int _n = vsnprintf(s, _strsize, f, _arglist);               \
             va_end(_arglist);                                           \
             if(_n >= 0 && _n < _strsize) break;                         \
-            free(s);                                                    \
+            Q_FREE(s);                                                  \
         }                                                               \
     } while(0)
 
@@ -71,9 +121,19 @@
 #endif
 
 #define MAX_LINEBUF (1023+1)
+#define SHA256_DIGEST_LEN   (32)
 #define DEF_DIR_MODE  (S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH)
 #define DEF_FILE_MODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)
 
+/*
+ * Internal Types
+ */
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    unsigned char buf[64];
+} _q_sha256_t;
+
 /*
  * qInternalCommon.c
  */
@@ -84,6 +144,7 @@ extern size_t _q_urldecode(char *str);
 extern char *_q_fgets(char *str, size_t size, FILE *fp);
 extern char *_q_fgetline(FILE *fp, size_t initsize);
 extern int _q_unlink(const char *pathname);
+extern int _q_mkdir(const char *pathname, mode_t mode);
 extern char *_q_strcpy(char *dst, size_t size, const char *src);
 extern char *_q_strtrim(char *str);
 extern char *_q_strunchar(char *str, char head, char tail);
@@ -92,5 +153,40 @@ extern off_t _q_filesize(const char *filepath);
 extern off_t _q_iosend(FILE *outfp, FILE *infp, off_t nbytes);
 extern int _q_countread(const char *filepath);
 extern bool _q_countsave(const char *filepath, int number);
+extern bool _q_randbytes(void *buf, size_t size);
+extern size_t _q_base32encode(char *out, const void *bin, size_t size);
+extern size_t _q_base64urlencode(char *out, const void *bin, size_t size);
+extern ssize_t _q_base64urldecode(void *out, const char *str, size_t len);
+extern void _q_sha256_init(_q_sha256_t *ctx);
+extern void _q_sha256_update(_q_sha256_t *ctx, const void *data, size_t size);
+extern void _q_sha256_final(_q_sha256_t *ctx, unsigned char digest[32]);
+extern void _q_hmac_sha256(unsigned char mac[32], const void *key,
+                           size_t keylen, const void *data, size_t size);
+extern bool _q_memeq(const void *s1, const void *s2, size_t size);
+extern uint32_t _q_crc32(uint32_t crc, const void *buf, size_t size);
+extern int _q_listen(const char *addr, int backlog, bool reuseport);
+extern const char *_q_ctxenv(const qcgictx_t *ctx, const char *name);
+extern FILE *_q_ctxin(const qcgictx_t *ctx);
+extern FILE *_q_ctxout(const qcgictx_t *ctx);
+extern char **_q_makeenv(qentry_t *params);
+extern void _q_freeenv(char **envp);
+
+/*
+ * qentry.c
+ */
+extern qentry_t *_q_entry_meta(qentry_t *entry, bool create);
+extern bool _q_entry_keep(qentry_t *entry, void *addr, size_t size);
+extern bool _q_entry_putencoded(qentry_t *entry, char *name, char *value);
+
+/*
+ * qalloc.c
+ */
+extern bool _q_allocactive;
+extern void *_q_malloc(size_t size);
+extern void *_q_calloc(size_t nmemb, size_t size);
+extern void *_q_realloc(void *ptr, size_t size);
+extern char *_q_strdup(const char *str);
+extern char *_q_strndup(const char *str, size_t n);
+extern void _q_free(void *ptr);
 
 #endif  /* _QINTERNAL_H */
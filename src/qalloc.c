@@ -0,0 +1,301 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * @file qalloc.c Memory Allocator API
+ *
+ * Routes the memory qDecoder allocates to an application allocator, such
+ * as a per-request arena or a pool, and keeps allocation statistics on
+ * request.
+ *
+ * @code
+ *   static void *mymalloc(size_t size, void *pool) { ... }
+ *   static void *myrealloc(void *ptr, size_t size, void *pool) { ... }
+ *   static void myfree(void *ptr, void *pool) { ... }
+ *
+ *   qdecoder_allocator_t allocator = {
+ *     mymalloc, myrealloc, myfree, pool, true
+ *   };
+ *   qdecoder_set_allocator(&allocator);
+ *
+ *   qentry_t *req = qcgireq_parse(NULL, 0);
+ *   (...)
+ *   req->free(req);
+ *
+ *   qdecoder_allocstat_t stat;
+ *   qdecoder_get_allocstats(&stat);
+ *   printf("%zu allocations, %zu bytes at peak\n", stat.count, stat.peak);
+ * @endcode
+ *
+ * @note
+ * The allocator is process wide and must be set before any other qDecoder
+ * call, memory allocated by one allocator can't be released by another.
+ * While an allocator is set, memory qDecoder returns to the application,
+ * such as the string of qcgireq_getquery(), is released with
+ * qdecoder_free() instead of free().
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include "qdecoder.h"
+#include "internal.h"
+
+#ifndef _DOXYGEN_SKIP
+
+/*
+ * With statistics, each block carries its size in a header. 16 bytes keeps
+ * the memory handed out aligned as malloc() aligns it.
+ */
+#define ALLOC_HEADER    (16)
+
+#define STAT_ADD(v, n)  __atomic_add_fetch(&(v), (n), __ATOMIC_RELAXED)
+#define STAT_SUB(v, n)  __atomic_sub_fetch(&(v), (n), __ATOMIC_RELAXED)
+#define STAT_GET(v)     __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STAT_SET(v, n)  __atomic_store_n(&(v), (n), __ATOMIC_RELAXED)
+
+static void *_libc_malloc(size_t size, void *userdata);
+static void *_libc_realloc(void *ptr, size_t size, void *userdata);
+static void _libc_free(void *ptr, void *userdata);
+static void _count(size_t oldsize, size_t newsize);
+
+static qdecoder_allocator_t _allocator = {
+    _libc_malloc, _libc_realloc, _libc_free, NULL, false
+};
+
+static size_t _count_total = 0;
+static size_t _bytes_total = 0;
+static size_t _bytes_inuse = 0;
+static size_t _bytes_peak = 0;
+static __thread size_t _count_thread = 0;
+static __thread size_t _bytes_thread = 0;
+
+bool _q_allocactive = false;
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Set the memory allocator of qDecoder.
+ *
+ * @param allocator allocator functions, NULL to restore the libc allocator
+ *                  without statistics. The functions must be all set, or
+ *                  all NULL to keep the libc allocator with statistics.
+ *
+ * @return true if successful, false when the functions are partly set.
+ *
+ * @note
+ * The allocator is copied. Set it once, before any other qDecoder call.
+ * Statistics add a 16-byte header to every allocation.
+ *
+ * @code
+ *   // count allocations of the libc allocator
+ *   qdecoder_allocator_t allocator = { NULL, NULL, NULL, NULL, true };
+ *   qdecoder_set_allocator(&allocator);
+ * @endcode
+ */
+bool qdecoder_set_allocator(const qdecoder_allocator_t *allocator)
+{
+    if (allocator == NULL || (allocator->malloc == NULL
+            && allocator->realloc == NULL && allocator->free == NULL)) {
+        _allocator.malloc = _libc_malloc;
+        _allocator.realloc = _libc_realloc;
+        _allocator.free = _libc_free;
+        _allocator.userdata = NULL;
+        _allocator.stats = (allocator != NULL) ? allocator->stats : false;
+    } else if (allocator->malloc == NULL || allocator->realloc == NULL
+               || allocator->free == NULL) {
+        DEBUG("The allocator functions are partly set.");
+        return false;
+    } else {
+        _allocator = *allocator;
+    }
+
+    qdecoder_reset_allocstats();
+    _q_allocactive = (_allocator.malloc != _libc_malloc || _allocator.stats);
+    return true;
+}
+
+/**
+ * Get the allocation statistics.
+ *
+ * @param stat  qdecoder_allocstat_t structure to fill
+ *
+ * @return true if successful, false when the statistics aren't kept.
+ *
+ * @note
+ * The counters are process wide except threadcount and threadbytes which
+ * are of the calling thread. Resetting the counters of a worker thread
+ * before each request gives the allocations of the request.
+ */
+bool qdecoder_get_allocstats(qdecoder_allocstat_t *stat)
+{
+    if (stat == NULL || _allocator.stats == false) return false;
+
+    stat->count = STAT_GET(_count_total);
+    stat->bytes = STAT_GET(_bytes_total);
+    stat->inuse = STAT_GET(_bytes_inuse);
+    stat->peak = STAT_GET(_bytes_peak);
+    stat->threadcount = _count_thread;
+    stat->threadbytes = _bytes_thread;
+    return true;
+}
+
+/**
+ * Reset the allocation statistics.
+ *
+ * Clears the process wide count, bytes and peak, and the counters of the
+ * calling thread. Bytes in use are kept, so the peak restarts from them.
+ */
+void qdecoder_reset_allocstats(void)
+{
+    STAT_SET(_count_total, 0);
+    STAT_SET(_bytes_total, 0);
+    STAT_SET(_bytes_peak, STAT_GET(_bytes_inuse));
+    _count_thread = 0;
+    _bytes_thread = 0;
+}
+
+/**
+ * Release memory returned by qDecoder.
+ *
+ * @param ptr   memory to release, NULL is ignored
+ *
+ * @note
+ * Same as free() unless an allocator is set by qdecoder_set_allocator().
+ */
+void qdecoder_free(void *ptr)
+{
+    Q_FREE(ptr);
+}
+
+#ifndef _DOXYGEN_SKIP
+
+void *_q_malloc(size_t size)
+{
+    if (_allocator.stats == false) {
+        return _allocator.malloc(size, _allocator.userdata);
+    }
+
+    if (size > SIZE_MAX - ALLOC_HEADER) return NULL;
+    char *block = (char *)_allocator.malloc(ALLOC_HEADER + size,
+                                            _allocator.userdata);
+    if (block == NULL) return NULL;
+    *(size_t *)block = size;
+    _count(0, size);
+    return block + ALLOC_HEADER;
+}
+
+void *_q_calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+    void *ptr = _q_malloc(nmemb * size);
+    if (ptr != NULL) memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *_q_realloc(void *ptr, size_t size)
+{
+    if (_allocator.stats == false) {
+        return _allocator.realloc(ptr, size, _allocator.userdata);
+    }
+    if (ptr == NULL) return _q_malloc(size);
+
+    if (size > SIZE_MAX - ALLOC_HEADER) return NULL;
+    char *block = (char *)ptr - ALLOC_HEADER;
+    size_t oldsize = *(size_t *)block;
+    block = (char *)_allocator.realloc(block, ALLOC_HEADER + size,
+                                       _allocator.userdata);
+    if (block == NULL) return NULL;
+    *(size_t *)block = size;
+    _count(oldsize, size);
+    return block + ALLOC_HEADER;
+}
+
+char *_q_strdup(const char *str)
+{
+    return _q_strndup(str, SIZE_MAX);
+}
+
+char *_q_strndup(const char *str, size_t n)
+{
+    size_t len = strnlen(str, n);
+    char *dup = (char *)_q_malloc(len + 1);
+    if (dup == NULL) return NULL;
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+void _q_free(void *ptr)
+{
+    if (ptr == NULL) return;
+    if (_allocator.stats == false) {
+        _allocator.free(ptr, _allocator.userdata);
+        return;
+    }
+
+    char *block = (char *)ptr - ALLOC_HEADER;
+    STAT_SUB(_bytes_inuse, *(size_t *)block);
+    _allocator.free(block, _allocator.userdata);
+}
+
+static void *_libc_malloc(size_t size, void *userdata)
+{
+    return malloc(size);
+}
+
+static void *_libc_realloc(void *ptr, size_t size, void *userdata)
+{
+    return realloc(ptr, size);
+}
+
+static void _libc_free(void *ptr, void *userdata)
+{
+    free(ptr);
+}
+
+static void _count(size_t oldsize, size_t newsize)
+{
+    STAT_ADD(_count_total, 1);
+    _count_thread++;
+    if (newsize <= oldsize) {
+        STAT_SUB(_bytes_inuse, oldsize - newsize);
+        return;
+    }
+
+    size_t grown = newsize - oldsize;
+    STAT_ADD(_bytes_total, grown);
+    _bytes_thread += grown;
+    size_t inuse = STAT_ADD(_bytes_inuse, grown);
+    size_t peak = STAT_GET(_bytes_peak);
+    while (inuse > peak && !__atomic_compare_exchange_n(&_bytes_peak, &peak,
+                      inuse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#endif /* _DOXYGEN_SKIP */
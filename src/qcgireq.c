@@ -130,14 +130,22 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <limits.h>
+#ifdef _WIN32
+#include <sys/time.h>
+#endif
 #ifndef _WIN32
 #include <dirent.h>
 #endif
 #include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/uio.h>
+#endif
 #include "qdecoder.h"
 #include "internal.h"
 
@@ -146,14 +154,96 @@
 #endif
 
 #ifndef _DOXYGEN_SKIP
-static int  _parse_multipart(qentry_t *request);
-static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
-                                                bool *finish);
-static char *_parse_multipart_value_into_disk(const char *boundary,
-        const char *savedir, const char *filename, int *filelen, bool *finish);
+
+#if !defined(_WIN32) && !defined(ENABLE_FASTCGI)
+#define CAPTURE_ENABLED
+#endif
+#define CAPTURE_MAGIC           "QCAP"
+#define CAPTURE_VERSION         (1)
+#define CAPTURE_MAXBODY         (16 * 1024 * 1024)  // larger aren't captured
+#define QUERY_MAXBODY           (16 * 1024 * 1024)  // qcgireq_getquery() of a body
+
+static char *_capturepath = NULL;   // qcgireq_setcapture()
+
+// limits of a request and what its parsing has used up so far
+typedef struct {
+    qcgireq_limit_t limit;  // SIZE_MAX for no limit
+    size_t fields;          // variables stored
+    size_t parts;           // multipart parts read
+    size_t upload;          // bytes of uploaded files
+    Q_CGIREQ_ERR_T error;   // the first limit exceeded
+} qcgilimit_t;
+
+// a parse in progress, statistics and limits are saved by _parse_end()
+typedef struct {
+    qcgireq_stat_t stat;
+    qcgireq_stat_t *statp;      // NULL when qcgireq_setstats() isn't on
+    int64_t started;
+    long disktime;
+    qdecoder_allocstat_t alloc;
+    bool allocstat;
+    qcgilimit_t lim;
+    bool limited;
+    bool lazy;                  // qcgireq_setlazy()
+} qcgiparse_t;
+
+// urlencoded push parser, fields are decoded as their bytes come in
+struct qcgireq_parser_s {
+    qentry_t *request;
+    qcgiparse_t *ps;        // statistics and limits to update
+    qcgiparse_t ownps;      // of qcgireq_parser_new()
+    size_t bodysize;        // bytes pushed
+    char *buf;              // decoded name, '\0', decoded value
+    size_t bufsize;
+    size_t len;             // bytes in buf
+    size_t namelen;         // length of the name, once in the value
+    size_t nameend;         // length of the name without trailing blanks
+    bool invalue;
+    bool pending;           // a field has begun
+    int escape;             // 1 after '%', 2 after '%' and a hex digit
+    char hex;
+};
+
+static FILE *_capture(qentry_t *request, qcgictx_t *ctx, char **body);
+static void _limit_init(qcgilimit_t *lim, const qcgireq_limit_t *limits);
+static bool _limit_load(qentry_t *request, qcgilimit_t *lim);
+static bool _limit_body(qcgilimit_t *lim, size_t size);
+static bool _limit_field(qcgilimit_t *lim, size_t namelen, size_t valuelen);
+static bool _content_length(qcgictx_t *ctx, size_t *size);
+static void _parse_begin(qentry_t *request, Q_CGI_T method, qcgiparse_t *ps);
+static void _parse_end(qentry_t *request, qcgiparse_t *ps);
+static bool _is_contenttype(const char *content_type, const char *type);
+static bool _is_internal(const char *name);
+static bool _parser_init(qcgireq_parser_t *parser, qentry_t *request,
+                         qcgiparse_t *ps);
+static bool _parser_push(qcgireq_parser_t *parser, const char *data,
+                         size_t size);
+static bool _parser_finish(qcgireq_parser_t *parser);
+static void _parse_urlencoded(qentry_t *request, FILE *in, ssize_t size,
+                              qcgiparse_t *ps);
+static FILE *_memopen(const void *buf, size_t size);
+static int _parse_lazy(qentry_t *request, char *query, char sepchar,
+                       qcgilimit_t *lim);
+static size_t _decodedlen(const char *str);
+static void _parse_string(qentry_t *request, const char *query,
+                          Q_CGI_T method, qcgiparse_t *ps);
+static void _parse_stream(qentry_t *request, const char *content_type,
+                          FILE *in, ssize_t size, qcgiparse_t *ps);
+static int  _parse_multipart(FILE *in, const char *content_type,
+                             qentry_t *request, qcgiparse_t *ps);
+static char *_parse_multipart_value_into_memory(FILE *in, char *boundary,
+        int *valuelen, bool *finish, qcgireq_stat_t *stat,
+        size_t maxlen, bool *toolong);
+static char *_parse_multipart_value_into_disk(FILE *in, const char *boundary,
+        const char *savedir, const char *filename, int *filelen, bool *finish,
+        qcgireq_stat_t *stat, size_t maxlen, bool *toolong);
+static ssize_t _write_upload(int fd, const void *buf, size_t size,
+                             qcgireq_stat_t *stat);
+static int64_t _usec(void);
 static int _upload_clear_base(const char *upload_basepath, int upload_clearold);
 static qentry_t *_parse_query(qentry_t *request, const char *query,
-                              char equalchar, char sepchar, int *count);
+                              char equalchar, char sepchar, int *count,
+                              qcgilimit_t *lim);
 #endif
 
 /**
@@ -236,8 +326,43 @@ qentry_t *qcgireq_setoption(qentry_t *request, bool filemode,
  * @note
  * When multiple methods are specified, it'll be parsed in the order of
  * (1)COOKIE, (2)POST (3)GET unless you call it separately multiple times.
+ * Variables named with the "_Q_" prefix of the library are dropped.
  */
 qentry_t *qcgireq_parse(qentry_t *request, Q_CGI_T method)
+{
+    return qcgireq_parse_ctx(NULL, request, method);
+}
+
+/**
+ * Parse one or more request(COOKIE/POST/GET) queries from a request context.
+ *
+ * @param ctx       request context. NULL for the process environment, stdin
+ *                  and stdout, or the context the request is already bound
+ *                  to.
+ * @param request   qentry_t container pointer that parsed key/value pairs
+ *                  will be stored. NULL can be used to create a new container.
+ * @param method    Target mask consists of one or more of Q_CGI_COOKIE,
+ *                  Q_CGI_POST and Q_CGI_GET. Q_CGI_ALL or 0 can be used for
+ *                  parsing all of those types.
+ *
+ * @return qentry_t* handle if successful, NULL if there was insufficient
+ *         memory to allocate a new object.
+ *
+ * @note
+ * The request is bound to the context, so qcgires_*() and qcgisess_*() write
+ * to the context's output and read its variables. The context must stay
+ * valid until the request is freed. Different requests parsed from
+ * different contexts can be served by different threads at the same time.
+ *
+ * @code
+ *   qcgictx_t ctx = { params, bodyfp, outfp };
+ *   qentry_t *req = qcgireq_parse_ctx(&ctx, NULL, 0);
+ *   qcgires_setcontenttype(req, "text/plain");  // written to outfp
+ *   fprintf(outfp, "Hello %s", req->getstr(req, "name", false));
+ *   req->free(req);
+ * @endcode
+ */
+qentry_t *qcgireq_parse_ctx(qcgictx_t *ctx, qentry_t *request, Q_CGI_T method)
 {
     // initialize entry structure
     if (request == NULL) {
@@ -245,115 +370,720 @@ qentry_t *qcgireq_parse(qentry_t *request, Q_CGI_T method)
         if (request == NULL) return NULL;
     }
 
-    // parse COOKIE
-    if (method == Q_CGI_ALL || (method & Q_CGI_COOKIE) != 0) {
-        char *query = qcgireq_getquery(Q_CGI_COOKIE);
-        if (query != NULL) {
-            _parse_query(request, query, '=', ';', NULL);
-            free(query);
+    // bind the request to the context
+    if (ctx == NULL) {
+        ctx = qcgireq_getctx(request);
+    } else {
+        qentry_t *meta = _q_entry_meta(request, true);
+        if (meta != NULL) meta->put(meta, "CONTEXT", &ctx, sizeof(ctx), true);
+    }
+
+    qcgiparse_t ps;
+    _parse_begin(request, method, &ps);
+
+    // a body over the limit is refused before any of it is read
+    if (method == Q_CGI_ALL || (method & Q_CGI_POST) != 0) {
+        size_t size;
+        if (_q_ctxenv(ctx, "CONTENT_LENGTH") != NULL) {
+            // a malformed one is over any limit
+            if (_content_length(ctx, &size) == false) size = SIZE_MAX;
+            _limit_body(&ps.lim, size);
         }
     }
 
+    // a captured body is parsed from memory, the binding stays as is
+    qcgictx_t capctx;
+    char *capbody = NULL;
+    FILE *capin = NULL;
+    if (ps.lim.error == Q_CGIREQ_OK &&
+        (method == Q_CGI_ALL || (method & Q_CGI_POST) != 0)) {
+        capin = _capture(request, ctx, &capbody);
+    }
+    if (capin != NULL) {
+        capctx.params = (ctx != NULL) ? ctx->params : NULL;
+        capctx.in = capin;
+        capctx.out = (ctx != NULL) ? ctx->out : NULL;
+        ctx = &capctx;
+    }
+
+    // parse COOKIE
+    if (ps.lim.error == Q_CGIREQ_OK &&
+        (method == Q_CGI_ALL || (method & Q_CGI_COOKIE) != 0)) {
+        char *query = qcgireq_getquery_ctx(ctx, Q_CGI_COOKIE);
+        _parse_string(request, query, Q_CGI_COOKIE, &ps);
+        if (query != NULL) Q_FREE(query);
+    }
+
     //  parse POST method
-    if (method == Q_CGI_ALL || (method & Q_CGI_POST) != 0) {
-        const char *content_type = getenv("CONTENT_TYPE");
-        if (content_type == NULL) content_type = "";
-        if (!strncmp(content_type, "application/x-www-form-urlencoded",
-                     CONST_STRLEN("application/x-www-form-urlencoded"))) {
-            char *query = qcgireq_getquery(Q_CGI_POST);
-            if (query != NULL) {
-                _parse_query(request, query, '=', '&', NULL);
-                free(query);
+    if (ps.lim.error == Q_CGIREQ_OK &&
+        (method == Q_CGI_ALL || (method & Q_CGI_POST) != 0)) {
+        const char *content_type = _q_ctxenv(ctx, "CONTENT_TYPE");
+        if (_is_contenttype(content_type, "application/x-www-form-urlencoded")) {
+            const char *request_method = _q_ctxenv(ctx, "REQUEST_METHOD");
+            size_t size;
+            if (request_method != NULL && !strcmp(request_method, "POST") &&
+                _content_length(ctx, &size) == true) {
+                _parse_urlencoded(request, _q_ctxin(ctx), (ssize_t)size, &ps);
             }
-        } else if (!strncmp(content_type, "multipart/form-data",
-                            CONST_STRLEN("multipart/form-data"))) {
-            _parse_multipart(request);
+        } else if (_is_contenttype(content_type, "multipart/form-data")) {
+#ifdef _WIN32
+            setmode(fileno(_q_ctxin(ctx)), _O_BINARY);
+            setmode(fileno(_q_ctxout(ctx)), _O_BINARY);
+#endif
+            _parse_multipart(_q_ctxin(ctx), content_type, request, &ps);
         }
     }
 
     // parse GET method
-    if (method == Q_CGI_ALL || (method & Q_CGI_GET) != 0) {
-        char *query = qcgireq_getquery(Q_CGI_GET);
-        if (query != NULL) {
-            _parse_query(request, query, '=', '&', NULL);
-            free(query);
+    if (ps.lim.error == Q_CGIREQ_OK &&
+        (method == Q_CGI_ALL || (method & Q_CGI_GET) != 0)) {
+        char *query = qcgireq_getquery_ctx(ctx, Q_CGI_GET);
+        _parse_string(request, query, Q_CGI_GET, &ps);
+        if (query != NULL) Q_FREE(query);
+    }
+
+    if (capin != NULL) {
+        fclose(capin);
+        Q_FREE(capbody);
+    }
+
+    _parse_end(request, &ps);
+    return request;
+}
+
+/**
+ * Parse a query string or a cookie header held in memory.
+ *
+ * @param request   qentry_t container pointer that parsed key/value pairs
+ *                  will be stored. NULL can be used to create a new container.
+ * @param query     query string like "a=1&b=2", or a cookie header like
+ *                  "a=1; b=2" for Q_CGI_COOKIE
+ * @param method    the source of the query, one of Q_CGI_COOKIE, Q_CGI_POST
+ *                  or Q_CGI_GET
+ *
+ * @return qentry_t* handle if successful, NULL if there was insufficient
+ *         memory to allocate a new object.
+ *
+ * @note
+ * Nothing is read from the CGI environment. Statistics and limits of the
+ * request apply like with qcgireq_parse().
+ *
+ * @code
+ *   qentry_t *req = qcgireq_parse_query(NULL, "color=red&size=10", Q_CGI_GET);
+ *   req = qcgireq_parse_query(req, cookie_header, Q_CGI_COOKIE);
+ * @endcode
+ */
+qentry_t *qcgireq_parse_query(qentry_t *request, const char *query,
+                              Q_CGI_T method)
+{
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
+
+    qcgiparse_t ps;
+    _parse_begin(request, method, &ps);
+    _parse_string(request, query, method, &ps);
+    _parse_end(request, &ps);
+
+    return request;
+}
+
+/**
+ * Parse a request body held in memory.
+ *
+ * @param request       qentry_t container pointer that parsed key/value
+ *                      pairs will be stored. NULL can be used to create a
+ *                      new container.
+ * @param contenttype   content type of the body with its parameters, like
+ *                      "multipart/form-data; boundary=xyz". Either
+ *                      application/x-www-form-urlencoded or
+ *                      multipart/form-data is parsed.
+ * @param body          body data
+ * @param size          size of the body
+ *
+ * @return qentry_t* handle if successful, NULL if there was insufficient
+ *         memory to allocate a new object.
+ *
+ * @note
+ * Nothing is read from the CGI environment. Options, statistics and limits
+ * of the request apply like with qcgireq_parse(), so uploaded files are
+ * saved to disk in file mode.
+ *
+ * @code
+ *   qentry_t *req = qcgireq_setoption(NULL, true, "/tmp", 86400);
+ *   req = qcgireq_parse_body(req, contenttype, body, bodylen);
+ * @endcode
+ */
+qentry_t *qcgireq_parse_body(qentry_t *request, const char *contenttype,
+                             const void *body, size_t size)
+{
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
+
+    qcgiparse_t ps;
+    _parse_begin(request, Q_CGI_POST, &ps);
+    if (body != NULL && size > 0) {
+        FILE *in = _memopen(body, size);
+        if (in != NULL) {
+            _parse_stream(request, contenttype, in, (ssize_t)size, &ps);
+            fclose(in);
+        } else {
+            DEBUG("Can't open the body as a stream.");
         }
     }
+    _parse_end(request, &ps);
+
+    return request;
+}
+
+/**
+ * Parse a request body read from a file descriptor.
+ *
+ * @param request       qentry_t container pointer that parsed key/value
+ *                      pairs will be stored. NULL can be used to create a
+ *                      new container.
+ * @param contenttype   content type of the body with its parameters, see
+ *                      qcgireq_parse_body()
+ * @param fd            file descriptor to read the body from, like a socket
+ *                      or a spooled file
+ * @param size          size of the body, -1 to read it up to the end
+ *
+ * @return qentry_t* handle if successful, NULL if there was insufficient
+ *         memory to allocate a new object.
+ *
+ * @note
+ * The descriptor is read with blocking reads and isn't closed. Reading is
+ * buffered, so data following a multipart body may be consumed too. A body
+ * of unknown size is checked against the maxbody limit as it's read.
+ *
+ * @code
+ *   int fd = open("/var/spool/app/body.123", O_RDONLY);
+ *   qentry_t *req = qcgireq_parse_fd(NULL, contenttype, fd, -1);
+ *   close(fd);
+ * @endcode
+ */
+qentry_t *qcgireq_parse_fd(qentry_t *request, const char *contenttype,
+                           int fd, ssize_t size)
+{
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
+
+    qcgiparse_t ps;
+    _parse_begin(request, Q_CGI_POST, &ps);
+    int dupfd = dup(fd);
+    FILE *in = (dupfd >= 0) ? fdopen(dupfd, "rb") : NULL;
+    if (in != NULL) {
+        _parse_stream(request, contenttype, in, size, &ps);
+        fclose(in);
+    } else {
+        DEBUG("Can't open the file descriptor %d.", fd);
+        if (dupfd >= 0) close(dupfd);
+    }
+    _parse_end(request, &ps);
+
+    return request;
+}
+
+/**
+ * Create a push parser of an urlencoded body, fed as the body comes in.
+ *
+ * @param request   qentry_t container pointer that parsed key/value pairs
+ *                  will be stored. NULL can be used to create a new container.
+ *
+ * @return  a push parser, NULL if there was insufficient memory.
+ *
+ * @note
+ * The body can be pushed in chunks of any size, split anywhere even in the
+ * middle of an escape like "%2F". Each field is stored into the request as
+ * soon as it's complete and only the field in progress is buffered, so the
+ * memory used is bounded by the longest field. Statistics and limits of the
+ * request apply like with qcgireq_parse(), the limits are checked as the
+ * bytes come in. qcgireq_parse() parses urlencoded bodies this way too.
+ *
+ * @code
+ *   qcgireq_parser_t *parser = qcgireq_parser_new(NULL);
+ *   while ((n = read(fd, buf, sizeof(buf))) > 0) {
+ *     if (qcgireq_parser_push(parser, buf, n) == false) break;
+ *   }
+ *   qentry_t *req = qcgireq_parser_end(parser);
+ *   if (qcgireq_geterror(req) != Q_CGIREQ_OK) {
+ *     (...the request went over a limit...)
+ *   }
+ * @endcode
+ */
+qcgireq_parser_t *qcgireq_parser_new(qentry_t *request)
+{
+    bool newrequest = false;
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+        newrequest = true;
+    }
+
+    qcgireq_parser_t *parser;
+    parser = (qcgireq_parser_t *)Q_MALLOC(sizeof(qcgireq_parser_t));
+    if (parser == NULL ||
+        _parser_init(parser, request, &parser->ownps) == false) {
+        if (parser != NULL) Q_FREE(parser);
+        if (newrequest == true) request->free(request);
+        return NULL;
+    }
+    _parse_begin(request, Q_CGI_POST, &parser->ownps);
+
+    return parser;
+}
+
+/**
+ * Push a chunk of the body to a push parser.
+ *
+ * @param parser    a push parser of qcgireq_parser_new()
+ * @param data      chunk of the body
+ * @param size      size of the chunk
+ *
+ * @return  true if successful, false when a limit was exceeded or there
+ *          was insufficient memory. The rest of the body is ignored then.
+ */
+bool qcgireq_parser_push(qcgireq_parser_t *parser, const void *data,
+                         size_t size)
+{
+    if (parser == NULL) return false;
+    if (data == NULL || size == 0) {
+        return (parser->ps->lim.error == Q_CGIREQ_OK);
+    }
+
+    // only the time spent in here counts as parsing
+    qcgiparse_t *ps = parser->ps;
+    int64_t started = (ps->statp != NULL) ? _usec() : 0;
+    bool ok = _parser_push(parser, (const char *)data, size);
+    if (ps->statp != NULL) ps->stat.parsetime += (long)(_usec() - started);
+
+    return ok;
+}
+
+/**
+ * Finish a push parser at the end of the body and free it.
+ *
+ * @param parser    a push parser of qcgireq_parser_new()
+ *
+ * @return  the request holding the parsed fields, NULL if parser is NULL.
+ */
+qentry_t *qcgireq_parser_end(qcgireq_parser_t *parser)
+{
+    if (parser == NULL) return NULL;
+
+    qentry_t *request = parser->request;
+    parser->ownps.started = _usec();
+    _parser_finish(parser);
+    _parse_end(request, &parser->ownps);
+
+    Q_FREE(parser->buf);
+    Q_FREE(parser);
+    return request;
+}
+
+/**
+ * Get raw query string.
+ *
+ * @param method    One of Q_CGI_COOKIE, Q_CGI_POST or Q_CGI_GET.
+ *
+ * @return      malloced query string otherwise returns NULL;
+ *
+ * @code
+ *   char *query = qcgireq_getquery(Q_CGI_GET);
+ *   if(query != NULL) {
+ *     printf("%s\n", query);
+ *     free(query);
+ *   }
+ * @endcode
+ *
+ * @note
+ * Release it with qdecoder_free() while qdecoder_set_allocator() is in use.
+ * A POST body is read in one string, so one over 16MB or with a malformed
+ * CONTENT_LENGTH is refused before anything is allocated and NULL is
+ * returned. qcgireq_parse() with qcgireq_setlimits() reads larger ones.
+ */
+char *qcgireq_getquery(Q_CGI_T method)
+{
+    return qcgireq_getquery_ctx(NULL, method);
+}
+
+/**
+ * Get raw query string from a request context.
+ *
+ * @param ctx       request context. NULL for the process environment and
+ *                  stdin.
+ * @param method    One of Q_CGI_COOKIE, Q_CGI_POST or Q_CGI_GET.
+ *
+ * @return      malloced query string otherwise returns NULL;
+ */
+char *qcgireq_getquery_ctx(qcgictx_t *ctx, Q_CGI_T method)
+{
+    if (method == Q_CGI_GET) {
+        const char *query_string = _q_ctxenv(ctx, "QUERY_STRING");
+        if (query_string == NULL) return NULL;
+        const char *req_uri = _q_ctxenv(ctx, "REQUEST_URI");
+
+        char *query = NULL;
+
+        // SSI query handling
+        if (strlen(query_string) == 0 && req_uri != NULL) {
+            const char *cp;
+            for (cp = req_uri; *cp != '\0'; cp++) {
+                if (*cp == '?') {
+                    cp++;
+                    break;
+                }
+            }
+            query = Q_STRDUP(cp);
+        } else {
+            query = Q_STRDUP(query_string);
+        }
+
+        return query;
+    } else if (method == Q_CGI_POST) {
+        const char *request_method = _q_ctxenv(ctx, "REQUEST_METHOD");
+        size_t cl;
+        if (request_method == NULL ||
+            strcmp(request_method, "POST") ||
+            _content_length(ctx, &cl) == false) {
+            return NULL;
+        }
+
+        // no request to take limits from, the string has a fixed one
+        qcgireq_limit_t limits;
+        memset((void *)&limits, 0, sizeof(limits));
+        limits.maxbody = QUERY_MAXBODY;
+        qcgilimit_t lim;
+        _limit_init(&lim, &limits);
+        if (_limit_body(&lim, cl) == false) return NULL;
+
+        char *query = (char *)Q_MALLOC(sizeof(char) * (cl + 1));
+        if (query == NULL) return NULL;
+        size_t nread = fread(query, 1, cl, _q_ctxin(ctx));
+        query[nread] = '\0';
+        return query;
+    } else if (method == Q_CGI_COOKIE) {
+        const char *http_cookie = _q_ctxenv(ctx, "HTTP_COOKIE");
+        if (http_cookie == NULL) return NULL;
+        char *query = Q_STRDUP(http_cookie);
+        return query;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get the request context a request is bound to.
+ *
+ * @param request   a pointer of request structure
+ *
+ * @return  the context given to qcgireq_parse_ctx(), or NULL when the
+ *          request comes from the process environment.
+ */
+qcgictx_t *qcgireq_getctx(qentry_t *request)
+{
+    qentry_t *meta = _q_entry_meta(request, false);
+    if (meta == NULL) return NULL;
+
+    size_t size = 0;
+    qcgictx_t **ctx = (qcgictx_t **)meta->get(meta, "CONTEXT", &size, false);
+    return (ctx != NULL && size == sizeof(*ctx)) ? *ctx : NULL;
+}
+
+/**
+ * Get a CGI variable of a request.
+ *
+ * @param request   a pointer of request structure
+ * @param name      variable name like "REMOTE_ADDR"
+ *
+ * @return  a pointer of the value, otherwise returns NULL
+ *
+ * @note
+ * Same as getenv() for CGI programs. Use this instead of getenv() so the
+ * code works with requests parsed by qcgireq_parse_ctx() too.
+ */
+const char *qcgireq_getenv(qentry_t *request, const char *name)
+{
+    return _q_ctxenv(qcgireq_getctx(request), name);
+}
+
+/**
+ * Record requests into a capture file to replay them later.
+ *
+ * @param filepath  capture file to append to, NULL to stop capturing
+ *
+ * @return  true if successful, false if capturing isn't available
+ *
+ * @note
+ * Capturing is also turned on per request by the QDECODER_CAPTURE
+ * variable holding the capture file path, set in the environment of a CGI
+ * program or passed by the web server like fastcgi_param. Each request is
+ * appended once with its CGI variables and raw body, by the qcgireq_parse()
+ * call parsing Q_CGI_POST, the body is then parsed from memory. Requests
+ * with bodies over 16MB aren't captured. Captures hold cookies and
+ * credentials as sent, keep them private. Not available with
+ * --enable-fastcgi and on Windows.
+ *
+ * The file is a series of records, integers are in network byte order.
+ *   "QCAP", version(1 byte), 3 reserved bytes,
+ *   variables length(4 bytes), body length(4 bytes),
+ *   variables as "NAME\0VALUE\0" pairs, body
+ *
+ * @code
+ *   $ QDECODER_CAPTURE=/tmp/app.qcap ./app.cgi < body.txt
+ *   $ bench/bench_replay -n 100000 -t 4 /tmp/app.qcap
+ * @endcode
+ */
+bool qcgireq_setcapture(const char *filepath)
+{
+#ifdef CAPTURE_ENABLED
+    char *copy = NULL;
+    if (filepath != NULL) {
+        copy = Q_STRDUP(filepath);
+        if (copy == NULL) return false;
+    }
+
+    Q_FREE(_capturepath);
+    _capturepath = copy;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Turn on statistics of request parsing.
+ *
+ * @param request   qentry_t container pointer that options will be set.
+ *                  NULL can be used to create a new container.
+ * @param enable    true to record statistics, false to stop
+ *
+ * @return  qentry_t container pointer, otherwise returns NULL.
+ *
+ * @note
+ * This method should be called before calling qcgireq_parse(). Each
+ * qcgireq_parse() call on the request then adds up the bytes read from
+ * the body, the fields by source, the multipart parts, the bytes written
+ * to disk in file mode and the time spent. Allocations are counted when
+ * qdecoder_set_allocator() keeps statistics.
+ *
+ * @code
+ *   qentry_t *req = qcgireq_setstats(NULL, true);
+ *   req = qcgireq_parse(req, 0);
+ *   (...)
+ *   qcgireq_logstats(req, NULL);  // one line to stderr, the server log
+ *   req->free(req);
+ * @endcode
+ */
+qentry_t *qcgireq_setstats(qentry_t *request, bool enable)
+{
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
+
+    qentry_t *meta = _q_entry_meta(request, enable);
+    if (meta == NULL) return request;
+
+    if (enable == true) {
+        if (meta->get(meta, "STATS", NULL, false) == NULL) {
+            qcgireq_stat_t stat;
+            memset(&stat, 0, sizeof(stat));
+            meta->put(meta, "STATS", &stat, sizeof(stat), true);
+        }
+    } else {
+        meta->remove(meta, "STATS");
+    }
+
+    return request;
+}
+
+/**
+ * Get statistics of request parsing.
+ *
+ * @param request   a pointer of request structure
+ * @param stat      qcgireq_stat_t structure to fill
+ *
+ * @return  true if successful, false when qcgireq_setstats() isn't on.
+ */
+bool qcgireq_getstats(qentry_t *request, qcgireq_stat_t *stat)
+{
+    qentry_t *meta = _q_entry_meta(request, false);
+    if (meta == NULL || stat == NULL) return false;
+
+    size_t size = 0;
+    void *data = meta->get(meta, "STATS", &size, false);
+    if (data == NULL || size != sizeof(qcgireq_stat_t)) return false;
+    memcpy(stat, data, sizeof(qcgireq_stat_t));
+    return true;
+}
+
+/**
+ * Write statistics of request parsing as one line of key=value pairs.
+ *
+ * @param request   a pointer of request structure
+ * @param fp        output stream, NULL for stderr
+ *
+ * @return  true if successful, false when qcgireq_setstats() isn't on.
+ *
+ * @code
+ *   [Result, wrapped here]
+ *   qdecoder: method=POST uri=/upload.cgi body=1049021 cookies=1 posts=2 \
+ *     gets=0 parts=2 partbytes=1048702 maxpart=1048576 disk=1048576 \
+ *     parsems=0.412 diskms=1.206 allocs=34 allocbytes=5210
+ * @endcode
+ */
+bool qcgireq_logstats(qentry_t *request, FILE *fp)
+{
+    qcgireq_stat_t stat;
+    if (qcgireq_getstats(request, &stat) == false) return false;
+
+    const char *method = qcgireq_getenv(request, "REQUEST_METHOD");
+    const char *uri = qcgireq_getenv(request, "SCRIPT_NAME");
+    if (qcgireq_getenv(request, "REQUEST_URI") != NULL) {
+        uri = qcgireq_getenv(request, "REQUEST_URI");
+    }
+
+    // the query string is left out, it may carry credentials
+    int urilen = 0;
+    if (uri != NULL) urilen = strcspn(uri, "? \t\r\n");
+
+    fprintf((fp != NULL) ? fp : stderr,
+            "qdecoder: method=%s uri=%.*s body=%zu cookies=%zu posts=%zu"
+            " gets=%zu parts=%zu partbytes=%zu maxpart=%zu disk=%zu"
+            " parsems=%.3f diskms=%.3f allocs=%zu allocbytes=%zu\n",
+            (method != NULL) ? method : "-",
+            (uri != NULL) ? urilen : 1, (uri != NULL) ? uri : "-",
+            stat.bodysize, stat.cookies, stat.posts, stat.gets,
+            stat.parts, stat.partsize, stat.maxpart, stat.disksize,
+            stat.parsetime / 1000.0, stat.disktime / 1000.0,
+            stat.allocs, stat.allocsize);
+    return true;
+}
+
+/**
+ * Set limits of a request, checked while it's parsed.
+ *
+ * @param request   qentry_t container pointer that options will be set.
+ *                  NULL can be used to create a new container.
+ * @param limits    limits to apply, 0 in a field for no limit. NULL to
+ *                  remove the limits.
+ *
+ * @return  qentry_t container pointer, otherwise returns NULL.
+ *
+ * @note
+ * This method should be called before calling qcgireq_parse(). A body over
+ * maxbody is refused by its CONTENT_LENGTH before any of it is read. The
+ * other limits are checked as the variables and the multipart values are
+ * read, a partly saved upload is removed. Parsing stops at the first limit
+ * exceeded and the request keeps the variables parsed before, see
+ * qcgireq_geterror(). The counts add up over the qcgireq_parse() calls on
+ * the request and nothing is parsed after a limit was exceeded.
+ *
+ * @code
+ *   qcgireq_limit_t limits = {
+ *     .maxbody = 10 * 1024 * 1024, .maxfields = 1000, .maxname = 256,
+ *     .maxvalue = 64 * 1024, .maxparts = 100, .maxfile = 8 * 1024 * 1024
+ *   };
+ *   qentry_t *req = qcgireq_setlimits(NULL, &limits);
+ *   req = qcgireq_parse(req, 0);
+ *   if (qcgireq_geterror(req) != Q_CGIREQ_OK) {
+ *     qcgires_senderror(req, 413, "Request Entity Too Large");
+ *   }
+ * @endcode
+ */
+qentry_t *qcgireq_setlimits(qentry_t *request, const qcgireq_limit_t *limits)
+{
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
+
+    qentry_t *meta = _q_entry_meta(request, (limits != NULL));
+    if (meta == NULL) return request;
+
+    if (limits != NULL) {
+        qcgilimit_t lim;
+        _limit_init(&lim, limits);
+        meta->put(meta, "LIMITS", &lim, sizeof(lim), true);
+    } else {
+        meta->remove(meta, "LIMITS");
+    }
 
     return request;
 }
 
 /**
- * Get raw query string.
+ * Turn lazy decoding of the request variables on or off.
  *
- * @param method    One of Q_CGI_COOKIE, Q_CGI_POST or Q_CGI_GET.
+ * @param request   qentry_t container pointer that options will be set.
+ *                  NULL can be used to create a new container.
+ * @param enable    true to only tokenize the variables while parsing,
+ *                  false to decode them all right away (default).
  *
- * @return      malloced query string otherwise returns NULL;
+ * @return  qentry_t container pointer, otherwise returns NULL.
+ *
+ * @note
+ * This method should be called before calling qcgireq_parse(). The cookies
+ * and the query string are then kept as they came in and split into
+ * variables. Only the names are decoded, a value is decoded in place the
+ * first time it's read and stays decoded. Handlers reading a few fields out
+ * of many skip the cost of the others. Reading a request from several
+ * threads at once isn't safe in this mode since a read may decode the
+ * value. A body, urlencoded or multipart, is always decoded right away in
+ * chunks, rather than read into memory at once.
  *
  * @code
- *   char *query = qcgireq_getquery(Q_CGI_GET);
- *   if(query != NULL) {
- *     printf("%s\n", query);
- *     free(query);
- *   }
+ *   qentry_t *req = qcgireq_setlazy(NULL, true);
+ *   req = qcgireq_parse(req, 0);
+ *   const char *id = req->getstr(req, "id", false);  // decoded here
  * @endcode
  */
-char *qcgireq_getquery(Q_CGI_T method)
+qentry_t *qcgireq_setlazy(qentry_t *request, bool enable)
 {
-    if (method == Q_CGI_GET) {
-        char *query_string = getenv("QUERY_STRING");
-        if (query_string == NULL) return NULL;
-        char *req_uri = getenv("REQUEST_URI");
+    if (request == NULL) {
+        request = qEntry();
+        if (request == NULL) return NULL;
+    }
 
-        char *query = NULL;
+    qentry_t *meta = _q_entry_meta(request, enable);
+    if (meta == NULL) return request;
 
-        // SSI query handling
-        if (strlen(query_string) == 0 && req_uri != NULL) {
-            char *cp;
-            for (cp = req_uri; *cp != '\0'; cp++) {
-                if (*cp == '?') {
-                    cp++;
-                    break;
-                }
-            }
-            query = strdup(cp);
-        } else {
-            query = strdup(query_string);
-        }
+    if (enable == true) meta->putint(meta, "LAZY", 1, true);
+    else meta->remove(meta, "LAZY");
 
-        return query;
-    } else if (method == Q_CGI_POST) {
-        char *request_method = getenv("REQUEST_METHOD");
-        char *content_length = getenv("CONTENT_LENGTH");
-        if (request_method == NULL ||
-            strcmp(request_method, "POST") ||
-            content_length == NULL) {
-            return NULL;
-        }
+    return request;
+}
 
-        int i, cl = atoi(content_length);
-        char *query = (char *)malloc(sizeof(char) * (cl + 1));
-        for (i = 0; i < cl; i++)query[i] = fgetc(stdin);
-        query[i] = '\0';
-        return query;
-    } else if (method == Q_CGI_COOKIE) {
-        char *http_cookie = getenv("HTTP_COOKIE");
-        if (http_cookie == NULL) return NULL;
-        char *query = strdup(http_cookie);
-        return query;
-    }
+/**
+ * Get the limit a request exceeded while it was parsed.
+ *
+ * @param request   a pointer of request structure
+ *
+ * @return  one of Q_CGIREQ_E*, Q_CGIREQ_OK when no limit was exceeded or
+ *          qcgireq_setlimits() isn't on.
+ */
+Q_CGIREQ_ERR_T qcgireq_geterror(qentry_t *request)
+{
+    if (request == NULL) return Q_CGIREQ_OK;
 
-    return NULL;
+    qcgilimit_t lim;
+    if (_limit_load(request, &lim) == false) return Q_CGIREQ_OK;
+    return lim.error;
 }
 
 #ifndef _DOXYGEN_SKIP
 
-static int _parse_multipart(qentry_t *request)
+static int _parse_multipart(FILE *in, const char *content_type,
+                            qentry_t *request, qcgiparse_t *ps)
 {
-#ifdef _WIN32
-    setmode(fileno(stdin), _O_BINARY);
-    setmode(fileno(stdout), _O_BINARY);
-#endif
+    qcgireq_stat_t *stat = ps->statp;
+    qcgilimit_t *lim = &ps->lim;
 
     char buf[MAX_LINEBUF];
     int  amount = 0;
@@ -366,7 +1096,7 @@ static int _parse_multipart(qentry_t *request)
 
     // Force to check the boundary string length to defense overflow attack
     int maxboundarylen = CONST_STRLEN("--");
-    char *boundaryfieldname = strstr(getenv("CONTENT_TYPE"), "boundary=");
+    char *boundaryfieldname = strstr(content_type, "boundary=");
     if (boundaryfieldname == NULL) {
         DEBUG("The boundary string is not specified. stopping process.");
         return amount;
@@ -381,7 +1111,7 @@ static int _parse_multipart(qentry_t *request)
 
     // find boundary string - Hidai Kenichi made this patch for handling quoted boundary string
     _q_strcpy(boundary_orig, sizeof(boundary_orig),
-              strstr(getenv("CONTENT_TYPE"), "boundary=") + CONST_STRLEN("boundary="));
+              boundaryfieldname + CONST_STRLEN("boundary="));
     _q_strtrim(boundary_orig);
     _q_strunchar(boundary_orig, '"', '"');
     snprintf(boundary, sizeof(boundary), "--%s", boundary_orig);
@@ -409,10 +1139,11 @@ static int _parse_multipart(qentry_t *request)
 
     // check boundary
     do {
-        if (_q_fgets(buf, sizeof(buf), stdin) == NULL) {
+        if (_q_fgets(buf, sizeof(buf), in) == NULL) {
             DEBUG("Bbrowser sent a non-HTTP compliant message.");
             return amount;
         }
+        if (stat != NULL) stat->bodysize += strlen(buf);
         _q_strtrim(buf);
     } while (!strcmp(buf, "")); // skip blank lines
 
@@ -435,22 +1166,30 @@ static int _parse_multipart(qentry_t *request)
         char *name = NULL, *value = NULL, *filename = NULL, *contenttype = NULL;
         int valuelen = 0;
 
+        if (lim->parts >= lim->limit.maxparts) {
+            DEBUG("Too many parts.");
+            lim->error = Q_CGIREQ_EPARTS;
+            break;
+        }
+        lim->parts++;
+
         // parse header
-        while (_q_fgets(buf, sizeof(buf), stdin)) {
+        while (_q_fgets(buf, sizeof(buf), in)) {
+            if (stat != NULL) stat->bodysize += strlen(buf);
             _q_strtrim(buf);
             if (!strcmp(buf, "")) break;
             else if (!strncasecmp(buf, "Content-Disposition: ", CONST_STRLEN("Content-Disposition: "))) {
                 int c_count;
 
                 // get name field
-                name = strdup(buf + CONST_STRLEN("Content-Disposition: form-data; name=\""));
+                name = Q_STRDUP(buf + CONST_STRLEN("Content-Disposition: form-data; name=\""));
                 for (c_count = 0; (name[c_count] != '\"') && (name[c_count] != '\0'); c_count++);
                 name[c_count] = '\0';
 
                 // get filename field
                 if (strstr(buf, "; filename=\"") != NULL) {
                     int erase;
-                    filename = strdup(strstr(buf, "; filename=\"") + CONST_STRLEN("; filename=\""));
+                    filename = Q_STRDUP(strstr(buf, "; filename=\"") + CONST_STRLEN("; filename=\""));
                     for (c_count = 0; (filename[c_count] != '\"') && (filename[c_count] != '\0'); c_count++);
                     filename[c_count] = '\0';
                     // remove directory from path, erase '\'
@@ -467,12 +1206,12 @@ static int _parse_multipart(qentry_t *request)
 
                     // empty attachment
                     if (!strcmp(filename, "")) {
-                        free(filename);
+                        Q_FREE(filename);
                         filename = NULL;
                     }
                 }
             } else if (!strncasecmp(buf, "Content-Type: ", CONST_STRLEN("Content-Type: "))) {
-                contenttype = strdup(buf + CONST_STRLEN("Content-Type: "));
+                contenttype = Q_STRDUP(buf + CONST_STRLEN("Content-Type: "));
                 _q_strtrim(contenttype);
             }
         }
@@ -483,23 +1222,68 @@ static int _parse_multipart(qentry_t *request)
             continue;
         }
 
-        // get value
-        if (filename != NULL && upload_filesave == true) {
-            char *tp, *savename = strdup(filename);
+        // check limits, the value is checked while it's read
+        if (_limit_field(lim, strlen(name), 0) == false) {
+            Q_FREE(name);
+            if (filename != NULL) Q_FREE(filename);
+            if (contenttype != NULL) Q_FREE(contenttype);
+            break;
+        }
+        size_t maxlen = lim->limit.maxvalue;
+        Q_CGIREQ_ERR_T overflow = Q_CGIREQ_EVALUE;
+        if (filename != NULL) {
+            maxlen = lim->limit.maxfile;
+            overflow = Q_CGIREQ_EFILE;
+            if (lim->limit.maxupload - lim->upload < maxlen) {
+                maxlen = lim->limit.maxupload - lim->upload;
+                overflow = Q_CGIREQ_EUPLOAD;
+            }
+        }
+
+        // get value, an internal name is read through and dropped
+        bool internal = _is_internal(name);
+        bool todisk = (filename != NULL && upload_filesave == true &&
+                       internal == false);
+        bool toolong = false, stored = false;
+        Q_TRACE2(part__start, name, filename);
+        if (todisk == true) {
+            char *tp, *savename = Q_STRDUP(filename);
             for (tp = savename; *tp != '\0'; tp++) {
                 if (*tp == ' ') *tp = '_'; // replace ' ' to '_'
             }
             value = _parse_multipart_value_into_disk(
-                        boundary, upload_basepath, savename, &valuelen, &finish);
-            free(savename);
-
-            if (value != NULL) request->putstr(request, name, value, false);
-            else request->putstr(request, name, "(parsing failure)", false);
+                        in, boundary, upload_basepath, savename, &valuelen,
+                        &finish, stat, maxlen, &toolong);
+            Q_FREE(savename);
+
+            if (value != NULL) stored = request->putstr(request, name, value, false);
+            else if (toolong == false) stored = request->putstr(request, name, "(parsing failure)", false);
+        } else if (internal == true) {
+            value = _parse_multipart_value_into_memory(in, boundary, &valuelen,
+                                                       &finish, stat,
+                                                       maxlen, &toolong);
+            if (value != NULL) Q_FREE(value);
+            value = NULL;
         } else {
-            value = _parse_multipart_value_into_memory(boundary, &valuelen, &finish);
+            value = _parse_multipart_value_into_memory(in, boundary, &valuelen,
+                                                       &finish, stat,
+                                                       maxlen, &toolong);
 
-            if (value != NULL) request->put(request, name, value, valuelen+1, false);
-            else request->putstr(request, name, "(parsing failure)", false);
+            if (value != NULL) stored = request->put(request, name, value, valuelen+1, false);
+            else if (toolong == false) stored = request->putstr(request, name, "(parsing failure)", false);
+        }
+        Q_TRACE3(part__end, name, (value != NULL) ? valuelen : -1, todisk);
+
+        if (toolong == true) lim->error = overflow;
+        else if (value != NULL && filename != NULL) lim->upload += valuelen;
+
+        if (stat != NULL) {
+            if (stored == true) stat->posts++;
+            if (value != NULL) {
+                stat->parts++;
+                stat->partsize += valuelen;
+                if (valuelen > stat->maxpart) stat->maxpart = valuelen;
+            }
         }
 
         // store additional information
@@ -525,18 +1309,19 @@ static int _parse_multipart(qentry_t *request)
         }
 
         // free resources
-        if (name != NULL) free(name);
-        if (value != NULL) free(value);
-        if (filename != NULL) free(filename);
-        if (contenttype != NULL) free(contenttype);
+        if (name != NULL) Q_FREE(name);
+        if (value != NULL) Q_FREE(value);
+        if (filename != NULL) Q_FREE(filename);
+        if (contenttype != NULL) Q_FREE(contenttype);
     }
 
     return amount;
 }
 
 #define _Q_MULTIPART_CHUNK_SIZE     (16 * 1024)
-static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
-        bool *finish)
+static char *_parse_multipart_value_into_memory(FILE *in, char *boundary,
+        int *valuelen, bool *finish, qcgireq_stat_t *stat,
+        size_t maxlen, bool *toolong)
 {
     char boundaryEOF[256], rnboundaryEOF[256];
     char boundaryrn[256], rnboundaryrn[256];
@@ -556,9 +1341,9 @@ static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
     boundaryEOFlen = strlen(boundaryEOF);
 
     for (value = NULL, length = 0, mallocsize = _Q_MULTIPART_CHUNK_SIZE, c_count = 0;
-         (c = fgetc(stdin)) != EOF; ) {
+         (c = fgetc(in)) != EOF; ) {
         if (c_count == 0) {
-            value = (char *)malloc(sizeof(char) * mallocsize);
+            value = (char *)Q_MALLOC(sizeof(char) * mallocsize);
             if (value == NULL) {
                 DEBUG("Memory allocation fail.");
                 *finish = true;
@@ -570,19 +1355,26 @@ static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
             mallocsize *= 2;
 
             // Here, we do not use realloc(). Because sometimes it is unstable.
-            valuetmp = (char *)malloc(sizeof(char) * mallocsize);
+            valuetmp = (char *)Q_MALLOC(sizeof(char) * mallocsize);
             if (valuetmp == NULL) {
                 DEBUG("Memory allocation fail.");
-                free(value);
+                Q_FREE(value);
                 *finish = true;
                 return NULL;
             }
             memcpy(valuetmp, value, c_count);
-            free(value);
+            Q_FREE(value);
             value = valuetmp;
         }
         value[c_count++] = (char)c;
 
+        // the value can't end within the limit anymore
+        if (c_count > boundarylen + 4 &&
+            (size_t)(c_count - (boundarylen + 4)) > maxlen) {
+            *toolong = true;
+            break;
+        }
+
         // check end
         if ((c == '\n') || (c == '-')) {
             value[c_count] = '\0';
@@ -622,9 +1414,19 @@ static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
         }
     }
 
+    if (stat != NULL) stat->bodysize += c_count;
+
+    if (*toolong == true || (c != EOF && (size_t)length > maxlen)) {
+        DEBUG("The value is over the limit.");
+        Q_FREE(value);
+        *toolong = true;
+        *finish = true;
+        return NULL;
+    }
+
     if (c == EOF) {
         DEBUG("Broken stream.");
-        if (value != NULL) free(value);
+        if (value != NULL) Q_FREE(value);
         *finish = true;
         return NULL;
     }
@@ -633,8 +1435,9 @@ static char *_parse_multipart_value_into_memory(char *boundary, int *valuelen,
     return value;
 }
 
-static char *_parse_multipart_value_into_disk(const char *boundary,
-        const char *savedir, const char *filename, int *filelen, bool *finish)
+static char *_parse_multipart_value_into_disk(FILE *in, const char *boundary,
+        const char *savedir, const char *filename, int *filelen, bool *finish,
+        qcgireq_stat_t *stat, size_t maxlen, bool *toolong)
 {
     char boundaryEOF[256], rnboundaryEOF[256];
     char boundaryrn[256], rnboundaryrn[256];
@@ -675,12 +1478,13 @@ static char *_parse_multipart_value_into_disk(const char *boundary,
     // read stream
     bool ioerror = false;
     int upload_length;
-    for (upload_length = 0, bufc = 0; (c = fgetc(stdin)) != EOF; ) {
+    size_t nread = 0;
+    for (upload_length = 0, bufc = 0; (c = fgetc(in)) != EOF; ) {
         if (bufc == sizeof(buffer) - 1) {
             // save
             ssize_t leftsize = boundarylen + 8;
             ssize_t savesize = bufc - leftsize;
-            ssize_t saved = write(upload_fd, buffer, savesize);
+            ssize_t saved = _write_upload(upload_fd, buffer, savesize, stat);
             if (saved <= 0) {
                 ioerror = true;
                 break;
@@ -691,6 +1495,14 @@ static char *_parse_multipart_value_into_disk(const char *boundary,
         }
         buffer[bufc++] = (char)c;
         upload_length++;
+        nread++;
+
+        // the file can't end within the limit anymore
+        if (upload_length > boundarylen + 4 &&
+            (size_t)(upload_length - (boundarylen + 4)) > maxlen) {
+            *toolong = true;
+            break;
+        }
 
         // check end
         if ((c == '\n') || (c == '-')) {
@@ -733,9 +1545,11 @@ static char *_parse_multipart_value_into_disk(const char *boundary,
         }
     }
 
+    if (c != EOF && (size_t)upload_length > maxlen) *toolong = true;
+
     // save rest
-    while (bufc > 0) {
-        ssize_t saved = write(upload_fd, buffer, bufc);
+    while (bufc > 0 && *toolong == false) {
+        ssize_t saved = _write_upload(upload_fd, buffer, bufc, stat);
         if (saved <= 0) {
             ioerror = true;
             break;
@@ -743,6 +1557,14 @@ static char *_parse_multipart_value_into_disk(const char *boundary,
         bufc -= saved;
     }
     close(upload_fd);
+    if (stat != NULL) stat->bodysize += nread;
+
+    if (*toolong == true) {
+        DEBUG("The file is over the limit.");
+        _q_unlink(upload_path);
+        *finish = true;
+        return NULL;
+    }
 
     // error occured
     if (c == EOF || ioerror == true) {
@@ -753,7 +1575,37 @@ static char *_parse_multipart_value_into_disk(const char *boundary,
 
     // succeed
     *filelen = upload_length;
-    return strdup(upload_path);
+    return Q_STRDUP(upload_path);
+}
+
+static ssize_t _write_upload(int fd, const void *buf, size_t size,
+                             qcgireq_stat_t *stat)
+{
+    if (stat == NULL) {
+        ssize_t saved = write(fd, buf, size);
+        Q_TRACE3(upload__write, fd, size, saved);
+        return saved;
+    }
+
+    int64_t started = _usec();
+    ssize_t saved = write(fd, buf, size);
+    stat->disktime += (long)(_usec() - started);
+    if (saved > 0) stat->disksize += saved;
+    Q_TRACE3(upload__write, fd, size, saved);
+    return saved;
+}
+
+static int64_t _usec(void)
+{
+#ifdef _WIN32
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
 }
 
 static int _upload_clear_base(const char *upload_basepath, int upload_clearold)
@@ -795,8 +1647,376 @@ static int _upload_clear_base(const char *upload_basepath, int upload_clearold)
 #endif
 }
 
+static void _parse_begin(qentry_t *request, Q_CGI_T method, qcgiparse_t *ps)
+{
+    Q_TRACE2(parse__start, request, (int)method);
+
+    // statistics are added up over the calls on the same request
+    memset((void *)ps, 0, sizeof(qcgiparse_t));
+    if (qcgireq_getstats(request, &ps->stat) == true) {
+        ps->statp = &ps->stat;
+        ps->started = _usec();
+        ps->disktime = ps->stat.disktime;
+        ps->allocstat = qdecoder_get_allocstats(&ps->alloc);
+    }
+    ps->limited = _limit_load(request, &ps->lim);
+    qentry_t *meta = _q_entry_meta(request, false);
+    ps->lazy = (meta != NULL && meta->getint(meta, "LAZY") > 0);
+}
+
+static void _parse_end(qentry_t *request, qcgiparse_t *ps)
+{
+    if (ps->statp != NULL) {
+        qcgireq_stat_t *stat = ps->statp;
+        stat->parsetime += (long)(_usec() - ps->started) -
+                           (stat->disktime - ps->disktime);
+        qdecoder_allocstat_t now;
+        if (ps->allocstat == true && qdecoder_get_allocstats(&now) == true) {
+            stat->allocs += now.threadcount - ps->alloc.threadcount;
+            stat->allocsize += now.threadbytes - ps->alloc.threadbytes;
+        }
+        qentry_t *meta = _q_entry_meta(request, true);
+        if (meta != NULL) {
+            meta->put(meta, "STATS", stat, sizeof(qcgireq_stat_t), true);
+        }
+    }
+
+    if (ps->limited == true) {
+        qentry_t *meta = _q_entry_meta(request, true);
+        if (meta != NULL) {
+            meta->put(meta, "LIMITS", &ps->lim, sizeof(qcgilimit_t), true);
+        }
+    }
+
+    Q_TRACE2(parse__end, request, request->num);
+}
+
+static bool _is_contenttype(const char *content_type, const char *type)
+{
+    if (content_type == NULL) return false;
+    return (strncasecmp(content_type, type, strlen(type)) == 0);
+}
+
+// names of the library's own variables, never taken from a client.
+static bool _is_internal(const char *name)
+{
+    if (strncmp(name, "_Q_", CONST_STRLEN("_Q_")) != 0) return false;
+    DEBUG("Dropped the internal name %s.", name);
+    return true;
+}
+
+// parses a query string, a cookie header or an urlencoded body
+static void _parse_string(qentry_t *request, const char *query,
+                          Q_CGI_T method, qcgiparse_t *ps)
+{
+    if (query == NULL || ps->lim.error != Q_CGIREQ_OK) return;
+    if (method == Q_CGI_POST && _limit_body(&ps->lim, strlen(query)) == false) {
+        return;
+    }
+
+    int count = 0;
+    char sepchar = (method == Q_CGI_COOKIE) ? ';' : '&';
+    char *lazyquery = (ps->lazy == true) ? Q_STRDUP(query) : NULL;
+    if (lazyquery != NULL) {
+        count = _parse_lazy(request, lazyquery, sepchar, &ps->lim);
+    } else {
+        _parse_query(request, query, '=', sepchar, &count, &ps->lim);
+    }
+    if (ps->statp == NULL) return;
+
+    if (method == Q_CGI_COOKIE) {
+        ps->stat.cookies += count;
+    } else if (method == Q_CGI_POST) {
+        ps->stat.bodysize += strlen(query);
+        ps->stat.posts += count;
+    } else {
+        ps->stat.gets += count;
+    }
+}
+
+// parses a body of the content type from the stream, size -1 for unknown.
+static void _parse_stream(qentry_t *request, const char *content_type,
+                          FILE *in, ssize_t size, qcgiparse_t *ps)
+{
+    if (size >= 0 && _limit_body(&ps->lim, size) == false) return;
+
+    if (_is_contenttype(content_type, "application/x-www-form-urlencoded")) {
+        _parse_urlencoded(request, in, size, ps);
+    } else if (_is_contenttype(content_type, "multipart/form-data")) {
+        _parse_multipart(in, content_type, request, ps);
+    }
+}
+
+// parses an urlencoded body from the stream in chunks, size -1 for unknown.
+static void _parse_urlencoded(qentry_t *request, FILE *in, ssize_t size,
+                              qcgiparse_t *ps)
+{
+    qcgireq_parser_t parser;
+    if (_parser_init(&parser, request, ps) == false) return;
+
+    char chunk[4096];
+    size_t total = 0;
+    bool ok = true;
+    while (ok == true && (size < 0 || total < (size_t)size)) {
+        size_t want = sizeof(chunk);
+        if (size >= 0 && (size_t)size - total < want) want = (size_t)size - total;
+        size_t nread = fread(chunk, 1, want, in);
+        if (nread == 0) break;
+        total += nread;
+        ok = _parser_push(&parser, chunk, nread);
+    }
+    if (ok == true) _parser_finish(&parser);
+
+    Q_FREE(parser.buf);
+}
+
+static bool _parser_init(qcgireq_parser_t *parser, qentry_t *request,
+                         qcgiparse_t *ps)
+{
+    memset((void *)parser, 0, sizeof(qcgireq_parser_t));
+    parser->request = request;
+    parser->ps = ps;
+    parser->bufsize = 256;
+    parser->buf = (char *)Q_MALLOC(parser->bufsize);
+    return (parser->buf != NULL);
+}
+
+// appends a decoded byte, a blank one doesn't end the name.
+static bool _parser_putc(qcgireq_parser_t *parser, char c, bool blank)
+{
+    if (parser->len + 2 > parser->bufsize) {  // the byte and a '\0'
+        char *buf = (char *)Q_REALLOC(parser->buf, parser->bufsize * 2);
+        if (buf == NULL) return false;
+        parser->buf = buf;
+        parser->bufsize *= 2;
+    }
+    parser->buf[parser->len++] = c;
+
+    qcgilimit_t *lim = &parser->ps->lim;
+    if (parser->invalue == false) {
+        if (blank == false) parser->nameend = parser->len;
+        if (parser->len > lim->limit.maxname) {
+            DEBUG("The variable name is over the limit.");
+            lim->error = Q_CGIREQ_ENAME;
+            return false;
+        }
+    } else if (parser->len - parser->namelen - 1 > lim->limit.maxvalue) {
+        DEBUG("The variable value is over the limit.");
+        lim->error = Q_CGIREQ_EVALUE;
+        return false;
+    }
+    return true;
+}
+
+// a '%' which didn't make an escape is taken as is.
+static bool _parser_unescape(qcgireq_parser_t *parser)
+{
+    int escape = parser->escape;
+    parser->escape = 0;
+    if (_parser_putc(parser, '%', false) == false) return false;
+    if (escape == 2 && _parser_putc(parser, parser->hex, false) == false) {
+        return false;
+    }
+    return true;
+}
+
+// stores the field parsed, same as _parse_query() does.
+static bool _parser_field(qcgireq_parser_t *parser)
+{
+    const char *name = parser->buf, *value;
+    size_t valuelen;
+    if (parser->invalue == true) {
+        parser->buf[parser->len] = '\0';
+        value = parser->buf + parser->namelen + 1;
+        valuelen = parser->len - parser->namelen - 1;
+    } else {
+        parser->namelen = parser->nameend;
+        parser->buf[parser->namelen] = '\0';
+        value = "";
+        valuelen = 0;
+    }
+
+    qcgiparse_t *ps = parser->ps;
+    bool fit = _limit_field(&ps->lim, parser->namelen, valuelen);
+    if (fit == true && _is_internal(name) == false &&
+        parser->request->putstr(parser->request, name, value, false) == true) {
+        if (ps->statp != NULL) ps->stat.posts++;
+    }
+
+    parser->len = parser->namelen = parser->nameend = 0;
+    parser->invalue = parser->pending = false;
+    return fit;
+}
+
+static bool _parser_push(qcgireq_parser_t *parser, const char *data,
+                         size_t size)
+{
+    qcgiparse_t *ps = parser->ps;
+    if (ps->lim.error != Q_CGIREQ_OK) return false;
+
+    parser->bodysize += size;
+    if (ps->statp != NULL) ps->stat.bodysize += size;
+    if (_limit_body(&ps->lim, parser->bodysize) == false) return false;
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        char c = data[i];
+
+        // an escape may be split over pushes, decoded once it's complete
+        if (parser->escape > 0) {
+            if (isxdigit((unsigned char)c)) {
+                if (parser->escape == 1) {
+                    parser->hex = c;
+                    parser->escape = 2;
+                    continue;
+                }
+                parser->escape = 0;
+                if (_parser_putc(parser, _q_x2c(parser->hex, c), false) == false) {
+                    return false;
+                }
+                continue;
+            }
+            if (_parser_unescape(parser) == false) return false;
+        }
+
+        if (c == '&') {
+            if (_parser_field(parser) == false) return false;
+            continue;
+        }
+
+        parser->pending = true;
+        bool ok = true;
+        if (c == '=' && parser->invalue == false) {
+            parser->namelen = parser->nameend;
+            parser->buf[parser->namelen] = '\0';
+            parser->len = parser->namelen + 1;
+            parser->invalue = true;
+        } else if (c == '%') {
+            parser->escape = 1;
+        } else if (c == '+') {
+            ok = _parser_putc(parser, ' ', false);
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            // leading blanks of a name are trimmed
+            if (parser->invalue == true || parser->len > 0) {
+                ok = _parser_putc(parser, c, true);
+            }
+        } else {
+            ok = _parser_putc(parser, c, false);
+        }
+        if (ok == false) return false;
+    }
+
+    return true;
+}
+
+// stores the last field.
+static bool _parser_finish(qcgireq_parser_t *parser)
+{
+    if (parser->ps->lim.error != Q_CGIREQ_OK) return false;
+    if (parser->escape > 0 && _parser_unescape(parser) == false) return false;
+    if (parser->pending == false) return true;
+    return _parser_field(parser);
+}
+
+// opens a stream reading the buffer
+static FILE *_memopen(const void *buf, size_t size)
+{
+#if defined(_WIN32) || defined(ENABLE_FASTCGI)
+    FILE *fp = tmpfile();
+    if (fp == NULL) return NULL;
+    if (fwrite(buf, 1, size, fp) != size) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    return fp;
+#else
+    return fmemopen((void *)buf, size, "r");
+#endif
+}
+
+static void _limit_init(qcgilimit_t *lim, const qcgireq_limit_t *limits)
+{
+    memset((void *)lim, 0, sizeof(qcgilimit_t));
+    if (limits != NULL) lim->limit = *limits;
+
+    size_t *n[] = {
+        &lim->limit.maxbody, &lim->limit.maxfields, &lim->limit.maxname,
+        &lim->limit.maxvalue, &lim->limit.maxparts, &lim->limit.maxfile,
+        &lim->limit.maxupload
+    };
+    int i;
+    for (i = 0; i < sizeof(n) / sizeof(n[0]); i++) {
+        if (*n[i] == 0) *n[i] = SIZE_MAX;
+    }
+}
+
+// returns false, with no limits loaded, when qcgireq_setlimits() isn't on.
+static bool _limit_load(qentry_t *request, qcgilimit_t *lim)
+{
+    qentry_t *meta = _q_entry_meta(request, false);
+    size_t size = 0;
+    void *data = NULL;
+    if (meta != NULL) data = meta->get(meta, "LIMITS", &size, false);
+    if (data == NULL || size != sizeof(qcgilimit_t)) {
+        _limit_init(lim, NULL);
+        return false;
+    }
+    memcpy((void *)lim, data, sizeof(qcgilimit_t));
+    return true;
+}
+
+// false with the error set if a body of the size is over the limit.
+static bool _limit_body(qcgilimit_t *lim, size_t size)
+{
+    if (lim->error != Q_CGIREQ_OK) return false;
+    if (size > lim->limit.maxbody) {
+        DEBUG("The request body is over the limit.");
+        lim->error = Q_CGIREQ_EBODY;
+        return false;
+    }
+    return true;
+}
+
+// CONTENT_LENGTH of the request, false if it's missing or malformed.
+static bool _content_length(qcgictx_t *ctx, size_t *size)
+{
+    const char *cl = _q_ctxenv(ctx, "CONTENT_LENGTH");
+    if (cl == NULL || *cl < '0' || *cl > '9') return false;  // no sign
+
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(cl, &end, 10);
+    if (errno != 0 || *end != '\0' || n > (unsigned long long)SSIZE_MAX) {
+        DEBUG("Malformed CONTENT_LENGTH %s.", cl);
+        return false;
+    }
+    *size = (size_t)n;
+    return true;
+}
+
+// counts a variable in, false with the error set if it's over the limits.
+static bool _limit_field(qcgilimit_t *lim, size_t namelen, size_t valuelen)
+{
+    if (lim->fields >= lim->limit.maxfields) {
+        DEBUG("Too many variables.");
+        lim->error = Q_CGIREQ_EFIELDS;
+    } else if (namelen > lim->limit.maxname) {
+        DEBUG("The variable name is over the limit.");
+        lim->error = Q_CGIREQ_ENAME;
+    } else if (valuelen > lim->limit.maxvalue) {
+        DEBUG("The variable value is over the limit.");
+        lim->error = Q_CGIREQ_EVALUE;
+    } else {
+        lim->fields++;
+        return true;
+    }
+    return false;
+}
+
 static qentry_t *_parse_query(qentry_t *request, const char *query,
-                              char equalchar, char sepchar, int *count)
+                              char equalchar, char sepchar, int *count,
+                              qcgilimit_t *lim)
 {
     if (request == NULL) {
         request = qEntry();
@@ -806,21 +2026,202 @@ static qentry_t *_parse_query(qentry_t *request, const char *query,
     char *newquery = NULL;
     int cnt = 0;
 
-    if (query != NULL) newquery = strdup(query);
+    if (query != NULL) newquery = Q_STRDUP(query);
     while (newquery && *newquery) {
         char *value = _q_makeword(newquery, sepchar);
         char *name = _q_strtrim(_q_makeword(value, equalchar));
-        _q_urldecode(name);
-        _q_urldecode(value);
+        size_t namelen = _q_urldecode(name);
+        size_t valuelen = _q_urldecode(value);
 
-        if (request->putstr(request, name, value, false) == true) cnt++;
-        free(name);
-        free(value);
+        bool fit = _limit_field(lim, namelen, valuelen);
+        if (fit == true && _is_internal(name) == false &&
+            request->putstr(request, name, value, false) == true) {
+            cnt++;
+        }
+        Q_FREE(name);
+        Q_FREE(value);
+        if (fit == false) break;
     }
-    if (newquery != NULL) free(newquery);
+    if (newquery != NULL) Q_FREE(newquery);
     if (count != NULL) *count = cnt;
 
     return request;
 }
 
+// tokenizes a query taken over as it is, the names are decoded in place and
+// the values once they're read. returns the number of fields stored.
+static int _parse_lazy(qentry_t *request, char *query, char sepchar,
+                       qcgilimit_t *lim)
+{
+    if (_q_entry_keep(request, query, strlen(query) + 1) == false) {
+        Q_FREE(query);
+        return 0;
+    }
+
+    int cnt = 0;
+    char *p = query;
+    while (*p != '\0') {
+        char *name = p;
+        char *sep = strchr(p, sepchar);
+        if (sep != NULL) {
+            *sep = '\0';
+            p = sep + 1;
+        } else {
+            p += strlen(p);
+        }
+
+        char *value = strchr(name, '=');
+        if (value != NULL) *value++ = '\0';
+        else value = name + strlen(name);
+
+        name = _q_strtrim(name);
+        size_t namelen = _q_urldecode(name);
+        size_t valuelen = 0;
+        if (lim->limit.maxvalue != SIZE_MAX) valuelen = _decodedlen(value);
+
+        if (_limit_field(lim, namelen, valuelen) == false) break;
+        if (_is_internal(name) == false &&
+            _q_entry_putencoded(request, name, value) == true) {
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+// length of an urlencoded string once decoded by _q_urldecode().
+static size_t _decodedlen(const char *str)
+{
+    size_t len = 0;
+    for (; *str != '\0'; str++, len++) {
+        if (*str == '%' && isxdigit((unsigned char)str[1]) &&
+            isxdigit((unsigned char)str[2])) {
+            str += 2;
+        }
+    }
+    return len;
+}
+
+#ifdef CAPTURE_ENABLED
+static bool _capture_var(const char *name)
+{
+    static const char *names[] = {
+        "AUTH_TYPE", "CONTENT_LENGTH", "CONTENT_TYPE", "DOCUMENT_ROOT",
+        "GATEWAY_INTERFACE", "HTTPS", "PATH_INFO", "PATH_TRANSLATED",
+        "QUERY_STRING", "REMOTE_ADDR", "REMOTE_HOST", "REMOTE_PORT",
+        "REMOTE_USER", "REQUEST_METHOD", "REQUEST_SCHEME", "REQUEST_URI",
+        "SCRIPT_FILENAME", "SCRIPT_NAME", "SERVER_ADDR", "SERVER_NAME",
+        "SERVER_PORT", "SERVER_PROTOCOL", "SERVER_SOFTWARE", NULL
+    };
+    if (!strncmp(name, "HTTP_", CONST_STRLEN("HTTP_"))) return true;
+    int i;
+    for (i = 0; names[i] != NULL; i++) {
+        if (!strcmp(name, names[i])) return true;
+    }
+    return false;
+}
+
+static void _put_uint32(unsigned char *p, uint32_t n)
+{
+    p[0] = (n >> 24) & 0xff;
+    p[1] = (n >> 16) & 0xff;
+    p[2] = (n >> 8) & 0xff;
+    p[3] = n & 0xff;
+}
+
+// appends the request to the capture file once, returns a stream over the
+// body read for that or NULL if there's nothing to parse from memory.
+static FILE *_capture(qentry_t *request, qcgictx_t *ctx, char **body)
+{
+    const char *path = _capturepath;
+    if (path == NULL) path = _q_ctxenv(ctx, "QDECODER_CAPTURE");
+    if (path == NULL && ctx != NULL && ctx->params != NULL) {
+        path = getenv("QDECODER_CAPTURE");
+    }
+    if (path == NULL || *path == '\0') return NULL;
+
+    qentry_t *meta = _q_entry_meta(request, true);
+    if (meta == NULL || meta->getint(meta, "CAPTURED") != 0) return NULL;
+    meta->putint(meta, "CAPTURED", 1, true);
+
+    size_t bodylen = 0;
+    if (_q_ctxenv(ctx, "CONTENT_LENGTH") != NULL &&
+        _content_length(ctx, &bodylen) == false) {
+        return NULL;
+    }
+    if (bodylen > CAPTURE_MAXBODY) return NULL;
+
+    char *vars = NULL;
+    size_t varslen = 0;
+    FILE *fp = open_memstream(&vars, &varslen);
+    if (fp == NULL) return NULL;
+    if (ctx != NULL && ctx->params != NULL) {
+        qentobj_t obj;
+        memset((void *)&obj, 0, sizeof(obj));
+        while (ctx->params->getnext(ctx->params, &obj, NULL, false) == true) {
+            if (_capture_var(obj.name) == false) continue;
+            fwrite(obj.name, 1, strlen(obj.name) + 1, fp);
+            fwrite(obj.data, 1, strlen((char *)obj.data) + 1, fp);
+        }
+    } else {
+        extern char **environ;
+        char **env;
+        for (env = environ; env != NULL && *env != NULL; env++) {
+            char *eq = strchr(*env, '=');
+            if (eq == NULL) continue;
+            char name[256];
+            size_t namelen = eq - *env;
+            if (namelen >= sizeof(name)) continue;
+            memcpy(name, *env, namelen);
+            name[namelen] = '\0';
+            if (_capture_var(name) == false) continue;
+            fwrite(name, 1, namelen + 1, fp);
+            fwrite(eq + 1, 1, strlen(eq + 1) + 1, fp);
+        }
+    }
+    fclose(fp);
+
+    *body = NULL;
+    FILE *in = NULL;
+    if (bodylen > 0) {
+        *body = (char *)Q_MALLOC(bodylen);
+        if (*body != NULL) bodylen = fread(*body, 1, bodylen, _q_ctxin(ctx));
+        else bodylen = 0;
+        in = (bodylen > 0) ? fmemopen(*body, bodylen, "r") : NULL;
+        if (in == NULL) bodylen = 0;
+    }
+
+    unsigned char hdr[16];
+    memcpy(hdr, CAPTURE_MAGIC, 4);
+    hdr[4] = CAPTURE_VERSION;
+    hdr[5] = hdr[6] = hdr[7] = 0;
+    _put_uint32(hdr + 8, (uint32_t)varslen);
+    _put_uint32(hdr + 12, (uint32_t)bodylen);
+    struct iovec iov[3] = {
+        { hdr, sizeof(hdr) }, { vars, varslen }, { *body, bodylen }
+    };
+
+    // one write keeps records whole with concurrent processes
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        if (writev(fd, iov, 3) != (ssize_t)(sizeof(hdr) + varslen + bodylen)) {
+            DEBUG("Can't write to the capture file %s.", path);
+        }
+        close(fd);
+    }
+    free(vars);  // from open_memstream()
+
+    if (in == NULL) {
+        Q_FREE(*body);
+        *body = NULL;
+    }
+    return in;
+}
+#else
+static FILE *_capture(qentry_t *request, qcgictx_t *ctx, char **body)
+{
+    return NULL;
+}
+#endif
+
 #endif /* _DOXYGEN_SKIP */
@@ -45,6 +45,24 @@
 #include "qdecoder.h"
 #include "internal.h"
 
+#ifndef _DOXYGEN_SKIP
+
+#define ERROR_TEMPLATE                                                  \
+    "<html>\n"                                                          \
+    "<head><title>{{status}} {{reason}}</title></head>\n"               \
+    "<body>\n"                                                          \
+    "<h1>{{status}} {{reason}}</h1>\n"                                  \
+    "<p>{{message}}</p>\n"                                              \
+    "</body>\n"                                                         \
+    "</html>\n"
+
+static char *_errtemplate = NULL;   // qcgires_seterrortemplate()
+
+static const char *_reason(int status);
+static void _puthtml(FILE *out, const char *str);
+
+#endif
+
 /**
  * Set cookie
  *
@@ -83,13 +101,18 @@ bool qcgires_setcookie(qentry_t *request, const char *name, const char *value,
     char *encvalue = _q_urlencode(value, strlen(value));
     char cookie[(4 * 1024) + 256];
     snprintf(cookie, sizeof(cookie), "%s=%s", encname, encvalue);
-    free(encname), free(encvalue);
+    Q_FREE(encname), Q_FREE(encvalue);
 
     if (expire != 0) {
         char gmtstr[sizeof(char) * (CONST_STRLEN("Mon, 00 Jan 0000 00:00:00 GMT") + 1)];
         time_t utctime = time(NULL) + expire;
-        struct tm *gmtm = gmtime(&utctime);
-        strftime(gmtstr, sizeof(gmtstr), "%a, %d %b %Y %H:%M:%S GMT", gmtm);
+        struct tm gmtm;
+#ifdef _WIN32
+        gmtime_s(&gmtm, &utctime);
+#else
+        gmtime_r(&utctime, &gmtm);
+#endif
+        strftime(gmtstr, sizeof(gmtstr), "%a, %d %b %Y %H:%M:%S GMT", &gmtm);
 
         strcat(cookie, "; expires=");
         strcat(cookie, gmtstr);
@@ -117,7 +140,7 @@ bool qcgires_setcookie(qentry_t *request, const char *name, const char *value,
         strcat(cookie, "; secure");
     }
 
-    printf("Set-Cookie: %s" CRLF, cookie);
+    fprintf(_q_ctxout(qcgireq_getctx(request)), "Set-Cookie: %s" CRLF, cookie);
 
     return true;
 }
@@ -167,7 +190,7 @@ bool qcgires_setcontenttype(qentry_t *request, const char *mimetype)
         return false;
     }
 
-    printf("Content-Type: %s" CRLF CRLF, mimetype);
+    fprintf(_q_ctxout(qcgireq_getctx(request)), "Content-Type: %s" CRLF CRLF, mimetype);
 
     if (request != NULL) {
         request->putstr(request, "_Q_CONTENTTYPE", mimetype, true);
@@ -212,7 +235,7 @@ bool qcgires_redirect(qentry_t *request, const char *uri)
         return false;
     }
 
-    printf("Location: %s" CRLF CRLF, uri);
+    fprintf(_q_ctxout(qcgireq_getctx(request)), "Location: %s" CRLF CRLF, uri);
     return true;
 }
 
@@ -258,18 +281,21 @@ int qcgires_download(qentry_t *request, const char *filepath,
     char *filename = _q_filename(filepath);
     off_t filesize = _q_filesize(filepath);
 
-    printf("Content-Disposition: %s;filename=\"%s\"" CRLF, disposition, filename);
-    printf("Content-Transfer-Encoding: binary" CRLF);
-    printf("Accept-Ranges: bytes" CRLF);
-    printf("Content-Length: %lu" CRLF, (unsigned long)filesize);
-    printf("Connection: close" CRLF);
+    FILE *out = _q_ctxout(qcgireq_getctx(request));
+    fprintf(out, "Content-Disposition: %s;filename=\"%s\"" CRLF, disposition, filename);
+    fprintf(out, "Content-Transfer-Encoding: binary" CRLF);
+    fprintf(out, "Accept-Ranges: bytes" CRLF);
+    fprintf(out, "Content-Length: %lu" CRLF, (unsigned long)filesize);
+    fprintf(out, "Connection: close" CRLF);
     qcgires_setcontenttype(request, mime);
 
-    free(filename);
+    Q_FREE(filename);
 
-    fflush(stdout);
+    fflush(out);
 
-    int sent = _q_iosend(stdout, fp, filesize);
+    Q_TRACE2(download__start, filepath, (int64_t)filesize);
+    int sent = _q_iosend(out, fp, filesize);
+    Q_TRACE2(download__end, filepath, sent);
 
     fclose(fp);
     return sent;
@@ -286,6 +312,10 @@ int qcgires_download(qentry_t *request, const char *filepath,
  * @code
  *   qcgires_error(req, "Error: can't find userid.");
  * @endcode
+ *
+ * @note
+ * Persistent FastCGI workers would be respawned after every error, use
+ * qcgires_senderror() which returns to the caller instead.
  */
 void qcgires_error(qentry_t *request, char *format, ...)
 {
@@ -295,23 +325,171 @@ void qcgires_error(qentry_t *request, char *format, ...)
         exit(EXIT_FAILURE);
     }
 
-    if (getenv("REMOTE_ADDR") == NULL)  {
-        printf("Error: %s\n", buf);
+    FILE *out = _q_ctxout(qcgireq_getctx(request));
+    if (qcgireq_getenv(request, "REMOTE_ADDR") == NULL)  {
+        fprintf(out, "Error: %s\n", buf);
     } else {
         qcgires_setcontenttype(request, "text/html");
 
-        printf("<html>\n");
-        printf("<head>\n");
-        printf("<title>Error: %s</title>\n", buf);
-        printf("<script language='JavaScript'>\n");
-        printf("  alert(\"%s\");\n", buf);
-        printf("  history.back();\n");
-        printf("</script>\n");
-        printf("</head>\n");
-        printf("</html>\n");
+        fprintf(out, "<html>\n");
+        fprintf(out, "<head>\n");
+        fprintf(out, "<title>Error: %s</title>\n", buf);
+        fprintf(out, "<script language='JavaScript'>\n");
+        fprintf(out, "  alert(\"%s\");\n", buf);
+        fprintf(out, "  history.back();\n");
+        fprintf(out, "</script>\n");
+        fprintf(out, "</head>\n");
+        fprintf(out, "</html>\n");
     }
+    fflush(out);
 
-    free(buf);
+    Q_FREE(buf);
     if (request != NULL) request->free(request);
     exit(EXIT_FAILURE);
 }
+
+/**
+ * Send an error response and return to the caller
+ *
+ * @param request   a pointer of request structure
+ * @param status    HTTP status code such as 400 or 404
+ * @param format    error message
+ *
+ * @return  true in case of success, false if the headers were sent
+ *          already
+ *
+ * @code
+ *   while (qfcgi_accept(fcgi) == true) {
+ *     qentry_t *req = qcgireq_parse(NULL, 0);
+ *     const char *userid = req->getstr(req, "userid", false);
+ *     if (userid == NULL) {
+ *       qcgires_senderror(req, 400, "Can't find userid.");
+ *       req->free(req);
+ *       continue;
+ *     }
+ *     (...)
+ *   }
+ * @endcode
+ *
+ * @note
+ * Unlike qcgires_error(), the request isn't freed and the program goes on,
+ * so a persistent FastCGI worker serves the next request instead of being
+ * respawned. The page is made from the template of
+ * qcgires_seterrortemplate() with the message HTML-escaped.
+ */
+bool qcgires_senderror(qentry_t *request, int status, const char *format, ...)
+{
+    if (qcgires_getcontenttype(request) != NULL) {
+        DEBUG("Should be called before qcgires_setcontenttype().");
+        return false;
+    }
+
+    char *buf;
+    DYNAMIC_VSPRINTF(buf, format);
+    if (buf == NULL) return false;
+
+    const char *reason = _reason(status);
+    FILE *out = _q_ctxout(qcgireq_getctx(request));
+    fprintf(out, "Status: %d %s" CRLF, status, reason);
+    fprintf(out, "Cache-Control: no-store" CRLF);
+    qcgires_setcontenttype(request, "text/html; charset=utf-8");
+
+    const char *p = (_errtemplate != NULL) ? _errtemplate : ERROR_TEMPLATE;
+    while (*p != '\0') {
+        const char *mark = strstr(p, "{{");
+        if (mark == NULL) {
+            fputs(p, out);
+            break;
+        }
+        fwrite(p, 1, mark - p, out);
+        if (!strncmp(mark, "{{status}}", 10)) {
+            fprintf(out, "%d", status);
+            p = mark + 10;
+        } else if (!strncmp(mark, "{{reason}}", 10)) {
+            fputs(reason, out);
+            p = mark + 10;
+        } else if (!strncmp(mark, "{{message}}", 11)) {
+            _puthtml(out, buf);
+            p = mark + 11;
+        } else {
+            fputs("{{", out);
+            p = mark + 2;
+        }
+    }
+    fflush(out);
+
+    Q_FREE(buf);
+    return true;
+}
+
+/**
+ * Set the page template of qcgires_senderror()
+ *
+ * @param html  HTML template, NULL to restore the default
+ *
+ * @return  true in case of success, otherwise returns false
+ *
+ * @code
+ *   qcgires_seterrortemplate(
+ *       "<html><body><h1>{{status}} {{reason}}</h1>"
+ *       "<p>{{message}}</p><a href='/'>Home</a></body></html>");
+ * @endcode
+ *
+ * @note
+ * {{status}}, {{reason}} and {{message}} are replaced in the template.
+ * It applies to the whole process, so set it before serving requests.
+ */
+bool qcgires_seterrortemplate(const char *html)
+{
+    char *copy = NULL;
+    if (html != NULL) {
+        copy = Q_STRDUP(html);
+        if (copy == NULL) return false;
+    }
+
+    Q_FREE(_errtemplate);
+    _errtemplate = copy;
+    return true;
+}
+
+#ifndef _DOXYGEN_SKIP
+
+static const char *_reason(int status)
+{
+    switch (status) {
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 410: return "Gone";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 422: return "Unprocessable Entity";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+    }
+    return (status >= 500) ? "Server Error" : "Error";
+}
+
+static void _puthtml(FILE *out, const char *str)
+{
+    for (; *str != '\0'; str++) {
+        switch (*str) {
+            case '<': fputs("&lt;", out); break;
+            case '>': fputs("&gt;", out); break;
+            case '&': fputs("&amp;", out); break;
+            case '"': fputs("&quot;", out); break;
+            case '\'': fputs("&#39;", out); break;
+            default: fputc(*str, out); break;
+        }
+    }
+}
+
+#endif /* _DOXYGEN_SKIP */
@@ -41,10 +41,15 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <time.h>
-#include <sys/time.h>
+#include <sys/stat.h>
 #include <limits.h>
+#include <errno.h>
 #ifndef _WIN32
 #include <dirent.h>
+#include <pthread.h>
+#endif
+#ifdef ENABLE_OPENSSL
+#include <openssl/evp.h>
 #endif
 #include "qdecoder.h"
 #include "internal.h"
@@ -60,11 +65,23 @@
 #endif
 
 #define SESSION_ID                          "QSESSIONID"
+#define SESSION_DATA                        "QSESSIONDATA"
 #define SESSION_PREFIX                      "qsession-"
 #define SESSION_STORAGE_EXTENSION           ".properties"
 #define SESSION_TIMEOUT_EXTENSION           ".expire"
 #define SESSION_TIMETOCLEAR_FILENAME        "qsession-timetoclear"
 #define SESSION_DEFAULT_TIMEOUT_INTERVAL    (30 * 60)
+#define SESSION_SHARDS                      (256 * 256)
+#define SESSION_GC_SHARDS_PER_SAVE          (16)
+#define SESSION_ID_BYTES                    (16)    // 128 bits
+#define SESSION_ID_MAXLEN                   (64)
+#define SESSION_CACHE_BUCKETS               (4096)
+#define SESSION_KEY_MINLEN                  (16)
+#define SESSION_COOKIE_MAXLEN               (3800)  // encoded cookie value
+#define SESSION_COOKIE_VERSION              (1)
+#define SESSION_COOKIE_ENCRYPTED            (0x01)
+#define SESSION_NONCE_LEN                   (12)
+#define SESSION_TAG_LEN                     (16)
 
 #ifndef _DOXYGEN_SKIP
 
@@ -74,14 +91,132 @@
 #define INTER_CREATED_SEC       INTER_PREFIX "CREATED"
 #define INTER_INTERVAL_SEC      INTER_PREFIX "INTERVAL"
 #define INTER_CONNECTIONS       INTER_PREFIX "CONNECTIONS"
+#define INTER_OPTIONS           INTER_PREFIX "OPTIONS"
+#define INTER_FILESTORE         INTER_PREFIX "FILESTORE"
 
-static bool _clear_repo(const char *session_repository_path);
+static bool _clear_repo(const char *session_repository_path, int options);
+static int _clear_dir(const char *dirpath);
+static int _session_shard(const char *sessionkey);
+static char *_session_path(char *buf, size_t size, const char *repository,
+                           const char *sessionkey, const char *extension,
+                           int options);
+static bool _make_shard(const char *repository, const char *sessionkey);
+static bool _is_valid_sessionkey(const char *sessionkey);
+static bool _save_atomic(qentry_t *session, const char *filepath,
+                         struct stat *st);
+static bool _cache_load(qentry_t *session, const char *filepath,
+                        struct stat *st);
+static void _cache_store(qentry_t *session, const char *filepath,
+                         const struct stat *st);
+static void _cache_remove(const char *filepath);
+static bool _file_save(qentry_t *session);
+static bool _cookie_save(qentry_t *session);
+static bool _cookie_load(qentry_t *session, qentry_t *request);
+static char *_cookie_encode(qentry_t *session);
+static void _set_request(qentry_t *session, qentry_t *request);
+static qentry_t *_get_request(qentry_t *session);
 static int _is_valid_session(const char *filepath);
 static bool _update_timeout(const char *filepath, time_t timeout_interval);
 static char *_genuniqid(void);
 
+static struct {
+    bool set;
+    unsigned char mackey[SHA256_DIGEST_LEN];
+    unsigned char enckey[SHA256_DIGEST_LEN];
+} _sesskey;
+
 #endif
 
+/**
+ * Set session storage options.
+ *
+ * @param request   a pointer of request structure returned by qcgireq_parse()
+ * @param options   one or more of Q_SESS_T flags. Q_SESS_DEFAULT resets
+ *                  to the default flat layout.
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * This should be called before qcgisess_init(). With Q_SESS_SHARDED, session
+ * files are spread over two levels of sub-directories derived from the
+ * session id (e.g. "/tmp/3f/a9/qsession-...") instead of piling up in one
+ * directory, and expired sessions are swept a few shards at a time on every
+ * qcgisess_save(). All programs sharing a repository must use the same layout.
+ *
+ * With Q_SESS_COOKIE, the whole session is kept in the QSESSIONDATA cookie,
+ * signed with HMAC-SHA256 using the key given by qcgisess_setkey(), so
+ * nothing is stored on the server. Sessions which grow too big for a cookie
+ * fall back to the repository. Q_SESS_ENCRYPT additionally encrypts the
+ * cookie with AES-256-GCM, this needs qDecoder built with --enable-openssl.
+ * In cookie mode, qcgisess_save() and qcgisess_destroy() send cookies, so
+ * they must be called before qcgires_setcontenttype() and the request must
+ * not be freed before them.
+ *
+ * Q_SESS_BINARY stores session files in the binary format of
+ * qentry_t->savebin(), which loads faster and doesn't inflate binary values.
+ * Both formats are read regardless of this flag, so it can be switched on a
+ * live repository.
+ *
+ * @code
+ *   qentry_t *req = qcgireq_parse(NULL, 0);
+ *   qcgisess_setoption(req, Q_SESS_SHARDED);
+ *   qentry_t *sess = qcgisess_init(req, "/var/lib/sessions");
+ * @endcode
+ *
+ * @code
+ *   qcgisess_setkey(secret, sizeof(secret)); // once, at start-up
+ *
+ *   qentry_t *req = qcgireq_parse(NULL, 0);
+ *   qcgisess_setoption(req, Q_SESS_COOKIE);
+ *   qentry_t *sess = qcgisess_init(req, NULL);
+ *   sess->putstr(sess, "user", "wolkykim", true);
+ *   qcgisess_save(sess);
+ *   qcgires_setcontenttype(req, "text/html");
+ * @endcode
+ */
+bool qcgisess_setoption(qentry_t *request, Q_SESS_T options)
+{
+    if (request == NULL) return false;
+#ifndef ENABLE_OPENSSL
+    if ((options & Q_SESS_ENCRYPT) != 0) {
+        DEBUG("Built without OpenSSL, can't encrypt session cookies.");
+        return false;
+    }
+#endif
+
+    // kept apart from the request variables which clients can fill
+    qentry_t *meta = _q_entry_meta(request, true);
+    if (meta == NULL) return false;
+    return meta->putint(meta, "SESSION_OPTIONS", (int)options, true);
+}
+
+/**
+ * Set the secret key for cookie based sessions.
+ *
+ * @param key       secret key, at least 16 bytes of random data
+ * @param keylen    length of the key
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * Every process serving the same site must use the same key. Changing the
+ * key invalidates all cookie sessions. Without a key, Q_SESS_COOKIE sessions
+ * are stored in the repository.
+ */
+bool qcgisess_setkey(const void *key, size_t keylen)
+{
+    if (key == NULL || keylen < SESSION_KEY_MINLEN) return false;
+
+    // separate keys for signing and encryption
+    _q_hmac_sha256(_sesskey.mackey, key, keylen,
+                   "qdecoder session mac", CONST_STRLEN("qdecoder session mac"));
+    _q_hmac_sha256(_sesskey.enckey, key, keylen,
+                   "qdecoder session enc", CONST_STRLEN("qdecoder session enc"));
+    _sesskey.set = true;
+
+    return true;
+}
+
 /**
  * Initialize session
  *
@@ -106,16 +241,42 @@ qentry_t *qcgisess_init(qentry_t *request, const char *dirpath)
     qentry_t *session = qEntry();
     if (session == NULL) return NULL;
 
+    qentry_t *meta = _q_entry_meta(request, false);
+    int options = (meta != NULL) ? meta->getint(meta, "SESSION_OPTIONS") : 0;
+    if ((options & Q_SESS_COOKIE) != 0) {
+        _set_request(session, request);
+
+        // stateless session carried by the cookie itself
+        if (_cookie_load(session, request) == true) {
+            session->putstr(session, INTER_SESSION_REPO,
+                            (dirpath != NULL) ? dirpath : SESSION_DEFAULT_REPOSITORY,
+                            true);
+            session->putint(session, INTER_OPTIONS, options, true);
+            const char *sessionid = qcgisess_getid(session);
+            request->putstr(request, SESSION_ID, sessionid, true);
+
+            int conns = session->getint(session, INTER_CONNECTIONS);
+            session->putint(session, INTER_CONNECTIONS, ++conns, true);
+            qcgisess_settimeout(session, session->getint(session, INTER_INTERVAL_SEC));
+            Q_TRACE2(session__load, sessionid, false);
+            return session;
+        }
+    }
+
     // check session status & get session id
     bool new_session;
     char *sessionkey;
-    if (request->getstr(request, SESSION_ID, false) != NULL) {
+    if (_is_valid_sessionkey(request->getstr(request, SESSION_ID, false))) {
         sessionkey = request->getstr(request, SESSION_ID, true);
         new_session = false;
     } else { // new session
         sessionkey = _genuniqid();
         new_session = true;
     }
+    if (sessionkey == NULL) {
+        session->free(session);
+        return NULL;
+    }
 
     // make storage path for session
     char session_repository_path[PATH_MAX];
@@ -127,14 +288,12 @@ qentry_t *qcgisess_init(qentry_t *request, const char *dirpath)
                                      sizeof(session_repository_path));
     else strncpy(session_repository_path, SESSION_DEFAULT_REPOSITORY,
                      sizeof(session_repository_path));
-    snprintf(session_storage_path, sizeof(session_storage_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_STORAGE_EXTENSION);
-    snprintf(session_timeout_path, sizeof(session_timeout_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_TIMEOUT_EXTENSION);
+    _session_path(session_storage_path, sizeof(session_storage_path),
+                  session_repository_path, sessionkey,
+                  SESSION_STORAGE_EXTENSION, options);
+    _session_path(session_timeout_path, sizeof(session_timeout_path),
+                  session_repository_path, sessionkey,
+                  SESSION_TIMEOUT_EXTENSION, options);
 
     // validate exist session
     if (new_session == false) {
@@ -146,16 +305,18 @@ qentry_t *qcgisess_init(qentry_t *request, const char *dirpath)
             }
 
             // remake storage path
-            free(sessionkey);
+            Q_FREE(sessionkey);
             sessionkey = _genuniqid();
-            snprintf(session_storage_path, sizeof(session_storage_path),
-                     "%s/%s%s%s",
-                     session_repository_path,
-                     SESSION_PREFIX, sessionkey, SESSION_STORAGE_EXTENSION);
-            snprintf(session_timeout_path, sizeof(session_timeout_path),
-                     "%s/%s%s%s",
-                     session_repository_path,
-                     SESSION_PREFIX, sessionkey, SESSION_TIMEOUT_EXTENSION);
+            if (sessionkey == NULL) {
+                session->free(session);
+                return NULL;
+            }
+            _session_path(session_storage_path, sizeof(session_storage_path),
+                          session_repository_path, sessionkey,
+                          SESSION_STORAGE_EXTENSION, options);
+            _session_path(session_timeout_path, sizeof(session_timeout_path),
+                          session_repository_path, sessionkey,
+                          SESSION_TIMEOUT_EXTENSION, options);
 
             // set flag
             new_session = true;
@@ -164,7 +325,10 @@ qentry_t *qcgisess_init(qentry_t *request, const char *dirpath)
 
     // if new session, set session id
     if (new_session == true) {
-        qcgires_setcookie(request, SESSION_ID, sessionkey, 0, "/", NULL, NULL);
+        // in cookie mode, cookies are sent by qcgisess_save()
+        if ((options & Q_SESS_COOKIE) == 0) {
+            qcgires_setcookie(request, SESSION_ID, sessionkey, 0, "/", NULL, NULL);
+        }
         // force to add session_in to query list
         request->putstr(request, SESSION_ID, sessionkey, true);
 
@@ -175,23 +339,37 @@ qentry_t *qcgisess_init(qentry_t *request, const char *dirpath)
         session->putstr(session, INTER_SESSION_REPO, session_repository_path, false);
         session->putstr(session, INTER_CREATED_SEC, created_sec, false);
         session->putint(session, INTER_CONNECTIONS, 1, false);
+        session->putint(session, INTER_OPTIONS, options, false);
 
         // set timeout interval
         qcgisess_settimeout(session, session_timeout_interval);
     } else { // read session properties
 
         // read exist session informations
-        session->load(session, session_storage_path);
+        struct stat st;
+        if (_cache_load(session, session_storage_path, &st) == false) {
+            // either format, whatever the writer was configured with
+            if (session->loadbin(session, session_storage_path) == 0) {
+                session->load(session, session_storage_path);
+            }
+            _cache_store(session, session_storage_path, &st);
+        }
 
         // update session informations
         int conns = session->getint(session, INTER_CONNECTIONS);
         session->putint(session, INTER_CONNECTIONS, ++conns, true);
+        session->putint(session, INTER_OPTIONS, options, true);
+        if ((options & Q_SESS_COOKIE) != 0) {
+            session->putint(session, INTER_FILESTORE, 1, true);
+            _set_request(session, request);
+        }
 
         // set timeout interval
         qcgisess_settimeout(session, session->getint(session, INTER_INTERVAL_SEC));
     }
 
-    free(sessionkey);
+    Q_TRACE2(session__load, sessionkey, new_session);
+    Q_FREE(sessionkey);
 
     // set globals
     return session;
@@ -250,33 +428,13 @@ time_t qcgisess_getcreated(qentry_t *session)
  */
 bool qcgisess_save(qentry_t *session)
 {
-    const char *sessionkey = session->getstr(session, INTER_SESSIONID, false);
-    const char *session_repository_path = session->getstr(session, INTER_SESSION_REPO, false);
-    int session_timeout_interval = session->getint(session, INTER_INTERVAL_SEC);
-    if (sessionkey == NULL || session_repository_path == NULL) return false;
+    if (session == NULL) return false;
 
-    char session_storage_path[PATH_MAX];
-    char session_timeout_path[PATH_MAX];
-    snprintf(session_storage_path, sizeof(session_storage_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_STORAGE_EXTENSION);
-    snprintf(session_timeout_path, sizeof(session_timeout_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_TIMEOUT_EXTENSION);
-
-    if (session->save(session, session_storage_path) == false) {
-        DEBUG("Can't save session file %s", session_storage_path);
-        return false;
-    }
-    if (_update_timeout(session_timeout_path, session_timeout_interval) == false) {
-        DEBUG("Can't update file %s", session_timeout_path);
-        return false;
-    }
-
-    _clear_repo(session_repository_path);
-    return true;
+    int options = session->getint(session, INTER_OPTIONS);
+    bool saved = ((options & Q_SESS_COOKIE) != 0) ? _cookie_save(session)
+                                                  : _file_save(session);
+    Q_TRACE2(session__save, session->getstr(session, INTER_SESSIONID, false), saved);
+    return saved;
 }
 
 /**
@@ -299,19 +457,26 @@ bool qcgisess_destroy(qentry_t *session)
         return false;
     }
 
+    int options = session->getint(session, INTER_OPTIONS);
+    if ((options & Q_SESS_COOKIE) != 0) {
+        qentry_t *request = _get_request(session);
+        if (request != NULL && request->getstr(request, SESSION_DATA, false) != NULL) {
+            qcgires_removecookie(request, SESSION_DATA, "/", NULL, false);
+        }
+    }
+
     char session_storage_path[PATH_MAX];
     char session_timeout_path[PATH_MAX];
-    snprintf(session_storage_path, sizeof(session_storage_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_STORAGE_EXTENSION);
-    snprintf(session_timeout_path, sizeof(session_timeout_path),
-             "%s/%s%s%s",
-             session_repository_path,
-             SESSION_PREFIX, sessionkey, SESSION_TIMEOUT_EXTENSION);
+    _session_path(session_storage_path, sizeof(session_storage_path),
+                  session_repository_path, sessionkey,
+                  SESSION_STORAGE_EXTENSION, options);
+    _session_path(session_timeout_path, sizeof(session_timeout_path),
+                  session_repository_path, sessionkey,
+                  SESSION_TIMEOUT_EXTENSION, options);
 
     _q_unlink(session_storage_path);
     _q_unlink(session_timeout_path);
+    _cache_remove(session_storage_path);
 
     if (session != NULL) session->free(session);
     return true;
@@ -319,25 +484,230 @@ bool qcgisess_destroy(qentry_t *session)
 
 #ifndef _DOXYGEN_SKIP
 
-static bool _clear_repo(const char *session_repository_path)
+static bool _file_save(qentry_t *session)
+{
+    const char *sessionkey = session->getstr(session, INTER_SESSIONID, false);
+    const char *session_repository_path = session->getstr(session, INTER_SESSION_REPO, false);
+    int session_timeout_interval = session->getint(session, INTER_INTERVAL_SEC);
+    int options = session->getint(session, INTER_OPTIONS);
+    if (sessionkey == NULL || session_repository_path == NULL) return false;
+
+    char session_storage_path[PATH_MAX];
+    char session_timeout_path[PATH_MAX];
+    _session_path(session_storage_path, sizeof(session_storage_path),
+                  session_repository_path, sessionkey,
+                  SESSION_STORAGE_EXTENSION, options);
+    _session_path(session_timeout_path, sizeof(session_timeout_path),
+                  session_repository_path, sessionkey,
+                  SESSION_TIMEOUT_EXTENSION, options);
+
+    if ((options & Q_SESS_SHARDED) != 0 &&
+        _make_shard(session_repository_path, sessionkey) == false) {
+        DEBUG("Can't make shard directory for session %s", sessionkey);
+        return false;
+    }
+    struct stat st;
+    if (_save_atomic(session, session_storage_path, &st) == false) {
+        DEBUG("Can't save session file %s", session_storage_path);
+        return false;
+    }
+    if (_update_timeout(session_timeout_path, session_timeout_interval) == false) {
+        DEBUG("Can't update file %s", session_timeout_path);
+        return false;
+    }
+    _cache_store(session, session_storage_path, &st);
+
+    _clear_repo(session_repository_path, options);
+    return true;
+}
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Remove expired sessions in a range of shards of a sharded repository.
+ *
+ * @param dirpath   session repository path. NULL for the default repository.
+ * @param first     first shard number to sweep, 0 ~ 65535
+ * @param count     number of shards to sweep. 0 or less sweeps every shard
+ *                  from the first one.
+ *
+ * @return  the number of removed sessions, otherwise returns -1.
+ *
+ * @note
+ * qcgisess_save() already sweeps a few shards at a time, so this is only
+ * needed for periodic full clean-ups. Ranges don't overlap, so several
+ * processes can sweep disjoint ranges in parallel.
+ *
+ * @code
+ *   // 4 workers, each sweeps a quarter of the repository.
+ *   qcgisess_gc("/var/lib/sessions", worker * 16384, 16384);
+ * @endcode
+ */
+int qcgisess_gc(const char *dirpath, int first, int count)
+{
+    if (dirpath == NULL) dirpath = SESSION_DEFAULT_REPOSITORY;
+    if (first < 0 || first >= SESSION_SHARDS) return -1;
+    if (count <= 0 || first + count > SESSION_SHARDS) {
+        count = SESSION_SHARDS - first;
+    }
+
+    int removed = 0;
+    int shard;
+    for (shard = first; shard < first + count; shard++) {
+        char shardpath[PATH_MAX];
+        snprintf(shardpath, sizeof(shardpath), "%s/%02x/%02x",
+                 dirpath, shard >> 8, shard & 0xff);
+        int n = _clear_dir(shardpath);
+        if (n > 0) removed += n;
+    }
+
+    return removed;
+}
+
+#ifndef _DOXYGEN_SKIP
+
+typedef struct sesscache_s sesscache_t;
+struct sesscache_s {
+    char *filepath;         // storage path, the cache key
+    qentry_t *data;         // session data as stored in the file
+    size_t memsize;
+    ino_t ino;              // identity of the file when it was cached
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+
+    sesscache_t *hnext;     // hash chain
+    sesscache_t *prev;      // LRU list, most recently used first
+    sesscache_t *next;
+};
+
+static struct {
+    sesscache_t **buckets;
+    sesscache_t *head;
+    sesscache_t *tail;
+    qcgisess_cachestat_t stat;
+} _cache;
+
+#ifndef _WIN32
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CACHE_LOCK()    pthread_mutex_lock(&_cache_lock)
+#define CACHE_UNLOCK()  pthread_mutex_unlock(&_cache_lock)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+static void _cache_evict(sesscache_t *item);
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Enable per-process session cache.
+ *
+ * @param maxmem    memory limit of the cache in bytes. 0 disables the cache
+ *                  and releases every cached session.
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * Useful for persistent processes like FastCGI. qcgisess_init() serves a
+ * session from the cache when its storage file hasn't changed since it was
+ * cached, so a user coming back to the same process doesn't make it read and
+ * parse the file again. Least recently used sessions are dropped once the
+ * limit is reached.
+ *
+ * @code
+ *   qcgisess_setcache(16 * 1024 * 1024);
+ *   while (FCGI_Accept() >= 0) {
+ *     (...)
+ *     qentry_t *sess = qcgisess_init(req, NULL);
+ *   }
+ * @endcode
+ */
+bool qcgisess_setcache(size_t maxmem)
+{
+    CACHE_LOCK();
+    if (maxmem > 0 && _cache.buckets == NULL) {
+        _cache.buckets = (sesscache_t **)Q_CALLOC(SESSION_CACHE_BUCKETS,
+                                                sizeof(sesscache_t *));
+        if (_cache.buckets == NULL) {
+            CACHE_UNLOCK();
+            return false;
+        }
+    }
+    _cache.stat.maxmem = maxmem;
+
+    // shrink
+    while (_cache.tail != NULL && _cache.stat.memsize > _cache.stat.maxmem) {
+        _cache_evict(_cache.tail);
+    }
+    if (maxmem == 0 && _cache.buckets != NULL) {
+        Q_FREE(_cache.buckets);
+        _cache.buckets = NULL;
+    }
+    CACHE_UNLOCK();
+
+    return true;
+}
+
+/**
+ * Get session cache statistics.
+ *
+ * @param stat  a pointer of qcgisess_cachestat_t structure to be filled
+ *
+ * @return  true if successful, otherwise returns false
+ */
+bool qcgisess_getcachestat(qcgisess_cachestat_t *stat)
+{
+    if (stat == NULL) return false;
+
+    CACHE_LOCK();
+    *stat = _cache.stat;
+    CACHE_UNLOCK();
+
+    return true;
+}
+
+#ifndef _DOXYGEN_SKIP
+
+static bool _clear_repo(const char *session_repository_path, int options)
+{
+    if ((options & Q_SESS_SHARDED) == 0) {
+        return (_clear_dir(session_repository_path) >= 0);
+    }
+
+    // sweep next few shards, the cursor is shared by every process.
+    char cursorpath[PATH_MAX];
+    snprintf(cursorpath, sizeof(cursorpath), "%s/%s",
+             session_repository_path, SESSION_TIMETOCLEAR_FILENAME);
+    int cursor = _q_countread(cursorpath) % SESSION_SHARDS;
+    _q_countsave(cursorpath, (cursor + SESSION_GC_SHARDS_PER_SAVE) % SESSION_SHARDS);
+
+    return (qcgisess_gc(session_repository_path, cursor,
+                        SESSION_GC_SHARDS_PER_SAVE) >= 0);
+}
+
+// returns the number of removed sessions, -1 if the directory can't be read.
+static int _clear_dir(const char *dirpath)
 {
 #ifdef _WIN32
-    return false;
+    return -1;
 #else
     // clear old session data
     DIR *dp;
-    if ((dp = opendir(session_repository_path)) == NULL) {
-        DEBUG("Can't open session repository %s", session_repository_path);
-        return false;
+    if ((dp = opendir(dirpath)) == NULL) {
+        DEBUG("Can't open session repository %s", dirpath);
+        return -1;
     }
 
+    int removed = 0;
     struct dirent *dirp;
     while ((dirp = readdir(dp)) != NULL) {
         if (strstr(dirp->d_name, SESSION_PREFIX) &&
             strstr(dirp->d_name, SESSION_TIMEOUT_EXTENSION)) {
             char timeoutpath[PATH_MAX];
             snprintf(timeoutpath, sizeof(timeoutpath),
-                     "%s/%s", session_repository_path, dirp->d_name);
+                     "%s/%s", dirpath, dirp->d_name);
             if (_is_valid_session(timeoutpath) <= 0) { // expired
                 // remove timeout
                 _q_unlink(timeoutpath);
@@ -346,15 +716,61 @@ static bool _clear_repo(const char *session_repository_path)
                 timeoutpath[strlen(timeoutpath) - strlen(SESSION_TIMEOUT_EXTENSION)] = '\0';
                 strcat(timeoutpath, SESSION_STORAGE_EXTENSION);
                 _q_unlink(timeoutpath);
+                removed++;
             }
         }
     }
     closedir(dp);
 
-    return true;
+    Q_TRACE2(session__gc, dirpath, removed);
+    return removed;
 #endif
 }
 
+// FNV-1a hash of the session id, so the layout doesn't depend on the id format.
+static int _session_shard(const char *sessionkey)
+{
+    unsigned int hash = 2166136261U;
+    for (; *sessionkey != '\0'; sessionkey++) {
+        hash ^= (unsigned char)*sessionkey;
+        hash *= 16777619U;
+    }
+    return (int)(hash % SESSION_SHARDS);
+}
+
+static char *_session_path(char *buf, size_t size, const char *repository,
+                           const char *sessionkey, const char *extension,
+                           int options)
+{
+    if ((options & Q_SESS_SHARDED) != 0) {
+        int shard = _session_shard(sessionkey);
+        snprintf(buf, size, "%s/%02x/%02x/%s%s%s", repository,
+                 shard >> 8, shard & 0xff, SESSION_PREFIX, sessionkey, extension);
+    } else {
+        snprintf(buf, size, "%s/%s%s%s", repository,
+                 SESSION_PREFIX, sessionkey, extension);
+    }
+    return buf;
+}
+
+static bool _make_shard(const char *repository, const char *sessionkey)
+{
+    int shard = _session_shard(sessionkey);
+    char shardpath[PATH_MAX];
+    snprintf(shardpath, sizeof(shardpath), "%s/%02x/%02x",
+             repository, shard >> 8, shard & 0xff);
+    if (access(shardpath, W_OK|X_OK) == 0) return true;
+
+    // make upper level first, "repository/xx"
+    size_t len = strlen(shardpath);
+    shardpath[len - CONST_STRLEN("/xx")] = '\0';
+    if (_q_mkdir(shardpath, DEF_DIR_MODE) != 0 && errno != EEXIST) return false;
+    shardpath[len - CONST_STRLEN("/xx")] = '/';
+    if (_q_mkdir(shardpath, DEF_DIR_MODE) != 0 && errno != EEXIST) return false;
+
+    return true;
+}
+
 // session not found 0, session expired -1, session valid 1
 static int _is_valid_session(const char *filepath)
 {
@@ -381,31 +797,550 @@ static bool _update_timeout(const char *filepath, time_t timeout_interval)
     return true;
 }
 
+// 128 random bits in base32, 26 characters. Safe to call from any thread.
 static char *_genuniqid(void)
 {
-#ifdef _WIN32
-    unsigned int sec = time(NULL);
-    FILETIME ft;
-    GetSystemTimeAsFileTime(&ft);
-    unsigned int usec = ft.dwLowDateTime % 1000000;
+    unsigned char rnd[SESSION_ID_BYTES];
+    if (_q_randbytes(rnd, sizeof(rnd)) == false) {
+        DEBUG("Can't get random bytes.");
+        return NULL;
+    }
+
+    char *uniqid = (char *)Q_MALLOC((SESSION_ID_BYTES * 8 + 4) / 5 + 1);
+    if (uniqid == NULL) return NULL;
+    _q_base32encode(uniqid, rnd, sizeof(rnd));
+
+    return uniqid;
+}
+
+static bool _cookie_save(qentry_t *session)
+{
+    qentry_t *request = _get_request(session);
+    bool filestore = (session->getint(session, INTER_FILESTORE) == 1);
+
+    char *cookie = _cookie_encode(session);
+    if (cookie != NULL) {
+        bool ret = qcgires_setcookie(request, SESSION_DATA, cookie, 0, "/", NULL, false);
+        Q_FREE(cookie);
+        if (ret == false) return false;
+
+        if (filestore == true) { // moved out of the repository
+            const char *sessionkey = session->getstr(session, INTER_SESSIONID, false);
+            const char *repo = session->getstr(session, INTER_SESSION_REPO, false);
+            int options = session->getint(session, INTER_OPTIONS);
+            char path[PATH_MAX];
+            _session_path(path, sizeof(path), repo, sessionkey,
+                          SESSION_STORAGE_EXTENSION, options);
+            _q_unlink(path);
+            _cache_remove(path);
+            _session_path(path, sizeof(path), repo, sessionkey,
+                          SESSION_TIMEOUT_EXTENSION, options);
+            _q_unlink(path);
+
+            qcgires_removecookie(request, SESSION_ID, "/", NULL, false);
+            session->remove(session, INTER_FILESTORE);
+        }
+        return true;
+    }
+
+    // too big for a cookie, or no key. keep it in the repository.
+    if (filestore == false) {
+        const char *sessionkey = session->getstr(session, INTER_SESSIONID, false);
+        if (qcgires_setcookie(request, SESSION_ID, sessionkey, 0, "/", NULL, false) == false) {
+            return false;
+        }
+        if (request != NULL && request->getstr(request, SESSION_DATA, false) != NULL) {
+            qcgires_removecookie(request, SESSION_DATA, "/", NULL, false);
+        }
+        session->putint(session, INTER_FILESTORE, 1, true);
+    }
+
+    return _file_save(session);
+}
+
+static bool _is_cookie_excluded(const char *name)
+{
+    return (!strcmp(name, INTER_SESSION_REPO) || !strcmp(name, INTER_OPTIONS) ||
+            !strcmp(name, INTER_FILESTORE));
+}
+
+static size_t _varint_put(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+    do {
+        p[n++] = (unsigned char)((v & 0x7F) | ((v > 0x7F) ? 0x80 : 0));
+        v >>= 7;
+    } while (v > 0);
+    return n;
+}
+
+static bool _varint_get(const unsigned char **p, const unsigned char *end,
+                        uint64_t *v)
+{
+    int shift;
+    for (*v = 0, shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+#ifdef ENABLE_OPENSSL
+// out: nonce | ciphertext | tag
+static bool _cookie_encrypt(unsigned char *out, const unsigned char *plain,
+                            size_t size)
+{
+    if (_q_randbytes(out, SESSION_NONCE_LEN) == false) return false;
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) return false;
+
+    int len, ok;
+    ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, SESSION_NONCE_LEN, NULL) &&
+         EVP_EncryptInit_ex(ctx, NULL, NULL, _sesskey.enckey, out) &&
+         EVP_EncryptUpdate(ctx, out + SESSION_NONCE_LEN, &len, plain, (int)size) &&
+         EVP_EncryptFinal_ex(ctx, out + SESSION_NONCE_LEN + len, &len) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, SESSION_TAG_LEN,
+                             out + SESSION_NONCE_LEN + size);
+    EVP_CIPHER_CTX_free(ctx);
+
+    return (ok != 0);
+}
+
+static bool _cookie_decrypt(unsigned char *plain, const unsigned char *in,
+                            size_t size)
+{
+    if (size < SESSION_NONCE_LEN + SESSION_TAG_LEN) return false;
+    size_t ctsize = size - SESSION_NONCE_LEN - SESSION_TAG_LEN;
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) return false;
+
+    int len, ok;
+    ok = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, SESSION_NONCE_LEN, NULL) &&
+         EVP_DecryptInit_ex(ctx, NULL, NULL, _sesskey.enckey, in) &&
+         EVP_DecryptUpdate(ctx, plain, &len, in + SESSION_NONCE_LEN, (int)ctsize) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, SESSION_TAG_LEN,
+                             (void *)(in + SESSION_NONCE_LEN + ctsize)) &&
+         EVP_DecryptFinal_ex(ctx, plain + len, &len);
+    EVP_CIPHER_CTX_free(ctx);
+
+    return (ok != 0);
+}
+#endif
+
+/*
+ * Cookie value is "base64url(blob).base64url(HMAC-SHA256(blob))".
+ * blob is version, flags then the payload, which is AES-GCM encrypted
+ * (nonce | ciphertext | tag) when Q_SESS_ENCRYPT is set.
+ * payload is varint(expire) then varint(namelen) name varint(size) data
+ * for every session entry.
+ */
+static char *_cookie_encode(qentry_t *session)
+{
+    if (_sesskey.set == false) return NULL;
+
+    // measure
+    size_t plainsize = 10;
+    qentobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    while (session->getnext(session, &obj, NULL, false) == true) {
+        if (_is_cookie_excluded(obj.name)) continue;
+        plainsize += 10 + strlen(obj.name) + 10 + obj.size;
+    }
+    if (plainsize > SESSION_COOKIE_MAXLEN) return NULL;
+
+    unsigned char *plain = (unsigned char *)Q_MALLOC(plainsize);
+    size_t blobmax = 2 + SESSION_NONCE_LEN + plainsize + SESSION_TAG_LEN;
+    unsigned char *blob = (unsigned char *)Q_MALLOC(blobmax);
+    if (plain == NULL || blob == NULL) {
+        Q_FREE(plain);
+        Q_FREE(blob);
+        return NULL;
+    }
+
+    // serialize
+    time_t expire = time(NULL) + session->getint(session, INTER_INTERVAL_SEC);
+    size_t n = _varint_put(plain, (uint64_t)expire);
+    memset((void *)&obj, 0, sizeof(obj));
+    while (session->getnext(session, &obj, NULL, false) == true) {
+        if (_is_cookie_excluded(obj.name)) continue;
+        size_t namelen = strlen(obj.name);
+        n += _varint_put(plain + n, namelen);
+        memcpy(plain + n, obj.name, namelen);
+        n += namelen;
+        n += _varint_put(plain + n, obj.size);
+        memcpy(plain + n, obj.data, obj.size);
+        n += obj.size;
+    }
+
+    size_t bloblen = 2;
+    blob[0] = SESSION_COOKIE_VERSION;
+    blob[1] = 0;
+#ifdef ENABLE_OPENSSL
+    if ((session->getint(session, INTER_OPTIONS) & Q_SESS_ENCRYPT) != 0) {
+        blob[1] |= SESSION_COOKIE_ENCRYPTED;
+        if (_cookie_encrypt(blob + 2, plain, n) == false) {
+            Q_FREE(plain);
+            Q_FREE(blob);
+            return NULL;
+        }
+        bloblen += SESSION_NONCE_LEN + n + SESSION_TAG_LEN;
+    }
+#endif
+    if ((blob[1] & SESSION_COOKIE_ENCRYPTED) == 0) {
+        memcpy(blob + 2, plain, n);
+        bloblen += n;
+    }
+    memset(plain, 0, plainsize);
+    Q_FREE(plain);
+
+    unsigned char mac[SHA256_DIGEST_LEN];
+    _q_hmac_sha256(mac, _sesskey.mackey, sizeof(_sesskey.mackey), blob, bloblen);
+
+    size_t cookielen = ((bloblen + 2) / 3 * 4) + 1 + ((sizeof(mac) + 2) / 3 * 4);
+    char *cookie = NULL;
+    if (cookielen <= SESSION_COOKIE_MAXLEN) cookie = (char *)Q_MALLOC(cookielen + 1);
+    if (cookie != NULL) {
+        size_t len = _q_base64urlencode(cookie, blob, bloblen);
+        cookie[len++] = '.';
+        _q_base64urlencode(cookie + len, mac, sizeof(mac));
+    }
+    Q_FREE(blob);
+
+    return cookie;
+}
+
+static bool _cookie_load(qentry_t *session, qentry_t *request)
+{
+    if (_sesskey.set == false) return false;
+
+    const char *cookie = request->getstr(request, SESSION_DATA, false);
+    if (cookie == NULL) return false;
+    const char *dot = strrchr(cookie, '.');
+    if (dot == NULL || (dot - cookie) > SESSION_COOKIE_MAXLEN) return false;
+
+    unsigned char mac[SHA256_DIGEST_LEN + 3], expected[SHA256_DIGEST_LEN];
+    if (strlen(dot + 1) > (SHA256_DIGEST_LEN + 2) / 3 * 4 ||
+        _q_base64urldecode(mac, dot + 1, strlen(dot + 1)) != SHA256_DIGEST_LEN) {
+        return false;
+    }
+
+    size_t enclen = dot - cookie;
+    unsigned char *blob = (unsigned char *)Q_MALLOC(enclen * 3 / 4 + 1);
+    if (blob == NULL) return false;
+    ssize_t bloblen = _q_base64urldecode(blob, cookie, enclen);
+    if (bloblen < 2) {
+        Q_FREE(blob);
+        return false;
+    }
+
+    // verify
+    _q_hmac_sha256(expected, _sesskey.mackey, sizeof(_sesskey.mackey), blob, bloblen);
+    if (_q_memeq(mac, expected, SHA256_DIGEST_LEN) == false ||
+        blob[0] != SESSION_COOKIE_VERSION) {
+        DEBUG("Invalid session cookie.");
+        Q_FREE(blob);
+        return false;
+    }
+
+    const unsigned char *p = blob + 2;
+    const unsigned char *end = blob + bloblen;
+    unsigned char *plain = NULL;
+    if ((blob[1] & SESSION_COOKIE_ENCRYPTED) != 0) {
+#ifdef ENABLE_OPENSSL
+        plain = (unsigned char *)Q_MALLOC(bloblen);
+        if (plain == NULL || _cookie_decrypt(plain, p, end - p) == false) {
+            Q_FREE(plain);
+            Q_FREE(blob);
+            return false;
+        }
+        end = plain + ((end - p) - SESSION_NONCE_LEN - SESSION_TAG_LEN);
+        p = plain;
 #else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    unsigned int sec = tv.tv_sec;
-    unsigned int usec = tv.tv_usec;
+        Q_FREE(blob);
+        return false;
 #endif
-    unsigned int port = 0;
-    const char *remote_port = getenv("REMOTE_PORT");
-    if (remote_port != NULL) {
-        port = atoi(remote_port);
     }
 
-    char *uniqid = (char *)malloc(5+5+4+4+1);
-    if (snprintf(uniqid, 5+5+4+4+1, "%05x%05x%04x%04x",
-                 usec%0x100000, sec%0x100000, getpid()%0x10000, port%0x10000)
-        >= 5+5+4+4+1) uniqid[5+5+4+4] = '\0';;
+    // deserialize
+    bool ok = false;
+    uint64_t expire;
+    if (_varint_get(&p, end, &expire) == true && (time_t)expire >= time(NULL)) {
+        ok = true;
+        while (p < end) {
+            uint64_t namelen, size;
+            if (_varint_get(&p, end, &namelen) == false || namelen == 0 ||
+                namelen > (uint64_t)(end - p) || namelen >= MAX_LINEBUF) {
+                ok = false;
+                break;
+            }
+            char name[MAX_LINEBUF];
+            memcpy(name, p, namelen);
+            name[namelen] = '\0';
+            p += namelen;
+            if (_varint_get(&p, end, &size) == false || size > (uint64_t)(end - p)) {
+                ok = false;
+                break;
+            }
+            session->put(session, name, p, size, false);
+            p += size;
+        }
+    }
+    if (ok == true && _is_valid_sessionkey(qcgisess_getid(session)) == false) {
+        ok = false;
+    }
 
-    return uniqid;
+    if (plain != NULL) {
+        memset(plain, 0, bloblen);
+        Q_FREE(plain);
+    }
+    Q_FREE(blob);
+
+    if (ok == false) session->truncate(session);
+    return ok;
+}
+
+// the request reference is only meaningful in this process, it's kept in
+// the private table of the session which is never stored nor sent.
+static void _set_request(qentry_t *session, qentry_t *request)
+{
+    qentry_t *meta = _q_entry_meta(session, true);
+    if (meta != NULL) meta->put(meta, "REQUEST", &request, sizeof(request), true);
+}
+
+static qentry_t *_get_request(qentry_t *session)
+{
+    qentry_t *meta = _q_entry_meta(session, false);
+    if (meta == NULL) return NULL;
+
+    size_t size = 0;
+    qentry_t **ref = (qentry_t **)meta->get(meta, "REQUEST", &size, false);
+    return (ref != NULL && size == sizeof(*ref)) ? *ref : NULL;
+}
+
+// write to a temporary file then rename, readers never see a partial file
+// and every save gets a new inode which the cache relies on. st is filled
+// with the identity of the written file, zeroed if it's unknown.
+static bool _save_atomic(qentry_t *session, const char *filepath,
+                         struct stat *st)
+{
+    memset((void *)st, 0, sizeof(struct stat));
+
+    unsigned char rnd[5];
+    char suffix[8+1];
+    if (_q_randbytes(rnd, sizeof(rnd)) == false) return false;
+    _q_base32encode(suffix, rnd, sizeof(rnd));
+
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.%s", filepath, suffix);
+    bool saved;
+    if ((session->getint(session, INTER_OPTIONS) & Q_SESS_BINARY) != 0) {
+        saved = session->savebin(session, tmppath);
+    } else {
+        saved = session->save(session, tmppath);
+    }
+    if (saved == false) {
+        _q_unlink(tmppath);
+        return false;
+    }
+    // nobody else knows the temporary name yet and rename() keeps the inode
+    if (stat(tmppath, st) != 0) memset((void *)st, 0, sizeof(struct stat));
+#ifdef _WIN32
+    _q_unlink(filepath);
+#endif
+    if (rename(tmppath, filepath) != 0) {
+        _q_unlink(tmppath);
+        return false;
+    }
+
+    return true;
+}
+
+static unsigned int _cache_hash(const char *filepath)
+{
+    unsigned int hash = 2166136261U;
+    for (; *filepath != '\0'; filepath++) {
+        hash ^= (unsigned char)*filepath;
+        hash *= 16777619U;
+    }
+    return hash % SESSION_CACHE_BUCKETS;
+}
+
+// must be called with lock held.
+static sesscache_t *_cache_find(const char *filepath)
+{
+    sesscache_t *item;
+    for (item = _cache.buckets[_cache_hash(filepath)]; item; item = item->hnext) {
+        if (!strcmp(item->filepath, filepath)) return item;
+    }
+    return NULL;
+}
+
+// must be called with lock held.
+static void _cache_unlink_lru(sesscache_t *item)
+{
+    if (item->prev != NULL) item->prev->next = item->next;
+    else _cache.head = item->next;
+    if (item->next != NULL) item->next->prev = item->prev;
+    else _cache.tail = item->prev;
+    item->prev = item->next = NULL;
+}
+
+// must be called with lock held.
+static void _cache_evict(sesscache_t *item)
+{
+    sesscache_t **pp;
+    for (pp = &_cache.buckets[_cache_hash(item->filepath)]; *pp; pp = &(*pp)->hnext) {
+        if (*pp == item) {
+            *pp = item->hnext;
+            break;
+        }
+    }
+    _cache_unlink_lru(item);
+
+    _cache.stat.items--;
+    _cache.stat.memsize -= item->memsize;
+    item->data->free(item->data);
+    Q_FREE(item->filepath);
+    Q_FREE(item);
+}
+
+static bool _cache_enabled(void)
+{
+    CACHE_LOCK();
+    bool enabled = (_cache.buckets != NULL);
+    CACHE_UNLOCK();
+    return enabled;
+}
+
+// st is filled with the identity of the file taken before it's read, so a
+// change in between is caught by the next lookup. zeroed if it's unknown.
+static bool _cache_load(qentry_t *session, const char *filepath,
+                        struct stat *st)
+{
+    memset((void *)st, 0, sizeof(struct stat));
+    if (_cache_enabled() == false) return false;
+
+    bool found = (stat(filepath, st) == 0);
+    if (found == false) memset((void *)st, 0, sizeof(struct stat));
+
+    CACHE_LOCK();
+    sesscache_t *item = (_cache.buckets != NULL) ? _cache_find(filepath) : NULL;
+    if (item != NULL && (found == false ||
+                         item->ino != st->st_ino || item->size != st->st_size ||
+                         item->mtime != st->st_mtime ||
+                         item->mtime_nsec != Q_STAT_MTIME_NSEC(*st))) {
+        // changed by other process
+        _cache_evict(item);
+        item = NULL;
+    }
+    if (item == NULL) {
+        _cache.stat.misses++;
+        CACHE_UNLOCK();
+        return false;
+    }
+
+    // move to the front
+    _cache_unlink_lru(item);
+    item->next = _cache.head;
+    if (_cache.head != NULL) _cache.head->prev = item;
+    _cache.head = item;
+    if (_cache.tail == NULL) _cache.tail = item;
+
+    qentobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    while (item->data->getnext(item->data, &obj, NULL, false) == true) {
+        session->put(session, obj.name, obj.data, obj.size, false);
+    }
+    _cache.stat.hits++;
+    CACHE_UNLOCK();
+
+    return true;
+}
+
+static void _cache_store(qentry_t *session, const char *filepath,
+                         const struct stat *st)
+{
+    if (st->st_nlink == 0) return; // unknown identity
+    if (_cache_enabled() == false) return;
+
+    // copy outside of the lock
+    sesscache_t *item = (sesscache_t *)Q_CALLOC(1, sizeof(sesscache_t));
+    if (item == NULL) return;
+    item->filepath = Q_STRDUP(filepath);
+    item->data = qEntry();
+    if (item->filepath == NULL || item->data == NULL) {
+        if (item->data != NULL) item->data->free(item->data);
+        Q_FREE(item->filepath);
+        Q_FREE(item);
+        return;
+    }
+    item->memsize = sizeof(sesscache_t) + sizeof(qentry_t) + strlen(filepath) + 1;
+
+    qentobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    while (session->getnext(session, &obj, NULL, false) == true) {
+        item->data->put(item->data, obj.name, obj.data, obj.size, false);
+        item->memsize += sizeof(qentobj_t) + strlen(obj.name) + 1 + obj.size;
+    }
+    item->ino = st->st_ino;
+    item->size = st->st_size;
+    item->mtime = st->st_mtime;
+    item->mtime_nsec = Q_STAT_MTIME_NSEC(*st);
+
+    CACHE_LOCK();
+    if (_cache.buckets == NULL || item->memsize > _cache.stat.maxmem) {
+        CACHE_UNLOCK();
+        item->data->free(item->data);
+        Q_FREE(item->filepath);
+        Q_FREE(item);
+        return;
+    }
+
+    sesscache_t *old = _cache_find(filepath);
+    if (old != NULL) _cache_evict(old);
+    while (_cache.tail != NULL &&
+           _cache.stat.memsize + item->memsize > _cache.stat.maxmem) {
+        _cache_evict(_cache.tail);
+    }
+
+    unsigned int hash = _cache_hash(filepath);
+    item->hnext = _cache.buckets[hash];
+    _cache.buckets[hash] = item;
+    item->next = _cache.head;
+    if (_cache.head != NULL) _cache.head->prev = item;
+    _cache.head = item;
+    if (_cache.tail == NULL) _cache.tail = item;
+
+    _cache.stat.items++;
+    _cache.stat.memsize += item->memsize;
+    CACHE_UNLOCK();
+}
+
+static void _cache_remove(const char *filepath)
+{
+    CACHE_LOCK();
+    sesscache_t *item = (_cache.buckets != NULL) ? _cache_find(filepath) : NULL;
+    if (item != NULL) _cache_evict(item);
+    CACHE_UNLOCK();
+}
+
+// session id comes from the client and becomes a part of file path.
+static bool _is_valid_sessionkey(const char *sessionkey)
+{
+    if (sessionkey == NULL) return false;
+
+    size_t len;
+    for (len = 0; sessionkey[len] != '\0'; len++) {
+        char c = sessionkey[len];
+        if (len >= SESSION_ID_MAXLEN) return false;
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))) return false;
+    }
+    return (len > 0);
 }
 
 #endif /* _DOXYGEN_SKIP */
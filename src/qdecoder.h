@@ -44,7 +44,9 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/types.h>
 
 /*
  * Types and definitions
@@ -52,6 +54,22 @@ extern "C" {
 
 typedef struct qentry_s qentry_t;
 typedef struct qentobj_s qentobj_t;
+typedef struct qcgireq_stat_s qcgireq_stat_t;
+typedef struct qcgireq_limit_s qcgireq_limit_t;
+typedef struct qcgireq_parser_s qcgireq_parser_t;
+typedef struct qcgisess_cachestat_s qcgisess_cachestat_t;
+typedef struct qdecoder_allocator_s qdecoder_allocator_t;
+typedef struct qdecoder_allocstat_s qdecoder_allocstat_t;
+typedef struct qfcgi_s qfcgi_t;
+typedef struct qscgi_s qscgi_t;
+typedef struct qhttpd_s qhttpd_t;
+typedef struct qcgictx_s qcgictx_t;
+typedef struct qfcgireq_s qfcgireq_t;
+typedef struct qfcgi_scoreboard_s qfcgi_scoreboard_t;
+typedef struct qfcgi_scoreslot_s qfcgi_scoreslot_t;
+typedef void (*qfcgi_handler_t)(qcgictx_t *ctx, void *arg);
+typedef void (*qfcgi_worker_t)(qfcgi_t *fcgi, void *arg);
+typedef void (*qfcgireq_cb_t)(qfcgireq_t *req, void *arg);
 
 typedef enum {
     Q_CGI_ALL    = 0,
@@ -60,6 +78,70 @@ typedef enum {
     Q_CGI_GET    = 0x04
 } Q_CGI_T;
 
+typedef enum {
+    Q_CGIREQ_OK = 0,    /*!< no limit exceeded */
+    Q_CGIREQ_EBODY,     /*!< body larger than maxbody */
+    Q_CGIREQ_EFIELDS,   /*!< more variables than maxfields */
+    Q_CGIREQ_ENAME,     /*!< a name longer than maxname */
+    Q_CGIREQ_EVALUE,    /*!< a value longer than maxvalue */
+    Q_CGIREQ_EPARTS,    /*!< more multipart parts than maxparts */
+    Q_CGIREQ_EFILE,     /*!< an uploaded file larger than maxfile */
+    Q_CGIREQ_EUPLOAD    /*!< uploaded files larger than maxupload */
+} Q_CGIREQ_ERR_T;
+
+typedef enum {
+    Q_SESS_DEFAULT = 0,
+    Q_SESS_SHARDED = 0x01,
+    Q_SESS_COOKIE  = 0x02,
+    Q_SESS_ENCRYPT = 0x04,
+    Q_SESS_BINARY  = 0x08
+} Q_SESS_T;
+
+typedef enum {
+    Q_FCGI_DEFAULT = 0,
+    Q_FCGI_PINCPU  = 0x01
+} Q_FCGI_T;
+
+typedef enum {
+    Q_FCGIREQ_READ  = 0x01,
+    Q_FCGIREQ_EOF   = 0x02,
+    Q_FCGIREQ_DRAIN = 0x04
+} Q_FCGIREQ_T;
+
+typedef enum {
+    Q_SCORE_FREE = 0,   /*!< slot not in use */
+    Q_SCORE_IDLE,       /*!< waiting for a request */
+    Q_SCORE_BUSY,       /*!< serving a request */
+    Q_SCORE_LOOP        /*!< event loop, serving active requests */
+} Q_SCORE_T;
+
+/*
+ * qalloc.c
+ */
+extern bool qdecoder_set_allocator(const qdecoder_allocator_t *allocator);
+extern bool qdecoder_get_allocstats(qdecoder_allocstat_t *stat);
+extern void qdecoder_reset_allocstats(void);
+extern void qdecoder_free(void *ptr);
+
+/* memory allocator */
+struct qdecoder_allocator_s {
+    void *(*malloc)(size_t size, void *userdata);
+    void *(*realloc)(void *ptr, size_t size, void *userdata);
+    void (*free)(void *ptr, void *userdata);
+    void *userdata;     /*!< passed to the functions as is */
+    bool stats;         /*!< keep allocation statistics */
+};
+
+/* allocation statistics */
+struct qdecoder_allocstat_s {
+    size_t count;       /*!< number of allocations */
+    size_t bytes;       /*!< bytes allocated in total */
+    size_t inuse;       /*!< bytes allocated and not freed yet */
+    size_t peak;        /*!< highest inuse */
+    size_t threadcount; /*!< number of allocations of the calling thread */
+    size_t threadbytes; /*!< bytes allocated by the calling thread */
+};
+
 /*
  * qcgireq.c
  */
@@ -67,6 +149,63 @@ extern qentry_t *qcgireq_setoption(qentry_t *request, bool filemode,
                                    const char *basepath, int clearold);
 extern qentry_t *qcgireq_parse(qentry_t *request, Q_CGI_T method);
 extern char *qcgireq_getquery(Q_CGI_T method);
+extern qentry_t *qcgireq_parse_ctx(qcgictx_t *ctx, qentry_t *request,
+                                   Q_CGI_T method);
+extern char *qcgireq_getquery_ctx(qcgictx_t *ctx, Q_CGI_T method);
+extern qentry_t *qcgireq_parse_query(qentry_t *request, const char *query,
+                                     Q_CGI_T method);
+extern qentry_t *qcgireq_parse_body(qentry_t *request, const char *contenttype,
+                                    const void *body, size_t size);
+extern qentry_t *qcgireq_parse_fd(qentry_t *request, const char *contenttype,
+                                  int fd, ssize_t size);
+extern qcgireq_parser_t *qcgireq_parser_new(qentry_t *request);
+extern bool qcgireq_parser_push(qcgireq_parser_t *parser, const void *data,
+                                size_t size);
+extern qentry_t *qcgireq_parser_end(qcgireq_parser_t *parser);
+extern qcgictx_t *qcgireq_getctx(qentry_t *request);
+extern const char *qcgireq_getenv(qentry_t *request, const char *name);
+extern bool qcgireq_setcapture(const char *filepath);
+extern qentry_t *qcgireq_setstats(qentry_t *request, bool enable);
+extern bool qcgireq_getstats(qentry_t *request, qcgireq_stat_t *stat);
+extern bool qcgireq_logstats(qentry_t *request, FILE *fp);
+extern qentry_t *qcgireq_setlimits(qentry_t *request,
+                                   const qcgireq_limit_t *limits);
+extern Q_CGIREQ_ERR_T qcgireq_geterror(qentry_t *request);
+extern qentry_t *qcgireq_setlazy(qentry_t *request, bool enable);
+
+/* request context */
+struct qcgictx_s {
+    qentry_t *params;   /*!< CGI variables, NULL for the process environment */
+    FILE *in;           /*!< request body, NULL for stdin */
+    FILE *out;          /*!< response output, NULL for stdout */
+};
+
+/* request parsing statistics */
+struct qcgireq_stat_s {
+    size_t bodysize;    /*!< bytes read from the request body */
+    size_t cookies;     /*!< number of fields from COOKIE */
+    size_t posts;       /*!< number of fields from POST */
+    size_t gets;        /*!< number of fields from GET */
+    size_t parts;       /*!< number of multipart values */
+    size_t partsize;    /*!< bytes of multipart values in total */
+    size_t maxpart;     /*!< bytes of the largest multipart value */
+    size_t disksize;    /*!< bytes of uploaded files written to disk */
+    long parsetime;     /*!< microseconds spent parsing, disk writes excluded */
+    long disktime;      /*!< microseconds spent writing uploaded files */
+    size_t allocs;      /*!< number of allocations while parsing */
+    size_t allocsize;   /*!< bytes allocated while parsing */
+};
+
+/* request limits, 0 for no limit */
+struct qcgireq_limit_s {
+    size_t maxbody;     /*!< bytes of a request body, by CONTENT_LENGTH */
+    size_t maxfields;   /*!< number of variables */
+    size_t maxname;     /*!< bytes of a variable name */
+    size_t maxvalue;    /*!< bytes of a variable value, uploads excluded */
+    size_t maxparts;    /*!< number of multipart parts */
+    size_t maxfile;     /*!< bytes of an uploaded file */
+    size_t maxupload;   /*!< bytes of uploaded files in total */
+};
 
 /*
  * qcgires.c
@@ -84,16 +223,123 @@ extern bool qcgires_redirect(qentry_t *request, const char *uri);
 extern int qcgires_download(qentry_t *request, const char *filepath,
                             const char *mimetype);
 extern void qcgires_error(qentry_t *request, char *format, ...);
+extern bool qcgires_senderror(qentry_t *request, int status,
+                              const char *format, ...);
+extern bool qcgires_seterrortemplate(const char *html);
 
 /*
  * qcgisess.c
  */
+extern bool qcgisess_setoption(qentry_t *request, Q_SESS_T options);
+extern bool qcgisess_setkey(const void *key, size_t keylen);
 extern qentry_t  *qcgisess_init(qentry_t *request, const char *dirpath);
 extern bool qcgisess_settimeout(qentry_t *session, time_t seconds);
 extern const char *qcgisess_getid(qentry_t *session);
 extern time_t qcgisess_getcreated(qentry_t *session);
 extern bool qcgisess_save(qentry_t *session);
 extern bool qcgisess_destroy(qentry_t *session);
+extern int qcgisess_gc(const char *dirpath, int first, int count);
+extern bool qcgisess_setcache(size_t maxmem);
+extern bool qcgisess_getcachestat(qcgisess_cachestat_t *stat);
+
+/*
+ * qfcgi.c
+ */
+extern qfcgi_t *qfcgi_listen(const char *addr, int backlog);
+extern bool qfcgi_accept(qfcgi_t *fcgi);
+extern bool qfcgi_finish(qfcgi_t *fcgi);
+extern qentry_t *qfcgi_getparams(qfcgi_t *fcgi);
+extern qcgictx_t *qfcgi_getctx(qfcgi_t *fcgi);
+extern bool qfcgi_serve(qfcgi_t *fcgi, int nthreads, qfcgi_handler_t handler,
+                        void *arg);
+extern bool qfcgi_loop(qfcgi_t *fcgi, int maxconns, qfcgi_handler_t handler,
+                       void *arg);
+extern bool qfcgi_loop_async(qfcgi_t *fcgi, int maxconns, qfcgireq_cb_t start,
+                             void *arg);
+extern void qfcgi_stop(qfcgi_t *fcgi);
+extern bool qfcgi_setlimits(qfcgi_t *fcgi, long maxrequests, size_t maxrss);
+extern bool qfcgi_prefork(qfcgi_t *fcgi, int nworkers, Q_FCGI_T options,
+                          qfcgi_worker_t worker, void *arg);
+extern bool qfcgi_setscoreboard(qfcgi_t *fcgi, const char *filepath,
+                                int nslots);
+extern void qfcgi_free(qfcgi_t *fcgi);
+
+extern qentry_t *qfcgireq_getparams(qfcgireq_t *req);
+extern qcgictx_t *qfcgireq_getctx(qfcgireq_t *req);
+extern size_t qfcgireq_read(qfcgireq_t *req, void *buf, size_t size);
+extern bool qfcgireq_eof(qfcgireq_t *req);
+extern bool qfcgireq_aborted(qfcgireq_t *req);
+extern size_t qfcgireq_pending(qfcgireq_t *req);
+extern bool qfcgireq_wait(qfcgireq_t *req, Q_FCGIREQ_T events,
+                          qfcgireq_cb_t cb, void *arg);
+extern bool qfcgireq_end(qfcgireq_t *req);
+
+/*
+ * qscgi.c
+ */
+extern qscgi_t *qscgi_listen(const char *addr, int backlog);
+extern bool qscgi_accept(qscgi_t *scgi);
+extern bool qscgi_finish(qscgi_t *scgi);
+extern qentry_t *qscgi_getparams(qscgi_t *scgi);
+extern qcgictx_t *qscgi_getctx(qscgi_t *scgi);
+extern void qscgi_free(qscgi_t *scgi);
+
+/*
+ * qhttpd.c
+ */
+extern qhttpd_t *qhttpd_listen(const char *addr, int backlog);
+extern bool qhttpd_accept(qhttpd_t *httpd);
+extern bool qhttpd_finish(qhttpd_t *httpd);
+extern qentry_t *qhttpd_getparams(qhttpd_t *httpd);
+extern qcgictx_t *qhttpd_getctx(qhttpd_t *httpd);
+extern void qhttpd_free(qhttpd_t *httpd);
+
+/* scoreboard file of qfcgi_setscoreboard(), the header is followed by
+ * nslots of qfcgi_scoreslot_t */
+#define Q_SCORE_MAGIC       "QSCB"
+#define Q_SCORE_VERSION     (1)
+#define Q_SCORE_BUCKETS     (16)
+#define Q_SCORE_URILEN      (128)
+
+struct qfcgi_scoreboard_s {
+    char magic[4];          /*!< Q_SCORE_MAGIC */
+    uint32_t version;       /*!< Q_SCORE_VERSION */
+    uint32_t nslots;        /*!< number of slots */
+    uint32_t slotsize;      /*!< sizeof(qfcgi_scoreslot_t) */
+    int64_t created;        /*!< time() of creation */
+    char reserved[40];
+};
+
+/* scoreboard slot of a worker process or thread */
+struct qfcgi_scoreslot_s {
+    uint32_t pid;           /*!< owner process, 0 when free */
+    uint32_t thread;        /*!< worker thread of qfcgi_serve(), 1 and up */
+    uint32_t state;         /*!< Q_SCORE_T */
+    uint32_t seq;           /*!< odd while the request fields change */
+    int64_t since;          /*!< time of the state or the last request in ms */
+    uint32_t active;        /*!< requests in progress */
+    uint32_t reserved1;
+    uint64_t requests;      /*!< requests served */
+    uint64_t errors;        /*!< requests aborted or failed to respond */
+    uint64_t bytesin;       /*!< bytes received from the web server */
+    uint64_t bytesout;      /*!< bytes sent to the web server */
+    uint64_t latency;       /*!< microseconds of the requests in total */
+    uint64_t histogram[Q_SCORE_BUCKETS]; /*!< requests by latency, bucket n
+                                              under 2^n ms, the last one
+                                              the rest */
+    char method[8];         /*!< of the last request */
+    char uri[Q_SCORE_URILEN];
+    char reserved2[48];
+};
+
+/* session cache statistics */
+struct qcgisess_cachestat_s {
+    size_t hits;        /*!< number of sessions served from the cache */
+    size_t misses;      /*!< number of sessions read from the repository */
+    size_t items;       /*!< number of cached sessions */
+    size_t memsize;     /*!< memory used by cached sessions */
+    size_t maxmem;      /*!< memory limit, 0 when the cache is disabled */
+};
 
 /*
  * qentry.c - Linked-List Table
@@ -146,6 +392,11 @@ struct qentry_s {
     int num;            /*!< number of objects */
     qentobj_t *first;   /*!< first object pointer */
     qentobj_t *last;    /*!< last object pointer */
+
+    /* appended to keep the layout of the members above */
+    bool (*savebin) (qentry_t *entry, const char *filepath);
+    int (*loadbin) (qentry_t *entry, const char *filepath);
+    int (*loadmmap) (qentry_t *entry, const char *filepath);
 };
 
 /* qentry object */
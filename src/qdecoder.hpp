@@ -0,0 +1,233 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * qDecoder C++20 coroutine handlers for the FastCGI event loop.
+ *
+ * A request handler is written as a coroutine which suspends, instead of
+ * blocking, while the body is on its way or the output is being sent.
+ * Each suspended request costs its coroutine frame, so thousands of slow
+ * uploads are served by the one thread of qfcgi_loop_async().
+ *
+ * @code
+ *   #include "qdecoder.hpp"
+ *
+ *   static qdecoder::task handler(qdecoder::request req) {
+ *     qentry_t *form = co_await req.form();
+ *     if (form == NULL) co_return;  // aborted
+ *
+ *     qcgires_setcontenttype(form, "text/plain");
+ *     fprintf(req.ctx()->out, "Hello %s", form->getstr(form, "name", false));
+ *     co_await req.drain();
+ *     form->free(form);
+ *   }  // the request ends with the coroutine
+ *
+ *   qfcgi_t *fcgi = qfcgi_listen("unix:/var/run/app.sock", 0);
+ *   qdecoder::loop(fcgi, 0, handler);  // until qfcgi_stop()
+ *   qfcgi_free(fcgi);
+ * @endcode
+ *
+ * @note
+ * Requires a C++20 compiler with <coroutine>, otherwise only qdecoder.h is
+ * included. Coroutines resume on the loop thread and must not block.
+ *
+ * @file qdecoder.hpp
+ */
+
+#ifndef _QDECODER_HPP
+#define _QDECODER_HPP
+
+#include "qdecoder.h"
+
+#if defined(__cplusplus) && __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define _Q_COROUTINE
+#endif
+#endif
+
+#ifdef _Q_COROUTINE
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace qdecoder {
+
+/**
+ * Coroutine type of request handlers. Starts right away and frees itself
+ * when finished, the loop doesn't wait for it.
+ */
+class task {
+public:
+    struct promise_type {
+        task get_return_object() noexcept { return task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * A request of qfcgi_loop_async(), ended by the destructor.
+ */
+class request {
+public:
+    explicit request(qfcgireq_t *req) noexcept : req_(req) {}
+    request(request &&other) noexcept : req_(std::exchange(other.req_, nullptr)) {}
+    request &operator=(request &&other) noexcept {
+        if (this != &other) {
+            end();
+            req_ = std::exchange(other.req_, nullptr);
+        }
+        return *this;
+    }
+    request(const request &) = delete;
+    request &operator=(const request &) = delete;
+    ~request() { end(); }
+
+    qfcgireq_t *get() const noexcept { return req_; }
+    qentry_t *params() const noexcept { return qfcgireq_getparams(req_); }
+    qcgictx_t *ctx() const noexcept { return qfcgireq_getctx(req_); }
+    bool aborted() const noexcept { return qfcgireq_aborted(req_); }
+
+    /** Finish the response now, instead of at the end of the coroutine. */
+    bool end() noexcept {
+        if (req_ == nullptr) return false;
+        return qfcgireq_end(std::exchange(req_, nullptr));
+    }
+
+    /**
+     * Await the next part of the body, as the web server sends it.
+     * Resumes with the number of bytes read, 0 at the end of the body or
+     * when aborted. These are raw bytes, a multipart body is not split into
+     * its parts here; await form() for them.
+     */
+    auto read(void *buf, size_t size) noexcept {
+        struct awaiter {
+            qfcgireq_t *req;
+            void *buf;
+            size_t size;
+            size_t n;
+
+            bool await_ready() noexcept { return fill(); }
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                qfcgireq_wait(req, Q_FCGIREQ_READ, _resume, h.address());
+            }
+            size_t await_resume() noexcept {
+                if (n == 0) fill();
+                return n;
+            }
+            bool fill() noexcept {
+                n = qfcgireq_read(req, buf, size);
+                return (n > 0 || qfcgireq_eof(req) || qfcgireq_aborted(req));
+            }
+        };
+        return awaiter{req_, buf, size, 0};
+    }
+
+    /**
+     * Await the whole body and parse the request like qcgireq_parse().
+     * Resumes with a new list of variables, NULL when aborted. The body
+     * beyond 256KB waits in a temporary file, and the limits set by
+     * qcgireq_setlimits() apply when it is parsed.
+     */
+    auto form(Q_CGI_T method = Q_CGI_ALL) noexcept {
+        struct awaiter {
+            qfcgireq_t *req;
+            Q_CGI_T method;
+
+            bool await_ready() noexcept {
+                return (qfcgireq_eof(req) || qfcgireq_aborted(req));
+            }
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                qfcgireq_wait(req, Q_FCGIREQ_EOF, _resume, h.address());
+            }
+            qentry_t *await_resume() noexcept {
+                qcgictx_t *ctx = qfcgireq_getctx(req);
+                if (qfcgireq_aborted(req) || ctx == NULL) return NULL;
+                return qcgireq_parse_ctx(ctx, NULL, method);
+            }
+        };
+        return awaiter{req_, method};
+    }
+
+    /**
+     * Await the output written so far to be sent to the web server.
+     * Resumes with false when aborted.
+     */
+    auto drain() noexcept {
+        struct awaiter {
+            qfcgireq_t *req;
+
+            bool await_ready() noexcept {
+                return (qfcgireq_aborted(req) || qfcgireq_pending(req) == 0);
+            }
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                qfcgireq_wait(req, Q_FCGIREQ_DRAIN, _resume, h.address());
+            }
+            bool await_resume() noexcept { return !qfcgireq_aborted(req); }
+        };
+        return awaiter{req_};
+    }
+
+private:
+    static void _resume(qfcgireq_t *, void *arg) {
+        std::coroutine_handle<>::from_address(arg).resume();
+    }
+
+    qfcgireq_t *req_;
+};
+
+/**
+ * Serve FastCGI requests with qfcgi_loop_async(), calling the handler
+ * with each request. The handler is any callable taking a request,
+ * typically a coroutine returning task.
+ *
+ * @return  true when stopped by qfcgi_stop() or a recycling limit,
+ *          false on an error
+ */
+template <typename F>
+bool loop(qfcgi_t *fcgi, int maxconns, F &&handler)
+{
+    using H = std::decay_t<F>;  // a function becomes a function pointer
+    H fn(std::forward<F>(handler));
+    qfcgireq_cb_t start = [](qfcgireq_t *req, void *arg) {
+        (*static_cast<H *>(arg))(request(req));
+    };
+    return qfcgi_loop_async(fcgi, maxconns, start, (void *)std::addressof(fn));
+}
+
+}  // namespace qdecoder
+
+#endif /* _Q_COROUTINE */
+
+#endif /* _QDECODER_HPP */
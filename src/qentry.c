@@ -64,8 +64,13 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "qdecoder.h"
 #include "internal.h"
 
@@ -84,6 +89,49 @@
 #define _VAR_CMD    '!'
 #define _VAR_ENV    '%'
 
+#define _BIN_MAGIC      "QENT"
+#define _BIN_VERSION    (1)
+#define _BIN_CRC        (0x01)  // header flag, CRC-32 trailer present
+#define _BIN_HEADER_LEN (12)
+
+#ifndef O_BINARY
+#define O_BINARY    (0)
+#endif
+
+// qentobj_t flags
+#define _OBJ_BORROWED   (0x01)  // name and data live in a storage block
+#define _OBJ_ENCODED    (0x02)  // data is urlencoded, decoded on first access
+#define _OBJ_POOLED     (0x04)  // object itself lives in a storage block
+#define _OBJ_STRING     (0x08)  // size counts the terminating '\0'
+
+typedef struct qentblk_s qentblk_t;
+struct qentblk_s {
+    void *addr;
+    size_t size;
+    bool mapped;
+    qentblk_t *next;
+};
+
+// qentry_t with the storage state kept out of the public structure
+typedef struct {
+    qentry_t entry;         // must be the first member
+    qentblk_t *blocks;      // storage backing borrowed objects
+    qentry_t *meta;         // see _q_entry_meta()
+} qentpriv_t;
+
+// qentobj_t with its storage flags
+typedef struct {
+    qentobj_t obj;          // must be the first member
+    int flags;
+} qentpobj_t;
+
+#define _BLOCKS(e)      (((qentpriv_t *)(e))->blocks)
+#define _FLAGS(o)       (((qentpobj_t *)(o))->flags)
+
+static void _resolve(qentobj_t *obj);
+static void _freeobj(qentobj_t *obj);
+static void _freeblocks(qentry_t *entry);
+
 static bool _put(qentry_t *entry, const char *name, const void *data,
                  size_t size, bool replace);
 static bool _putstr(qentry_t *entry, const char *name, const char *str,
@@ -117,6 +165,9 @@ static bool _reverse(qentry_t *entry);
 
 static bool _save(qentry_t *entry, const char *filepath);
 static int _load(qentry_t *entry, const char *filepath);
+static bool _savebin(qentry_t *entry, const char *filepath);
+static int _loadbin(qentry_t *entry, const char *filepath);
+static int _loadmmap(qentry_t *entry, const char *filepath);
 
 static bool _print(qentry_t *entry, FILE *out, bool print_data);
 static bool _free(qentry_t *entry);
@@ -135,10 +186,10 @@ static bool _free(qentry_t *entry);
  */
 qentry_t *qEntry(void)
 {
-    qentry_t *entry = (qentry_t *)malloc(sizeof(qentry_t));
+    qentry_t *entry = (qentry_t *)Q_MALLOC(sizeof(qentpriv_t));
     if (entry == NULL) return NULL;
 
-    memset((void *)entry, 0, sizeof(qentry_t));
+    memset((void *)entry, 0, sizeof(qentpriv_t));
 
     // member methods
     entry->put          = _put;
@@ -168,6 +219,9 @@ qentry_t *qEntry(void)
 
     entry->save         = _save;
     entry->load         = _load;
+    entry->savebin      = _savebin;
+    entry->loadbin      = _loadbin;
+    entry->loadmmap     = _loadmmap;
 
     entry->print        = _print;
     entry->free         = _free;
@@ -196,28 +250,29 @@ static bool _put(qentry_t *entry, const char *name,
     }
 
     // duplicate name
-    char *dup_name = strdup(name);
+    char *dup_name = Q_STRDUP(name);
     if (dup_name == NULL) return false;
 
     // duplicate object
-    void *dup_data = malloc(size);
+    void *dup_data = Q_MALLOC(size);
     if (dup_data == NULL) {
-        free(dup_name);
+        Q_FREE(dup_name);
         return false;
     }
     memcpy(dup_data, data, size);
 
     // make new object entry
-    qentobj_t *obj = (qentobj_t *)malloc(sizeof(qentobj_t));
+    qentobj_t *obj = (qentobj_t *)Q_MALLOC(sizeof(qentpobj_t));
     if (obj == NULL) {
-        free(dup_name);
-        free(dup_data);
+        Q_FREE(dup_name);
+        Q_FREE(dup_data);
         return false;
     }
     obj->name = dup_name;
     obj->data = dup_data;
     obj->size = size;
     obj->next = NULL;
+    _FLAGS(obj) = 0;
 
     // if replace flag is set, remove same key
     if (replace == true) _remove(entry, dup_name);
@@ -271,7 +326,7 @@ static bool _putstrf(qentry_t *entry, bool replace, const char *name,
     if (str == NULL) return false;
 
     bool ret = _putstr(entry, name, str, replace);
-    free(str);
+    Q_FREE(str);
 
     return ret;
 }
@@ -332,10 +387,11 @@ static void *_get(qentry_t *entry, const char *name, size_t *size, bool newmem)
     qentobj_t *obj;
     for (obj = entry->first; obj; obj = obj->next) {
         if (!strcmp(obj->name, name)) {
+            _resolve(obj);
             if (size != NULL) *size = obj->size;
 
             if (newmem == true) {
-                data = malloc(obj->size);
+                data = Q_MALLOC(obj->size);
                 memcpy(data, obj->data, obj->size);
             } else {
                 data = obj->data;
@@ -375,9 +431,10 @@ static void *_getlast(qentry_t *entry, const char *name, size_t *size,
 
     void *data = NULL;
     if (lastobj != NULL) {
+        _resolve(lastobj);
         if (size != NULL) *size = lastobj->size;
         if (newmem == true) {
-            data = malloc(lastobj->size);
+            data = Q_MALLOC(lastobj->size);
             memcpy(data, lastobj->data, lastobj->size);
         } else {
             data = lastobj->data;
@@ -417,7 +474,7 @@ static char *_getstrf(qentry_t *entry, bool newmem, const char *namefmt, ...)
     if (name == NULL) return NULL;
 
     char *data = (char *)_get(entry, name, NULL, newmem);
-    free(name);
+    Q_FREE(name);
 
     return data;
 }
@@ -450,7 +507,7 @@ static int _getint(qentry_t *entry, const char *name)
     char *str = _get(entry, name, NULL, true);
     if (str != NULL) {
         n = atoi(str);
-        free(str);
+        Q_FREE(str);
     }
     return n;
 }
@@ -469,7 +526,7 @@ static int _getintlast(qentry_t *entry, const char *name)
     int n = 0;
     if (str != NULL) {
         n = atoi(str);
-        free(str);
+        Q_FREE(str);
     }
     return n;
 
@@ -494,9 +551,10 @@ static void *_caseget(qentry_t *entry, const char *name, size_t *size,
     qentobj_t *obj;
     for (obj = entry->first; obj; obj = obj->next) {
         if (!strcasecmp(name, obj->name)) {
+            _resolve(obj);
             if (size != NULL) *size = obj->size;
             if (newmem == true) {
-                data = malloc(obj->size);
+                data = Q_MALLOC(obj->size);
                 memcpy(data, obj->data, obj->size);
             } else {
                 data = obj->data;
@@ -539,7 +597,7 @@ static int _casegetint(qentry_t *entry, const char *name)
     int n = 0;
     if (str != NULL) {
         n = atoi(str);
-        free(str);
+        Q_FREE(str);
     }
     return n;
 }
@@ -594,9 +652,10 @@ static bool _getnext(qentry_t *entry, qentobj_t *obj, const char *name,
     for (cont = obj->next; cont; cont = cont->next) {
         if (name != NULL && strcmp(cont->name, name)) continue;
 
+        _resolve(cont);
         if (newmem == true) {
-            obj->name = strdup(cont->name);
-            obj->data = malloc(cont->size);
+            obj->name = Q_STRDUP(cont->name);
+            obj->data = Q_MALLOC(cont->size);
             memcpy(obj->data, cont->data, cont->size);
         } else {
             obj->name = cont->name;
@@ -650,9 +709,7 @@ static int _remove(qentry_t *entry, const char *name)
             removed++;
 
             // remove entry itself
-            free(obj->name);
-            free(obj->data);
-            free(obj);
+            _freeobj(obj);
 
             // adjust chain links
             if (next == NULL) entry->last = prev;  // if the object is last one
@@ -687,11 +744,10 @@ static bool _truncate(qentry_t *entry)
     qentobj_t *obj;
     for (obj = entry->first; obj;) {
         qentobj_t *next = obj->next;
-        free(obj->name);
-        free(obj->data);
-        free(obj);
+        _freeobj(obj);
         obj = next;
     }
+    _freeblocks(entry);
 
     entry->num = 0;
     entry->first = NULL;
@@ -759,9 +815,10 @@ static bool _save(qentry_t *entry, const char *filepath)
 
     qentobj_t *obj;
     for (obj = entry->first; obj; obj = obj->next) {
+        _resolve(obj);
         char *encval = _q_urlencode(obj->data, obj->size);
         fprintf(fd, "%s=%s\n", obj->name, encval);
-        free(encval);
+        Q_FREE(encval);
     }
 
     fclose(fd);
@@ -802,6 +859,464 @@ static int _load(qentry_t *entry, const char *filepath)
     return cnt;
 }
 
+#ifndef _DOXYGEN_SKIP
+
+static void _put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xff; p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff; p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t _get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool _write_crc(FILE *fp, const void *buf, size_t size, uint32_t *crc)
+{
+    *crc = _q_crc32(*crc, buf, size);
+    return (fwrite(buf, 1, size, fp) == size);
+}
+
+/*
+ * Check the layout of a binary image. Returns the number of records or -1,
+ * end is set to the end of the records.
+ */
+static int _bin_check(const unsigned char *buf, size_t size, bool checkcrc,
+                      const unsigned char **end)
+{
+    if (size < _BIN_HEADER_LEN + 4 || memcmp(buf, _BIN_MAGIC, 4) != 0 ||
+        buf[4] != _BIN_VERSION) {
+        return -1;
+    }
+
+    *end = buf + size;
+    if ((buf[5] & _BIN_CRC) != 0) {
+        *end -= 4;
+        if (checkcrc == true && _q_crc32(0, buf, *end - buf) != _get_le32(*end)) {
+            DEBUG("qentry_t: CRC mismatch");
+            return -1;
+        }
+    }
+
+    uint32_t count = _get_le32(buf + 8);
+    const unsigned char *p = buf + _BIN_HEADER_LEN;
+    uint32_t i;
+    for (i = 0; i < count && i < INT32_MAX; i++) {
+        if (*end - p < 4) break;
+        uint32_t namesize = _get_le32(p);
+        p += 4;
+        if (namesize == 0 || namesize > (size_t)(*end - p) ||
+            p[namesize - 1] != '\0') break;
+        p += namesize;
+        if (*end - p < 4) break;
+        uint32_t datasize = _get_le32(p);
+        p += 4;
+        if (datasize == 0 || datasize > (size_t)(*end - p)) break;
+        p += datasize;
+    }
+    if (i != count || p != *end) return -1;
+
+    return (int)count;
+}
+
+#endif
+
+/**
+ * qentry_t->savebin(): Save qentry_t in binary format
+ *
+ * @param   entry   qentry_t pointer
+ * @param   filepath save file path
+ *
+ * @return  true if successful, otherwise returns false.
+ *
+ * @note
+ * Values are stored as they are, so binary data doesn't grow like it does
+ * with save() and the file can be loaded back with loadbin() without
+ * decoding. All integers are little-endian.
+ *
+ * @code
+ *   header : "QENT" | version(1) | flags(1) | reserved(2) | count(4)
+ *   record : name size(4) | name with '\0' | data size(4) | data
+ *   trailer: CRC-32 of the header and records(4)
+ * @endcode
+ */
+static bool _savebin(qentry_t *entry, const char *filepath)
+{
+    if (entry == NULL) return false;
+
+    FILE *fp;
+    if ((fp = fopen(filepath, "wb")) == NULL) {
+        DEBUG("qentry_t->savebin(): Can't open file %s", filepath);
+        return false;
+    }
+
+    // change mode
+#if defined(__MINGW32__) && defined(_WIN32) && !defined(__CYGWIN__)
+    chmod(filepath, DEF_FILE_MODE);
+#else
+    fchmod(fileno(fp), DEF_FILE_MODE);
+#endif
+
+    unsigned char header[_BIN_HEADER_LEN];
+    memcpy(header, _BIN_MAGIC, 4);
+    header[4] = _BIN_VERSION;
+    header[5] = _BIN_CRC;
+    header[6] = header[7] = 0;
+    _put_le32(header + 8, (uint32_t)entry->num);
+
+    uint32_t crc = 0;
+    bool ok = _write_crc(fp, header, sizeof(header), &crc);
+
+    qentobj_t *obj;
+    for (obj = entry->first; ok && obj; obj = obj->next) {
+        _resolve(obj);
+        size_t namesize = strlen(obj->name) + 1;
+        if (obj->size > UINT32_MAX) {
+            ok = false;
+            break;
+        }
+
+        unsigned char len[4];
+        _put_le32(len, (uint32_t)namesize);
+        ok = _write_crc(fp, len, sizeof(len), &crc) &&
+             _write_crc(fp, obj->name, namesize, &crc);
+        _put_le32(len, (uint32_t)obj->size);
+        ok = ok && _write_crc(fp, len, sizeof(len), &crc) &&
+             _write_crc(fp, obj->data, obj->size, &crc);
+    }
+
+    unsigned char trailer[4];
+    _put_le32(trailer, crc);
+    if (ok) ok = (fwrite(trailer, 1, sizeof(trailer), fp) == sizeof(trailer));
+    if (fclose(fp) != 0) ok = false;
+
+    return ok;
+}
+
+/**
+ * qentry_t->loadbin(): Load and append entries from a file saved by savebin()
+ *
+ * @param   entry   qentry_t pointer
+ * @param   filepath save file path
+ *
+ * @return  a number of loaded entries. returns 0 without touching entries
+ *          when the file is not in binary format or corrupted.
+ *
+ * @note
+ * The file is read at once and validated before any entry is added, so the
+ * result can be used to tell binary files from text ones.
+ *
+ * @code
+ *   if (entry->loadbin(entry, path) == 0) entry->load(entry, path);
+ * @endcode
+ */
+static int _loadbin(qentry_t *entry, const char *filepath)
+{
+    if (entry == NULL) return 0;
+
+    int fd = open(filepath, O_RDONLY | O_BINARY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < _BIN_HEADER_LEN + 4) {
+        close(fd);
+        return 0;
+    }
+
+    // read at once
+    size_t size = (size_t)st.st_size;
+    unsigned char *buf = (unsigned char *)Q_MALLOC(size);
+    if (buf == NULL) {
+        close(fd);
+        return 0;
+    }
+    size_t nread = 0;
+    while (nread < size) {
+        ssize_t n = read(fd, buf + nread, size - nread);
+        if (n <= 0) break;
+        nread += n;
+    }
+    close(fd);
+
+    // validate
+    const unsigned char *end;
+    if (nread != size || _bin_check(buf, size, true, &end) < 0) {
+        DEBUG("qentry_t->loadbin(): Not a valid binary file %s", filepath);
+        Q_FREE(buf);
+        return 0;
+    }
+
+    // build entries
+    int cnt = 0;
+    const unsigned char *p;
+    for (p = buf + _BIN_HEADER_LEN; p < end; cnt++) {
+        const char *name = (const char *)(p + 4);
+        p += 4 + _get_le32(p);
+        size_t datasize = _get_le32(p);
+        if (_put(entry, name, p + 4, datasize, false) == false) break;
+        p += 4 + datasize;
+    }
+
+    Q_FREE(buf);
+    return cnt;
+}
+
+/**
+ * qentry_t->loadmmap(): Map a file saved by save() or savebin() and append
+ * its entries without copying them.
+ *
+ * @param   entry   qentry_t pointer
+ * @param   filepath save file path
+ *
+ * @return  a number of loaded entries.
+ *
+ * @note
+ * The file is mapped privately, so it's never modified and the mapping is
+ * released by truncate() or free(). Only a small index is built up front:
+ * names and values point into the mapping and text values are urldecoded in
+ * place the first time they are accessed, so looking up a couple of keys in
+ * a big file costs little more than the index. With the binary format even
+ * the values are never copied, but the CRC is not verified, use loadbin()
+ * when the integrity of the file matters. Objects loaded this way can be
+ * removed or replaced as usual.
+ *
+ * @code
+ *   qentry_t *conf = qEntry();
+ *   conf->loadmmap(conf, "/etc/app.conf");
+ *   const char *root = conf->getstr(conf, "docroot", false);
+ *   conf->free(conf);  // unmaps the file
+ * @endcode
+ */
+static int _loadmmap(qentry_t *entry, const char *filepath)
+{
+    if (entry == NULL) return 0;
+
+    int fd = open(filepath, O_RDONLY | O_BINARY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+
+    // map a private copy-on-write view, values are decoded in place.
+    unsigned char *buf = NULL;
+    bool mapped = false;
+#ifndef _WIN32
+    buf = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) buf = NULL;
+    else mapped = true;
+
+    // a text file must end with a newline to be terminated in place.
+    if (mapped == true && buf[size - 1] != '\n' &&
+        memcmp(buf, _BIN_MAGIC, (size < 4) ? size : 4) != 0) {
+        munmap(buf, size);
+        buf = NULL;
+        mapped = false;
+    }
+#endif
+    if (buf == NULL) { // read it into memory instead
+        buf = (unsigned char *)Q_MALLOC(size + 1);
+        size_t nread = 0;
+        while (buf != NULL && nread < size) {
+            ssize_t n = read(fd, buf + nread, size - nread);
+            if (n <= 0) break;
+            nread += n;
+        }
+        if (buf == NULL || nread != size) {
+            Q_FREE(buf);
+            close(fd);
+            return 0;
+        }
+        buf[size] = '\n';
+    }
+    close(fd);
+    size_t textsize = (mapped == true) ? size : size + 1;
+
+    // index
+    const unsigned char *end;
+    int count = _bin_check(buf, size, false, &end);
+    bool binary = (count >= 0);
+    if (binary == false && buf[textsize - 1] == '\n') {
+        const unsigned char *p;
+        for (count = 0, p = buf; p < buf + textsize; p++) {
+            p = memchr(p, '\n', buf + textsize - p);
+            count++;
+        }
+    }
+
+    qentpobj_t *pool = NULL;
+    if (count > 0) pool = (qentpobj_t *)Q_MALLOC(sizeof(qentpobj_t) * count);
+    qentblk_t *blk = (qentblk_t *)Q_MALLOC(sizeof(qentblk_t));
+    qentblk_t *poolblk = (qentblk_t *)Q_MALLOC(sizeof(qentblk_t));
+    if ((count > 0 && pool == NULL) || blk == NULL || poolblk == NULL) {
+        Q_FREE(pool);
+        Q_FREE(blk);
+        Q_FREE(poolblk);
+        count = 0;
+    }
+    if (count <= 0) {
+#ifndef _WIN32
+        if (mapped == true) munmap(buf, size);
+        else
+#endif
+            Q_FREE(buf);
+        return 0;
+    }
+
+    int cnt = 0;
+    if (binary == true) {
+        unsigned char *p;
+        for (p = buf + _BIN_HEADER_LEN; p < end; cnt++) {
+            qentobj_t *obj = &pool[cnt].obj;
+            obj->name = (char *)(p + 4);
+            p += 4 + _get_le32(p);
+            obj->size = _get_le32(p);
+            obj->data = p + 4;
+            _FLAGS(obj) = _OBJ_BORROWED | _OBJ_POOLED;
+            p += 4 + obj->size;
+        }
+    } else {
+        char *line = (char *)buf;
+        char *textend = (char *)buf + textsize;
+        while (line < textend) {
+            char *eol = memchr(line, '\n', textend - line);
+            *eol = '\0';
+            char *eq = (*line != '#') ? strchr(line, '=') : NULL;
+            if (eq != NULL) {
+                *eq = '\0';
+                char *name = _q_strtrim(line);
+                char *data = _q_strtrim(eq + 1);
+                if (*name != '\0' && *data != '\0') {
+                    qentobj_t *obj = &pool[cnt++].obj;
+                    obj->name = name;
+                    obj->data = data;
+                    obj->size = strlen(data);
+                    _FLAGS(obj) = _OBJ_BORROWED | _OBJ_ENCODED | _OBJ_POOLED;
+                }
+            }
+            line = eol + 1;
+        }
+    }
+
+    // keep the storage until truncate()
+    blk->addr = buf;
+    blk->size = size;
+    blk->mapped = mapped;
+    poolblk->addr = pool;
+    poolblk->size = sizeof(qentpobj_t) * count;
+    poolblk->mapped = false;
+    poolblk->next = _BLOCKS(entry);
+    blk->next = poolblk;
+    _BLOCKS(entry) = blk;
+
+    // make chain link
+    int i;
+    for (i = 0; i < cnt; i++) {
+        qentobj_t *obj = &pool[i].obj;
+        obj->next = NULL;
+        if (entry->first == NULL) entry->first = entry->last = obj;
+        else {
+            entry->last->next = obj;
+            entry->last = obj;
+        }
+    }
+    entry->num += cnt;
+
+    return cnt;
+}
+
+#ifndef _DOXYGEN_SKIP
+
+// decode a value loaded by loadmmap() or _q_entry_putencoded()
+static void _resolve(qentobj_t *obj)
+{
+    if ((_FLAGS(obj) & _OBJ_ENCODED) == 0) return;
+    obj->size = _q_urldecode((char *)obj->data);
+    if ((_FLAGS(obj) & _OBJ_STRING) != 0) obj->size++;
+    _FLAGS(obj) &= ~_OBJ_ENCODED;
+}
+
+// keeps a Q_MALLOC()ed block until truncate(), for objects to borrow from
+bool _q_entry_keep(qentry_t *entry, void *addr, size_t size)
+{
+    qentblk_t *blk = (qentblk_t *)Q_MALLOC(sizeof(qentblk_t));
+    if (blk == NULL) return false;
+    blk->addr = addr;
+    blk->size = size;
+    blk->mapped = false;
+    blk->next = _BLOCKS(entry);
+    _BLOCKS(entry) = blk;
+    return true;
+}
+
+// the library's own values of an entry, such as the settings of a request.
+// they're kept apart from the objects so nothing put into the entry, like a
+// client's variables, can reach them. they stay until free(). creates the
+// table when create is true, otherwise returns NULL if there is none yet.
+qentry_t *_q_entry_meta(qentry_t *entry, bool create)
+{
+    if (entry == NULL) return NULL;
+
+    qentpriv_t *priv = (qentpriv_t *)entry;
+    if (priv->meta == NULL && create == true) priv->meta = qEntry();
+    return priv->meta;
+}
+
+// appends a string object borrowing its name and urlencoded value from a
+// block kept by _q_entry_keep(), the value is decoded on first access.
+bool _q_entry_putencoded(qentry_t *entry, char *name, char *value)
+{
+    qentobj_t *obj = (qentobj_t *)Q_MALLOC(sizeof(qentpobj_t));
+    if (obj == NULL) return false;
+    obj->name = name;
+    obj->data = value;
+    obj->size = strlen(value) + 1;
+    obj->next = NULL;
+    _FLAGS(obj) = _OBJ_BORROWED | _OBJ_ENCODED | _OBJ_STRING;
+
+    if (entry->first == NULL) entry->first = entry->last = obj;
+    else {
+        entry->last->next = obj;
+        entry->last = obj;
+    }
+    entry->num++;
+
+    return true;
+}
+
+static void _freeobj(qentobj_t *obj)
+{
+    if ((_FLAGS(obj) & _OBJ_BORROWED) == 0) {
+        Q_FREE(obj->name);
+        Q_FREE(obj->data);
+    }
+    if ((_FLAGS(obj) & _OBJ_POOLED) == 0) Q_FREE(obj);
+}
+
+static void _freeblocks(qentry_t *entry)
+{
+    qentblk_t *blk;
+    for (blk = _BLOCKS(entry); blk;) {
+        qentblk_t *next = blk->next;
+#ifndef _WIN32
+        if (blk->mapped == true) munmap(blk->addr, blk->size);
+        else
+#endif
+            Q_FREE(blk->addr);
+        Q_FREE(blk);
+        blk = next;
+    }
+    _BLOCKS(entry) = NULL;
+}
+
+#endif
+
 /**
  * qentry_t->print(): Print out stored objects for debugging purpose.
  *
@@ -816,6 +1331,7 @@ static bool _print(qentry_t *entry, FILE *out, bool print_data)
 
     qentobj_t *obj;
     for (obj = entry->first; obj; obj = obj->next) {
+        _resolve(obj);
         fprintf(out, "%s=%s (%lu)\n", obj->name,
                 (print_data?(char *)obj->data:"(data)"),
                 (unsigned long)obj->size);
@@ -836,7 +1352,9 @@ static bool _free(qentry_t *entry)
     if (entry == NULL) return false;
 
     _truncate(entry);
+    qentry_t *meta = ((qentpriv_t *)entry)->meta;
+    if (meta != NULL) _free(meta);
 
-    free(entry);
+    Q_FREE(entry);
     return true;
 }
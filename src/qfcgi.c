@@ -0,0 +1,2893 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * @file qfcgi.c Native FastCGI API
+ *
+ * Speaks the FastCGI record protocol directly, without libfcgi. While a
+ * request is accepted, the environment, stdin and stdout of the process are
+ * bound to it, so qcgireq_parse(), qcgires_*() and qcgisess_*() work on it
+ * as they do for a CGI program.
+ *
+ * @code
+ *   qfcgi_t *fcgi = qfcgi_listen("unix:/var/run/app.sock", 0);
+ *   while (qfcgi_accept(fcgi) == true) {
+ *     qentry_t *req = qcgireq_parse(NULL, 0);
+ *     qcgires_setcontenttype(req, "text/plain");
+ *     printf("Hello %s\n", req->getstr(req, "name", false));
+ *     req->free(req);
+ *   }
+ *   qfcgi_free(fcgi);
+ * @endcode
+ *
+ * To serve requests concurrently from one process, qfcgi_serve() runs a
+ * pool of worker threads. Handlers get their own request context instead
+ * of the process stdio.
+ *
+ * @code
+ *   static void handler(qcgictx_t *ctx, void *arg) {
+ *     qentry_t *req = qcgireq_parse_ctx(ctx, NULL, 0);
+ *     qcgires_setcontenttype(req, "text/plain");
+ *     fprintf(ctx->out, "Hello %s\n", req->getstr(req, "name", false));
+ *     req->free(req);
+ *   }
+ *
+ *   qfcgi_t *fcgi = qfcgi_listen("unix:/var/run/app.sock", 0);
+ *   qfcgi_serve(fcgi, 8, handler, NULL);  // until qfcgi_stop()
+ *   qfcgi_free(fcgi);
+ * @endcode
+ *
+ * On Linux, qfcgi_loop() serves many connections from a single thread
+ * with an event loop, so slow clients don't hold a thread each.
+ * qfcgi_loop_async() hands requests over before their body arrives, for
+ * handlers written as callbacks or as C++20 coroutines with qdecoder.hpp.
+ *
+ * qfcgi_prefork() supervises a set of worker processes running any of
+ * these, recycling them after qfcgi_setlimits() and restarting them on
+ * SIGHUP.
+ *
+ * @note
+ * qfcgi_accept() handles one request at a time. Not available when
+ * qDecoder is built with --enable-fastcgi, libfcgi owns stdio in that case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include "qdecoder.h"
+#include "internal.h"
+
+#if !defined(ENABLE_FASTCGI) && !defined(_WIN32) &&                        \
+    (defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) ||    \
+     defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
+#define QFCGI_NATIVE
+#endif
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QFCGI_NATIVE
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    (0)
+#endif
+
+/* FastCGI protocol */
+#define FCGI_VERSION_1          (1)
+#define FCGI_HEADER_LEN         (8)
+#define FCGI_MAX_CONTENT        (65535)
+
+#define FCGI_BEGIN_REQUEST      (1)
+#define FCGI_ABORT_REQUEST      (2)
+#define FCGI_END_REQUEST        (3)
+#define FCGI_PARAMS             (4)
+#define FCGI_STDIN              (5)
+#define FCGI_STDOUT             (6)
+#define FCGI_GET_VALUES         (9)
+#define FCGI_GET_VALUES_RESULT  (10)
+#define FCGI_UNKNOWN_TYPE       (11)
+
+#define FCGI_RESPONDER          (1)
+#define FCGI_KEEP_CONN          (1)
+
+#define FCGI_REQUEST_COMPLETE   (0)
+#define FCGI_CANT_MPX_CONN      (1)
+#define FCGI_OVERLOADED         (2)
+#define FCGI_UNKNOWN_ROLE       (3)
+
+#define QFCGI_READBUF_SIZE      (16 * 1024)
+#define QFCGI_MAX_PARAMS        (1024 * 1024)   // bytes of PARAMS stream
+
+#define QFCGI_RESPAWN_DELAY     (100)       // ms, after the first crash
+#define QFCGI_RESPAWN_MAXDELAY  (10 * 1000) // ms
+#define QFCGI_RESPAWN_MINUPTIME (1000)      // ms, shorter lives keep backing off
+
+#define QFCGI_SCORE_SLOTS       (256)       // default of qfcgi_setscoreboard()
+#define QFCGI_SERVE_MAXIDLE     (1024)      // kept connections qfcgi_serve() watches
+
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define QFCGI_REUSEPORT         // kernel balances connections among sockets
+#endif
+
+#ifdef __linux__
+#define QFCGI_EPOLL
+#define QFCGI_EV_MAXCONNS       (1024)
+#define QFCGI_EV_MEMBODY        (256 * 1024)    // larger bodies are spooled
+#define QFCGI_EV_MAXPENDING     (1024 * 1024)   // output before reading stops
+#endif
+
+extern char **environ;
+
+struct qfcgi_s {
+    int listenfd;
+    char *unixpath;             // unlinked by qfcgi_free()
+    char *tcpaddr;              // rebound by prefork workers
+    int backlog;
+    int maxconns;               // reported to the web server
+    int stopfd[2];              // self-pipe of qfcgi_stop()
+
+    long maxrequests;           // recycling limits, 0 for unlimited
+    size_t maxrss;
+    long nrequests;
+    bool recycle;               // a limit was reached
+
+    int fd;                     // current connection, -1 if none
+    bool keepconn;
+    bool broken;                // connection can't be reused
+    uint16_t reqid;             // current request, 0 if none
+
+    unsigned char rbuf[QFCGI_READBUF_SIZE];
+    size_t rpos;
+    size_t rlen;
+
+    size_t inremain;            // unread content of the current STDIN record
+    size_t inpad;               // padding after it
+    bool ineof;
+
+    qentry_t *params;
+    qcgictx_t ctx;
+    char **envp;
+    FILE *in;
+    FILE *out;
+    FILE *orig_stdin;
+    FILE *orig_stdout;
+    char **orig_environ;
+
+    qfcgi_scoreboard_t *board;  // qfcgi_setscoreboard(), shared with workers
+    size_t boardsize;           // 0 when borrowed from the owner
+    qfcgi_scoreslot_t *slot;    // of this process or worker thread
+    int64_t reqstart;           // us, of the current request
+};
+
+typedef struct {
+    int type;
+    uint16_t reqid;
+    size_t len;
+    size_t pad;
+} fcgihdr_t;
+
+static bool _recv(qfcgi_t *fcgi, void *buf, size_t size);
+static bool _skip(qfcgi_t *fcgi, size_t size);
+static bool _read_header(qfcgi_t *fcgi, fcgihdr_t *hdr);
+static bool _send_record(qfcgi_t *fcgi, int type, uint16_t reqid,
+                         const void *data, size_t size);
+static bool _send_end(qfcgi_t *fcgi, uint16_t reqid, int protostatus);
+static bool _handle_other(qfcgi_t *fcgi, const fcgihdr_t *hdr);
+static bool _read_request(qfcgi_t *fcgi);
+static bool _parse_params(qfcgi_t *fcgi, const unsigned char *p, size_t size);
+static ssize_t _in_read(qfcgi_t *fcgi, char *buf, size_t size);
+static ssize_t _out_write(qfcgi_t *fcgi, const char *buf, size_t size);
+static bool _bind(qfcgi_t *fcgi);
+static void _unbind(qfcgi_t *fcgi);
+static void _clear_request(qfcgi_t *fcgi);
+static void _close_conn(qfcgi_t *fcgi);
+static bool _open_streams(qfcgi_t *fcgi);
+static void _close_streams(qfcgi_t *fcgi);
+static bool _end_request(qfcgi_t *fcgi);
+static bool _wait(qfcgi_t *fcgi, int fd);
+static void *_worker_main(void *arg);
+static bool _count_request(qfcgi_t *fcgi);
+static size_t _getrss(void);
+static int64_t _now(void);
+static pid_t _spawn(qfcgi_t *fcgi, int index, Q_FCGI_T options,
+                    const int *listenfds, int nlisten,
+                    qfcgi_worker_t worker, void *arg);
+static void _pincpu(int index);
+static void _score_claim(qfcgi_t *fcgi, int thread, Q_SCORE_T state);
+static void _score_release(qfcgi_t *fcgi);
+static void _score_begin(qfcgi_t *fcgi, qentry_t *params, int64_t *started);
+static void _score_end(qfcgi_t *fcgi, int64_t started, bool ok);
+static void _score_io(qfcgi_t *fcgi, size_t in, size_t out);
+
+/* connection queue between the acceptor and the workers */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int *fds;                   // connections to be served
+    int size;
+    int head;
+    int num;
+    bool closed;
+    int *idle;                  // kept connections watched by the acceptor
+    int nidle;
+    int wakefd[2];              // wakes the acceptor up for a new idle one
+} fcgiqueue_t;
+
+typedef struct {
+    qfcgi_t conn;               // connection state, owned by the worker
+    qfcgi_t *owner;
+    int index;                  // 1 and up, for the scoreboard
+    pthread_t tid;
+    fcgiqueue_t *queue;
+    qfcgi_handler_t handler;
+    void *arg;
+} fcgiworker_t;
+
+static void _queue_push(fcgiqueue_t *queue, int fd);
+static bool _queue_keep(fcgiqueue_t *queue, int fd);
+static void _queue_take(fcgiqueue_t *queue, int fd);
+
+#ifdef QFCGI_EPOLL
+/* per-connection state machine of the event loop */
+typedef struct fcgiconn_s fcgiconn_t;
+struct fcgiconn_s {
+    int fd;
+    fcgiconn_t *prev;
+    fcgiconn_t *next;
+
+    // record being received
+    unsigned char hdr[FCGI_HEADER_LEN];
+    size_t hdrlen;
+    fcgihdr_t rec;
+    size_t recgot;              // content and padding received
+    bool streamed;              // content goes to the request streams
+    unsigned char *content;     // content of other records
+    size_t contentsize;
+
+    // request being received
+    uint16_t reqid;
+    bool keepconn;
+    unsigned char *params;
+    size_t paramslen;
+    qentry_t *env;              // set at the end of the PARAMS stream
+    char *body;
+    size_t bodylen;
+    size_t bodysize;
+    FILE *spool;                // body beyond QFCGI_EV_MEMBODY
+
+    // response being sent
+    unsigned char *wbuf;
+    size_t wpos;
+    size_t wlen;
+    size_t wsize;
+    bool closing;               // close once sent
+
+    qfcgireq_t *req;            // request of qfcgi_loop_async()
+    bool kicked;
+    fcgiconn_t *kicknext;
+
+    int64_t started;            // us, request on the scoreboard, 0 if none
+};
+
+typedef struct {
+    qfcgi_t *fcgi;
+    int epfd;
+    int maxconns;
+    int nconns;
+    bool acceptwait;            // pending connections beyond maxconns
+    bool stopping;
+    qfcgi_handler_t handler;
+    qfcgireq_cb_t start;        // instead of the handler
+    void *arg;
+    fcgiconn_t *conns;
+    fcgiconn_t *closed;         // freed after the current batch of events
+    fcgiconn_t *kicks;          // to service after the current batch
+    unsigned char rbuf[64 * 1024];
+} fcgiloop_t;
+
+/* request served by qfcgi_loop_async(), outlives its connection */
+struct qfcgireq_s {
+    fcgiloop_t *loop;
+    fcgiconn_t *conn;           // NULL once the connection is gone
+    uint16_t reqid;
+    qentry_t *params;
+    qcgictx_t ctx;
+    char *inbuf;                // body received and not read yet
+    size_t inpos;
+    size_t inlen;
+    size_t insize;
+    FILE *spool;                // after inbuf, beyond QFCGI_EV_MEMBODY unread
+    off_t spoolpos;
+    off_t spoollen;
+    bool eof;
+    bool aborted;
+    int events;                 // qfcgireq_wait()
+    qfcgireq_cb_t cb;
+    void *cbarg;
+};
+
+static void _ev_accept(fcgiloop_t *loop);
+static void _ev_close(fcgiloop_t *loop, fcgiconn_t *conn);
+static void _ev_reset(fcgiconn_t *conn);
+static bool _ev_service(fcgiloop_t *loop, fcgiconn_t *conn);
+static bool _ev_feed(fcgiloop_t *loop, fcgiconn_t *conn,
+                     const unsigned char *data, size_t size);
+static bool _ev_record(fcgiloop_t *loop, fcgiconn_t *conn);
+static bool _ev_dispatch(fcgiloop_t *loop, fcgiconn_t *conn);
+static bool _ev_queue(fcgiconn_t *conn, int type, uint16_t reqid,
+                      const void *data, size_t size);
+static bool _ev_flush(fcgiloop_t *loop, fcgiconn_t *conn);
+static bool _ev_run(qfcgi_t *fcgi, int maxconns, qfcgi_handler_t handler,
+                    qfcgireq_cb_t start, void *arg);
+static bool _ev_start(fcgiloop_t *loop, fcgiconn_t *conn);
+static bool _ev_body(qfcgireq_t *req, const void *data, size_t size);
+static size_t _ev_unread(qfcgireq_t *req);
+static void _ev_kick(fcgiloop_t *loop, fcgiconn_t *conn);
+static void _ev_detach(fcgiconn_t *conn);
+static void _ev_notify(qfcgireq_t *req);
+static void _ev_done(fcgiloop_t *loop, fcgiconn_t *conn, bool ok);
+static ssize_t _req_read(void *cookie, char *buf, size_t size);
+static ssize_t _req_write(void *cookie, const char *buf, size_t size);
+#endif
+
+#else
+
+struct qfcgi_s {
+    int dummy;
+};
+
+#endif /* QFCGI_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Open a FastCGI listening socket.
+ *
+ * @param addr      "unix:/path/to/socket", "host:port" or ":port".
+ *                  NULL to use the socket passed by the web server on
+ *                  file descriptor 0, as mod_fcgid or spawn-fcgi do.
+ * @param backlog   listen backlog, 0 for the system default
+ *
+ * @return  a pointer of qfcgi_t if successful, otherwise returns NULL
+ */
+qfcgi_t *qfcgi_listen(const char *addr, int backlog)
+{
+#ifdef QFCGI_NATIVE
+    int listenfd = (addr != NULL) ? _q_listen(addr, backlog, false) : 0;
+    if (listenfd < 0) {
+        DEBUG("Can't listen on %s", addr);
+        return NULL;
+    }
+
+    qfcgi_t *fcgi = (qfcgi_t *)Q_CALLOC(1, sizeof(qfcgi_t));
+    if (fcgi == NULL) {
+        if (addr != NULL) close(listenfd);
+        return NULL;
+    }
+    fcgi->listenfd = listenfd;
+    fcgi->backlog = backlog;
+    fcgi->maxconns = 1;
+    fcgi->fd = -1;
+    if (pipe(fcgi->stopfd) != 0) {
+        if (addr != NULL) close(listenfd);
+        Q_FREE(fcgi);
+        return NULL;
+    }
+    fcntl(fcgi->stopfd[0], F_SETFL, O_NONBLOCK);
+    fcntl(fcgi->stopfd[1], F_SETFL, O_NONBLOCK);
+    if (addr != NULL && !strncmp(addr, "unix:", CONST_STRLEN("unix:"))) {
+        fcgi->unixpath = Q_STRDUP(addr + CONST_STRLEN("unix:"));
+    } else if (addr != NULL) {
+        fcgi->tcpaddr = Q_STRDUP(addr);
+    }
+
+    return fcgi;
+#else
+    DEBUG("Native FastCGI is not available on this build.");
+    return NULL;
+#endif
+}
+
+/**
+ * Wait for the next FastCGI request.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ *
+ * @return  true when a request is accepted, false on a listening error or
+ *          after qfcgi_stop()
+ *
+ * @note
+ * The previous request is finished first if qfcgi_finish() wasn't called.
+ * Once accepted, getenv(), stdin and stdout refer to the request until
+ * qfcgi_finish(). Request bodies are read from the connection as the
+ * program reads stdin, they are not buffered in memory.
+ */
+bool qfcgi_accept(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL) return false;
+    if (fcgi->reqid != 0) qfcgi_finish(fcgi);
+    if (fcgi->recycle == true) return false;
+    if (fcgi->board != NULL && fcgi->slot == NULL) {
+        _score_claim(fcgi, 0, Q_SCORE_IDLE);
+    }
+
+    while (true) {
+        if (fcgi->fd < 0) {
+            if (_wait(fcgi, fcgi->listenfd) == false) return false;
+            fcgi->fd = accept(fcgi->listenfd, NULL, NULL);
+            if (fcgi->fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return false;
+            }
+            fcgi->rpos = fcgi->rlen = 0;
+            fcgi->broken = false;
+        }
+
+        if (_read_request(fcgi) == true && _bind(fcgi) == true) break;
+        _clear_request(fcgi);
+        _close_conn(fcgi);
+    }
+
+    _score_begin(fcgi, fcgi->params, &fcgi->reqstart);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Finish the current FastCGI request.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ *
+ * @return  true if the response was delivered, otherwise returns false
+ *
+ * @note
+ * Flushes stdout, ends the request and restores the environment, stdin and
+ * stdout of the process. The connection is kept for the next request when
+ * the web server asked for it.
+ */
+bool qfcgi_finish(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || fcgi->reqid == 0) return false;
+
+    _unbind(fcgi);
+    bool ret = (fcgi->broken == false);
+    if (_end_request(fcgi) == false) _close_conn(fcgi);
+    ret = (ret == true && fcgi->broken == false);
+    _score_end(fcgi, fcgi->reqstart, ret);
+    if (_count_request(fcgi) == true) {
+        fcgi->recycle = true;
+        _close_conn(fcgi);
+    }
+    return ret;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Get the parameters of the current FastCGI request.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ *
+ * @return  a qentry_t of CGI environment variables sent by the web server,
+ *          or NULL when no request is accepted. Owned by fcgi, valid until
+ *          qfcgi_finish().
+ */
+qentry_t *qfcgi_getparams(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || fcgi->reqid == 0) return NULL;
+    return fcgi->params;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Get the request context of the current FastCGI request.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ *
+ * @return  a request context for qcgireq_parse_ctx(), or NULL when no
+ *          request is accepted. Owned by fcgi, valid until qfcgi_finish().
+ */
+qcgictx_t *qfcgi_getctx(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || fcgi->reqid == 0) return NULL;
+    return &fcgi->ctx;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Serve FastCGI requests with a pool of worker threads.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ * @param nthreads  number of worker threads, 0 for one per online CPU
+ * @param handler   request handler, called in a worker thread
+ * @param arg       user pointer passed to the handler
+ *
+ * @return  true when stopped by qfcgi_stop() or a recycling limit,
+ *          false on an error
+ *
+ * @note
+ * The calling thread accepts connections and hands them to idle workers.
+ * Each worker owns the connection state and buffers of the connection it
+ * serves and calls the handler once per request with a request context
+ * bound to it, the context and its streams are valid until the handler
+ * returns. Handlers must not use getenv(), stdin or stdout for the request,
+ * use qcgireq_parse_ctx() and ctx->out instead. The web server is told
+ * that up to nthreads connections can be handled at once. Connections kept
+ * by the web server go back to the calling thread between requests, so
+ * idle ones don't hold up the workers.
+ */
+bool qfcgi_serve(qfcgi_t *fcgi, int nthreads, qfcgi_handler_t handler,
+                 void *arg)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || handler == NULL || fcgi->reqid != 0) return false;
+    if (nthreads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > 0) ? (int)ncpu : 1;
+    }
+
+    fcgiqueue_t queue;
+    memset((void *)&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    queue.size = nthreads;
+    queue.fds = (int *)Q_MALLOC(sizeof(int) * nthreads);
+    queue.idle = (int *)Q_MALLOC(sizeof(int) * QFCGI_SERVE_MAXIDLE);
+    queue.wakefd[0] = queue.wakefd[1] = -1;
+    if (pipe(queue.wakefd) == 0) {
+        fcntl(queue.wakefd[0], F_SETFL, O_NONBLOCK);
+        fcntl(queue.wakefd[1], F_SETFL, O_NONBLOCK);
+    }
+    // the listening socket, qfcgi_stop(), the wakeup then idle connections
+    struct pollfd *pfd = (struct pollfd *)Q_MALLOC(sizeof(struct pollfd) *
+                                                  (3 + QFCGI_SERVE_MAXIDLE));
+    fcgiworker_t *workers = (fcgiworker_t *)Q_CALLOC(nthreads, sizeof(fcgiworker_t));
+
+    int started = 0;
+    if (queue.fds != NULL && queue.idle != NULL && queue.wakefd[0] >= 0 &&
+        pfd != NULL && workers != NULL) {
+        for (; started < nthreads; started++) {
+            fcgiworker_t *w = &workers[started];
+            w->conn.listenfd = -1;
+            w->conn.fd = -1;
+            w->conn.maxconns = nthreads;
+            w->conn.stopfd[0] = fcgi->stopfd[0];
+            w->conn.stopfd[1] = -1;
+            w->conn.board = fcgi->board;
+            w->owner = fcgi;
+            w->index = started + 1;
+            w->queue = &queue;
+            w->handler = handler;
+            w->arg = arg;
+            if (pthread_create(&w->tid, NULL, _worker_main, w) != 0) break;
+        }
+    }
+
+    bool ret = (started == nthreads);
+    if (ret == true) {
+        pfd[0].fd = fcgi->listenfd;
+        pfd[1].fd = fcgi->stopfd[0];
+        pfd[2].fd = queue.wakefd[0];
+    }
+    while (ret == true) {
+        int npfd = 3, i;
+        pthread_mutex_lock(&queue.lock);
+        for (i = 0; i < queue.nidle; i++) pfd[npfd++].fd = queue.idle[i];
+        pthread_mutex_unlock(&queue.lock);
+        for (i = 0; i < npfd; i++) pfd[i].events = POLLIN;
+
+        if (poll(pfd, npfd, -1) < 0) {
+            if (errno == EINTR) continue;
+            ret = false;
+            break;
+        }
+        if (pfd[1].revents != 0) break;  // stopped
+        if (pfd[2].revents != 0) {
+            char buf[64];
+            while (read(queue.wakefd[0], buf, sizeof(buf)) > 0);
+        }
+
+        // a kept connection with the next request, or closed
+        for (i = 3; i < npfd; i++) {
+            if (pfd[i].revents == 0) continue;
+            _queue_take(&queue, pfd[i].fd);
+            _queue_push(&queue, pfd[i].fd);
+        }
+
+        if (pfd[0].revents != 0) {
+            int fd = accept(fcgi->listenfd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) continue;
+                ret = false;
+                break;
+            }
+            _queue_push(&queue, fd);
+        }
+    }
+
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = true;
+    pthread_cond_broadcast(&queue.cond);
+    pthread_mutex_unlock(&queue.lock);
+
+    int i;
+    for (i = 0; i < started; i++) pthread_join(workers[i].tid, NULL);
+    for (; queue.num > 0; queue.num--) {
+        close(queue.fds[queue.head]);
+        queue.head = (queue.head + 1) % queue.size;
+    }
+    for (i = 0; i < queue.nidle; i++) close(queue.idle[i]);
+    if (queue.wakefd[0] >= 0) {
+        close(queue.wakefd[0]);
+        close(queue.wakefd[1]);
+    }
+
+    char buf[16];  // rearm for the next call
+    while (read(fcgi->stopfd[0], buf, sizeof(buf)) > 0);
+
+    Q_FREE(workers);
+    Q_FREE(pfd);
+    Q_FREE(queue.idle);
+    Q_FREE(queue.fds);
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.lock);
+
+    return ret;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Stop qfcgi_serve() or qfcgi_accept().
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ *
+ * @note
+ * Async-signal-safe, can be called from a signal handler or any thread.
+ * Requests in progress are completed, idle kept connections are closed.
+ */
+void qfcgi_stop(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL) return;
+    int saved = errno;
+    ssize_t n = write(fcgi->stopfd[1], "", 1);  // stays readable until drained
+    (void)n;
+    errno = saved;
+#endif
+}
+
+/**
+ * Serve FastCGI requests with an event loop.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ * @param maxconns  number of connections to hold at once, 0 for 1024
+ * @param handler   request handler
+ * @param arg       user pointer passed to the handler
+ *
+ * @return  true when stopped by qfcgi_stop() or a recycling limit,
+ *          false on an error
+ *
+ * @note
+ * All connections are served by the calling thread with edge-triggered
+ * epoll. Records are read as they arrive into a state machine per
+ * connection, and request bodies are collected in memory, or in a
+ * temporary file when they are large, until the web server has sent them
+ * completely. Only then the handler is called, so slow uploads cost a
+ * connection slot but no thread. The handler gets a request context like
+ * with qfcgi_serve() and must not block, the response is buffered and sent
+ * without blocking after it returns. When stopped, requests in progress
+ * are completed and idle connections are closed. Available on Linux only.
+ */
+bool qfcgi_loop(qfcgi_t *fcgi, int maxconns, qfcgi_handler_t handler,
+                void *arg)
+{
+#ifdef QFCGI_EPOLL
+    if (fcgi == NULL || handler == NULL || fcgi->reqid != 0) return false;
+    return _ev_run(fcgi, maxconns, handler, NULL, arg);
+#else
+    DEBUG("Event loop is not available on this platform.");
+    return false;
+#endif
+}
+
+/**
+ * Serve FastCGI requests with an event loop, without waiting for the body.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ * @param maxconns  number of connections to hold at once, 0 for 1024
+ * @param start     called for each request once its parameters arrived
+ * @param arg       user pointer passed to start
+ *
+ * @return  true when stopped by qfcgi_stop() or a recycling limit,
+ *          false on an error
+ *
+ * @code
+ *   static void on_body(qfcgireq_t *req, void *arg) {
+ *     char buf[4096];
+ *     while (qfcgireq_read(req, buf, sizeof(buf)) > 0);  // consume
+ *     if (qfcgireq_eof(req) == false && qfcgireq_aborted(req) == false) {
+ *       qfcgireq_wait(req, Q_FCGIREQ_READ, on_body, arg);
+ *       return;
+ *     }
+ *     fprintf(qfcgireq_getctx(req)->out, "Content-Type: text/plain\r\n\r\nok");
+ *     qfcgireq_end(req);
+ *   }
+ *
+ *   static void start(qfcgireq_t *req, void *arg) {
+ *     on_body(req, arg);
+ *   }
+ *
+ *   qfcgi_loop_async(fcgi, 0, start, NULL);
+ * @endcode
+ *
+ * @note
+ * Same as qfcgi_loop() but the request is handed over as qfcgireq_t as
+ * soon as its parameters are known. The body is then read as it comes
+ * with qfcgireq_read(), output is written to qfcgireq_getctx()->out and
+ * sent while the request goes on, and qfcgireq_wait() registers a
+ * callback for when there is more to do. Any number of requests can be
+ * waiting at once, each costs its buffers and the caller's own state.
+ * Every request must be finished with qfcgireq_end(), also when aborted.
+ * Callbacks run on the loop thread and must not block. This is what
+ * qdecoder.hpp builds C++20 coroutines on. Available on Linux only.
+ */
+bool qfcgi_loop_async(qfcgi_t *fcgi, int maxconns, qfcgireq_cb_t start,
+                      void *arg)
+{
+#ifdef QFCGI_EPOLL
+    if (fcgi == NULL || start == NULL || fcgi->reqid != 0) return false;
+    return _ev_run(fcgi, maxconns, NULL, start, arg);
+#else
+    DEBUG("Event loop is not available on this platform.");
+    return false;
+#endif
+}
+
+/**
+ * Set limits to recycle the process.
+ *
+ * @param fcgi          a pointer of qfcgi_t
+ * @param maxrequests   number of requests to serve, 0 for unlimited
+ * @param maxrss        resident memory size in bytes, 0 for unlimited
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * Once a limit is reached, qfcgi_accept() returns false and qfcgi_serve()
+ * stops after the request in progress, so the process can exit and be
+ * replaced by qfcgi_prefork() or an external process manager. Contains
+ * slow leaks and heap fragmentation of long running programs.
+ */
+bool qfcgi_setlimits(qfcgi_t *fcgi, long maxrequests, size_t maxrss)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || maxrequests < 0) return false;
+    fcgi->maxrequests = maxrequests;
+    fcgi->maxrss = maxrss;
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifndef _DOXYGEN_SKIP
+#ifdef QFCGI_NATIVE
+static int _sigpipe[2] = { -1, -1 };   // supervisor wakeup
+static volatile sig_atomic_t _sighup = 0;
+static volatile sig_atomic_t _sigterm = 0;
+static qfcgi_t *_workerfcgi = NULL;     // in a worker process
+
+static void _supervisor_signal(int signo)
+{
+    int saved = errno;
+    if (signo == SIGHUP) _sighup = 1;
+    else if (signo == SIGTERM || signo == SIGINT) _sigterm = 1;
+    ssize_t n = write(_sigpipe[1], "", 1);
+    (void)n;
+    errno = saved;
+}
+
+static void _worker_signal(int signo)
+{
+    qfcgi_stop(_workerfcgi);
+}
+
+static int64_t _backoff(int failures)
+{
+    int64_t delay = QFCGI_RESPAWN_DELAY;
+    while (--failures > 0 && delay < QFCGI_RESPAWN_MAXDELAY) delay *= 2;
+    return (delay < QFCGI_RESPAWN_MAXDELAY) ? delay : QFCGI_RESPAWN_MAXDELAY;
+}
+#endif
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Run a prefork process manager.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ * @param nworkers  number of worker processes, 0 for one per online CPU
+ * @param options   Q_FCGI_PINCPU to pin each worker to its own CPU
+ * @param worker    worker process main, usually a qfcgi_accept() loop or
+ *                  a qfcgi_serve() call on the given qfcgi_t
+ * @param arg       user pointer passed to the worker
+ *
+ * @return  true when stopped, false on an error
+ *
+ * @note
+ * The calling process becomes the supervisor until SIGTERM, SIGINT or
+ * qfcgi_stop(). It forks the workers and replaces them as they exit. A
+ * worker which returns or exits with 0, as it does on reaching the limits
+ * of qfcgi_setlimits(), is replaced at once. Crashed workers are restarted
+ * with an exponential backoff while they keep failing within a second.
+ * On SIGHUP, a new set of workers is started and the old ones finish
+ * their requests in progress and exit. Connections waiting to be accepted
+ * stay in the listening sockets, which outlive the workers, so the program
+ * reloads without dropping them. Idle connections kept by the web server
+ * are closed by the old workers, as with qfcgi_stop().
+ *
+ * With a TCP address on Linux, every worker slot has its own SO_REUSEPORT
+ * socket and the kernel balances new connections among them. The
+ * supervisor keeps the socket of a slot and hands it to each worker
+ * started in the slot, it's only replaced when the worker crashed.
+ * Otherwise, the workers share the listening socket. Workers get SIGTERM
+ * to stop, which calls qfcgi_stop() on their qfcgi_t.
+ *
+ * @code
+ *   static void worker(qfcgi_t *fcgi, void *arg) {
+ *     while (qfcgi_accept(fcgi) == true) {
+ *       ...
+ *     }
+ *   }
+ *
+ *   qfcgi_t *fcgi = qfcgi_listen(":9000", 0);
+ *   qfcgi_setlimits(fcgi, 10000, 256 * 1024 * 1024);
+ *   qfcgi_prefork(fcgi, 0, Q_FCGI_PINCPU, worker, NULL);
+ *   qfcgi_free(fcgi);
+ * @endcode
+ */
+bool qfcgi_prefork(qfcgi_t *fcgi, int nworkers, Q_FCGI_T options,
+                   qfcgi_worker_t worker, void *arg)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || worker == NULL || fcgi->reqid != 0) return false;
+    if (_sigpipe[0] >= 0) return false;  // one supervisor per process
+    if (nworkers <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = (ncpu > 0) ? (int)ncpu : 1;
+    }
+
+    typedef struct {
+        pid_t pid;
+        int64_t started;
+        int64_t respawn;    // when to start again if pid is 0
+        int failures;
+    } fcgislot_t;
+
+    fcgislot_t *slots = (fcgislot_t *)Q_CALLOC(nworkers, sizeof(fcgislot_t));
+    pid_t *retired = (pid_t *)Q_CALLOC(nworkers, sizeof(pid_t));
+    int nretired = 0, maxretired = nworkers;
+    if (slots == NULL || retired == NULL || pipe(_sigpipe) != 0) {
+        Q_FREE(slots);
+        Q_FREE(retired);
+        return false;
+    }
+    fcntl(_sigpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(_sigpipe[1], F_SETFL, O_NONBLOCK);
+    _sighup = _sigterm = 0;
+
+    int i;
+    int *listenfds = NULL;  // of each slot with SO_REUSEPORT, -1 if none
+#ifdef QFCGI_REUSEPORT
+    if (fcgi->tcpaddr != NULL) {
+        listenfds = (int *)Q_MALLOC(sizeof(int) * nworkers);
+        if (listenfds == NULL) {
+            close(_sigpipe[0]);
+            close(_sigpipe[1]);
+            _sigpipe[0] = _sigpipe[1] = -1;
+            Q_FREE(slots);
+            Q_FREE(retired);
+            return false;
+        }
+        for (i = 0; i < nworkers; i++) listenfds[i] = -1;
+
+        // the group is made of the slot sockets only
+        close(fcgi->listenfd);
+        fcgi->listenfd = -1;
+    }
+#endif
+
+    int sigs[] = { SIGCHLD, SIGHUP, SIGTERM, SIGINT };
+    struct sigaction sa, oldsa[4];
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = _supervisor_signal;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < 4; i++) sigaction(sigs[i], &sa, &oldsa[i]);
+
+    bool stopping = false, stopreq = false;
+    while (true) {
+        int64_t now = _now();
+
+        // reap
+        for (i = 0; i < nworkers; i++) {
+            fcgislot_t *slot = &slots[i];
+            int status;
+            if (slot->pid <= 0 || waitpid(slot->pid, &status, WNOHANG) <= 0) continue;
+            slot->pid = 0;
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                slot->failures = 0;  // recycled
+                slot->respawn = now;
+            } else {
+                if (now - slot->started < QFCGI_RESPAWN_MINUPTIME) slot->failures++;
+                else slot->failures = 1;
+                slot->respawn = now + _backoff(slot->failures);
+                DEBUG("Worker %d died (status %d), restarting in %lldms.", i,
+                      status, (long long)(slot->respawn - now));
+
+                // nobody would accept on it until the restart
+                if (listenfds != NULL && listenfds[i] >= 0) {
+                    close(listenfds[i]);
+                    listenfds[i] = -1;
+                }
+            }
+        }
+        for (i = 0; i < nretired; ) {
+            if (waitpid(retired[i], NULL, WNOHANG) > 0) {
+                retired[i] = retired[--nretired];
+            } else {
+                i++;
+            }
+        }
+
+        if (stopping == false && (_sigterm != 0 || stopreq == true)) {
+            stopping = true;
+            for (i = 0; i < nworkers; i++) {
+                if (slots[i].pid > 0) kill(slots[i].pid, SIGTERM);
+            }
+            for (i = 0; i < nretired; i++) kill(retired[i], SIGTERM);
+        }
+
+        if (stopping == false && _sighup != 0) {
+            _sighup = 0;
+            if (nretired + nworkers > maxretired) {
+                pid_t *tmp = (pid_t *)Q_REALLOC(retired, sizeof(pid_t) * (nretired + nworkers));
+                if (tmp != NULL) {
+                    retired = tmp;
+                    maxretired = nretired + nworkers;
+                }
+            }
+            // new workers first, then the old ones drain
+            for (i = 0; i < nworkers && nretired < maxretired; i++) {
+                fcgislot_t *slot = &slots[i];
+                if (slot->pid > 0) {
+                    kill(slot->pid, SIGTERM);
+                    retired[nretired++] = slot->pid;
+                }
+                slot->pid = 0;
+                slot->failures = 0;
+                slot->respawn = now;
+            }
+        }
+
+        // spawn
+        int alive = nretired, timeout = -1;
+        for (i = 0; i < nworkers; i++) {
+            fcgislot_t *slot = &slots[i];
+            if (stopping == false && slot->pid == 0 && slot->respawn <= now) {
+                slot->started = now;
+                slot->pid = -1;
+                if (listenfds != NULL && listenfds[i] < 0) {
+                    listenfds[i] = _q_listen(fcgi->tcpaddr, fcgi->backlog, true);
+                    if (listenfds[i] < 0) DEBUG("Can't listen on %s", fcgi->tcpaddr);
+                }
+                if (listenfds == NULL || listenfds[i] >= 0) {
+                    slot->pid = _spawn(fcgi, i, options, listenfds, nworkers,
+                                       worker, arg);
+                }
+                if (slot->pid < 0) {
+                    slot->pid = 0;
+                    slot->failures++;
+                    slot->respawn = now + _backoff(slot->failures);
+                }
+            }
+            if (slot->pid > 0) {
+                alive++;
+            } else if (stopping == false) {
+                int wait = (int)(slot->respawn - now);
+                if (timeout < 0 || wait < timeout) timeout = wait;
+            }
+        }
+        if (stopping == true && alive == 0) break;
+
+        struct pollfd pfd[2];
+        pfd[0].fd = _sigpipe[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = fcgi->stopfd[0];
+        pfd[1].events = POLLIN;
+        if (poll(pfd, 2, timeout) > 0) {
+            char buf[64];
+            while (read(_sigpipe[0], buf, sizeof(buf)) > 0);
+            if (pfd[1].revents != 0) stopreq = true;
+        }
+    }
+
+    for (i = 0; i < 4; i++) sigaction(sigs[i], &oldsa[i], NULL);
+    close(_sigpipe[0]);
+    close(_sigpipe[1]);
+    _sigpipe[0] = _sigpipe[1] = -1;
+    char buf[16];  // rearm qfcgi_stop()
+    while (read(fcgi->stopfd[0], buf, sizeof(buf)) > 0);
+
+    if (listenfds != NULL) {
+        for (i = 0; i < nworkers; i++) {
+            if (listenfds[i] >= 0) close(listenfds[i]);
+        }
+        Q_FREE(listenfds);
+    }
+    Q_FREE(slots);
+    Q_FREE(retired);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Publish worker activity on a shared memory scoreboard.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ * @param filepath  scoreboard file to create, NULL to stop publishing
+ * @param nslots    number of worker slots, 0 for 256
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * Call before qfcgi_prefork(), qfcgi_serve(), qfcgi_loop() or the
+ * qfcgi_accept() loop. Every process and worker thread serving requests
+ * claims a slot where it publishes its state, the current request,
+ * bytes in and out, counters and a latency histogram. Each slot has a
+ * single writer, so nothing is locked on the request path. Slots of
+ * crashed workers are taken over by their replacements.
+ *
+ * The file holds a qfcgi_scoreboard_t header followed by the slots, as
+ * defined in qdecoder.h. It's replaced, not rewritten, so programs still
+ * mapping the previous one aren't disturbed. Monitoring tools map it read
+ * only, like tools/qdecoder-stat does.
+ *
+ * @code
+ *   qfcgi_t *fcgi = qfcgi_listen(":9000", 0);
+ *   qfcgi_setscoreboard(fcgi, "/var/run/app.score", 0);
+ *   qfcgi_prefork(fcgi, 0, 0, worker, NULL);
+ *
+ *   $ qdecoder-stat -i 1 /var/run/app.score
+ * @endcode
+ */
+bool qfcgi_setscoreboard(qfcgi_t *fcgi, const char *filepath, int nslots)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL || fcgi->reqid != 0 || nslots < 0) return false;
+
+    _score_release(fcgi);
+    if (fcgi->boardsize > 0) munmap(fcgi->board, fcgi->boardsize);
+    fcgi->board = NULL;
+    fcgi->boardsize = 0;
+    if (filepath == NULL) return true;
+
+    if (nslots == 0) nslots = QFCGI_SCORE_SLOTS;
+    size_t size = sizeof(qfcgi_scoreboard_t) + sizeof(qfcgi_scoreslot_t) * nslots;
+
+    char tmppath[PATH_MAX];
+    if (snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", filepath)
+            >= (int)sizeof(tmppath)) {
+        return false;
+    }
+    int fd = mkstemp(tmppath);
+    if (fd < 0) {
+        DEBUG("Can't create the scoreboard %s", tmppath);
+        return false;
+    }
+    fchmod(fd, DEF_FILE_MODE);  // readable by monitoring tools
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmppath);
+        return false;
+    }
+
+    qfcgi_scoreboard_t *board = (qfcgi_scoreboard_t *)map;
+    memcpy(board->magic, Q_SCORE_MAGIC, sizeof(board->magic));
+    board->version = Q_SCORE_VERSION;
+    board->nslots = nslots;
+    board->slotsize = sizeof(qfcgi_scoreslot_t);
+    board->created = time(NULL);
+    if (rename(tmppath, filepath) != 0) {
+        DEBUG("Can't rename the scoreboard to %s", filepath);
+        munmap(map, size);
+        unlink(tmppath);
+        return false;
+    }
+
+    fcgi->board = board;
+    fcgi->boardsize = size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Close the listening socket and free qfcgi_t.
+ *
+ * @param fcgi      a pointer of qfcgi_t
+ */
+void qfcgi_free(qfcgi_t *fcgi)
+{
+#ifdef QFCGI_NATIVE
+    if (fcgi == NULL) return;
+
+    if (fcgi->reqid != 0) qfcgi_finish(fcgi);
+    _close_conn(fcgi);
+    if (fcgi->unixpath != NULL) {
+        close(fcgi->listenfd);
+        unlink(fcgi->unixpath);
+        Q_FREE(fcgi->unixpath);
+    } else if (fcgi->listenfd > 0) {
+        close(fcgi->listenfd);
+    }
+    Q_FREE(fcgi->tcpaddr);
+    close(fcgi->stopfd[0]);
+    close(fcgi->stopfd[1]);
+    qfcgi_setscoreboard(fcgi, NULL, 0);
+    Q_FREE(fcgi);
+#endif
+}
+
+/**
+ * Get the parameters of a request of qfcgi_loop_async().
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  a pointer of qentry_t, owned by the request
+ */
+qentry_t *qfcgireq_getparams(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL) return NULL;
+    return req->params;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Get the request context of a request of qfcgi_loop_async().
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  a pointer of qcgictx_t to pass to qcgireq_parse_ctx() and
+ *          qcgires functions, NULL on an error
+ *
+ * @note
+ * Output written to ctx->out is queued to the web server without
+ * blocking. ctx->in reads the body received so far, the same as
+ * qfcgireq_read(), so parse the request after qfcgireq_eof() is true.
+ */
+qcgictx_t *qfcgireq_getctx(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL) return NULL;
+
+    if (req->ctx.out == NULL) {
+        cookie_io_functions_t io;
+        memset(&io, 0, sizeof(io));
+        io.write = _req_write;
+        req->ctx.out = fopencookie(req, "w", io);
+        memset(&io, 0, sizeof(io));
+        io.read = _req_read;
+        req->ctx.in = fopencookie(req, "r", io);
+        if (req->ctx.out == NULL || req->ctx.in == NULL) {
+            if (req->ctx.out != NULL) fclose(req->ctx.out);
+            if (req->ctx.in != NULL) fclose(req->ctx.in);
+            req->ctx.out = req->ctx.in = NULL;
+            return NULL;
+        }
+    }
+    return &req->ctx;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Read the request body received so far.
+ *
+ * @param req   a pointer of qfcgireq_t
+ * @param buf   buffer to read into
+ * @param size  size of the buffer
+ *
+ * @return  number of bytes read, 0 if nothing is available right now
+ *
+ * @note
+ * Never blocks. When 0 is returned, see qfcgireq_eof() and
+ * qfcgireq_aborted(), or wait for Q_FCGIREQ_READ. Reading from the web
+ * server pauses while 256KB are left unread, unless Q_FCGIREQ_EOF is
+ * waited for. Then the rest of the body is spooled to a temporary file.
+ */
+size_t qfcgireq_read(qfcgireq_t *req, void *buf, size_t size)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL || buf == NULL) return 0;
+
+    bool paused = (_ev_unread(req) >= QFCGI_EV_MEMBODY);
+    size_t n = req->inlen - req->inpos;
+    if (n > 0) {
+        if (n > size) n = size;
+        memcpy(buf, req->inbuf + req->inpos, n);
+        req->inpos += n;
+        if (req->inpos == req->inlen) req->inpos = req->inlen = 0;
+    } else if (req->spool != NULL) {
+        if (fseeko(req->spool, req->spoolpos, SEEK_SET) != 0) return 0;
+        n = fread(buf, 1, size, req->spool);
+        req->spoolpos += n;
+        if (req->spoolpos == req->spoollen) {  // back to memory
+            fclose(req->spool);
+            req->spool = NULL;
+            req->spoolpos = req->spoollen = 0;
+        }
+    }
+    if (paused == true && req->conn != NULL) _ev_kick(req->loop, req->conn);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Check if the whole request body has been received.
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  true if the web server has sent all of the body
+ */
+bool qfcgireq_eof(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    return (req != NULL && req->eof == true);
+#else
+    return false;
+#endif
+}
+
+/**
+ * Check if the request has been aborted.
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  true if the web server aborted the request or the connection
+ *          is gone, nothing more will be received or sent
+ */
+bool qfcgireq_aborted(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    return (req == NULL || req->aborted == true);
+#else
+    return true;
+#endif
+}
+
+/**
+ * Get the amount of output not sent to the web server yet.
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  number of bytes including the record framing
+ */
+size_t qfcgireq_pending(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL || req->conn == NULL) return 0;
+    if (req->ctx.out != NULL) fflush(req->ctx.out);
+    return (req->conn != NULL) ? req->conn->wlen - req->conn->wpos : 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Call back when a request can go on.
+ *
+ * @param req       a pointer of qfcgireq_t
+ * @param events    Q_FCGIREQ_READ for more of the body or its end,
+ *                  Q_FCGIREQ_EOF for the end of the body,
+ *                  Q_FCGIREQ_DRAIN for the output to be sent, ORed
+ * @param cb        callback
+ * @param arg       user pointer passed to the callback
+ *
+ * @return  true if successful, otherwise returns false
+ *
+ * @note
+ * The callback is called once, from the loop, when any of the events
+ * happened or the request is aborted. It replaces a previous one not
+ * called yet. If the connection is already gone, it's called right away.
+ */
+bool qfcgireq_wait(qfcgireq_t *req, Q_FCGIREQ_T events, qfcgireq_cb_t cb,
+                   void *arg)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL || events == 0 || cb == NULL) return false;
+
+    if ((events & Q_FCGIREQ_DRAIN) != 0 && req->ctx.out != NULL) {
+        fflush(req->ctx.out);
+    }
+    req->events = events;
+    req->cb = cb;
+    req->cbarg = arg;
+    if (req->conn != NULL) _ev_kick(req->loop, req->conn);
+    else _ev_notify(req);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Finish a request of qfcgi_loop_async() and free it.
+ *
+ * @param req   a pointer of qfcgireq_t
+ *
+ * @return  true if the end of the response is queued, false if the
+ *          request was aborted
+ */
+bool qfcgireq_end(qfcgireq_t *req)
+{
+#ifdef QFCGI_EPOLL
+    if (req == NULL) return false;
+
+    if (req->ctx.out != NULL) fclose(req->ctx.out);  // last of the output
+    if (req->ctx.in != NULL) fclose(req->ctx.in);
+
+    bool ret = false;
+    fcgiconn_t *conn = req->conn;
+    if (conn != NULL) {
+        fcgiloop_t *loop = req->loop;
+        unsigned char end[8] = { 0, 0, 0, 0, FCGI_REQUEST_COMPLETE, 0, 0, 0 };
+        ret = _ev_queue(conn, FCGI_STDOUT, req->reqid, NULL, 0) &&
+              _ev_queue(conn, FCGI_END_REQUEST, req->reqid, end, sizeof(end));
+        if (ret == false || conn->keepconn == false || loop->stopping == true) {
+            conn->closing = true;
+        }
+        conn->req = NULL;
+        _ev_done(loop, conn, ret);
+        _ev_reset(conn);
+        _ev_kick(loop, conn);
+        if (_count_request(loop->fcgi) == true) qfcgi_stop(loop->fcgi);
+    }
+
+    if (req->params != NULL) req->params->free(req->params);
+    Q_FREE(req->inbuf);
+    if (req->spool != NULL) fclose(req->spool);
+    Q_FREE(req);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QFCGI_NATIVE
+
+static bool _recv(qfcgi_t *fcgi, void *buf, size_t size)
+{
+    unsigned char *p = (unsigned char *)buf;
+    while (size > 0) {
+        if (fcgi->rpos == fcgi->rlen) {
+            // an idle connection doesn't hold up qfcgi_stop()
+            if (fcgi->reqid == 0 && _wait(fcgi, fcgi->fd) == false) {
+                fcgi->broken = true;
+                return false;
+            }
+            // large chunks go straight to the caller's buffer
+            if (p != NULL && size >= sizeof(fcgi->rbuf)) {
+                ssize_t n = recv(fcgi->fd, p, size, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    fcgi->broken = true;
+                    return false;
+                }
+                _score_io(fcgi, n, 0);
+                p += n;
+                size -= n;
+                continue;
+            }
+            ssize_t n = recv(fcgi->fd, fcgi->rbuf, sizeof(fcgi->rbuf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fcgi->broken = true;
+                return false;
+            }
+            _score_io(fcgi, n, 0);
+            fcgi->rpos = 0;
+            fcgi->rlen = n;
+        }
+
+        size_t chunk = fcgi->rlen - fcgi->rpos;
+        if (chunk > size) chunk = size;
+        if (p != NULL) {
+            memcpy(p, fcgi->rbuf + fcgi->rpos, chunk);
+            p += chunk;
+        }
+        fcgi->rpos += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool _skip(qfcgi_t *fcgi, size_t size)
+{
+    return _recv(fcgi, NULL, size);
+}
+
+static bool _read_header(qfcgi_t *fcgi, fcgihdr_t *hdr)
+{
+    unsigned char h[FCGI_HEADER_LEN];
+    if (_recv(fcgi, h, sizeof(h)) == false) return false;
+    if (h[0] != FCGI_VERSION_1) {
+        fcgi->broken = true;
+        return false;
+    }
+
+    hdr->type = h[1];
+    hdr->reqid = (uint16_t)((h[2] << 8) | h[3]);
+    hdr->len = (size_t)((h[4] << 8) | h[5]);
+    hdr->pad = h[6];
+    return true;
+}
+
+static bool _send_record(qfcgi_t *fcgi, int type, uint16_t reqid,
+                         const void *data, size_t size)
+{
+    unsigned char h[FCGI_HEADER_LEN];
+    h[0] = FCGI_VERSION_1;
+    h[1] = (unsigned char)type;
+    h[2] = (reqid >> 8) & 0xff;
+    h[3] = reqid & 0xff;
+    h[4] = (size >> 8) & 0xff;
+    h[5] = size & 0xff;
+    h[6] = 0;
+    h[7] = 0;
+
+    struct iovec iov[2];
+    iov[0].iov_base = h;
+    iov[0].iov_len = sizeof(h);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = size;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size > 0) ? 2 : 1;
+
+    size_t total = sizeof(h) + size;
+    while (total > 0) {
+        ssize_t n = sendmsg(fcgi->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fcgi->broken = true;
+            return false;
+        }
+        _score_io(fcgi, 0, n);
+        total -= n;
+
+        // advance over what was sent
+        while (n > 0 && msg.msg_iovlen > 0) {
+            if ((size_t)n >= msg.msg_iov[0].iov_len) {
+                n -= msg.msg_iov[0].iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            } else {
+                msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + n;
+                msg.msg_iov[0].iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+    return true;
+}
+
+static bool _send_end(qfcgi_t *fcgi, uint16_t reqid, int protostatus)
+{
+    unsigned char body[8] = { 0, 0, 0, 0, (unsigned char)protostatus, 0, 0, 0 };
+    return _send_record(fcgi, FCGI_END_REQUEST, reqid, body, sizeof(body));
+}
+
+static size_t _get_length(const unsigned char **p, const unsigned char *end,
+                          bool *ok)
+{
+    if (*p >= end) {
+        *ok = false;
+        return 0;
+    }
+    if ((**p & 0x80) == 0) return *(*p)++;
+    if (end - *p < 4) {
+        *ok = false;
+        return 0;
+    }
+    size_t len = ((size_t)((*p)[0] & 0x7f) << 24) | ((size_t)(*p)[1] << 16) |
+                 ((size_t)(*p)[2] << 8) | (size_t)(*p)[3];
+    *p += 4;
+    return len;
+}
+
+static unsigned char *_put_length(unsigned char *p, size_t len)
+{
+    if (len < 0x80) {
+        *p++ = (unsigned char)len;
+    } else {
+        *p++ = (unsigned char)(((len >> 24) & 0x7f) | 0x80);
+        *p++ = (len >> 16) & 0xff;
+        *p++ = (len >> 8) & 0xff;
+        *p++ = len & 0xff;
+    }
+    return p;
+}
+
+// builds the FCGI_GET_VALUES_RESULT content for a query, returns its size.
+static size_t _values_result(int maxconns, const unsigned char *req,
+                             size_t size, unsigned char *res, size_t ressize)
+{
+    // one request per connection, no multiplexing
+    char maxstr[16];
+    snprintf(maxstr, sizeof(maxstr), "%d", maxconns);
+    const char *known[][2] = {
+        { "FCGI_MAX_CONNS", maxstr },
+        { "FCGI_MAX_REQS", maxstr },
+        { "FCGI_MPXS_CONNS", "0" }
+    };
+
+    unsigned char *w = res;
+    const unsigned char *p = req, *end = req + size;
+    while (p < end) {
+        bool ok = true;
+        size_t namelen = _get_length(&p, end, &ok);
+        size_t valuelen = _get_length(&p, end, &ok);
+        if (ok == false || namelen + valuelen > (size_t)(end - p)) break;
+
+        int i;
+        for (i = 0; i < (int)(sizeof(known) / sizeof(known[0])); i++) {
+            if (strlen(known[i][0]) == namelen &&
+                !memcmp(p, known[i][0], namelen) &&
+                (size_t)(w - res) + 2 + namelen + strlen(known[i][1]) <= ressize) {
+                w = _put_length(w, namelen);
+                w = _put_length(w, strlen(known[i][1]));
+                memcpy(w, known[i][0], namelen);
+                w += namelen;
+                memcpy(w, known[i][1], strlen(known[i][1]));
+                w += strlen(known[i][1]);
+            }
+        }
+        p += namelen + valuelen;
+    }
+
+    return w - res;
+}
+
+static bool _get_values(qfcgi_t *fcgi, size_t size)
+{
+    unsigned char *req = (unsigned char *)Q_MALLOC(size + 1);
+    if (req == NULL || _recv(fcgi, req, size) == false) {
+        Q_FREE(req);
+        return false;
+    }
+
+    unsigned char res[256];
+    size_t ressize = _values_result(fcgi->maxconns, req, size, res, sizeof(res));
+    Q_FREE(req);
+
+    return _send_record(fcgi, FCGI_GET_VALUES_RESULT, 0, res, ressize);
+}
+
+// records which don't belong to the current request stream.
+static bool _handle_other(qfcgi_t *fcgi, const fcgihdr_t *hdr)
+{
+    if (hdr->reqid == 0) { // management record
+        if (hdr->type == FCGI_GET_VALUES) {
+            if (_get_values(fcgi, hdr->len) == false) return false;
+        } else {
+            unsigned char body[8] = { (unsigned char)hdr->type, 0, 0, 0, 0, 0, 0, 0 };
+            if (_skip(fcgi, hdr->len) == false ||
+                _send_record(fcgi, FCGI_UNKNOWN_TYPE, 0, body, sizeof(body)) == false) {
+                return false;
+            }
+        }
+        return _skip(fcgi, hdr->pad);
+    }
+
+    if (hdr->type == FCGI_BEGIN_REQUEST && hdr->reqid != fcgi->reqid) {
+        if (_skip(fcgi, hdr->len + hdr->pad) == false) return false;
+        return _send_end(fcgi, hdr->reqid, FCGI_CANT_MPX_CONN);
+    }
+
+    return _skip(fcgi, hdr->len + hdr->pad);
+}
+
+// read records up to the end of the PARAMS stream of a request.
+static bool _read_request(qfcgi_t *fcgi)
+{
+    unsigned char *params = NULL;
+    size_t paramslen = 0;
+
+    while (true) {
+        fcgihdr_t hdr;
+        if (_read_header(fcgi, &hdr) == false) break;
+
+        if (fcgi->reqid == 0 && hdr.type == FCGI_BEGIN_REQUEST && hdr.reqid != 0) {
+            unsigned char body[8];
+            if (hdr.len != sizeof(body) || _recv(fcgi, body, sizeof(body)) == false ||
+                _skip(fcgi, hdr.pad) == false) {
+                break;
+            }
+            int role = (body[0] << 8) | body[1];
+            if (role != FCGI_RESPONDER) {
+                if (_send_end(fcgi, hdr.reqid, FCGI_UNKNOWN_ROLE) == false) break;
+                continue;
+            }
+            fcgi->reqid = hdr.reqid;
+            fcgi->keepconn = ((body[2] & FCGI_KEEP_CONN) != 0);
+            fcgi->inremain = fcgi->inpad = 0;
+            fcgi->ineof = false;
+            continue;
+        }
+
+        if (fcgi->reqid != 0 && hdr.reqid == fcgi->reqid) {
+            if (hdr.type == FCGI_ABORT_REQUEST) {
+                if (_skip(fcgi, hdr.len + hdr.pad) == false ||
+                    _send_end(fcgi, fcgi->reqid, FCGI_REQUEST_COMPLETE) == false) {
+                    break;
+                }
+                fcgi->reqid = 0;
+                paramslen = 0;
+                continue;
+            }
+            if (hdr.type == FCGI_PARAMS) {
+                if (hdr.len == 0) { // end of stream
+                    if (_skip(fcgi, hdr.pad) == false) break;
+                    bool ret = _parse_params(fcgi, params, paramslen);
+                    Q_FREE(params);
+                    return ret;
+                }
+                if (paramslen + hdr.len > QFCGI_MAX_PARAMS) break;
+                unsigned char *tmp = (unsigned char *)Q_REALLOC(params, paramslen + hdr.len);
+                if (tmp == NULL) break;
+                params = tmp;
+                if (_recv(fcgi, params + paramslen, hdr.len) == false ||
+                    _skip(fcgi, hdr.pad) == false) {
+                    break;
+                }
+                paramslen += hdr.len;
+                continue;
+            }
+        }
+
+        if (_handle_other(fcgi, &hdr) == false) break;
+    }
+
+    Q_FREE(params);
+    return false;
+}
+
+// decodes name-value pairs of a PARAMS stream.
+static qentry_t *_params_entry(const unsigned char *p, size_t size)
+{
+    qentry_t *params = qEntry();
+    if (params == NULL) return NULL;
+
+    const unsigned char *end = p + size;
+    while (p < end) {
+        bool ok = true;
+        size_t namelen = _get_length(&p, end, &ok);
+        size_t valuelen = _get_length(&p, end, &ok);
+        if (ok == false || namelen == 0 || namelen + valuelen > (size_t)(end - p)) {
+            params->free(params);
+            return NULL;
+        }
+
+        char *name = Q_STRNDUP((const char *)p, namelen);
+        char *value = Q_STRNDUP((const char *)p + namelen, valuelen);
+        if (name == NULL || value == NULL ||
+            params->putstr(params, name, value, true) == false) {
+            Q_FREE(name);
+            Q_FREE(value);
+            params->free(params);
+            return NULL;
+        }
+        Q_FREE(name);
+        Q_FREE(value);
+        p += namelen + valuelen;
+    }
+
+    return params;
+}
+
+static bool _parse_params(qfcgi_t *fcgi, const unsigned char *p, size_t size)
+{
+    fcgi->params = _params_entry(p, size);
+    if (fcgi->params == NULL) return false;
+
+    fcgi->envp = _q_makeenv(fcgi->params);  // for getenv()
+    return (fcgi->envp != NULL);
+}
+
+static ssize_t _in_read(qfcgi_t *fcgi, char *buf, size_t size)
+{
+    while (fcgi->inremain == 0) {
+        if (fcgi->ineof == true || fcgi->broken == true) return 0;
+        if (_skip(fcgi, fcgi->inpad) == false) return -1;
+        fcgi->inpad = 0;
+
+        fcgihdr_t hdr;
+        if (_read_header(fcgi, &hdr) == false) return -1;
+        if (hdr.reqid == fcgi->reqid && hdr.type == FCGI_STDIN) {
+            fcgi->inremain = hdr.len;
+            fcgi->inpad = hdr.pad;
+            if (hdr.len == 0) {
+                fcgi->ineof = true;
+                return (_skip(fcgi, hdr.pad) == true) ? 0 : -1;
+            }
+        } else if (hdr.reqid == fcgi->reqid && hdr.type == FCGI_ABORT_REQUEST) {
+            // web server gave up, no point in answering
+            _skip(fcgi, hdr.len + hdr.pad);
+            fcgi->broken = true;
+            return -1;
+        } else if (_handle_other(fcgi, &hdr) == false) {
+            return -1;
+        }
+    }
+
+    if (size > fcgi->inremain) size = fcgi->inremain;
+    if (_recv(fcgi, buf, size) == false) return -1;
+    fcgi->inremain -= size;
+
+    return size;
+}
+
+static ssize_t _out_write(qfcgi_t *fcgi, const char *buf, size_t size)
+{
+    if (fcgi->broken == true) return -1;
+
+    size_t sent;
+    for (sent = 0; sent < size; ) {
+        size_t chunk = size - sent;
+        if (chunk > FCGI_MAX_CONTENT) chunk = FCGI_MAX_CONTENT;
+        if (_send_record(fcgi, FCGI_STDOUT, fcgi->reqid, buf + sent, chunk) == false) {
+            return -1;
+        }
+        sent += chunk;
+    }
+
+    return size;
+}
+
+#if defined(__GLIBC__)
+static ssize_t _cookie_read(void *cookie, char *buf, size_t size)
+{
+    return _in_read((qfcgi_t *)cookie, buf, size);
+}
+
+static ssize_t _cookie_write(void *cookie, const char *buf, size_t size)
+{
+    return _out_write((qfcgi_t *)cookie, buf, size);
+}
+
+static FILE *_open_stream(qfcgi_t *fcgi, bool output)
+{
+    cookie_io_functions_t io;
+    memset(&io, 0, sizeof(io));
+    if (output == true) io.write = _cookie_write;
+    else io.read = _cookie_read;
+    return fopencookie(fcgi, (output == true) ? "w" : "r", io);
+}
+#else
+static int _cookie_read(void *cookie, char *buf, int size)
+{
+    return (int)_in_read((qfcgi_t *)cookie, buf, (size_t)size);
+}
+
+static int _cookie_write(void *cookie, const char *buf, int size)
+{
+    return (int)_out_write((qfcgi_t *)cookie, buf, (size_t)size);
+}
+
+static FILE *_open_stream(qfcgi_t *fcgi, bool output)
+{
+    if (output == true) return funopen(fcgi, NULL, _cookie_write, NULL, NULL);
+    return funopen(fcgi, _cookie_read, NULL, NULL, NULL);
+}
+#endif
+
+static bool _open_streams(qfcgi_t *fcgi)
+{
+    fcgi->in = _open_stream(fcgi, false);
+    fcgi->out = _open_stream(fcgi, true);
+    if (fcgi->in == NULL || fcgi->out == NULL) {
+        if (fcgi->in != NULL) fclose(fcgi->in);
+        if (fcgi->out != NULL) fclose(fcgi->out);
+        fcgi->in = fcgi->out = NULL;
+        return false;
+    }
+    setvbuf(fcgi->out, NULL, _IOFBF, 16 * 1024);
+
+    fcgi->ctx.params = fcgi->params;
+    fcgi->ctx.in = fcgi->in;
+    fcgi->ctx.out = fcgi->out;
+    return true;
+}
+
+static void _close_streams(qfcgi_t *fcgi)
+{
+    if (fcgi->out == NULL) return;
+
+    fclose(fcgi->out);  // flushes the response
+    fclose(fcgi->in);
+    fcgi->in = fcgi->out = NULL;
+    memset((void *)&fcgi->ctx, 0, sizeof(fcgi->ctx));
+}
+
+// ends the current request, returns true if the connection can be reused.
+static bool _end_request(qfcgi_t *fcgi)
+{
+    _close_streams(fcgi);
+
+    // consume the rest of the body to stay in sync with the next request.
+    char buf[4096];
+    while (fcgi->broken == false && fcgi->ineof == false) {
+        if (_in_read(fcgi, buf, sizeof(buf)) <= 0) break;
+    }
+
+    bool ret = false;
+    if (fcgi->broken == false) {
+        ret = _send_record(fcgi, FCGI_STDOUT, fcgi->reqid, NULL, 0) &&
+              _send_end(fcgi, fcgi->reqid, FCGI_REQUEST_COMPLETE);
+    }
+
+    bool keepconn = (fcgi->keepconn == true && fcgi->ineof == true && ret == true);
+    _clear_request(fcgi);
+    return keepconn;
+}
+
+// waits until fd is readable, false if stopped.
+static bool _wait(qfcgi_t *fcgi, int fd)
+{
+    struct pollfd pfd[2];
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = fcgi->stopfd[0];
+    pfd[1].events = POLLIN;
+    while (poll(pfd, 2, -1) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return (pfd[1].revents == 0);
+}
+
+static void *_worker_main(void *arg)
+{
+    fcgiworker_t *w = (fcgiworker_t *)arg;
+    qfcgi_t *conn = &w->conn;
+    fcgiqueue_t *queue = w->queue;
+    if (conn->board != NULL) _score_claim(conn, w->index, Q_SCORE_IDLE);
+
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->num == 0 && queue->closed == false) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+        if (queue->num == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        conn->fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->num--;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+
+        conn->rpos = conn->rlen = 0;
+        conn->broken = false;
+        while (true) {
+            if (_read_request(conn) == false || _open_streams(conn) == false) {
+                _clear_request(conn);
+                break;
+            }
+            _score_begin(conn, conn->params, &conn->reqstart);
+            w->handler(&conn->ctx, w->arg);
+            bool keepconn = _end_request(conn);
+            _score_end(conn, conn->reqstart, (conn->broken == false));
+            if (_count_request(w->owner) == true) {
+                qfcgi_stop(w->owner);
+                break;
+            }
+            if (keepconn == false) break;
+
+            // wait for the next request without holding up this worker
+            if (conn->rpos == conn->rlen && _queue_keep(queue, conn->fd) == true) {
+                conn->fd = -1;
+                break;
+            }
+        }
+        _close_conn(conn);
+    }
+
+    _score_release(conn);
+    return NULL;
+}
+
+// waits for an idle worker, connections aren't queued beyond that.
+static void _queue_push(fcgiqueue_t *queue, int fd)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->num == queue->size) pthread_cond_wait(&queue->cond, &queue->lock);
+    queue->fds[(queue->head + queue->num) % queue->size] = fd;
+    queue->num++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// hands a kept connection over to the acceptor, false if it watches too
+// many already. the acceptor closes them when it stops.
+static bool _queue_keep(fcgiqueue_t *queue, int fd)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool kept = (queue->nidle < QFCGI_SERVE_MAXIDLE);
+    if (kept == true) {
+        queue->idle[queue->nidle++] = fd;
+        ssize_t n = write(queue->wakefd[1], "", 1);
+        (void)n;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return kept;
+}
+
+// takes a connection out of the watched ones.
+static void _queue_take(fcgiqueue_t *queue, int fd)
+{
+    pthread_mutex_lock(&queue->lock);
+    int i;
+    for (i = 0; i < queue->nidle; i++) {
+        if (queue->idle[i] != fd) continue;
+        queue->idle[i] = queue->idle[--queue->nidle];
+        break;
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// counts a finished request, true when a recycling limit is reached.
+static bool _count_request(qfcgi_t *fcgi)
+{
+    long n = __atomic_add_fetch(&fcgi->nrequests, 1, __ATOMIC_RELAXED);
+    if (fcgi->maxrequests > 0 && n >= fcgi->maxrequests) return true;
+    if (fcgi->maxrss > 0 && _getrss() > fcgi->maxrss) return true;
+    return false;
+}
+
+static size_t _getrss(void)
+{
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return 0;
+    unsigned long size, resident;
+    int n = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    return (n == 2) ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    // peak size, close enough for a ceiling
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)ru.ru_maxrss;
+#else
+    return (size_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static int64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static pid_t _spawn(qfcgi_t *fcgi, int index, Q_FCGI_T options,
+                    const int *listenfds, int nlisten,
+                    qfcgi_worker_t worker, void *arg)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // worker process, detach from the supervisor's state
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    close(_sigpipe[0]);
+    close(_sigpipe[1]);
+    _sigpipe[0] = _sigpipe[1] = -1;
+
+    close(fcgi->stopfd[0]);
+    close(fcgi->stopfd[1]);
+    if (pipe(fcgi->stopfd) != 0) _exit(1);
+    fcntl(fcgi->stopfd[0], F_SETFL, O_NONBLOCK);
+    fcntl(fcgi->stopfd[1], F_SETFL, O_NONBLOCK);
+    Q_FREE(fcgi->unixpath);  // the supervisor removes it
+    fcgi->unixpath = NULL;
+    fcgi->slot = NULL;       // a worker claims its own
+
+    if (listenfds != NULL) {
+        // the socket of its slot, the others go with their own slots
+        int i;
+        for (i = 0; i < nlisten; i++) {
+            if (i != index && listenfds[i] >= 0) close(listenfds[i]);
+        }
+        fcgi->listenfd = listenfds[index];
+    }
+    if ((options & Q_FCGI_PINCPU) != 0) _pincpu(index);
+
+    _workerfcgi = fcgi;
+    signal(SIGTERM, _worker_signal);
+
+    worker(fcgi, arg);
+    _score_release(fcgi);
+
+    fflush(stdout);
+    _exit(0);
+}
+
+static void _pincpu(int index)
+{
+#ifdef __linux__
+    // the index-th CPU this process may run on
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    int ncpu = CPU_COUNT(&allowed);
+    if (ncpu <= 0) return;
+
+    int cpu, nth = index % ncpu;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && nth-- == 0) break;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        DEBUG("Can't pin worker %d to CPU %d.", index, cpu);
+    }
+#else
+    DEBUG("CPU pinning is not supported on this platform.");
+#endif
+}
+
+#define SCORE_SET(v, n)     __atomic_store_n(&(v), (n), __ATOMIC_RELAXED)
+#define SCORE_ADD(v, n)     SCORE_SET(v, (v) + (n))  // single writer per slot
+
+static int64_t _score_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t _score_wallms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// takes a free slot, or one of a process which is gone.
+static void _score_claim(qfcgi_t *fcgi, int thread, Q_SCORE_T state)
+{
+    qfcgi_scoreslot_t *slots = (qfcgi_scoreslot_t *)(fcgi->board + 1);
+    uint32_t pid = (uint32_t)getpid();
+    int pass, i;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < (int)fcgi->board->nslots; i++) {
+            qfcgi_scoreslot_t *slot = &slots[i];
+            uint32_t owner = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+            if (pass == 0 && owner != 0) continue;
+            if (pass == 1 && (owner == 0 || owner == pid ||
+                              kill((pid_t)owner, 0) == 0 || errno != ESRCH)) {
+                continue;
+            }
+            if (__atomic_compare_exchange_n(&slot->pid, &owner, pid, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                SCORE_SET(slot->thread, (uint32_t)thread);
+                SCORE_SET(slot->active, 0);
+                SCORE_SET(slot->since, _score_wallms());
+                SCORE_SET(slot->state, (uint32_t)state);
+                fcgi->slot = slot;
+                return;
+            }
+        }
+    }
+    DEBUG("The scoreboard is full.");
+}
+
+// the counters stay with the slot, so totals keep growing.
+static void _score_release(qfcgi_t *fcgi)
+{
+    qfcgi_scoreslot_t *slot = fcgi->slot;
+    if (slot == NULL) return;
+    fcgi->slot = NULL;
+    SCORE_SET(slot->state, Q_SCORE_FREE);
+    SCORE_SET(slot->active, 0);
+    __atomic_store_n(&slot->pid, 0, __ATOMIC_RELEASE);
+}
+
+static void _score_begin(qfcgi_t *fcgi, qentry_t *params, int64_t *started)
+{
+    qfcgi_scoreslot_t *slot = fcgi->slot;
+    if (slot == NULL) return;
+    *started = _score_usec();
+
+    const char *method = params->getstr(params, "REQUEST_METHOD", false);
+    const char *uri = params->getstr(params, "REQUEST_URI", false);
+    if (uri == NULL) uri = params->getstr(params, "SCRIPT_NAME", false);
+    int urilen = 0;
+    if (uri != NULL) urilen = strcspn(uri, "?");  // may carry credentials
+
+    // readers retry while seq is odd or has changed
+    SCORE_SET(slot->seq, slot->seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    snprintf(slot->method, sizeof(slot->method), "%s",
+             (method != NULL) ? method : "");
+    snprintf(slot->uri, sizeof(slot->uri), "%.*s", urilen,
+             (uri != NULL) ? uri : "");
+    SCORE_SET(slot->since, _score_wallms());
+    SCORE_ADD(slot->active, 1);
+    if (slot->state != Q_SCORE_LOOP) SCORE_SET(slot->state, Q_SCORE_BUSY);
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void _score_end(qfcgi_t *fcgi, int64_t started, bool ok)
+{
+    qfcgi_scoreslot_t *slot = fcgi->slot;
+    if (slot == NULL || started == 0) return;
+
+    int64_t usec = _score_usec() - started;
+    int bucket;
+    for (bucket = 0; bucket < Q_SCORE_BUCKETS - 1 &&
+         usec >= (int64_t)1000 << bucket; bucket++);
+
+    SCORE_ADD(slot->requests, 1);
+    if (ok == false) SCORE_ADD(slot->errors, 1);
+    SCORE_ADD(slot->latency, (uint64_t)usec);
+    SCORE_ADD(slot->histogram[bucket], 1);
+    if (slot->active > 0) SCORE_SET(slot->active, slot->active - 1);
+    if (slot->state == Q_SCORE_BUSY && slot->active == 0) {
+        SCORE_SET(slot->since, _score_wallms());
+        SCORE_SET(slot->state, Q_SCORE_IDLE);
+    }
+}
+
+static void _score_io(qfcgi_t *fcgi, size_t in, size_t out)
+{
+    qfcgi_scoreslot_t *slot = fcgi->slot;
+    if (slot == NULL) return;
+    if (in > 0) SCORE_ADD(slot->bytesin, in);
+    if (out > 0) SCORE_ADD(slot->bytesout, out);
+}
+
+#ifdef QFCGI_EPOLL
+static bool _ev_run(qfcgi_t *fcgi, int maxconns, qfcgi_handler_t handler,
+                    qfcgireq_cb_t start, void *arg)
+{
+    fcgiloop_t *loop = (fcgiloop_t *)Q_CALLOC(1, sizeof(fcgiloop_t));
+    if (loop == NULL) return false;
+    loop->fcgi = fcgi;
+    loop->maxconns = (maxconns > 0) ? maxconns : QFCGI_EV_MAXCONNS;
+    loop->handler = handler;
+    loop->start = start;
+    loop->arg = arg;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        Q_FREE(loop);
+        return false;
+    }
+
+    // the listening socket and the stop pipe are told apart by address
+    static char listenev, stopev;
+    struct epoll_event ev;
+    memset((void *)&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &listenev;
+    int flags = fcntl(fcgi->listenfd, F_GETFL);
+    fcntl(fcgi->listenfd, F_SETFL, flags | O_NONBLOCK);
+    bool ret = (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fcgi->listenfd, &ev) == 0);
+    ev.data.ptr = &stopev;
+    ret = ret && (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fcgi->stopfd[0], &ev) == 0);
+    int savedmax = fcgi->maxconns;
+    fcgi->maxconns = loop->maxconns;
+    bool claimed = false;
+    if (fcgi->board != NULL && fcgi->slot == NULL) {
+        _score_claim(fcgi, 0, Q_SCORE_LOOP);
+        claimed = true;
+    } else if (fcgi->slot != NULL) {
+        __atomic_store_n(&fcgi->slot->state, Q_SCORE_LOOP, __ATOMIC_RELAXED);
+    }
+
+    if (ret == true) _ev_accept(loop);  // connections before the loop
+    while (ret == true && (loop->stopping == false || loop->nconns > 0)) {
+        struct epoll_event events[256];
+        int n = epoll_wait(loop->epfd, events, 256, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ret = false;
+            break;
+        }
+
+        int i;
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == &listenev) {
+                if (loop->stopping == false) _ev_accept(loop);
+            } else if (events[i].data.ptr == &stopev) {
+                loop->stopping = true;
+            } else {
+                fcgiconn_t *conn = (fcgiconn_t *)events[i].data.ptr;
+                if (conn->fd >= 0 && _ev_service(loop, conn) == false) {
+                    _ev_close(loop, conn);
+                }
+            }
+        }
+
+        // requests of qfcgi_loop_async() moved on outside of their events
+        while (loop->kicks != NULL) {
+            fcgiconn_t *conn = loop->kicks;
+            loop->kicks = conn->kicknext;
+            conn->kicked = false;
+            if (conn->fd >= 0 && _ev_service(loop, conn) == false) {
+                _ev_close(loop, conn);
+            }
+        }
+
+        if (loop->stopping == true) {
+            // idle connections won't see another event
+            fcgiconn_t *conn, *next;
+            for (conn = loop->conns; conn != NULL; conn = next) {
+                next = conn->next;
+                if (conn->reqid == 0 && conn->hdrlen == 0 && conn->wlen == 0) {
+                    _ev_close(loop, conn);
+                }
+            }
+        } else if (loop->acceptwait == true && loop->nconns < loop->maxconns) {
+            _ev_accept(loop);
+        }
+
+        while (loop->closed != NULL) {
+            fcgiconn_t *conn = loop->closed;
+            loop->closed = conn->next;
+            Q_FREE(conn);
+        }
+    }
+
+    while (loop->conns != NULL) _ev_close(loop, loop->conns);
+    loop->kicks = NULL;
+    while (loop->closed != NULL) {
+        fcgiconn_t *conn = loop->closed;
+        loop->closed = conn->next;
+        Q_FREE(conn);
+    }
+    close(loop->epfd);
+    fcntl(fcgi->listenfd, F_SETFL, flags);
+    fcgi->maxconns = savedmax;
+    if (claimed == true) {
+        _score_release(fcgi);
+    } else if (fcgi->slot != NULL) {
+        __atomic_store_n(&fcgi->slot->state, Q_SCORE_IDLE, __ATOMIC_RELAXED);
+    }
+    Q_FREE(loop);
+
+    char buf[16];  // rearm for the next call
+    while (read(fcgi->stopfd[0], buf, sizeof(buf)) > 0);
+
+    return ret;
+}
+
+static void _ev_accept(fcgiloop_t *loop)
+{
+    loop->acceptwait = false;
+    while (true) {
+        if (loop->nconns >= loop->maxconns) {
+            loop->acceptwait = true;
+            return;
+        }
+
+        int fd = accept4(loop->fcgi->listenfd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;  // EAGAIN, or an error to retry on the next event
+        }
+
+        fcgiconn_t *conn = (fcgiconn_t *)Q_CALLOC(1, sizeof(fcgiconn_t));
+        struct epoll_event ev;
+        memset((void *)&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = conn;
+        if (conn == NULL || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            Q_FREE(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->next = loop->conns;
+        if (loop->conns != NULL) loop->conns->prev = conn;
+        loop->conns = conn;
+        loop->nconns++;
+    }
+}
+
+// closes a connection, the memory is freed after the current events.
+static void _ev_close(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    _ev_done(loop, conn, false);
+    if (conn->req != NULL) _ev_detach(conn);
+    close(conn->fd);  // leaves the epoll set as well
+    conn->fd = -1;
+    _ev_reset(conn);
+    Q_FREE(conn->content);
+    Q_FREE(conn->wbuf);
+
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else loop->conns = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    conn->prev = NULL;
+    conn->next = loop->closed;
+    loop->closed = conn;
+    loop->nconns--;
+}
+
+static void _ev_reset(fcgiconn_t *conn)
+{
+    Q_FREE(conn->params);
+    conn->params = NULL;
+    conn->paramslen = 0;
+    if (conn->env != NULL) conn->env->free(conn->env);
+    conn->env = NULL;
+    Q_FREE(conn->body);
+    conn->body = NULL;
+    conn->bodylen = conn->bodysize = 0;
+    if (conn->spool != NULL) fclose(conn->spool);
+    conn->spool = NULL;
+    conn->reqid = 0;
+}
+
+// reads and answers what's available, false to close the connection.
+static bool _ev_service(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    while (true) {
+        if (_ev_flush(loop, conn) == false) return false;
+        if (conn->wlen - conn->wpos > QFCGI_EV_MAXPENDING) break;  // until EPOLLOUT
+        if (conn->closing == true) return (conn->wlen > 0);
+        qfcgireq_t *req = conn->req;
+        if (req != NULL && _ev_unread(req) >= QFCGI_EV_MEMBODY &&
+            (req->cb == NULL || (req->events & Q_FCGIREQ_EOF) == 0)) {
+            break;  // until the request reads its body
+        }
+
+        ssize_t n = recv(conn->fd, loop->rbuf, sizeof(loop->rbuf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        if (n == 0) return false;
+
+        _score_io(loop->fcgi, n, 0);
+        if (_ev_feed(loop, conn, loop->rbuf, n) == false) return false;
+    }
+
+    if (conn->req != NULL) _ev_notify(conn->req);
+    return true;
+}
+
+static bool _ev_feed(fcgiloop_t *loop, fcgiconn_t *conn,
+                     const unsigned char *data, size_t size)
+{
+    while (true) {
+        if (conn->hdrlen < FCGI_HEADER_LEN) {
+            if (size == 0) break;
+            size_t n = FCGI_HEADER_LEN - conn->hdrlen;
+            if (n > size) n = size;
+            memcpy(conn->hdr + conn->hdrlen, data, n);
+            conn->hdrlen += n;
+            data += n;
+            size -= n;
+            if (conn->hdrlen < FCGI_HEADER_LEN) break;
+
+            if (conn->hdr[0] != FCGI_VERSION_1) return false;
+            fcgihdr_t *h = &conn->rec;
+            h->type = conn->hdr[1];
+            h->reqid = (uint16_t)((conn->hdr[2] << 8) | conn->hdr[3]);
+            h->len = (size_t)((conn->hdr[4] << 8) | conn->hdr[5]);
+            h->pad = conn->hdr[6];
+            conn->recgot = 0;
+
+            // streams of the current request aren't buffered per record
+            conn->streamed = (conn->reqid != 0 && h->reqid == conn->reqid &&
+                              ((h->type == FCGI_PARAMS && conn->env == NULL &&
+                                conn->req == NULL) ||
+                               (h->type == FCGI_STDIN &&
+                                (conn->env != NULL || conn->req != NULL))));
+            if (conn->streamed == false && h->len > conn->contentsize) {
+                unsigned char *tmp = (unsigned char *)Q_REALLOC(conn->content, h->len);
+                if (tmp == NULL) return false;
+                conn->content = tmp;
+                conn->contentsize = h->len;
+            }
+        }
+
+        fcgihdr_t *h = &conn->rec;
+        size_t total = h->len + h->pad;
+        size_t n = total - conn->recgot;
+        if (n > size) n = size;
+        if (conn->recgot < h->len) {
+            size_t clen = h->len - conn->recgot;
+            if (clen > n) clen = n;
+            if (conn->streamed == false) {
+                memcpy(conn->content + conn->recgot, data, clen);
+            } else if (h->type == FCGI_PARAMS) {
+                if (conn->paramslen + clen > QFCGI_MAX_PARAMS) return false;
+                unsigned char *tmp = (unsigned char *)Q_REALLOC(conn->params,
+                                                              conn->paramslen + clen);
+                if (tmp == NULL) return false;
+                conn->params = tmp;
+                memcpy(conn->params + conn->paramslen, data, clen);
+                conn->paramslen += clen;
+            } else if (conn->req != NULL) {
+                if (_ev_body(conn->req, data, clen) == false) return false;
+            } else if (conn->spool != NULL) {
+                if (fwrite(data, 1, clen, conn->spool) != clen) return false;
+            } else if (conn->bodylen + clen > QFCGI_EV_MEMBODY) {
+                conn->spool = tmpfile();
+                if (conn->spool == NULL ||
+                    fwrite(conn->body, 1, conn->bodylen, conn->spool) != conn->bodylen ||
+                    fwrite(data, 1, clen, conn->spool) != clen) {
+                    return false;
+                }
+                Q_FREE(conn->body);
+                conn->body = NULL;
+                conn->bodysize = 0;
+            } else {
+                if (conn->bodylen + clen > conn->bodysize) {
+                    size_t newsize = (conn->bodysize > 0) ? conn->bodysize * 2 : 4096;
+                    while (newsize < conn->bodylen + clen) newsize *= 2;
+                    char *tmp = (char *)Q_REALLOC(conn->body, newsize);
+                    if (tmp == NULL) return false;
+                    conn->body = tmp;
+                    conn->bodysize = newsize;
+                }
+                memcpy(conn->body + conn->bodylen, data, clen);
+            }
+            if (conn->streamed == true && h->type == FCGI_STDIN) conn->bodylen += clen;
+        }
+        conn->recgot += n;
+        data += n;
+        size -= n;
+        if (conn->recgot < total) break;
+
+        conn->hdrlen = 0;
+        if (_ev_record(loop, conn) == false) return false;
+    }
+
+    return true;
+}
+
+// a record has been received completely.
+static bool _ev_record(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    fcgihdr_t *h = &conn->rec;
+
+    if (h->reqid == 0) { // management record
+        if (h->type == FCGI_GET_VALUES) {
+            unsigned char res[256];
+            size_t ressize = _values_result(loop->maxconns, conn->content,
+                                            h->len, res, sizeof(res));
+            return _ev_queue(conn, FCGI_GET_VALUES_RESULT, 0, res, ressize);
+        }
+        unsigned char body[8] = { (unsigned char)h->type, 0, 0, 0, 0, 0, 0, 0 };
+        return _ev_queue(conn, FCGI_UNKNOWN_TYPE, 0, body, sizeof(body));
+    }
+
+    unsigned char end[8] = { 0, 0, 0, 0, FCGI_REQUEST_COMPLETE, 0, 0, 0 };
+    if (h->type == FCGI_BEGIN_REQUEST) {
+        if (conn->reqid != 0 || loop->stopping == true) {
+            end[4] = (conn->reqid != 0) ? FCGI_CANT_MPX_CONN : FCGI_OVERLOADED;
+            return _ev_queue(conn, FCGI_END_REQUEST, h->reqid, end, sizeof(end));
+        }
+        if (h->len != 8) return false;
+        int role = (conn->content[0] << 8) | conn->content[1];
+        if (role != FCGI_RESPONDER) {
+            end[4] = FCGI_UNKNOWN_ROLE;
+            return _ev_queue(conn, FCGI_END_REQUEST, h->reqid, end, sizeof(end));
+        }
+        conn->reqid = h->reqid;
+        conn->keepconn = ((conn->content[2] & FCGI_KEEP_CONN) != 0);
+        return true;
+    }
+
+    if (h->reqid != conn->reqid) return true;  // stale, ignored
+
+    if (h->type == FCGI_ABORT_REQUEST) {
+        _ev_done(loop, conn, false);
+        if (conn->req != NULL) _ev_detach(conn);
+        _ev_reset(conn);
+        if (conn->keepconn == false) conn->closing = true;
+        return _ev_queue(conn, FCGI_END_REQUEST, h->reqid, end, sizeof(end));
+    }
+    if (h->type == FCGI_PARAMS && h->len == 0 && conn->env == NULL) {
+        conn->env = _params_entry(conn->params, conn->paramslen);
+        Q_FREE(conn->params);
+        conn->params = NULL;
+        conn->paramslen = 0;
+        if (conn->env == NULL) return false;
+        _score_begin(loop->fcgi, conn->env, &conn->started);
+        return (loop->start != NULL) ? _ev_start(loop, conn) : true;
+    }
+    if (h->type == FCGI_STDIN && h->len == 0 && conn->req != NULL) {
+        conn->req->eof = true;  // told after the records at hand
+        return true;
+    }
+    if (h->type == FCGI_STDIN && h->len == 0 && conn->env != NULL) {
+        return _ev_dispatch(loop, conn);
+    }
+
+    return true;
+}
+
+// calls the handler on a complete request and queues the response.
+static bool _ev_dispatch(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    FILE *in;
+    if (conn->spool != NULL) {
+        in = conn->spool;
+        conn->spool = NULL;
+        rewind(in);
+    } else if (conn->bodylen > 0) {
+        in = fmemopen(conn->body, conn->bodylen, "r");
+    } else {
+        in = fopen("/dev/null", "r");
+    }
+
+    char *obuf = NULL;
+    size_t olen = 0;
+    FILE *out = open_memstream(&obuf, &olen);
+    if (in == NULL || out == NULL) {
+        if (in != NULL) fclose(in);
+        if (out != NULL) fclose(out);
+        free(obuf);
+        return false;
+    }
+
+    qcgictx_t ctx;
+    ctx.params = conn->env;
+    ctx.in = in;
+    ctx.out = out;
+    loop->handler(&ctx, loop->arg);
+    fclose(out);
+    fclose(in);
+
+    uint16_t reqid = conn->reqid;
+    unsigned char end[8] = { 0, 0, 0, 0, FCGI_REQUEST_COMPLETE, 0, 0, 0 };
+    bool ret = true;
+    size_t sent;
+    for (sent = 0; ret == true && sent < olen; ) {
+        size_t chunk = olen - sent;
+        if (chunk > FCGI_MAX_CONTENT) chunk = FCGI_MAX_CONTENT;
+        ret = _ev_queue(conn, FCGI_STDOUT, reqid, obuf + sent, chunk);
+        sent += chunk;
+    }
+    free(obuf);  // from open_memstream()
+    ret = ret && _ev_queue(conn, FCGI_STDOUT, reqid, NULL, 0) &&
+          _ev_queue(conn, FCGI_END_REQUEST, reqid, end, sizeof(end));
+
+    if (conn->keepconn == false || loop->stopping == true) conn->closing = true;
+    _ev_done(loop, conn, ret);
+    _ev_reset(conn);
+    if (_count_request(loop->fcgi) == true) qfcgi_stop(loop->fcgi);
+
+    return ret;
+}
+
+// hands a request over to qfcgi_loop_async() once its parameters arrived.
+static bool _ev_start(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    qfcgireq_t *req = (qfcgireq_t *)Q_CALLOC(1, sizeof(qfcgireq_t));
+    if (req == NULL) return false;
+    req->loop = loop;
+    req->conn = conn;
+    req->reqid = conn->reqid;
+    req->params = conn->env;
+    req->ctx.params = conn->env;
+    conn->env = NULL;
+    conn->req = req;
+
+    loop->start(req, loop->arg);
+    return true;
+}
+
+static bool _ev_body(qfcgireq_t *req, const void *data, size_t size)
+{
+    // spooled like the body of qfcgi_loop(), the unread part is kept in order
+    if (req->spool != NULL || req->inlen - req->inpos + size > QFCGI_EV_MEMBODY) {
+        if (req->spool == NULL) req->spool = tmpfile();
+        if (req->spool == NULL || fseeko(req->spool, 0, SEEK_END) != 0 ||
+            fwrite(data, 1, size, req->spool) != size) {
+            return false;
+        }
+        req->spoollen += size;
+        return true;
+    }
+
+    if (req->inpos > 0 && req->inlen + size > req->insize) {
+        memmove(req->inbuf, req->inbuf + req->inpos, req->inlen - req->inpos);
+        req->inlen -= req->inpos;
+        req->inpos = 0;
+    }
+    if (req->inlen + size > req->insize) {
+        size_t newsize = (req->insize > 0) ? req->insize * 2 : 4096;
+        while (newsize < req->inlen + size) newsize *= 2;
+        char *tmp = (char *)Q_REALLOC(req->inbuf, newsize);
+        if (tmp == NULL) return false;
+        req->inbuf = tmp;
+        req->insize = newsize;
+    }
+    memcpy(req->inbuf + req->inlen, data, size);
+    req->inlen += size;
+    return true;
+}
+
+// bytes of the body received and not read yet.
+static size_t _ev_unread(qfcgireq_t *req)
+{
+    return (req->inlen - req->inpos) + (size_t)(req->spoollen - req->spoolpos);
+}
+
+// services a connection again after the current batch of events.
+static void _ev_kick(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    if (conn->kicked == true) return;
+    conn->kicked = true;
+    conn->kicknext = loop->kicks;
+    loop->kicks = conn;
+}
+
+// the request outlives the connection as aborted until qfcgireq_end().
+static void _ev_detach(fcgiconn_t *conn)
+{
+    qfcgireq_t *req = conn->req;
+    conn->req = NULL;
+    req->conn = NULL;
+    req->aborted = true;
+    _ev_notify(req);
+}
+
+// calls the callback of qfcgireq_wait() if it can go on.
+static void _ev_notify(qfcgireq_t *req)
+{
+    if (req->cb == NULL) return;
+
+    bool ready = (req->aborted == true);
+    if ((req->events & Q_FCGIREQ_READ) != 0 &&
+        (_ev_unread(req) > 0 || req->eof == true)) {
+        ready = true;
+    }
+    if ((req->events & Q_FCGIREQ_EOF) != 0 && req->eof == true) ready = true;
+    if ((req->events & Q_FCGIREQ_DRAIN) != 0 &&
+        (req->conn == NULL || req->conn->wlen == 0)) {
+        ready = true;
+    }
+    if (ready == false) return;
+
+    qfcgireq_cb_t cb = req->cb;
+    void *arg = req->cbarg;
+    req->cb = NULL;
+    req->events = 0;
+    cb(req, arg);  // may end the request
+}
+
+// takes a request of the loop off the scoreboard.
+static void _ev_done(fcgiloop_t *loop, fcgiconn_t *conn, bool ok)
+{
+    if (conn->started == 0) return;
+    _score_end(loop->fcgi, conn->started, ok);
+    conn->started = 0;
+}
+
+static ssize_t _req_read(void *cookie, char *buf, size_t size)
+{
+    return (ssize_t)qfcgireq_read((qfcgireq_t *)cookie, buf, size);
+}
+
+static ssize_t _req_write(void *cookie, const char *buf, size_t size)
+{
+    qfcgireq_t *req = (qfcgireq_t *)cookie;
+    if (req->conn == NULL) return -1;
+
+    size_t sent;
+    for (sent = 0; sent < size; ) {
+        size_t chunk = size - sent;
+        if (chunk > FCGI_MAX_CONTENT) chunk = FCGI_MAX_CONTENT;
+        if (_ev_queue(req->conn, FCGI_STDOUT, req->reqid, buf + sent,
+                      chunk) == false) {
+            return -1;
+        }
+        sent += chunk;
+    }
+    _ev_kick(req->loop, req->conn);
+    return (ssize_t)size;
+}
+
+static bool _ev_queue(fcgiconn_t *conn, int type, uint16_t reqid,
+                      const void *data, size_t size)
+{
+    size_t need = conn->wlen + FCGI_HEADER_LEN + size;
+    if (need > conn->wsize) {
+        size_t newsize = (conn->wsize > 0) ? conn->wsize * 2 : 4096;
+        while (newsize < need) newsize *= 2;
+        unsigned char *tmp = (unsigned char *)Q_REALLOC(conn->wbuf, newsize);
+        if (tmp == NULL) return false;
+        conn->wbuf = tmp;
+        conn->wsize = newsize;
+    }
+
+    unsigned char *h = conn->wbuf + conn->wlen;
+    h[0] = FCGI_VERSION_1;
+    h[1] = (unsigned char)type;
+    h[2] = (reqid >> 8) & 0xff;
+    h[3] = reqid & 0xff;
+    h[4] = (size >> 8) & 0xff;
+    h[5] = size & 0xff;
+    h[6] = 0;
+    h[7] = 0;
+    if (size > 0) memcpy(h + FCGI_HEADER_LEN, data, size);
+    conn->wlen = need;
+
+    return true;
+}
+
+// sends queued output without blocking, false if the connection is gone.
+static bool _ev_flush(fcgiloop_t *loop, fcgiconn_t *conn)
+{
+    while (conn->wpos < conn->wlen) {
+        ssize_t n = send(conn->fd, conn->wbuf + conn->wpos,
+                         conn->wlen - conn->wpos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        _score_io(loop->fcgi, 0, n);
+        conn->wpos += n;
+    }
+
+    if (conn->wpos == conn->wlen) {
+        conn->wpos = conn->wlen = 0;
+    } else if (conn->wpos > conn->wsize / 2) {
+        memmove(conn->wbuf, conn->wbuf + conn->wpos, conn->wlen - conn->wpos);
+        conn->wlen -= conn->wpos;
+        conn->wpos = 0;
+    }
+    return true;
+}
+#endif /* QFCGI_EPOLL */
+
+static bool _bind(qfcgi_t *fcgi)
+{
+    if (_open_streams(fcgi) == false) return false;
+
+    fflush(stdout);
+    fcgi->orig_stdin = stdin;
+    fcgi->orig_stdout = stdout;
+    fcgi->orig_environ = environ;
+    stdin = fcgi->in;
+    stdout = fcgi->out;
+    environ = fcgi->envp;
+
+    return true;
+}
+
+static void _unbind(qfcgi_t *fcgi)
+{
+    if (fcgi->out == NULL) return;
+
+    stdin = fcgi->orig_stdin;
+    stdout = fcgi->orig_stdout;
+    environ = fcgi->orig_environ;
+
+    _close_streams(fcgi);
+}
+
+static void _clear_request(qfcgi_t *fcgi)
+{
+    if (fcgi->params != NULL) {
+        fcgi->params->free(fcgi->params);
+        fcgi->params = NULL;
+    }
+    _q_freeenv(fcgi->envp);
+    fcgi->envp = NULL;
+    fcgi->reqid = 0;
+}
+
+static void _close_conn(qfcgi_t *fcgi)
+{
+    if (fcgi->fd >= 0) close(fcgi->fd);
+    fcgi->fd = -1;
+    fcgi->rpos = fcgi->rlen = 0;
+}
+
+#endif /* QFCGI_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
@@ -0,0 +1,830 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * @file qhttpd.c Embedded HTTP/1.1 server API
+ *
+ * A small HTTP/1.1 server to run and load test CGI programs without a web
+ * server. Each request is mapped onto the CGI environment, stdin and
+ * stdout of the process, so qcgireq_parse(), qcgires_*() and qcgisess_*()
+ * run unchanged. Persistent connections, pipelined requests and
+ * Content-Length or chunked request bodies are supported.
+ *
+ * @code
+ *   qhttpd_t *httpd = qhttpd_listen("127.0.0.1:8080", 0);
+ *   while (qhttpd_accept(httpd) == true) {
+ *     qentry_t *req = qcgireq_parse(NULL, 0);
+ *     qcgires_setcontenttype(req, "text/plain");
+ *     printf("Hello %s\n", req->getstr(req, "name", false));
+ *     req->free(req);
+ *   }
+ *   qhttpd_free(httpd);
+ * @endcode
+ *
+ * @note
+ * Meant for development and benchmarking, not to face the Internet. One
+ * request is served at a time, while idle keep-alive connections wait in
+ * a poll set. The program's output is buffered and sent with a
+ * Content-Length once the request is finished; the CGI "Status" and
+ * "Location" headers set the status line. Not available when qDecoder is
+ * built with --enable-fastcgi.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#endif
+#include "qdecoder.h"
+#include "internal.h"
+
+#if !defined(ENABLE_FASTCGI) && !defined(_WIN32) &&                        \
+    (defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) ||    \
+     defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
+#define QHTTPD_NATIVE
+#endif
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QHTTPD_NATIVE
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    (0)
+#endif
+
+#define QHTTPD_MAXCONNS         (256)       // connections held at once
+#define QHTTPD_MAXHEAD          (64 * 1024) // request line and headers
+#define QHTTPD_MAXNAME          (250)       // header name
+#define QHTTPD_MAXCHUNKED       (64 * 1024 * 1024)  // decoded chunked body
+#define QHTTPD_TIMEOUT          (10)        // seconds, for a stalled client
+#define QHTTPD_READBUF_SIZE     (16 * 1024)
+
+extern char **environ;
+
+typedef struct {
+    int fd;
+    char addr[64];
+    char port[8];
+    unsigned char rbuf[QHTTPD_READBUF_SIZE];
+    size_t rpos;
+    size_t rlen;
+} httpconn_t;
+
+struct qhttpd_s {
+    int listenfd;
+    char *unixpath;             // unlinked by qhttpd_free()
+    char serverport[8];
+
+    httpconn_t *conns[QHTTPD_MAXCONNS];
+    int nconns;
+    int next;                   // round robin among ready connections
+
+    // current request
+    httpconn_t *conn;           // NULL if none
+    bool keepalive;
+    bool head;                  // HEAD request, no body in the response
+    size_t bodyremain;          // unread Content-Length body
+    char *chunked;              // decoded chunked body
+    qentry_t *params;
+    qcgictx_t ctx;
+    char **envp;
+    FILE *in;
+    FILE *out;
+    char *obuf;
+    size_t olen;
+    FILE *orig_stdin;
+    FILE *orig_stdout;
+    char **orig_environ;
+};
+
+static httpconn_t *_wait_conn(qhttpd_t *httpd);
+static void _close_conn(qhttpd_t *httpd, httpconn_t *conn);
+static ssize_t _conn_read(httpconn_t *conn, void *buf, size_t size);
+static char *_read_line(httpconn_t *conn, char *buf, size_t size);
+static bool _read_request(qhttpd_t *httpd);
+static bool _read_chunked(qhttpd_t *httpd, size_t *len);
+static bool _send_all(int fd, const void *buf, size_t size);
+static bool _sendv(int fd, struct iovec *iov, int iovcnt);
+static bool _send_response(qhttpd_t *httpd);
+static void _send_error(httpconn_t *conn, const char *status);
+static FILE *_open_body(qhttpd_t *httpd);
+static void _clear_request(qhttpd_t *httpd);
+
+#else
+
+struct qhttpd_s {
+    int dummy;
+};
+
+#endif /* QHTTPD_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Open a HTTP listening socket.
+ *
+ * @param addr      "host:port", ":port" or "unix:/path/to/socket"
+ * @param backlog   listen backlog, 0 for the system default
+ *
+ * @return  a pointer of qhttpd_t if successful, otherwise returns NULL
+ */
+qhttpd_t *qhttpd_listen(const char *addr, int backlog)
+{
+#ifdef QHTTPD_NATIVE
+    int listenfd = _q_listen(addr, backlog, false);
+    if (listenfd < 0) {
+        DEBUG("Can't listen on %s", addr);
+        return NULL;
+    }
+
+    qhttpd_t *httpd = (qhttpd_t *)Q_CALLOC(1, sizeof(qhttpd_t));
+    if (httpd == NULL) {
+        close(listenfd);
+        return NULL;
+    }
+    httpd->listenfd = listenfd;
+    if (!strncmp(addr, "unix:", CONST_STRLEN("unix:"))) {
+        httpd->unixpath = Q_STRDUP(addr + CONST_STRLEN("unix:"));
+    } else {
+        const char *colon = strrchr(addr, ':');
+        snprintf(httpd->serverport, sizeof(httpd->serverport), "%s", colon + 1);
+    }
+
+    return httpd;
+#else
+    DEBUG("HTTP server is not available on this build.");
+    return NULL;
+#endif
+}
+
+/**
+ * Wait for the next HTTP request.
+ *
+ * @param httpd     a pointer of qhttpd_t
+ *
+ * @return  true when a request is accepted, false on a listening error
+ *
+ * @note
+ * The previous request is finished first if qhttpd_finish() wasn't
+ * called. Once accepted, getenv(), stdin and stdout refer to the request
+ * until qhttpd_finish(). Malformed requests are answered with an error
+ * status and don't reach the program.
+ */
+bool qhttpd_accept(qhttpd_t *httpd)
+{
+#ifdef QHTTPD_NATIVE
+    if (httpd == NULL) return false;
+    if (httpd->conn != NULL) qhttpd_finish(httpd);
+
+    while (true) {
+        httpd->conn = _wait_conn(httpd);
+        if (httpd->conn == NULL) return false;
+        if (_read_request(httpd) == true) break;
+        _close_conn(httpd, httpd->conn);
+        _clear_request(httpd);
+    }
+
+    fflush(stdout);
+    httpd->orig_stdin = stdin;
+    httpd->orig_stdout = stdout;
+    httpd->orig_environ = environ;
+    stdin = httpd->in;
+    stdout = httpd->out;
+    environ = httpd->envp;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Finish the current HTTP request.
+ *
+ * @param httpd     a pointer of qhttpd_t
+ *
+ * @return  true if the response was sent, otherwise returns false
+ *
+ * @note
+ * Sends the response and restores the environment, stdin and stdout of
+ * the process. The connection is kept for the next request unless the
+ * client or the program asked to close it.
+ */
+bool qhttpd_finish(qhttpd_t *httpd)
+{
+#ifdef QHTTPD_NATIVE
+    if (httpd == NULL || httpd->conn == NULL) return false;
+
+    stdin = httpd->orig_stdin;
+    stdout = httpd->orig_stdout;
+    environ = httpd->orig_environ;
+
+    // consume the rest of the body to stay in sync with the next request.
+    char buf[4096];
+    while (httpd->bodyremain > 0) {
+        size_t size = (httpd->bodyremain < sizeof(buf)) ? httpd->bodyremain : sizeof(buf);
+        ssize_t n = _conn_read(httpd->conn, buf, size);
+        if (n <= 0) {
+            httpd->keepalive = false;
+            break;
+        }
+        httpd->bodyremain -= n;
+    }
+
+    fclose(httpd->out);  // completes obuf
+    httpd->out = NULL;
+    bool ret = _send_response(httpd);
+    if (ret == false || httpd->keepalive == false) _close_conn(httpd, httpd->conn);
+    _clear_request(httpd);
+
+    return ret;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Get the parameters of the current HTTP request.
+ *
+ * @param httpd     a pointer of qhttpd_t
+ *
+ * @return  a qentry_t of CGI environment variables of the request, or NULL
+ *          when no request is accepted. Owned by httpd, valid until
+ *          qhttpd_finish().
+ */
+qentry_t *qhttpd_getparams(qhttpd_t *httpd)
+{
+#ifdef QHTTPD_NATIVE
+    if (httpd == NULL || httpd->conn == NULL) return NULL;
+    return httpd->params;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Get the request context of the current HTTP request.
+ *
+ * @param httpd     a pointer of qhttpd_t
+ *
+ * @return  a request context for qcgireq_parse_ctx(), or NULL when no
+ *          request is accepted. Owned by httpd, valid until
+ *          qhttpd_finish().
+ */
+qcgictx_t *qhttpd_getctx(qhttpd_t *httpd)
+{
+#ifdef QHTTPD_NATIVE
+    if (httpd == NULL || httpd->conn == NULL) return NULL;
+    return &httpd->ctx;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Close all connections and the listening socket and free qhttpd_t.
+ *
+ * @param httpd     a pointer of qhttpd_t
+ */
+void qhttpd_free(qhttpd_t *httpd)
+{
+#ifdef QHTTPD_NATIVE
+    if (httpd == NULL) return;
+
+    if (httpd->conn != NULL) qhttpd_finish(httpd);
+    while (httpd->nconns > 0) _close_conn(httpd, httpd->conns[0]);
+    close(httpd->listenfd);
+    if (httpd->unixpath != NULL) {
+        unlink(httpd->unixpath);
+        Q_FREE(httpd->unixpath);
+    }
+    Q_FREE(httpd);
+#endif
+}
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QHTTPD_NATIVE
+
+// picks a connection with a request to read, accepting new ones.
+static httpconn_t *_wait_conn(qhttpd_t *httpd)
+{
+    while (true) {
+        // pipelined requests already read
+        int i;
+        for (i = 0; i < httpd->nconns; i++) {
+            httpconn_t *conn = httpd->conns[(httpd->next + i) % httpd->nconns];
+            if (conn->rpos < conn->rlen) {
+                httpd->next = (httpd->next + i + 1) % httpd->nconns;
+                return conn;
+            }
+        }
+
+        struct pollfd pfd[QHTTPD_MAXCONNS + 1];
+        pfd[0].fd = httpd->listenfd;
+        pfd[0].events = (httpd->nconns < QHTTPD_MAXCONNS) ? POLLIN : 0;
+        for (i = 0; i < httpd->nconns; i++) {
+            pfd[i + 1].fd = httpd->conns[i]->fd;
+            pfd[i + 1].events = POLLIN;
+        }
+        if (poll(pfd, httpd->nconns + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+
+        for (i = 0; i < httpd->nconns; i++) {
+            int idx = (httpd->next + i) % httpd->nconns;
+            if (pfd[idx + 1].revents != 0) {
+                httpd->next = (idx + 1) % httpd->nconns;
+                return httpd->conns[idx];
+            }
+        }
+
+        if (pfd[0].revents == 0) continue;
+        struct sockaddr_storage sa;
+        socklen_t salen = sizeof(sa);
+        int fd = accept(httpd->listenfd, (struct sockaddr *)&sa, &salen);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return NULL;
+        }
+
+        httpconn_t *conn = (httpconn_t *)Q_CALLOC(1, sizeof(httpconn_t));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        if (sa.ss_family == AF_UNIX || getnameinfo((struct sockaddr *)&sa, salen,
+                conn->addr, sizeof(conn->addr), conn->port, sizeof(conn->port),
+                NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+            strcpy(conn->addr, "127.0.0.1");
+            strcpy(conn->port, "0");
+        }
+        struct timeval tv = { QHTTPD_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        httpd->conns[httpd->nconns++] = conn;
+    }
+}
+
+static void _close_conn(qhttpd_t *httpd, httpconn_t *conn)
+{
+    int i;
+    for (i = 0; i < httpd->nconns; i++) {
+        if (httpd->conns[i] == conn) {
+            httpd->conns[i] = httpd->conns[--httpd->nconns];
+            break;
+        }
+    }
+    close(conn->fd);
+    Q_FREE(conn);
+    if (httpd->conn == conn) httpd->conn = NULL;
+}
+
+static ssize_t _conn_read(httpconn_t *conn, void *buf, size_t size)
+{
+    if (conn->rpos == conn->rlen) {
+        if (size >= sizeof(conn->rbuf)) {
+            ssize_t n;
+            while ((n = recv(conn->fd, buf, size, 0)) < 0 && errno == EINTR);
+            return n;
+        }
+        ssize_t n;
+        while ((n = recv(conn->fd, conn->rbuf, sizeof(conn->rbuf), 0)) < 0 &&
+               errno == EINTR);
+        if (n <= 0) return n;
+        conn->rpos = 0;
+        conn->rlen = n;
+    }
+
+    size_t n = conn->rlen - conn->rpos;
+    if (n > size) n = size;
+    memcpy(buf, conn->rbuf + conn->rpos, n);
+    conn->rpos += n;
+    return n;
+}
+
+// reads a line without its CRLF, NULL at EOF or when it doesn't fit.
+static char *_read_line(httpconn_t *conn, char *buf, size_t size)
+{
+    size_t len = 0;
+    while (true) {
+        if (conn->rpos == conn->rlen) {
+            ssize_t n;
+            while ((n = recv(conn->fd, conn->rbuf, sizeof(conn->rbuf), 0)) < 0 &&
+                   errno == EINTR);
+            if (n <= 0) return NULL;
+            conn->rpos = 0;
+            conn->rlen = n;
+        }
+        char c = conn->rbuf[conn->rpos++];
+        if (c == '\n') break;
+        if (len + 1 >= size) return NULL;
+        buf[len++] = c;
+    }
+    if (len > 0 && buf[len - 1] == '\r') len--;
+    buf[len] = '\0';
+    return buf;
+}
+
+static bool _read_request(qhttpd_t *httpd)
+{
+    httpconn_t *conn = httpd->conn;
+    char line[8 * 1024];
+
+    // request line, empty lines before it are ignored
+    do {
+        if (_read_line(conn, line, sizeof(line)) == NULL) return false;
+    } while (line[0] == '\0');
+
+    char *method = line;
+    char *uri = strchr(method, ' ');
+    char *proto = (uri != NULL) ? strchr(uri + 1, ' ') : NULL;
+    if (proto == NULL || strncmp(proto + 1, "HTTP/1.", CONST_STRLEN("HTTP/1."))) {
+        _send_error(conn, "400 Bad Request");
+        return false;
+    }
+    *uri++ = '\0';
+    *proto++ = '\0';
+
+    httpd->params = qEntry();
+    if (httpd->params == NULL) return false;
+    qentry_t *env = httpd->params;
+    env->putstr(env, "GATEWAY_INTERFACE", "CGI/1.1", true);
+    env->putstr(env, "SERVER_SOFTWARE", "qDecoder", true);
+    env->putstr(env, "SERVER_PROTOCOL", proto, true);
+    env->putstr(env, "SERVER_PORT", httpd->serverport, true);
+    env->putstr(env, "REQUEST_METHOD", method, true);
+    env->putstr(env, "REQUEST_URI", uri, true);
+    env->putstr(env, "REMOTE_ADDR", conn->addr, true);
+    env->putstr(env, "REMOTE_PORT", conn->port, true);
+    env->putstr(env, "SCRIPT_NAME", "", true);
+    char *query = strchr(uri, '?');
+    env->putstr(env, "QUERY_STRING", (query != NULL) ? query + 1 : "", true);
+    if (query != NULL) *query = '\0';
+    env->putstr(env, "PATH_INFO", uri, true);
+
+    httpd->head = !strcmp(method, "HEAD");
+    httpd->keepalive = strcmp(proto, "HTTP/1.0");  // 1.1 defaults to keep-alive
+    bool chunked = false, expect = false;
+
+    size_t headsize = 0;
+    while (true) {
+        if (_read_line(conn, line, sizeof(line)) == NULL) return false;
+        if (line[0] == '\0') break;
+        headsize += strlen(line);
+        char *value = strchr(line, ':');
+        if (value == NULL || headsize > QHTTPD_MAXHEAD ||
+            value - line > QHTTPD_MAXNAME) {
+            _send_error(conn, "400 Bad Request");
+            return false;
+        }
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+
+        if (!strcasecmp(line, "Connection")) {
+            if (strcasestr(value, "close") != NULL) httpd->keepalive = false;
+            if (strcasestr(value, "keep-alive") != NULL) httpd->keepalive = true;
+        } else if (!strcasecmp(line, "Transfer-Encoding")) {
+            chunked = (strcasestr(value, "chunked") != NULL);
+        } else if (!strcasecmp(line, "Expect")) {
+            expect = (strcasecmp(value, "100-continue") == 0);
+        }
+
+        // Content-Type and Content-Length go without the HTTP_ prefix
+        char name[CONST_STRLEN("HTTP_") + QHTTPD_MAXNAME + 1];
+        bool content = (!strcasecmp(line, "Content-Type") ||
+                        !strcasecmp(line, "Content-Length"));
+        strcpy(name, content ? "" : "HTTP_");
+        strcat(name, line);
+        char *p;
+        for (p = name; *p != '\0'; p++) {
+            *p = (*p == '-') ? '_' : toupper((unsigned char)*p);
+        }
+
+        const char *prev = env->getstr(env, name, false);
+        if (prev != NULL) { // repeated headers are joined
+            const char *sep = !strcmp(name, "HTTP_COOKIE") ? "; " : ", ";
+            char *joined = (char *)Q_MALLOC(strlen(prev) + strlen(sep) + strlen(value) + 1);
+            if (joined == NULL) return false;
+            sprintf(joined, "%s%s%s", prev, sep, value);
+            env->putstr(env, name, joined, true);
+            Q_FREE(joined);
+        } else {
+            env->putstr(env, name, value, true);
+        }
+    }
+
+    const char *host = env->getstr(env, "HTTP_HOST", false);
+    if (host != NULL) {
+        char *servername = Q_STRDUP(host);
+        char *colon = (servername != NULL) ? strrchr(servername, ':') : NULL;
+        if (colon != NULL && strchr(colon, ']') == NULL) *colon = '\0';
+        if (servername != NULL) env->putstr(env, "SERVER_NAME", servername, true);
+        Q_FREE(servername);
+    }
+
+    if (expect == true) {
+        const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (_send_all(conn->fd, cont, strlen(cont)) == false) return false;
+    }
+
+    if (chunked == true) {
+        size_t len;
+        if (_read_chunked(httpd, &len) == false) {
+            _send_error(conn, "400 Bad Request");
+            return false;
+        }
+        char lenstr[32];
+        snprintf(lenstr, sizeof(lenstr), "%zu", len);
+        env->putstr(env, "CONTENT_LENGTH", lenstr, true);
+        httpd->bodyremain = 0;
+        httpd->in = (len > 0) ? fmemopen(httpd->chunked, len, "r") : NULL;
+    } else {
+        const char *cl = env->getstr(env, "CONTENT_LENGTH", false);
+        long long len = (cl != NULL) ? atoll(cl) : 0;
+        if (len < 0) {
+            _send_error(conn, "400 Bad Request");
+            return false;
+        }
+        httpd->bodyremain = (size_t)len;
+    }
+    if (httpd->in == NULL) httpd->in = _open_body(httpd);
+
+    httpd->out = open_memstream(&httpd->obuf, &httpd->olen);
+    httpd->envp = _q_makeenv(env);
+    if (httpd->in == NULL || httpd->out == NULL || httpd->envp == NULL) return false;
+
+    httpd->ctx.params = httpd->params;
+    httpd->ctx.in = httpd->in;
+    httpd->ctx.out = httpd->out;
+    return true;
+}
+
+// decodes a chunked body into memory.
+static bool _read_chunked(qhttpd_t *httpd, size_t *len)
+{
+    httpconn_t *conn = httpd->conn;
+    size_t size = 0;
+    char line[1024];
+
+    while (true) {
+        if (_read_line(conn, line, sizeof(line)) == NULL) return false;
+        char *end;
+        unsigned long chunk = strtoul(line, &end, 16);
+        if (end == line) return false;
+        if (chunk == 0) break;
+        if (size + chunk > QHTTPD_MAXCHUNKED) return false;
+
+        char *tmp = (char *)Q_REALLOC(httpd->chunked, size + chunk);
+        if (tmp == NULL) return false;
+        httpd->chunked = tmp;
+        size_t got = 0;
+        while (got < chunk) {
+            ssize_t n = _conn_read(conn, httpd->chunked + size + got, chunk - got);
+            if (n <= 0) return false;
+            got += n;
+        }
+        size += chunk;
+        if (_read_line(conn, line, sizeof(line)) == NULL || line[0] != '\0') {
+            return false;
+        }
+    }
+
+    // trailers
+    do {
+        if (_read_line(conn, line, sizeof(line)) == NULL) return false;
+    } while (line[0] != '\0');
+
+    *len = size;
+    return true;
+}
+
+#if defined(__GLIBC__)
+static ssize_t _body_read(void *cookie, char *buf, size_t size)
+#else
+static int _body_read(void *cookie, char *buf, int size)
+#endif
+{
+    qhttpd_t *httpd = (qhttpd_t *)cookie;
+    if ((size_t)size > httpd->bodyremain) size = httpd->bodyremain;
+    if (size == 0) return 0;
+    ssize_t n = _conn_read(httpd->conn, buf, size);
+    if (n <= 0) {
+        httpd->keepalive = false;
+        return -1;
+    }
+    httpd->bodyremain -= n;
+    return n;
+}
+
+// a stream of the request body, limited to its Content-Length.
+static FILE *_open_body(qhttpd_t *httpd)
+{
+#if defined(__GLIBC__)
+    cookie_io_functions_t io;
+    memset(&io, 0, sizeof(io));
+    io.read = _body_read;
+    return fopencookie(httpd, "r", io);
+#else
+    return funopen(httpd, _body_read, NULL, NULL, NULL);
+#endif
+}
+
+static bool _send_all(int fd, const void *buf, size_t size)
+{
+    const char *p = (const char *)buf;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool _sendv(int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+
+        // advance over what was sent
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov[0].iov_len) {
+            n -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + n;
+            msg.msg_iov[0].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// turns the CGI output into a HTTP response.
+static bool _send_response(qhttpd_t *httpd)
+{
+    char *obuf = httpd->obuf;
+    size_t olen = httpd->olen;
+
+    // CGI headers end with an empty line, LF alone is tolerated.
+    char *body = NULL;
+    size_t i;
+    for (i = 0; i < olen; i++) {
+        if (obuf[i] != '\n') continue;
+        if (i + 1 < olen && obuf[i + 1] == '\n') {
+            body = obuf + i + 2;
+            break;
+        }
+        if (i + 2 < olen && obuf[i + 1] == '\r' && obuf[i + 2] == '\n') {
+            body = obuf + i + 3;
+            break;
+        }
+    }
+    if (body == NULL) body = obuf;  // no headers
+    size_t bodylen = olen - (body - obuf);
+
+    size_t hsize = 2 * (body - obuf) + 2;  // LF alone becomes CRLF
+    char *head = (char *)Q_MALLOC(hsize);
+    if (head == NULL) return false;
+    char status[128] = "200 OK";
+    size_t hlen = 0;
+    bool location = false, hasstatus = false;
+
+    char *line = obuf;
+    while (line < body) {
+        char *eol = memchr(line, '\n', body - line);
+        if (eol == NULL) eol = body;
+        size_t len = eol - line;
+        if (len > 0 && line[len - 1] == '\r') len--;
+        if (len == 0) break;
+
+        if (len > 7 && !strncasecmp(line, "Status:", 7)) {
+            char *p = line + 7;
+            while (*p == ' ') p++;
+            size_t slen = len - (p - line);
+            if (slen >= sizeof(status)) slen = sizeof(status) - 1;
+            memcpy(status, p, slen);
+            status[slen] = '\0';
+            hasstatus = true;
+        } else if (len > 15 && !strncasecmp(line, "Content-Length:", 15)) {
+            // recomputed below
+        } else if (len > 11 && !strncasecmp(line, "Connection:", 11)) {
+            if (memmem(line, len, "close", 5) != NULL) httpd->keepalive = false;
+        } else {
+            if (len > 9 && !strncasecmp(line, "Location:", 9)) location = true;
+            memcpy(head + hlen, line, len);
+            hlen += len;
+            memcpy(head + hlen, "\r\n", 2);
+            hlen += 2;
+        }
+        line = eol + 1;
+    }
+    if (location == true && hasstatus == false) strcpy(status, "302 Found");
+
+    char date[64];
+    time_t now = time(NULL);
+    struct tm gmtm;
+    gmtime_r(&now, &gmtm);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &gmtm);
+
+    char first[256];
+    int flen = snprintf(first, sizeof(first),
+                        "HTTP/1.1 %s\r\nDate: %s\r\nContent-Length: %zu\r\n"
+                        "Connection: %s\r\n", status, date, bodylen,
+                        (httpd->keepalive == true) ? "keep-alive" : "close");
+    memcpy(head + hlen, "\r\n", 2);
+    hlen += 2;
+
+    // in one go, small writes would wait on delayed ACKs
+    struct iovec iov[3];
+    iov[0].iov_base = first;
+    iov[0].iov_len = flen;
+    iov[1].iov_base = head;
+    iov[1].iov_len = hlen;
+    iov[2].iov_base = body;
+    iov[2].iov_len = (httpd->head == true) ? 0 : bodylen;
+    bool ret = _sendv(httpd->conn->fd, iov, 3);
+    Q_FREE(head);
+
+    return ret;
+}
+
+static void _send_error(httpconn_t *conn, const char *status)
+{
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Length: 0\r\n"
+                       "Connection: close\r\n\r\n", status);
+    _send_all(conn->fd, buf, len);
+}
+
+static void _clear_request(qhttpd_t *httpd)
+{
+    if (httpd->in != NULL) fclose(httpd->in);
+    if (httpd->out != NULL) fclose(httpd->out);
+    httpd->in = httpd->out = NULL;
+    free(httpd->obuf);  // from open_memstream()
+    httpd->obuf = NULL;
+    httpd->olen = 0;
+    Q_FREE(httpd->chunked);
+    httpd->chunked = NULL;
+    httpd->bodyremain = 0;
+
+    if (httpd->params != NULL) httpd->params->free(httpd->params);
+    httpd->params = NULL;
+    _q_freeenv(httpd->envp);
+    httpd->envp = NULL;
+    memset((void *)&httpd->ctx, 0, sizeof(httpd->ctx));
+    httpd->conn = NULL;
+}
+
+#endif /* QHTTPD_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
@@ -0,0 +1,390 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * @file qscgi.c SCGI API
+ *
+ * Serves requests over SCGI from a persistent process. While a request is
+ * accepted, the environment, stdin and stdout of the process are bound to
+ * it, so qcgireq_parse(), qcgires_*() and qcgisess_*() work on it as they
+ * do for a CGI program.
+ *
+ * @code
+ *   qscgi_t *scgi = qscgi_listen("127.0.0.1:4000", 0);
+ *   while (qscgi_accept(scgi) == true) {
+ *     qentry_t *req = qcgireq_parse(NULL, 0);
+ *     qcgires_setcontenttype(req, "text/plain");
+ *     printf("Hello %s\n", req->getstr(req, "name", false));
+ *     req->free(req);
+ *   }
+ *   qscgi_free(scgi);
+ * @endcode
+ *
+ * @note
+ * SCGI carries one request per connection. The header block is parsed
+ * straight into the request parameters and the body is read from the
+ * connection as the program reads stdin. Not available when qDecoder is
+ * built with --enable-fastcgi.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+#include "qdecoder.h"
+#include "internal.h"
+
+#if !defined(ENABLE_FASTCGI) && !defined(_WIN32) &&                        \
+    (defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) ||    \
+     defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
+#define QSCGI_NATIVE
+#endif
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QSCGI_NATIVE
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    (0)
+#endif
+
+#define QSCGI_MAX_HEADERS       (1024 * 1024)   // bytes of the header block
+
+extern char **environ;
+
+struct qscgi_s {
+    int listenfd;
+    char *unixpath;             // unlinked by qscgi_free()
+
+    int fd;                     // current connection, -1 if none
+    qentry_t *params;
+    qcgictx_t ctx;
+    char **envp;
+    FILE *in;
+    FILE *out;
+    FILE *orig_stdin;
+    FILE *orig_stdout;
+    char **orig_environ;
+};
+
+static bool _read_headers(qscgi_t *scgi);
+static FILE *_open_out(qscgi_t *scgi);
+static void _clear_request(qscgi_t *scgi);
+
+#else
+
+struct qscgi_s {
+    int dummy;
+};
+
+#endif /* QSCGI_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
+
+/**
+ * Open a SCGI listening socket.
+ *
+ * @param addr      "unix:/path/to/socket", "host:port" or ":port".
+ *                  NULL to use the socket on file descriptor 0.
+ * @param backlog   listen backlog, 0 for the system default
+ *
+ * @return  a pointer of qscgi_t if successful, otherwise returns NULL
+ */
+qscgi_t *qscgi_listen(const char *addr, int backlog)
+{
+#ifdef QSCGI_NATIVE
+    int listenfd = (addr != NULL) ? _q_listen(addr, backlog, false) : 0;
+    if (listenfd < 0) {
+        DEBUG("Can't listen on %s", addr);
+        return NULL;
+    }
+
+    qscgi_t *scgi = (qscgi_t *)Q_CALLOC(1, sizeof(qscgi_t));
+    if (scgi == NULL) {
+        if (addr != NULL) close(listenfd);
+        return NULL;
+    }
+    scgi->listenfd = listenfd;
+    scgi->fd = -1;
+    if (addr != NULL && !strncmp(addr, "unix:", CONST_STRLEN("unix:"))) {
+        scgi->unixpath = Q_STRDUP(addr + CONST_STRLEN("unix:"));
+    }
+
+    return scgi;
+#else
+    DEBUG("SCGI is not available on this build.");
+    return NULL;
+#endif
+}
+
+/**
+ * Wait for the next SCGI request.
+ *
+ * @param scgi      a pointer of qscgi_t
+ *
+ * @return  true when a request is accepted, false on a listening error
+ *
+ * @note
+ * The previous request is finished first if qscgi_finish() wasn't called.
+ * Once accepted, getenv(), stdin and stdout refer to the request until
+ * qscgi_finish().
+ */
+bool qscgi_accept(qscgi_t *scgi)
+{
+#ifdef QSCGI_NATIVE
+    if (scgi == NULL) return false;
+    if (scgi->fd >= 0) qscgi_finish(scgi);
+
+    while (true) {
+        scgi->fd = accept(scgi->listenfd, NULL, NULL);
+        if (scgi->fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return false;
+        }
+
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(scgi->fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        scgi->in = fdopen(scgi->fd, "r");
+        scgi->out = _open_out(scgi);
+        if (scgi->in != NULL && scgi->out != NULL && _read_headers(scgi) == true) {
+            break;
+        }
+        _clear_request(scgi);
+    }
+    setvbuf(scgi->out, NULL, _IOFBF, 16 * 1024);
+
+    scgi->ctx.params = scgi->params;
+    scgi->ctx.in = scgi->in;
+    scgi->ctx.out = scgi->out;
+
+    fflush(stdout);
+    scgi->orig_stdin = stdin;
+    scgi->orig_stdout = stdout;
+    scgi->orig_environ = environ;
+    stdin = scgi->in;
+    stdout = scgi->out;
+    environ = scgi->envp;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Finish the current SCGI request.
+ *
+ * @param scgi      a pointer of qscgi_t
+ *
+ * @return  true if the response was delivered, otherwise returns false
+ *
+ * @note
+ * Flushes stdout, closes the connection and restores the environment,
+ * stdin and stdout of the process.
+ */
+bool qscgi_finish(qscgi_t *scgi)
+{
+#ifdef QSCGI_NATIVE
+    if (scgi == NULL || scgi->fd < 0) return false;
+
+    stdin = scgi->orig_stdin;
+    stdout = scgi->orig_stdout;
+    environ = scgi->orig_environ;
+
+    bool ret = (fflush(scgi->out) == 0);
+    _clear_request(scgi);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Get the parameters of the current SCGI request.
+ *
+ * @param scgi      a pointer of qscgi_t
+ *
+ * @return  a qentry_t of CGI environment variables sent by the web server,
+ *          or NULL when no request is accepted. Owned by scgi, valid until
+ *          qscgi_finish().
+ */
+qentry_t *qscgi_getparams(qscgi_t *scgi)
+{
+#ifdef QSCGI_NATIVE
+    if (scgi == NULL || scgi->fd < 0) return NULL;
+    return scgi->params;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Get the request context of the current SCGI request.
+ *
+ * @param scgi      a pointer of qscgi_t
+ *
+ * @return  a request context for qcgireq_parse_ctx(), or NULL when no
+ *          request is accepted. Owned by scgi, valid until qscgi_finish().
+ */
+qcgictx_t *qscgi_getctx(qscgi_t *scgi)
+{
+#ifdef QSCGI_NATIVE
+    if (scgi == NULL || scgi->fd < 0) return NULL;
+    return &scgi->ctx;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Close the listening socket and free qscgi_t.
+ *
+ * @param scgi      a pointer of qscgi_t
+ */
+void qscgi_free(qscgi_t *scgi)
+{
+#ifdef QSCGI_NATIVE
+    if (scgi == NULL) return;
+
+    if (scgi->fd >= 0) qscgi_finish(scgi);
+    if (scgi->unixpath != NULL) {
+        close(scgi->listenfd);
+        unlink(scgi->unixpath);
+        Q_FREE(scgi->unixpath);
+    } else if (scgi->listenfd > 0) {
+        close(scgi->listenfd);
+    }
+    Q_FREE(scgi);
+#endif
+}
+
+#ifndef _DOXYGEN_SKIP
+
+#ifdef QSCGI_NATIVE
+
+// reads the netstring "<len>:<name>\0<value>\0...," into params.
+static bool _read_headers(qscgi_t *scgi)
+{
+    size_t len = 0;
+    int c, digits = 0;
+    while ((c = fgetc(scgi->in)) != ':') {
+        if (c < '0' || c > '9' || ++digits > 8) return false;
+        len = (len * 10) + (c - '0');
+    }
+    if (digits == 0 || len == 0 || len > QSCGI_MAX_HEADERS) return false;
+
+    char *buf = (char *)Q_MALLOC(len + 1);
+    if (buf == NULL) return false;
+    if (fread(buf, 1, len, scgi->in) != len || fgetc(scgi->in) != ',' ||
+        buf[len - 1] != '\0') {
+        Q_FREE(buf);
+        return false;
+    }
+
+    scgi->params = qEntry();
+    if (scgi->params == NULL) {
+        Q_FREE(buf);
+        return false;
+    }
+
+    char *p = buf, *end = buf + len;
+    while (p < end) {
+        char *name = p;
+        char *value = name + strlen(name) + 1;
+        if (value >= end || name[0] == '\0') break;
+        p = value + strlen(value) + 1;
+        scgi->params->putstr(scgi->params, name, value, true);
+    }
+    bool complete = (p >= end);
+    Q_FREE(buf);
+
+    if (complete == false || scgi->params->getstr(scgi->params, "CONTENT_LENGTH", false) == NULL) {
+        DEBUG("Malformed SCGI header block.");
+        return false;
+    }
+
+    scgi->envp = _q_makeenv(scgi->params);  // for getenv()
+    return (scgi->envp != NULL);
+}
+
+#if defined(__GLIBC__)
+static ssize_t _out_write(void *cookie, const char *buf, size_t size)
+#else
+static int _out_write(void *cookie, const char *buf, int size)
+#endif
+{
+    // a web server gone away mustn't kill the process with SIGPIPE
+    qscgi_t *scgi = (qscgi_t *)cookie;
+    size_t sent = 0;
+    while (sent < (size_t)size) {
+        ssize_t n = send(scgi->fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        sent += n;
+    }
+    return size;
+}
+
+// a stream of the response, written to the connection.
+static FILE *_open_out(qscgi_t *scgi)
+{
+#if defined(__GLIBC__)
+    cookie_io_functions_t io;
+    memset(&io, 0, sizeof(io));
+    io.write = _out_write;
+    return fopencookie(scgi, "w", io);
+#else
+    return funopen(scgi, NULL, _out_write, NULL, NULL);
+#endif
+}
+
+static void _clear_request(qscgi_t *scgi)
+{
+    if (scgi->out != NULL) fclose(scgi->out);
+    if (scgi->in != NULL) fclose(scgi->in);
+    else if (scgi->fd >= 0) close(scgi->fd);
+    scgi->in = scgi->out = NULL;
+    scgi->fd = -1;
+
+    if (scgi->params != NULL) scgi->params->free(scgi->params);
+    scgi->params = NULL;
+    _q_freeenv(scgi->envp);
+    scgi->envp = NULL;
+    memset((void *)&scgi->ctx, 0, sizeof(scgi->ctx));
+}
+
+#endif /* QSCGI_NATIVE */
+
+#endif /* _DOXYGEN_SKIP */
@@ -0,0 +1,219 @@
+/******************************************************************************
+ * qunit - C Unit Test Framework
+ *
+ * Copyright (c) 2014-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "qtestnet.h"
+
+#define FCGI_BEGIN_REQUEST  (1)
+#define FCGI_END_REQUEST    (3)
+#define FCGI_PARAMS         (4)
+#define FCGI_STDOUT         (6)
+
+static int _connected(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * Returns the path of the unix socket of this test.
+ *
+ * @return path unique to the test process.
+ */
+const char *qtest_sockpath(void) {
+    static char path[64] = "";
+    if (path[0] == '\0') {
+        snprintf(path, sizeof(path), "/tmp/qdecoder-test-%d.sock", getpid());
+    }
+    return path;
+}
+
+/**
+ * Returns the listening address of qtest_sockpath().
+ *
+ * @return "unix:" address for qfcgi_listen() and the like.
+ */
+const char *qtest_sockaddr(void) {
+    static char addr[80] = "";
+    if (addr[0] == '\0') {
+        snprintf(addr, sizeof(addr), "unix:%s", qtest_sockpath());
+    }
+    return addr;
+}
+
+/**
+ * Runs a server in a child process.
+ *
+ * @param serve function run by the child, returns its exit status.
+ * @param arg   argument of serve.
+ *
+ * @return process id of the child.
+ */
+pid_t qtest_fork(int (*serve)(void *arg), void *arg) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    _exit(serve(arg));
+}
+
+/**
+ * Stops a server of qtest_fork() with SIGTERM and waits for it.
+ *
+ * @param pid   process id of the server.
+ *
+ * @return true if it exited with status 0.
+ */
+bool qtest_stop(pid_t pid) {
+    int status;
+    kill(pid, SIGTERM);
+    if (waitpid(pid, &status, 0) != pid) return false;
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/**
+ * Connects to a unix socket. Reading fails after 2 seconds rather than
+ * hanging on a dead server.
+ *
+ * @param path  path of the socket.
+ *
+ * @return connected socket, -1 on failure.
+ */
+int qtest_connect(const char *path) {
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+    return _connected(socket(AF_UNIX, SOCK_STREAM, 0),
+                      (struct sockaddr *)&sun, sizeof(sun));
+}
+
+/**
+ * Connects to a port of the loopback address, like qtest_connect().
+ *
+ * @param port  TCP port.
+ *
+ * @return connected socket, -1 on failure.
+ */
+int qtest_tcpconnect(int port) {
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return _connected(socket(AF_INET, SOCK_STREAM, 0),
+                      (struct sockaddr *)&sin, sizeof(sin));
+}
+
+/**
+ * Sends a FastCGI record, with padding to exercise it.
+ */
+void qtest_fcgi_record(int fd, int type, int id, const void *data,
+                       size_t size) {
+    unsigned char h[8] = { 1, (unsigned char)type, (unsigned char)(id >> 8),
+                           (unsigned char)(id & 0xff), (unsigned char)(size >> 8),
+                           (unsigned char)(size & 0xff), 3, 0 };
+    unsigned char pad[3] = { 0, 0, 0 };
+    write(fd, h, sizeof(h));
+    if (size > 0) write(fd, data, size);
+    write(fd, pad, sizeof(pad));
+}
+
+/**
+ * Sends a FCGI_BEGIN_REQUEST record.
+ */
+void qtest_fcgi_begin(int fd, int id, int role, bool keepconn) {
+    unsigned char body[8] = { 0, (unsigned char)role,
+                              (unsigned char)(keepconn ? 1 : 0), 0, 0, 0, 0, 0 };
+    qtest_fcgi_record(fd, FCGI_BEGIN_REQUEST, id, body, sizeof(body));
+}
+
+/**
+ * Sends a FCGI_PARAMS record of one short name-value pair.
+ */
+void qtest_fcgi_param(int fd, int id, const char *name, const char *value) {
+    unsigned char buf[256];
+    size_t namelen = strlen(name), valuelen = strlen(value);
+    buf[0] = namelen;
+    buf[1] = valuelen;
+    memcpy(buf + 2, name, namelen);
+    memcpy(buf + 2 + namelen, value, valuelen);
+    qtest_fcgi_record(fd, FCGI_PARAMS, id, buf, 2 + namelen + valuelen);
+}
+
+/**
+ * Collects FCGI_STDOUT of a request until its FCGI_END_REQUEST. Records
+ * of other requests are skipped. For management records, id 0, the
+ * content of the first record is returned and status is its type.
+ *
+ * @return length of the output, -1 on failure.
+ */
+int qtest_fcgi_response(int fd, int id, char *out, size_t size,
+                        int *status) {
+    size_t len = 0;
+    while (true) {
+        unsigned char h[8];
+        if (recv(fd, h, sizeof(h), MSG_WAITALL) != sizeof(h)) return -1;
+        size_t clen = (h[4] << 8) | h[5];
+        unsigned char body[65535 + 255];
+        if (clen + h[6] > 0 &&
+            recv(fd, body, clen + h[6], MSG_WAITALL) != (ssize_t)(clen + h[6])) {
+            return -1;
+        }
+        if (id == 0) {
+            *status = h[1];
+            memcpy(out, body, (clen < size) ? clen : size);
+            return clen;
+        }
+        if (((h[2] << 8) | h[3]) != id) continue;
+        if (h[1] == FCGI_STDOUT && len + clen < size) {
+            memcpy(out + len, body, clen);
+            len += clen;
+        } else if (h[1] == FCGI_END_REQUEST) {
+            *status = body[4];
+            out[len] = '\0';
+            return len;
+        }
+    }
+}
+
+static int _connected(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    if (fd < 0) return -1;
+    if (connect(fd, addr, addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    struct timeval tv = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+ * qunit - C Unit Test Framework
+ *
+ * Copyright (c) 2014-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * Sockets and forked servers for the protocol tests of qunit.
+ *
+ * @file qtestnet.h
+ */
+
+#ifndef QTESTNET_H
+#define QTESTNET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* servers */
+extern const char *qtest_sockpath(void);
+extern const char *qtest_sockaddr(void);
+extern pid_t qtest_fork(int (*serve)(void *arg), void *arg);
+extern bool qtest_stop(pid_t pid);
+
+/* clients */
+extern int qtest_connect(const char *path);
+extern int qtest_tcpconnect(int port);
+
+/* FastCGI clients */
+extern void qtest_fcgi_record(int fd, int type, int id, const void *data,
+                              size_t size);
+extern void qtest_fcgi_begin(int fd, int id, int role, bool keepconn);
+extern void qtest_fcgi_param(int fd, int id, const char *name,
+                             const char *value);
+extern int qtest_fcgi_response(int fd, int id, char *out, size_t size,
+                               int *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QTESTNET_H */
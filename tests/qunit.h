@@ -56,7 +56,7 @@ extern long _qunit_current_milli(void);
     } while(0)
 
 #define QUNIT_START(title)                                                  \
-char *_q_title = title;                                                     \
+const char *_q_title = title;                                               \
 int _q_tot_tests = 0;                                                       \
 int _q_tot_failed = 0;                                                      \
 int _q_this_failed = 0;                                                     \
@@ -0,0 +1,141 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qdecoder.h"
+#include "internal.h"
+
+static const char *sha256hex(const void *data, size_t size);
+static const char *hmachex(const void *key, size_t keylen,
+                           const void *data, size_t size);
+static const char *tohex(const unsigned char *digest);
+
+QUNIT_START("Test internal.c/_q_sha256");
+
+TEST("Test SHA-256 with FIPS 180-2 vectors")
+{
+    ASSERT_EQUAL_STR(sha256hex("", 0),
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    ASSERT_EQUAL_STR(sha256hex("abc", 3),
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    ASSERT_EQUAL_STR(sha256hex(two, strlen(two)),
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // fed in uneven pieces
+    char block[1000];
+    memset(block, 'a', sizeof(block));
+    _q_sha256_t ctx;
+    _q_sha256_init(&ctx);
+    int i;
+    for (i = 0; i < 1000; i++) {
+        _q_sha256_update(&ctx, block, 1);
+        _q_sha256_update(&ctx, block, 999);
+    }
+    unsigned char digest[32];
+    _q_sha256_final(&ctx, digest);
+    ASSERT_EQUAL_STR(tohex(digest),
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST("Test HMAC-SHA256 with RFC 4231 vectors")
+{
+    unsigned char key[131];
+    memset(key, 0x0b, 20);
+    ASSERT_EQUAL_STR(hmachex(key, 20, "Hi There", 8),
+        "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+    const char *data = "what do ya want for nothing?";
+    ASSERT_EQUAL_STR(hmachex("Jefe", 4, data, strlen(data)),
+        "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+    // a key longer than the block is hashed first
+    memset(key, 0xaa, sizeof(key));
+    data = "Test Using Larger Than Block-Size Key - Hash Key First";
+    ASSERT_EQUAL_STR(hmachex(key, sizeof(key), data, strlen(data)),
+        "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+}
+
+TEST("Test base64url with RFC 4648 vectors")
+{
+    const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    const char *encoded[] = { "", "Zg", "Zm8", "Zm9v", "Zm9vYg", "Zm9vYmE",
+                              "Zm9vYmFy" };
+    char buf[16];
+    int i;
+    for (i = 0; i < 7; i++) {
+        ASSERT_EQUAL_INT(_q_base64urlencode(buf, plain[i], strlen(plain[i])),
+                         strlen(encoded[i]));
+        ASSERT_EQUAL_STR(buf, encoded[i]);
+        ASSERT_EQUAL_INT(_q_base64urldecode(buf, encoded[i], strlen(encoded[i])),
+                         strlen(plain[i]));
+        ASSERT_EQUAL_MEM(buf, plain[i], strlen(plain[i]));
+    }
+
+    // the url safe alphabet, "+/8=" in base64
+    unsigned char bin[2] = { 0xfb, 0xff };
+    ASSERT_EQUAL_INT(_q_base64urlencode(buf, bin, sizeof(bin)), 3);
+    ASSERT_EQUAL_STR(buf, "-_8");
+    ASSERT_EQUAL_INT(_q_base64urldecode(buf, "-_8", 3), 2);
+    ASSERT_EQUAL_MEM(buf, bin, sizeof(bin));
+
+    // malformed
+    ASSERT_EQUAL_INT(_q_base64urldecode(buf, "+/8", 3), -1);
+    ASSERT_EQUAL_INT(_q_base64urldecode(buf, "Zm9v=", 5), -1);
+    ASSERT_EQUAL_INT(_q_base64urldecode(buf, "Zm9vY", 5), -1);
+}
+
+QUNIT_END();
+
+static const char *sha256hex(const void *data, size_t size)
+{
+    unsigned char digest[32];
+    _q_sha256_t ctx;
+    _q_sha256_init(&ctx);
+    _q_sha256_update(&ctx, data, size);
+    _q_sha256_final(&ctx, digest);
+    return tohex(digest);
+}
+
+static const char *hmachex(const void *key, size_t keylen,
+                           const void *data, size_t size)
+{
+    unsigned char mac[32];
+    _q_hmac_sha256(mac, key, keylen, data, size);
+    return tohex(mac);
+}
+
+static const char *tohex(const unsigned char *digest)
+{
+    static char hex[64 + 1];
+    int i;
+    for (i = 0; i < 32; i++) {
+        sprintf(hex + (i * 2), "%02x", digest[i]);
+    }
+    return hex;
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qdecoder.h"
+#include <stdlib.h>
+
+// an allocator counting its calls
+typedef struct {
+    int mallocs;
+    int reallocs;
+    int frees;
+} counter_t;
+
+static void *count_malloc(size_t size, void *userdata);
+static void *count_realloc(void *ptr, size_t size, void *userdata);
+static void count_free(void *ptr, void *userdata);
+
+QUNIT_START("Test qalloc.c");
+
+TEST("Test a custom allocator")
+{
+    counter_t counter = { 0, 0, 0 };
+    qdecoder_allocator_t allocator = {
+        count_malloc, count_realloc, count_free, &counter, false
+    };
+
+    // partly set functions are refused
+    qdecoder_allocator_t partial = { count_malloc, NULL, NULL, NULL, false };
+    ASSERT_FALSE(qdecoder_set_allocator(&partial));
+
+    ASSERT_TRUE(qdecoder_set_allocator(&allocator));
+    qentry_t *entry = qEntry();
+    entry->putstr(entry, "name", "value", false);
+    ASSERT_TRUE(counter.mallocs > 0);
+    entry->free(entry);
+    ASSERT_EQUAL_INT(counter.frees, counter.mallocs);
+
+    // memory returned by qDecoder goes back through the allocator
+    entry = qEntry();
+    entry->putstr(entry, "name", "value", false);
+    char *value = entry->getstr(entry, "name", true);
+    ASSERT_EQUAL_STR(value, "value");
+    qdecoder_free(value);
+    entry->free(entry);
+    ASSERT_EQUAL_INT(counter.frees, counter.mallocs);
+
+    // statistics aren't kept without asking
+    qdecoder_allocstat_t stat;
+    ASSERT_FALSE(qdecoder_get_allocstats(&stat));
+
+    ASSERT_TRUE(qdecoder_set_allocator(NULL));
+}
+
+TEST("Test allocation statistics")
+{
+    counter_t counter = { 0, 0, 0 };
+    qdecoder_allocator_t allocator = {
+        count_malloc, count_realloc, count_free, &counter, true
+    };
+    ASSERT_TRUE(qdecoder_set_allocator(&allocator));
+
+    qdecoder_allocstat_t stat;
+    ASSERT_TRUE(qdecoder_get_allocstats(&stat));
+    ASSERT_EQUAL_INT(stat.count, 0);
+
+    qentry_t *entry = qEntry();
+    entry->putstr(entry, "name", "0123456789", false);
+    ASSERT_TRUE(qdecoder_get_allocstats(&stat));
+    ASSERT_EQUAL_INT(stat.count, counter.mallocs);
+    ASSERT_EQUAL_INT(stat.threadcount, stat.count);
+    ASSERT_TRUE(stat.inuse >= strlen("name") + strlen("0123456789") + 2);
+    size_t peak = stat.inuse;
+    entry->free(entry);
+
+    ASSERT_TRUE(qdecoder_get_allocstats(&stat));
+    ASSERT_EQUAL_INT(stat.inuse, 0);
+    ASSERT_EQUAL_INT(stat.peak, peak);
+
+    qdecoder_reset_allocstats();
+    ASSERT_TRUE(qdecoder_get_allocstats(&stat));
+    ASSERT_EQUAL_INT(stat.count, 0);
+    ASSERT_EQUAL_INT(stat.threadbytes, 0);
+
+    // the libc allocator with statistics
+    qdecoder_allocator_t libc = { NULL, NULL, NULL, NULL, true };
+    ASSERT_TRUE(qdecoder_set_allocator(&libc));
+    int mallocs = counter.mallocs;
+    entry = qEntry();
+    ASSERT_TRUE(qdecoder_get_allocstats(&stat));
+    ASSERT_EQUAL_INT(stat.count, 1);
+    ASSERT_EQUAL_INT(counter.mallocs, mallocs);
+    entry->free(entry);
+
+    ASSERT_TRUE(qdecoder_set_allocator(NULL));
+}
+
+TEST("Test allocations counted in parse statistics")
+{
+    qdecoder_allocator_t libc = { NULL, NULL, NULL, NULL, true };
+    ASSERT_TRUE(qdecoder_set_allocator(&libc));
+
+    qentry_t *req = qcgireq_setstats(NULL, true);
+    req = qcgireq_parse_query(req, "a=1&b=2&c=3", Q_CGI_GET);
+    qcgireq_stat_t stat;
+    ASSERT_TRUE(qcgireq_getstats(req, &stat));
+    ASSERT_EQUAL_INT(stat.gets, 3);
+    ASSERT_TRUE(stat.allocs > 0);
+    ASSERT_TRUE(stat.allocsize > 0);
+    req->free(req);
+
+    ASSERT_TRUE(qdecoder_set_allocator(NULL));
+}
+
+QUNIT_END();
+
+static void *count_malloc(size_t size, void *userdata)
+{
+    ((counter_t *)userdata)->mallocs++;
+    return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size, void *userdata)
+{
+    ((counter_t *)userdata)->reallocs++;
+    return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, void *userdata)
+{
+    ((counter_t *)userdata)->frees++;
+    free(ptr);
+}
@@ -0,0 +1,577 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qdecoder.h"
+#include <dirent.h>
+#include <unistd.h>
+
+#define MULTIPART_TYPE  "multipart/form-data; boundary=xx"
+#define MULTIPART_BODY                                                      \
+    "--xx\r\n"                                                              \
+    "Content-Disposition: form-data; name=\"title\"\r\n\r\n"                \
+    "hello\r\n"                                                             \
+    "--xx\r\n"                                                              \
+    "Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n" \
+    "Content-Type: text/plain\r\n\r\n"                                      \
+    "0123456789\r\n"                                                        \
+    "--xx--\r\n"
+
+static qcgictx_t ctx;
+static qentry_t *parse(qentry_t *req, const char *query,
+                       const char *contenttype, const char *body);
+static int count_files(const char *dirpath);
+
+QUNIT_START("Test qcgireq.c");
+
+TEST("Test parsing without limits")
+{
+    qentry_t *req = parse(NULL, "a=1&b=2", "application/x-www-form-urlencoded",
+                          "c=3&d=%34");
+    ASSERT_NOT_NULL(req);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_OK);
+    ASSERT_EQUAL_STR(req->getstr(req, "b", false), "2");
+    ASSERT_EQUAL_STR(req->getstr(req, "d", false), "4");
+    req->free(req);
+}
+
+TEST("Test internal names from clients are dropped")
+{
+    // the process environment, the request isn't bound to a context
+    setenv("REQUEST_METHOD", "GET", 1);
+    setenv("QUERY_STRING", "_Q_CONTEXT=AAAAAAAA&_Q_UPLOAD_BASEPATH=/&a=1", 1);
+    setenv("HTTP_COOKIE", "_Q_LAZY=1; c=2", 1);
+    qentry_t *req = qcgireq_parse(NULL, 0);
+    ASSERT_NULL(qcgireq_getctx(req));
+    ASSERT_NULL(req->getstr(req, "_Q_CONTEXT", false));
+    ASSERT_NULL(req->getstr(req, "_Q_UPLOAD_BASEPATH", false));
+    ASSERT_NULL(req->getstr(req, "_Q_LAZY", false));
+    ASSERT_EQUAL_STR(req->getstr(req, "a", false), "1");
+    ASSERT_EQUAL_STR(req->getstr(req, "c", false), "2");
+    req->free(req);
+    unsetenv("REQUEST_METHOD");
+    unsetenv("QUERY_STRING");
+    unsetenv("HTTP_COOKIE");
+
+    // bound to a context, none of the body is taken either
+    req = parse(NULL, "_Q_CONTEXT=AAAAAAAA", MULTIPART_TYPE,
+                "--xx\r\n"
+                "Content-Disposition: form-data; name=\"_Q_STATS\"\r\n\r\n"
+                "0123456789\r\n"
+                "--xx\r\n"
+                "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+                "hello\r\n"
+                "--xx--\r\n");
+    ASSERT_EQUAL_PT(qcgireq_getctx(req), &ctx);
+    ASSERT_NULL(req->getstr(req, "_Q_CONTEXT", false));
+    ASSERT_NULL(req->getstr(req, "_Q_STATS", false));
+    ASSERT_EQUAL_STR(req->getstr(req, "title", false), "hello");
+    req->free(req);
+
+    qcgireq_parser_t *parser = qcgireq_parser_new(NULL);
+    ASSERT_TRUE(qcgireq_parser_push(parser, "_Q_LIMITS=x&b=2", 15));
+    req = qcgireq_parser_end(parser);
+    ASSERT_NULL(req->getstr(req, "_Q_LIMITS", false));
+    ASSERT_EQUAL_STR(req->getstr(req, "b", false), "2");
+    req->free(req);
+}
+
+TEST("Test parse statistics")
+{
+    // a client field can't switch them on
+    qentry_t *req = parse(NULL, "_Q_STATS=0123456789012345678901234567890",
+                          NULL, NULL);
+    qcgireq_stat_t stat;
+    ASSERT_FALSE(qcgireq_getstats(req, &stat));
+    ASSERT_FALSE(qcgireq_logstats(req, NULL));
+    req->free(req);
+
+    req = parse(qcgireq_setstats(NULL, true), "a=1&b=2", MULTIPART_TYPE,
+                MULTIPART_BODY);
+    ASSERT_TRUE(qcgireq_getstats(req, &stat));
+    ASSERT_EQUAL_INT(stat.gets, 2);
+    ASSERT_EQUAL_INT(stat.posts, 2);
+    ASSERT_EQUAL_INT(stat.parts, 2);
+    ASSERT_EQUAL_INT(stat.partsize, strlen("hello") + strlen("0123456789"));
+    ASSERT_EQUAL_INT(stat.maxpart, strlen("0123456789"));
+    // reading stops at the closing boundary, before its line end
+    ASSERT_EQUAL_INT(stat.bodysize, strlen(MULTIPART_BODY) - 2);
+    ASSERT_TRUE(stat.parsetime >= 0);
+
+    // added up over the calls on the same request
+    req = qcgireq_parse_query(req, "c=3", Q_CGI_COOKIE);
+    ASSERT_TRUE(qcgireq_getstats(req, &stat));
+    ASSERT_EQUAL_INT(stat.cookies, 1);
+    ASSERT_EQUAL_INT(stat.gets, 2);
+
+    // one line, the query string left out
+    ctx.params = qEntry();
+    ctx.params->putstr(ctx.params, "REQUEST_METHOD", "POST", true);
+    ctx.params->putstr(ctx.params, "REQUEST_URI", "/app?token=secret", true);
+    ctx.in = NULL;
+    ctx.out = stdout;
+    req = qcgireq_parse_ctx(&ctx, req, Q_CGI_GET);
+    char line[512] = "";
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(qcgireq_logstats(req, fp));
+    rewind(fp);
+    ASSERT_NOT_NULL(fgets(line, sizeof(line), fp));
+    fclose(fp);
+    ASSERT_TRUE(!strncmp(line, "qdecoder: method=POST uri=/app body=", 36));
+    ASSERT_NULL(strstr(line, "secret"));
+    ASSERT_NOT_NULL(strstr(line, " cookies=1 posts=2 gets=2 parts=2 "));
+    ctx.params->free(ctx.params);
+    ctx.params = NULL;
+
+    // turned off
+    qcgireq_setstats(req, false);
+    ASSERT_FALSE(qcgireq_getstats(req, &stat));
+    req->free(req);
+
+    // only the parts stored are counted
+    qcgireq_limit_t limits = { .maxvalue = 5 };
+    req = qcgireq_setstats(qcgireq_setlimits(NULL, &limits), true);
+    req = parse(req, NULL, MULTIPART_TYPE,
+                "--xx\r\n"
+                "Content-Disposition: form-data; name=\"_Q_STATS\"\r\n\r\n"
+                "x\r\n"
+                "--xx\r\n"
+                "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+                "hello\r\n"
+                "--xx\r\n"
+                "Content-Disposition: form-data; name=\"long\"\r\n\r\n"
+                "0123456789\r\n"
+                "--xx--\r\n");
+    ASSERT_TRUE(qcgireq_getstats(req, &stat));
+    ASSERT_EQUAL_INT(stat.posts, 1);
+    ASSERT_EQUAL_INT(req->size(req), 1);
+    req->free(req);
+}
+
+TEST("Test body limit")
+{
+    qcgireq_limit_t limits = { .maxbody = 8 };
+    qentry_t *req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, "a=1", "application/x-www-form-urlencoded", "c=3&d=%34");
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EBODY);
+    ASSERT_NULL(req->getstr(req, "a", false));
+    ASSERT_NULL(req->getstr(req, "c", false));
+    req->free(req);
+
+    // nothing is parsed after a limit was exceeded
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, "a=1", "application/x-www-form-urlencoded", "c=3");
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_OK);
+    req = parse(req, "e=5", "application/x-www-form-urlencoded", "c=3&d=%34");
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EBODY);
+    ASSERT_NOT_NULL(req->getstr(req, "a", false));
+    ASSERT_NULL(req->getstr(req, "e", false));
+    req->free(req);
+}
+
+TEST("Test raw POST body and its length")
+{
+    const char *body = "c=3&d=%34";
+    ctx.params = qEntry();
+    ctx.params->putstr(ctx.params, "REQUEST_METHOD", "POST", true);
+    ctx.out = stdout;
+
+    // refused before anything is read
+    const char *bad[] = { "-1", "abc", "9x", "", "99999999999999999999999",
+                          "2147483647", "16777217" };
+    int i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        ctx.params->putstr(ctx.params, "CONTENT_LENGTH", bad[i], true);
+        ctx.in = fmemopen((void *)body, strlen(body), "r");
+        ASSERT_NULL(qcgireq_getquery_ctx(&ctx, Q_CGI_POST));
+        ASSERT_EQUAL_INT(ftell(ctx.in), 0);
+        fclose(ctx.in);
+    }
+
+    ctx.params->putint(ctx.params, "CONTENT_LENGTH", strlen(body), true);
+    ctx.in = fmemopen((void *)body, strlen(body), "r");
+    char *query = qcgireq_getquery_ctx(&ctx, Q_CGI_POST);
+    ASSERT_NOT_NULL(query);
+    ASSERT_EQUAL_STR(query, body);
+    free(query);
+    fclose(ctx.in);
+
+    // a malformed length is over the limit of a parse
+    ctx.params->putstr(ctx.params, "CONTENT_LENGTH", "1e3", true);
+    ctx.params->putstr(ctx.params, "CONTENT_TYPE", "application/x-www-form-urlencoded", true);
+    ctx.in = fmemopen((void *)body, strlen(body), "r");
+    qcgireq_limit_t limits = { .maxbody = 1024 };
+    qentry_t *req = qcgireq_setlimits(NULL, &limits);
+    req = qcgireq_parse_ctx(&ctx, req, 0);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EBODY);
+    ASSERT_NULL(req->getstr(req, "c", false));
+    req->free(req);
+    fclose(ctx.in);
+
+    ctx.params->free(ctx.params);
+    ctx.params = NULL;
+}
+
+TEST("Test field limits")
+{
+    qcgireq_limit_t limits = { .maxfields = 3 };
+    qentry_t *req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, "a=1&b=2", "application/x-www-form-urlencoded", "c=3&d=4");
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EFIELDS);
+    ASSERT_NOT_NULL(req->getstr(req, "d", false));
+    ASSERT_NOT_NULL(req->getstr(req, "a", false));
+    ASSERT_NULL(req->getstr(req, "b", false));
+    req->free(req);
+
+    limits = (qcgireq_limit_t){ .maxname = 3 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, "abc=1&abcd=2", NULL, NULL);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_ENAME);
+    ASSERT_NOT_NULL(req->getstr(req, "abc", false));
+    req->free(req);
+
+    // values are measured decoded
+    limits = (qcgireq_limit_t){ .maxvalue = 3 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, "a=%41%42%43&b=ABCD", NULL, NULL);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EVALUE);
+    ASSERT_EQUAL_STR(req->getstr(req, "a", false), "ABC");
+    ASSERT_NULL(req->getstr(req, "b", false));
+
+    // the state isn't in reach of client fields, it's only reset by the API
+    req = parse(req, "_Q_LIMITS=&c=1", NULL, NULL);
+    ASSERT_NULL(req->getstr(req, "_Q_LIMITS", false));
+    ASSERT_NULL(req->getstr(req, "c", false));
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EVALUE);
+    qcgireq_setlimits(req, NULL);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_OK);
+    req->free(req);
+}
+
+TEST("Test multipart limits")
+{
+    qcgireq_limit_t limits = { .maxparts = 1 };
+    qentry_t *req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EPARTS);
+    ASSERT_EQUAL_STR(req->getstr(req, "title", false), "hello");
+    ASSERT_NULL(req->getstr(req, "file", false));
+    req->free(req);
+
+    limits = (qcgireq_limit_t){ .maxvalue = 4 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EVALUE);
+    ASSERT_NULL(req->getstr(req, "title", false));
+    req->free(req);
+
+    // uploads aren't values
+    limits = (qcgireq_limit_t){ .maxvalue = 5, .maxfile = 10 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_OK);
+    ASSERT_EQUAL_INT(req->getint(req, "file.length"), 10);
+    req->free(req);
+
+    limits = (qcgireq_limit_t){ .maxfile = 9 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EFILE);
+    ASSERT_NOT_NULL(req->getstr(req, "title", false));
+    ASSERT_NULL(req->getstr(req, "file", false));
+    req->free(req);
+
+    limits = (qcgireq_limit_t){ .maxfile = 10, .maxupload = 9 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EUPLOAD);
+    req->free(req);
+}
+
+TEST("Test partly saved uploads are removed")
+{
+    char dirpath[] = "/tmp/test_qcgireq_XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(dirpath));
+
+    qcgireq_limit_t limits = { .maxfile = 10 };
+    qentry_t *req = qcgireq_setoption(NULL, true, dirpath, 0);
+    req = qcgireq_setlimits(req, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_OK);
+    ASSERT_EQUAL_INT(count_files(dirpath), 1);
+    unlink(req->getstr(req, "file.savepath", false));
+    req->free(req);
+
+    limits.maxfile = 9;
+    req = qcgireq_setoption(NULL, true, dirpath, 0);
+    req = qcgireq_setlimits(req, &limits);
+    req = parse(req, NULL, MULTIPART_TYPE, MULTIPART_BODY);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EFILE);
+    ASSERT_EQUAL_INT(count_files(dirpath), 0);
+    req->free(req);
+
+    rmdir(dirpath);
+}
+
+TEST("Test parsing from memory")
+{
+    qentry_t *req = qcgireq_parse_query(NULL, "a=1&b=%32", Q_CGI_GET);
+    ASSERT_NOT_NULL(req);
+    req = qcgireq_parse_query(req, "c=3; d=4", Q_CGI_COOKIE);
+    ASSERT_EQUAL_STR(req->getstr(req, "b", false), "2");
+    ASSERT_EQUAL_STR(req->getstr(req, "d", false), "4");
+    req->free(req);
+
+    // not NUL terminated
+    const char body[] = "e=5&f=6XXX";
+    req = qcgireq_parse_body(NULL, "application/x-www-form-urlencoded",
+                             body, 7);
+    ASSERT_EQUAL_STR(req->getstr(req, "f", false), "6");
+    req->free(req);
+
+    req = qcgireq_parse_body(NULL, MULTIPART_TYPE, MULTIPART_BODY,
+                             strlen(MULTIPART_BODY));
+    ASSERT_EQUAL_STR(req->getstr(req, "title", false), "hello");
+    ASSERT_EQUAL_STR(req->getstr(req, "file.filename", false), "a.txt");
+    ASSERT_EQUAL_INT(req->getint(req, "file.length"), 10);
+    req->free(req);
+
+    qcgireq_limit_t limits = { .maxbody = 6 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = qcgireq_parse_body(req, "application/x-www-form-urlencoded",
+                             body, 7);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EBODY);
+    req->free(req);
+}
+
+TEST("Test parsing from a file descriptor")
+{
+    int fds[2];
+    ASSERT_EQUAL_INT(pipe(fds), 0);
+    ASSERT_EQUAL_INT(write(fds[1], MULTIPART_BODY, strlen(MULTIPART_BODY)),
+                     strlen(MULTIPART_BODY));
+    close(fds[1]);
+    qentry_t *req = qcgireq_parse_fd(NULL, MULTIPART_TYPE, fds[0], -1);
+    close(fds[0]);
+    ASSERT_EQUAL_STR(req->getstr(req, "title", false), "hello");
+    ASSERT_EQUAL_INT(req->getint(req, "file.length"), 10);
+    req->free(req);
+
+    // a body of unknown size is checked as it's read
+    ASSERT_EQUAL_INT(pipe(fds), 0);
+    ASSERT_EQUAL_INT(write(fds[1], "a=1&b=2&c=3", 11), 11);
+    close(fds[1]);
+    qcgireq_limit_t limits = { .maxbody = 10 };
+    req = qcgireq_setlimits(NULL, &limits);
+    req = qcgireq_parse_fd(req, "application/x-www-form-urlencoded", fds[0], -1);
+    close(fds[0]);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EBODY);
+    ASSERT_NULL(req->getstr(req, "a", false));
+    req->free(req);
+}
+
+TEST("Test push parser")
+{
+    // split anywhere, even inside escapes
+    const char *body = "name=Hello%20World%21&empty=&plus=a+b&last=%4";
+    size_t len = strlen(body), split;
+    for (split = 0; split <= len; split++) {
+        qcgireq_parser_t *parser = qcgireq_parser_new(NULL);
+        ASSERT_TRUE(qcgireq_parser_push(parser, body, split));
+        ASSERT_TRUE(qcgireq_parser_push(parser, body + split, len - split));
+        qentry_t *req = qcgireq_parser_end(parser);
+        ASSERT_EQUAL_STR(req->getstr(req, "name", false), "Hello World!");
+        ASSERT_EQUAL_STR(req->getstr(req, "empty", false), "");
+        ASSERT_EQUAL_STR(req->getstr(req, "plus", false), "a b");
+        ASSERT_EQUAL_STR(req->getstr(req, "last", false), "%4");
+        req->free(req);
+    }
+
+    // fields are stored as they complete, limits are checked on the way
+    qcgireq_limit_t limits = { .maxvalue = 4 };
+    qentry_t *req = qcgireq_setlimits(NULL, &limits);
+    qcgireq_parser_t *parser = qcgireq_parser_new(req);
+    ASSERT_TRUE(qcgireq_parser_push(parser, "a=1&b=12", 8));
+    ASSERT_NOT_NULL(req->getstr(req, "a", false));
+    ASSERT_NULL(req->getstr(req, "b", false));
+    ASSERT_FALSE(qcgireq_parser_push(parser, "345", 3));
+    ASSERT_EQUAL_PT(qcgireq_parser_end(parser), req);
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EVALUE);
+    ASSERT_NULL(req->getstr(req, "b", false));
+    req->free(req);
+}
+
+TEST("Test lazy decoding")
+{
+    // the same variables as decoded right away
+    const char *query = " a%20b =Hello%20World%21&empty=&noeq&plus=a+b&bad=%4";
+    qentry_t *req = parse(qcgireq_setlazy(NULL, true), query,
+                          "application/x-www-form-urlencoded", "x=%41&x=2");
+    qentry_t *eager = parse(NULL, query,
+                            "application/x-www-form-urlencoded", "x=%41&x=2");
+    ASSERT_EQUAL_INT(req->size(req), eager->size(eager));
+    qentobj_t obj, eobj;
+    memset((void *)&obj, 0, sizeof(obj));
+    memset((void *)&eobj, 0, sizeof(eobj));
+    while (eager->getnext(eager, &eobj, NULL, false) == true) {
+        ASSERT_TRUE(req->getnext(req, &obj, NULL, false));
+        ASSERT_EQUAL_STR(obj.name, eobj.name);
+        ASSERT_EQUAL_INT(obj.size, eobj.size);
+        ASSERT_EQUAL_MEM(obj.data, eobj.data, eobj.size);
+    }
+    eager->free(eager);
+
+    // a value is decoded once, replacing it frees nothing borrowed
+    ASSERT_EQUAL_STR(req->getstr(req, "a b", false), "Hello World!");
+    ASSERT_EQUAL_STR(req->getstr(req, "a b", false), "Hello World!");
+    ASSERT_EQUAL_STR(req->getstrlast(req, "x", false), "2");
+    ASSERT_TRUE(req->putstr(req, "x", "3", true));
+    ASSERT_EQUAL_STR(req->getstr(req, "x", false), "3");
+    req->free(req);
+
+    // limits are checked on the decoded lengths
+    qcgireq_limit_t limits = { .maxvalue = 3 };
+    req = qcgireq_setlazy(qcgireq_setlimits(NULL, &limits), true);
+    req = parse(req, "a=%41%42%43&b=ABCD", NULL, NULL);
+    ASSERT_EQUAL_STR(req->getstr(req, "a", false), "ABC");
+    ASSERT_NULL(req->getstr(req, "b", false));
+    ASSERT_EQUAL_INT(qcgireq_geterror(req), Q_CGIREQ_EVALUE);
+    req->free(req);
+}
+
+TEST("Test capture and replay")
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/qdecoder-test-%d.qcap", getpid());
+    unlink(path);
+    ASSERT_TRUE(qcgireq_setcapture(path));
+
+    // parsed in parts, the body is read and recorded once
+    const char *body = "p=1&q=2";
+    ctx.params = qEntry();
+    ctx.params->putstr(ctx.params, "REQUEST_METHOD", "POST", true);
+    ctx.params->putstr(ctx.params, "CONTENT_TYPE",
+                       "application/x-www-form-urlencoded", true);
+    ctx.params->putint(ctx.params, "CONTENT_LENGTH", strlen(body), true);
+    ctx.params->putstr(ctx.params, "QUERY_STRING", "g=1", true);
+    ctx.params->putstr(ctx.params, "HTTP_COOKIE", "c=1", true);
+    ctx.params->putstr(ctx.params, "SECRET", "x", true);  // not captured
+    ctx.in = fmemopen((void *)body, strlen(body), "r");
+    ctx.out = stdout;
+    qentry_t *req = qcgireq_parse_ctx(&ctx, NULL, Q_CGI_COOKIE);
+    req = qcgireq_parse_ctx(&ctx, req, Q_CGI_POST);
+    req = qcgireq_parse_ctx(&ctx, req, Q_CGI_GET);
+    req = qcgireq_parse_ctx(&ctx, req, Q_CGI_POST);
+    ASSERT_TRUE(qcgireq_setcapture(NULL));
+    fclose(ctx.in);
+    ctx.params->free(ctx.params);
+    ASSERT_EQUAL_INT(req->size(req), 4);
+    ASSERT_EQUAL_STR(req->getstr(req, "c", false), "1");
+    ASSERT_EQUAL_STR(req->getstr(req, "p", false), "1");
+    ASSERT_EQUAL_STR(req->getstr(req, "q", false), "2");
+    ASSERT_EQUAL_STR(req->getstr(req, "g", false), "1");
+
+    // one record
+    char rec[4096];
+    FILE *fp = fopen(path, "r");
+    ASSERT_NOT_NULL(fp);
+    size_t reclen = fread(rec, 1, sizeof(rec), fp);
+    fclose(fp);
+    unlink(path);
+    ASSERT_TRUE(reclen > 16);
+    ASSERT_EQUAL_MEM(rec, "QCAP\1\0\0\0", 8);
+    unsigned char *hdr = (unsigned char *)rec;
+    size_t varslen = (hdr[8] << 24) | (hdr[9] << 16) | (hdr[10] << 8) | hdr[11];
+    size_t bodylen = (hdr[12] << 24) | (hdr[13] << 16) | (hdr[14] << 8) | hdr[15];
+    ASSERT_EQUAL_INT(bodylen, strlen(body));
+    ASSERT_EQUAL_INT(reclen, 16 + varslen + bodylen);
+    ASSERT_EQUAL_MEM(rec + 16 + varslen, body, bodylen);
+
+    // replayed, the same variables
+    ctx.params = qEntry();
+    char *p;
+    for (p = rec + 16; p < rec + 16 + varslen; ) {
+        char *value = p + strlen(p) + 1;
+        ctx.params->putstr(ctx.params, p, value, true);
+        p = value + strlen(value) + 1;
+    }
+    ASSERT_NULL(ctx.params->getstr(ctx.params, "SECRET", false));
+    ctx.in = fmemopen(rec + 16 + varslen, bodylen, "r");
+    qentry_t *replay = qcgireq_parse_ctx(&ctx, NULL, 0);
+    fclose(ctx.in);
+    ctx.params->free(ctx.params);
+    ctx.params = NULL;
+    ASSERT_EQUAL_INT(replay->size(replay), req->size(req));
+    qentobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    while (req->getnext(req, &obj, NULL, false) == true) {
+        ASSERT_EQUAL_STR(replay->getstr(replay, obj.name, false), (char *)obj.data);
+    }
+    replay->free(replay);
+    req->free(req);
+}
+
+QUNIT_END();
+
+static qentry_t *parse(qentry_t *req, const char *query,
+                       const char *contenttype, const char *body)
+{
+    ctx.params = qEntry();
+    if (query != NULL) ctx.params->putstr(ctx.params, "QUERY_STRING", query, true);
+    if (body != NULL) {
+        ctx.params->putstr(ctx.params, "REQUEST_METHOD", "POST", true);
+        ctx.params->putstr(ctx.params, "CONTENT_TYPE", contenttype, true);
+        ctx.params->putint(ctx.params, "CONTENT_LENGTH", strlen(body), true);
+        ctx.in = fmemopen((void *)body, strlen(body), "r");
+    } else {
+        ctx.params->putstr(ctx.params, "REQUEST_METHOD", "GET", true);
+        ctx.in = NULL;
+    }
+    ctx.out = stdout;
+
+    req = qcgireq_parse_ctx(&ctx, req, 0);
+
+    if (ctx.in != NULL) fclose(ctx.in);
+    ctx.params->free(ctx.params);
+    ctx.params = NULL;
+    return req;
+}
+
+static int count_files(const char *dirpath)
+{
+    DIR *dp = opendir(dirpath);
+    if (dp == NULL) return -1;
+
+    int count = 0;
+    struct dirent *dirp;
+    while ((dirp = readdir(dp)) != NULL) {
+        if (dirp->d_name[0] != '.') count++;
+    }
+    closedir(dp);
+    return count;
+}
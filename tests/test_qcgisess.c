@@ -0,0 +1,398 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qdecoder.h"
+#include <glob.h>
+#include <limits.h>
+#include <unistd.h>
+
+// two levels of hex directories
+#define SHARD   "[0-9a-f][0-9a-f]/[0-9a-f][0-9a-f]/"
+
+static qcgictx_t ctx;
+static qentry_t *request(const char *query, const char *cookie);
+static int count_glob(const char *repo, const char *pattern);
+static bool new_session(const char *repo, char *idcookie, const char *user);
+static bool take_cookie(const char *prefix, char *cookie, size_t size);
+
+QUNIT_START("Test qcgisess.c");
+
+TEST("Test sharded layout")
+{
+    char repo[] = "/tmp/qsesstest.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(repo));
+
+    qentry_t *req = request(NULL, NULL);
+    ASSERT_TRUE(qcgisess_setoption(req, Q_SESS_SHARDED));
+    qentry_t *sess = qcgisess_init(req, repo);
+    ASSERT_NOT_NULL(sess);
+    char id[64];
+    snprintf(id, sizeof(id), "QSESSIONID=%s", qcgisess_getid(sess));
+    sess->putstr(sess, "user", "wolkykim", true);
+    ASSERT_TRUE(qcgisess_save(sess));
+    sess->free(sess);
+    req->free(req);
+
+    // two levels of shard directories, nothing at the top
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*.properties"), 1);
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*.expire"), 1);
+    ASSERT_EQUAL_INT(count_glob(repo, "qsession-*.properties"), 0);
+
+    // found again by the id
+    req = request(NULL, id);
+    qcgisess_setoption(req, Q_SESS_SHARDED);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "wolkykim");
+    ASSERT_TRUE(qcgisess_destroy(sess));
+    req->free(req);
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*"), 0);
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", repo);
+    ASSERT_EQUAL_INT(system(cmd), 0);
+}
+
+TEST("Test garbage collection")
+{
+    char repo[] = "/tmp/qsesstest.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(repo));
+
+    int i;
+    for (i = 0; i < 3; i++) {
+        qentry_t *req = request(NULL, NULL);
+        qcgisess_setoption(req, Q_SESS_SHARDED);
+        qentry_t *sess = qcgisess_init(req, repo);
+        ASSERT_TRUE(qcgisess_save(sess));
+        sess->free(sess);
+        req->free(req);
+    }
+    ASSERT_EQUAL_INT(qcgisess_gc(repo, 0, 0), 0);
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*.properties"), 3);
+
+    // expire them all
+    glob_t g;
+    char pattern[PATH_MAX];
+    snprintf(pattern, sizeof(pattern), "%s/" SHARD "qsession-*.expire", repo);
+    ASSERT_EQUAL_INT(glob(pattern, 0, NULL, &g), 0);
+    for (i = 0; i < (int)g.gl_pathc; i++) {
+        FILE *fp = fopen(g.gl_pathv[i], "w");
+        ASSERT_NOT_NULL(fp);
+        fprintf(fp, "1");
+        fclose(fp);
+    }
+    globfree(&g);
+
+    ASSERT_EQUAL_INT(qcgisess_gc(repo, -1, 0), -1);
+    ASSERT_EQUAL_INT(qcgisess_gc(repo, 0, 0), 3);
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*"), 0);
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", repo);
+    ASSERT_EQUAL_INT(system(cmd), 0);
+}
+
+TEST("Test session options")
+{
+    char repo[] = "/tmp/qsesstest.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(repo));
+
+    // clients can't pick the layout
+    qentry_t *req = request("_Q_SESSION_OPTIONS=1", "_Q_SESSION_OPTIONS=1");
+    ASSERT_NULL(req->getstr(req, "_Q_SESSION_OPTIONS", false));
+    qentry_t *sess = qcgisess_init(req, repo);
+    ASSERT_TRUE(qcgisess_save(sess));
+    sess->free(sess);
+    req->free(req);
+    ASSERT_EQUAL_INT(count_glob(repo, "qsession-*.properties"), 1);
+    ASSERT_EQUAL_INT(count_glob(repo, SHARD "qsession-*"), 0);
+
+    // the binary format
+    req = request(NULL, NULL);
+    ASSERT_TRUE(qcgisess_setoption(req, Q_SESS_BINARY));
+    ASSERT_NULL(req->getstr(req, "_Q_SESSION_OPTIONS", false));
+    sess = qcgisess_init(req, repo);
+    char id[64];
+    snprintf(id, sizeof(id), "QSESSIONID=%s", qcgisess_getid(sess));
+    sess->putstr(sess, "user", "wolkykim", true);
+    ASSERT_TRUE(qcgisess_save(sess));
+    sess->free(sess);
+    req->free(req);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/qsession-%s.properties", repo, id + 11);
+    qentry_t *bin = qEntry();
+    ASSERT_TRUE(bin->loadbin(bin, path) > 0);
+    ASSERT_EQUAL_STR(bin->getstr(bin, "user", false), "wolkykim");
+    bin->free(bin);
+
+    // read back whatever the options are now
+    req = request(NULL, id);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "wolkykim");
+    ASSERT_EQUAL_INT(qcgisess_gc(repo, 0, 0), 0); // not sharded
+    ASSERT_TRUE(qcgisess_destroy(sess));
+    req->free(req);
+
+    // encryption needs OpenSSL
+    req = request(NULL, NULL);
+#ifdef ENABLE_OPENSSL
+    ASSERT_TRUE(qcgisess_setoption(req, Q_SESS_COOKIE | Q_SESS_ENCRYPT));
+#else
+    ASSERT_FALSE(qcgisess_setoption(req, Q_SESS_COOKIE | Q_SESS_ENCRYPT));
+#endif
+    req->free(req);
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", repo);
+    ASSERT_EQUAL_INT(system(cmd), 0);
+}
+
+TEST("Test session cache")
+{
+    char repo[] = "/tmp/qsesstest.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(repo));
+    ASSERT_TRUE(qcgisess_setcache(1024 * 1024));
+
+    char id1[64], id2[64];
+    ASSERT_TRUE(new_session(repo, id1, "first"));
+    qcgisess_cachestat_t stat;
+    ASSERT_TRUE(qcgisess_getcachestat(&stat));
+    ASSERT_EQUAL_INT(stat.items, 1);
+    ASSERT_EQUAL_INT(stat.hits + stat.misses, 0);
+
+    // hit
+    qentry_t *req = request(NULL, id1);
+    qentry_t *sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "first");
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.hits, 1);
+    ASSERT_EQUAL_INT(stat.misses, 0);
+
+    // changed by another process, a miss then cached again
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/qsession-%s.properties", repo, id1 + 11);
+    sess->putstr(sess, "user", "changed", true);
+    char tmppath[PATH_MAX + sizeof(".tmp")];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    ASSERT_TRUE(sess->save(sess, tmppath));
+    ASSERT_EQUAL_INT(rename(tmppath, path), 0);
+    sess->free(sess);
+    req->free(req);
+
+    req = request(NULL, id1);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "changed");
+    sess->free(sess);
+    req->free(req);
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.hits, 1);
+    ASSERT_EQUAL_INT(stat.misses, 1);
+    ASSERT_EQUAL_INT(stat.items, 1);
+
+    // eviction, only one fits
+    ASSERT_TRUE(qcgisess_setcache(stat.memsize + 16));
+    ASSERT_TRUE(new_session(repo, id2, "second"));
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.items, 1);
+
+    req = request(NULL, id1);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "changed");
+    sess->free(sess);
+    req->free(req);
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.misses, 2);
+    ASSERT_EQUAL_INT(stat.items, 1); // id2 made room for id1
+
+    // removed along with the session
+    req = request(NULL, id1);
+    sess = qcgisess_init(req, repo);
+    ASSERT_TRUE(qcgisess_destroy(sess));
+    req->free(req);
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.hits, 2);
+    ASSERT_EQUAL_INT(stat.items, 0);
+
+    // disabled
+    ASSERT_TRUE(qcgisess_setcache(0));
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.maxmem, 0);
+    req = request(NULL, id2);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "second");
+    sess->free(sess);
+    req->free(req);
+    qcgisess_getcachestat(&stat);
+    ASSERT_EQUAL_INT(stat.hits + stat.misses, 4); // unchanged
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", repo);
+    ASSERT_EQUAL_INT(system(cmd), 0);
+}
+
+TEST("Test cookie sessions")
+{
+    char repo[] = "/tmp/qsesstest.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(repo));
+    const char secret[] = "0123456789abcdef0123456789abcdef";
+    ASSERT_TRUE(qcgisess_setkey(secret, strlen(secret)));
+
+    qentry_t *req = request(NULL, NULL);
+    ASSERT_TRUE(qcgisess_setoption(req, Q_SESS_COOKIE));
+    qentry_t *sess = qcgisess_init(req, repo);
+    char id[64];
+    snprintf(id, sizeof(id), "%s", qcgisess_getid(sess));
+    sess->putstr(sess, "user", "wolkykim", true);
+    ASSERT_TRUE(qcgisess_save(sess));
+    // the request is referred to privately, never as a session variable
+    ASSERT_NULL(sess->getstr(sess, "_Q_REQUEST", false));
+    sess->free(sess);
+    req->free(req);
+
+    // nothing on the server
+    ASSERT_EQUAL_INT(count_glob(repo, "qsession-*"), 0);
+    char cookie[4096];
+    ASSERT_TRUE(take_cookie("QSESSIONDATA=", cookie, sizeof(cookie)));
+
+    // round trip
+    req = request(NULL, cookie);
+    qcgisess_setoption(req, Q_SESS_COOKIE);
+    sess = qcgisess_init(req, repo);
+    ASSERT_EQUAL_STR(qcgisess_getid(sess), id);
+    ASSERT_EQUAL_STR(sess->getstr(sess, "user", false), "wolkykim");
+    ASSERT_NULL(sess->getstr(sess, "_Q_REQUEST", false));
+    qcgisess_settimeout(sess, 1);
+    ASSERT_TRUE(qcgisess_save(sess));
+    sess->free(sess);
+    req->free(req);
+
+    // tampered, a new empty session
+    char *tampered = strdup(cookie);
+    char *p = strchr(tampered, '=') + 5;
+    *p = (*p == 'A') ? 'B' : 'A';
+    req = request(NULL, tampered);
+    qcgisess_setoption(req, Q_SESS_COOKIE);
+    sess = qcgisess_init(req, repo);
+    ASSERT_NOT_NULL(sess);
+    ASSERT_TRUE(strcmp(qcgisess_getid(sess), id) != 0);
+    ASSERT_NULL(sess->getstr(sess, "user", false));
+    sess->free(sess);
+    req->free(req);
+    free(tampered);
+
+    // signed with another key
+    ASSERT_TRUE(qcgisess_setkey("abcdef0123456789abcdef0123456789", 32));
+    req = request(NULL, cookie);
+    qcgisess_setoption(req, Q_SESS_COOKIE);
+    sess = qcgisess_init(req, repo);
+    ASSERT_NULL(sess->getstr(sess, "user", false));
+    sess->free(sess);
+    req->free(req);
+    ASSERT_TRUE(qcgisess_setkey(secret, strlen(secret)));
+
+    // expired
+    ASSERT_TRUE(take_cookie("QSESSIONDATA=", cookie, sizeof(cookie)));
+    sleep(2);
+    req = request(NULL, cookie);
+    qcgisess_setoption(req, Q_SESS_COOKIE);
+    sess = qcgisess_init(req, repo);
+    ASSERT_TRUE(strcmp(qcgisess_getid(sess), id) != 0);
+    ASSERT_NULL(sess->getstr(sess, "user", false));
+    sess->free(sess);
+    req->free(req);
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", repo);
+    ASSERT_EQUAL_INT(system(cmd), 0);
+}
+
+QUNIT_END();
+
+static qentry_t *request(const char *query, const char *cookie)
+{
+    ctx.params = qEntry();
+    ctx.params->putstr(ctx.params, "REQUEST_METHOD", "GET", true);
+    if (query != NULL) ctx.params->putstr(ctx.params, "QUERY_STRING", query, true);
+    if (cookie != NULL) ctx.params->putstr(ctx.params, "HTTP_COOKIE", cookie, true);
+    ctx.in = NULL;
+    if (ctx.out == NULL) ctx.out = tmpfile(); // Set-Cookie headers
+
+    qentry_t *req = qcgireq_parse_ctx(&ctx, NULL, 0);
+
+    ctx.params->free(ctx.params);
+    ctx.params = NULL;
+    return req;
+}
+
+static int count_glob(const char *repo, const char *pattern)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", repo, pattern);
+
+    glob_t g;
+    if (glob(path, 0, NULL, &g) != 0) return 0;
+    int count = (int)g.gl_pathc;
+    globfree(&g);
+    return count;
+}
+
+// saves a new flat session, idcookie gets "QSESSIONID=..." for the next request
+static bool new_session(const char *repo, char *idcookie, const char *user)
+{
+    qentry_t *req = request(NULL, NULL);
+    qentry_t *sess = qcgisess_init(req, repo);
+    if (sess == NULL) {
+        req->free(req);
+        return false;
+    }
+    sprintf(idcookie, "QSESSIONID=%s", qcgisess_getid(sess));
+    sess->putstr(sess, "user", user, true);
+    bool saved = qcgisess_save(sess);
+    sess->free(sess);
+    req->free(req);
+    return saved;
+}
+
+// takes the last Set-Cookie header starting with prefix out of the response
+static bool take_cookie(const char *prefix, char *cookie, size_t size)
+{
+    char line[4096];
+    bool found = false;
+    rewind(ctx.out);
+    while (fgets(line, sizeof(line), ctx.out) != NULL) {
+        if (strncmp(line, "Set-Cookie: ", 12) != 0 ||
+            strncmp(line + 12, prefix, strlen(prefix)) != 0) continue;
+        line[strcspn(line, ";\r\n")] = '\0';
+        snprintf(cookie, size, "%s", line + 12);
+        found = true;
+    }
+    rewind(ctx.out);
+    if (ftruncate(fileno(ctx.out), 0) != 0) return false;
+    return found;
+}
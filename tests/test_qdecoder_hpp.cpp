@@ -0,0 +1,237 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qtestnet.h"
+#include "qdecoder.hpp"
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#define ABORT_REQUEST   (2)
+#define PARAMS          (4)
+#define STDIN           (5)
+#define STDOUT          (6)
+
+static int start_loop(void);
+static bool stop_loop(int fd);
+static bool wait_started(int fd);
+
+static qfcgi_t *fcgi;
+static pid_t server;
+
+QUNIT_START("Test qdecoder.hpp");
+
+char out[4096];
+int fd, status, len;
+
+TEST("Test read() while the body arrives")
+{
+    fd = start_loop();
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, true);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "read");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "9");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    ASSERT_TRUE(wait_started(fd));
+
+    qtest_fcgi_record(fd, STDIN, 1, "abc", 3);
+    usleep(50 * 1000);
+    qtest_fcgi_record(fd, STDIN, 1, "defg", 4);
+    usleep(50 * 1000);
+    qtest_fcgi_record(fd, STDIN, 1, "hi", 2);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+    len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "read=abcdefghi"));
+    ASSERT_EQUAL_INT(status, 0);
+    ASSERT_TRUE(stop_loop(fd));
+}
+
+TEST("Test form() and drain()")
+{
+    fd = start_loop();
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, true);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "form");
+    qtest_fcgi_param(fd, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "7");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    ASSERT_TRUE(wait_started(fd));
+
+    qtest_fcgi_record(fd, STDIN, 1, "a=1", 3);
+    qtest_fcgi_record(fd, STDIN, 1, "&b=2", 4);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+    len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=1,b=2,drained=1"));
+    ASSERT_TRUE(stop_loop(fd));
+}
+
+TEST("Test form() of a body beyond 256KB")
+{
+    fd = start_loop();
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, true);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "length");
+    qtest_fcgi_param(fd, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "600006");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    ASSERT_TRUE(wait_started(fd));
+
+    char chunk[60000];
+    memset(chunk, 'x', sizeof(chunk));
+    qtest_fcgi_record(fd, STDIN, 1, "a=", 2);
+    for (int i = 0; i < 10; i++) qtest_fcgi_record(fd, STDIN, 1, chunk, sizeof(chunk));
+    qtest_fcgi_record(fd, STDIN, 1, "&b=2", 4);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+    len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=600000,b=2"));
+    ASSERT_TRUE(stop_loop(fd));
+}
+
+TEST("Test abort while awaiting form()")
+{
+    fd = start_loop();
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, true);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "form");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "10");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    ASSERT_TRUE(wait_started(fd));
+    qtest_fcgi_record(fd, ABORT_REQUEST, 1, NULL, 0);
+    len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len >= 0);
+    ASSERT_EQUAL_INT(status, 0);
+
+    // ended by the handler, the connection goes on
+    qtest_fcgi_begin(fd, 2, 1, true);
+    qtest_fcgi_param(fd, 2, "QUERY_STRING", "aborts");
+    qtest_fcgi_record(fd, PARAMS, 2, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 2, NULL, 0);
+    len = qtest_fcgi_response(fd, 2, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "aborts=1"));
+    ASSERT_TRUE(stop_loop(fd));
+}
+
+QUNIT_END();
+
+static int aborts = 0;
+
+static qdecoder::task handler(qdecoder::request req)
+{
+    qentry_t *params = req.params();
+    const char *query = params->getstr(params, "QUERY_STRING", false);
+    fprintf(req.ctx()->out, "Content-Type: text/plain\r\n\r\n");
+    if (query != NULL && !strcmp(query, "aborts")) {
+        fprintf(req.ctx()->out, "aborts=%d", aborts);
+        co_return;
+    }
+    fprintf(req.ctx()->out, "started,");
+    co_await req.drain();
+
+    if (query != NULL && !strcmp(query, "read")) {
+        char body[64];
+        size_t total = 0, n;
+        while ((n = co_await req.read(body + total, sizeof(body) - 1 - total)) > 0) {
+            total += n;
+        }
+        body[total] = '\0';
+        fprintf(req.ctx()->out, "read=%s", body);
+        co_return;
+    }
+
+    qentry_t *form = co_await req.form();
+    if (form == NULL) {
+        aborts++;
+        co_return;
+    }
+    if (query != NULL && !strcmp(query, "length")) {
+        const char *a = form->getstr(form, "a", false);
+        fprintf(req.ctx()->out, "a=%zu,b=%s", (a != NULL) ? strlen(a) : 0,
+                form->getstr(form, "b", false));
+        form->free(form);
+        co_return;
+    }
+    fprintf(req.ctx()->out, "a=%s,b=%s", form->getstr(form, "a", false),
+            form->getstr(form, "b", false));
+    bool drained = co_await req.drain();
+    fprintf(req.ctx()->out, ",drained=%d", drained ? 1 : 0);
+    form->free(form);
+}
+
+static void loop_stop(int signo)
+{
+    qfcgi_stop(fcgi);
+}
+
+static int serve(void *arg)
+{
+    signal(SIGTERM, loop_stop);
+    return (qdecoder::loop(fcgi, 0, handler) == true) ? 0 : 1;
+}
+
+// starts a server and returns a connection to it.
+static int start_loop(void)
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    if (fcgi == NULL) return -1;
+    server = qtest_fork(serve, NULL);
+    return qtest_connect(qtest_sockpath());
+}
+
+// true if the server stopped cleanly.
+static bool stop_loop(int fd)
+{
+    close(fd);
+    bool ret = qtest_stop(server);
+    qfcgi_free(fcgi);
+    return ret;
+}
+
+// true when the first STDOUT record says the handler started.
+static bool wait_started(int fd)
+{
+    unsigned char h[8];
+    if (recv(fd, h, sizeof(h), MSG_WAITALL) != sizeof(h) || h[1] != STDOUT) {
+        return false;
+    }
+    char out[4096];
+    size_t clen = (h[4] << 8) | h[5];
+    if (recv(fd, out, clen + h[6], MSG_WAITALL) != (ssize_t)(clen + h[6])) {
+        return false;
+    }
+    out[clen] = '\0';
+    return (strstr(out, "started") != NULL);
+}
@@ -0,0 +1,171 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qdecoder.h"
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TESTFILE    "/tmp/test_qentry.bin"
+
+static qentry_t *sample(void);
+static bool same(qentry_t *entry, qentry_t *expect);
+static bool rewrite(const char *filepath, long offset, int c, off_t size);
+
+QUNIT_START("Test qentry.c");
+
+TEST("Test savebin() and loadbin() round trip")
+{
+    qentry_t *entry = sample();
+    ASSERT_TRUE(entry->savebin(entry, TESTFILE));
+
+    qentry_t *loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadbin(loaded, TESTFILE), entry->size(entry));
+    ASSERT_TRUE(same(loaded, entry));
+    loaded->free(loaded);
+
+    // loaded again into a table with objects in it
+    loaded = qEntry();
+    loaded->putstr(loaded, "first", "1", false);
+    ASSERT_EQUAL_INT(loaded->loadbin(loaded, TESTFILE), entry->size(entry));
+    ASSERT_EQUAL_INT(loaded->size(loaded), entry->size(entry) + 1);
+    loaded->free(loaded);
+
+    entry->free(entry);
+}
+
+TEST("Test loadmmap() of binary and text files")
+{
+    qentry_t *entry = sample();
+
+    ASSERT_TRUE(entry->savebin(entry, TESTFILE));
+    qentry_t *loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadmmap(loaded, TESTFILE), entry->size(entry));
+    ASSERT_TRUE(same(loaded, entry));
+
+    // borrowed objects can be replaced, removed and truncated
+    ASSERT_TRUE(loaded->putstr(loaded, "name", "new", true));
+    ASSERT_EQUAL_STR(loaded->getstr(loaded, "name", false), "new");
+    ASSERT_EQUAL_INT(loaded->remove(loaded, "binary"), 1);
+    ASSERT_TRUE(loaded->truncate(loaded));
+    ASSERT_EQUAL_INT(loaded->size(loaded), 0);
+    loaded->free(loaded);
+
+    // text values are decoded on first access, same as load() does
+    ASSERT_TRUE(entry->save(entry, TESTFILE));
+    loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadmmap(loaded, TESTFILE), entry->size(entry));
+    ASSERT_TRUE(same(loaded, entry));
+    qentry_t *text = qEntry();
+    text->load(text, TESTFILE);  // counts the comment lines too
+    ASSERT_TRUE(same(loaded, text));
+    text->free(text);
+    loaded->free(loaded);
+
+    entry->free(entry);
+}
+
+TEST("Test corrupted and truncated binary files")
+{
+    qentry_t *entry = sample();
+    ASSERT_TRUE(entry->savebin(entry, TESTFILE));
+    struct stat st;
+    ASSERT_EQUAL_INT(stat(TESTFILE, &st), 0);
+
+    // a flipped byte fails the CRC
+    ASSERT_TRUE(rewrite(TESTFILE, st.st_size / 2, 0xff, st.st_size));
+    qentry_t *loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadbin(loaded, TESTFILE), 0);
+    ASSERT_EQUAL_INT(loaded->size(loaded), 0);
+    loaded->free(loaded);
+
+    // a truncated file is refused by both loaders
+    ASSERT_TRUE(entry->savebin(entry, TESTFILE));
+    ASSERT_TRUE(rewrite(TESTFILE, -1, 0, st.st_size - 6));
+    loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadbin(loaded, TESTFILE), 0);
+    ASSERT_TRUE(loaded->loadmmap(loaded, TESTFILE) <= 0);
+    ASSERT_EQUAL_INT(loaded->size(loaded), 0);
+    loaded->free(loaded);
+
+    // so is a header alone
+    ASSERT_TRUE(rewrite(TESTFILE, -1, 0, 8));
+    loaded = qEntry();
+    ASSERT_EQUAL_INT(loaded->loadbin(loaded, TESTFILE), 0);
+    loaded->free(loaded);
+
+    unlink(TESTFILE);
+    entry->free(entry);
+}
+
+QUNIT_END();
+
+static qentry_t *sample(void)
+{
+    qentry_t *entry = qEntry();
+    entry->putstr(entry, "name", "value", false);
+    entry->putstr(entry, "space", "a b+c%", false);
+    entry->putstr(entry, "dup", "1", false);
+    entry->putstr(entry, "dup", "2", false);
+    unsigned char bin[256];
+    int i;
+    for (i = 0; i < sizeof(bin); i++) bin[i] = (unsigned char)i;
+    entry->put(entry, "binary", bin, sizeof(bin), false);
+    return entry;
+}
+
+// same objects in the same order
+static bool same(qentry_t *entry, qentry_t *expect)
+{
+    if (entry->size(entry) != expect->size(expect)) return false;
+
+    qentobj_t obj, eobj;
+    memset((void *)&obj, 0, sizeof(obj));
+    memset((void *)&eobj, 0, sizeof(eobj));
+    while (expect->getnext(expect, &eobj, NULL, false) == true) {
+        if (entry->getnext(entry, &obj, NULL, false) == false ||
+            strcmp(obj.name, eobj.name) != 0 || obj.size != eobj.size ||
+            memcmp(obj.data, eobj.data, obj.size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// overwrites a byte at the offset (none if -1) and truncates to the size
+static bool rewrite(const char *filepath, long offset, int c, off_t size)
+{
+    FILE *fp = fopen(filepath, "r+b");
+    if (fp == NULL) return false;
+    if (offset >= 0) {
+        fseek(fp, offset, SEEK_SET);
+        fputc(c, fp);
+    }
+    fclose(fp);
+    return (truncate(filepath, size) == 0);
+}
@@ -0,0 +1,579 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qtestnet.h"
+#include "qdecoder.h"
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PARAMS          (4)
+#define STDIN           (5)
+#define STDOUT          (6)
+#define GET_VALUES      (9)
+#define GET_VALUES_RESULT (10)
+
+static int serve_accept(void *arg);
+static int serve_pool(void *arg);
+static int serve_prefork(void *arg);
+static int serve_reload(void *arg);
+static int serve_loop(void *arg);
+static int serve_async(void *arg);
+static int get_pid(void);
+static const qfcgi_scoreslot_t *find_slot(const qfcgi_scoreboard_t *board,
+                                          Q_SCORE_T state);
+
+static qfcgi_t *fcgi;
+static pid_t server;
+
+QUNIT_START("Test qfcgi.c");
+
+TEST("Test GET request")
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    server = qtest_fork(serve_accept, fcgi);
+
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "GET");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "a=hello%20world&b=2");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+
+    char out[4096];
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_EQUAL_INT(status, 0);
+    ASSERT_NOT_NULL(strstr(out, "Content-Type: text/plain"));
+    ASSERT_NOT_NULL(strstr(out, "a=hello world,b=2,method=GET"));
+    close(fd);
+}
+
+TEST("Test POST requests on a kept connection")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+
+    int id;
+    for (id = 1; id <= 2; id++) {
+        qtest_fcgi_begin(fd, id, 1, true);
+        qtest_fcgi_param(fd, id, "REQUEST_METHOD", "POST");
+        qtest_fcgi_param(fd, id, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+        qtest_fcgi_param(fd, id, "CONTENT_LENGTH", "11");
+        qtest_fcgi_record(fd, PARAMS, id, NULL, 0);
+        qtest_fcgi_record(fd, STDIN, id, "a=pos", 5);  // body split in records
+        qtest_fcgi_record(fd, STDIN, id, "t&b=", 4);
+        qtest_fcgi_record(fd, STDIN, id, (id == 1) ? "xy" : "zz", 2);
+        qtest_fcgi_record(fd, STDIN, id, NULL, 0);
+
+        char out[4096];
+        int status;
+        int len = qtest_fcgi_response(fd, id, out, sizeof(out), &status);
+        ASSERT_TRUE(len > 0);
+        ASSERT_EQUAL_INT(status, 0);
+        ASSERT_NOT_NULL(strstr(out, (id == 1) ? "a=post,b=xy" : "a=post,b=zz"));
+    }
+    close(fd);
+}
+
+TEST("Test management records and roles")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+
+    unsigned char query[] = { 13, 0, 'F','C','G','I','_','M','A','X','_','R','E','Q','S' };
+    qtest_fcgi_record(fd, GET_VALUES, 0, query, sizeof(query));
+    char out[256];
+    int type;
+    int len = qtest_fcgi_response(fd, 0, out, sizeof(out), &type);
+    ASSERT_EQUAL_INT(type, GET_VALUES_RESULT);
+    ASSERT_EQUAL_INT(len, 2 + 13 + 1);
+    ASSERT_EQUAL_MEM(out + 2, "FCGI_MAX_REQS1", 14);
+
+    // authorizer role is not supported
+    qtest_fcgi_begin(fd, 3, 2, true);
+    int status;
+    qtest_fcgi_response(fd, 3, out, sizeof(out), &status);
+    ASSERT_EQUAL_INT(status, 3);  // FCGI_UNKNOWN_ROLE
+    close(fd);
+
+    qtest_stop(server);
+    qfcgi_free(fcgi);  // removes the socket file
+}
+
+TEST("Test worker pool")
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    server = qtest_fork(serve_pool, fcgi);
+
+    // a slow request, the body is held back
+    int slow = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(slow >= 0);
+    qtest_fcgi_begin(slow, 1, 1, false);
+    qtest_fcgi_param(slow, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(slow, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(slow, 1, "CONTENT_LENGTH", "7");
+    qtest_fcgi_record(slow, PARAMS, 1, NULL, 0);
+
+    // doesn't wait for the slow one
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "GET");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "a=fast&b=1");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+
+    char out[4096];
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=fast,b=1,method=GET"));
+    close(fd);
+
+    qtest_fcgi_record(slow, STDIN, 1, "a=slow&", 7);
+    qtest_fcgi_record(slow, STDIN, 1, NULL, 0);
+    len = qtest_fcgi_response(slow, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=slow,b=(null),method=POST"));
+    close(slow);
+
+    // more idle kept connections than workers
+    int kept[3];
+    int i;
+    for (i = 0; i < 3; i++) {
+        kept[i] = qtest_connect(qtest_sockpath());
+        ASSERT_TRUE(kept[i] >= 0);
+    }
+    int round;
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < 3; i++) {
+            qtest_fcgi_begin(kept[i], 1, 1, true);
+            qtest_fcgi_param(kept[i], 1, "REQUEST_METHOD", "GET");
+            qtest_fcgi_param(kept[i], 1, "QUERY_STRING", "a=kept");
+            qtest_fcgi_record(kept[i], PARAMS, 1, NULL, 0);
+            qtest_fcgi_record(kept[i], STDIN, 1, NULL, 0);
+            len = qtest_fcgi_response(kept[i], 1, out, sizeof(out), &status);
+            ASSERT_TRUE(len > 0);
+            ASSERT_NOT_NULL(strstr(out, "a=kept,b=(null),method=GET"));
+        }
+    }
+    for (i = 0; i < 3; i++) close(kept[i]);
+
+    // concurrency is advertised, an idle kept connection doesn't block stop
+    fd = qtest_connect(qtest_sockpath());
+    unsigned char query[] = { 14, 0, 'F','C','G','I','_','M','A','X','_','C','O','N','N','S' };
+    qtest_fcgi_record(fd, GET_VALUES, 0, query, sizeof(query));
+    int type;
+    len = qtest_fcgi_response(fd, 0, out, sizeof(out), &type);
+    ASSERT_EQUAL_INT(len, 2 + 14 + 1);
+    ASSERT_EQUAL_MEM(out + 2, "FCGI_MAX_CONNS2", 15);
+
+    ASSERT_TRUE(qtest_stop(server));
+    close(fd);
+    qfcgi_free(fcgi);
+}
+
+TEST("Test scoreboard")
+{
+    char scorepath[64];
+    snprintf(scorepath, sizeof(scorepath), "/tmp/test_qfcgi_%d.score", getpid());
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    ASSERT_TRUE(qfcgi_setscoreboard(fcgi, scorepath, 4));
+    server = qtest_fork(serve_pool, fcgi);
+
+    // mapped as a monitoring tool would
+    int sfd = open(scorepath, O_RDONLY);
+    ASSERT_TRUE(sfd >= 0);
+    size_t size = sizeof(qfcgi_scoreboard_t) + 4 * sizeof(qfcgi_scoreslot_t);
+    const qfcgi_scoreboard_t *board = mmap(NULL, size, PROT_READ, MAP_SHARED, sfd, 0);
+    close(sfd);
+    ASSERT_TRUE(board != MAP_FAILED);
+    ASSERT_EQUAL_MEM(board->magic, Q_SCORE_MAGIC, 4);
+    ASSERT_EQUAL_INT(board->nslots, 4);
+
+    // a request in progress, the body is held back
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "REQUEST_URI", "/app.cgi?token=secret");
+    qtest_fcgi_param(fd, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "3");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    const qfcgi_scoreslot_t *slot = NULL;
+    int i;
+    for (i = 0; i < 100 && slot == NULL; i++) {
+        usleep(10 * 1000);
+        slot = find_slot(board, Q_SCORE_BUSY);
+    }
+    ASSERT_NOT_NULL(slot);
+    ASSERT_EQUAL_INT(slot->pid, server);
+    ASSERT_TRUE(slot->thread >= 1 && slot->thread <= 2);
+    ASSERT_EQUAL_STR(slot->method, "POST");
+    ASSERT_EQUAL_STR(slot->uri, "/app.cgi");
+
+    qtest_fcgi_record(fd, STDIN, 1, "a=1", 3);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+    char out[4096];
+    int status;
+    ASSERT_TRUE(qtest_fcgi_response(fd, 1, out, sizeof(out), &status) > 0);
+    close(fd);
+    for (i = 0; i < 100 && slot->state != Q_SCORE_IDLE; i++) usleep(10 * 1000);
+    ASSERT_EQUAL_INT(slot->state, Q_SCORE_IDLE);
+    ASSERT_EQUAL_INT(slot->requests, 1);
+    ASSERT_EQUAL_INT(slot->errors, 0);
+    ASSERT_TRUE(slot->bytesin > 0 && slot->bytesout > 0);
+    uint64_t count = 0;
+    for (i = 0; i < Q_SCORE_BUCKETS; i++) count += slot->histogram[i];
+    ASSERT_EQUAL_INT(count, 1);
+
+    // slots are freed on exit, the counters stay
+    ASSERT_TRUE(qtest_stop(server));
+    ASSERT_EQUAL_INT(slot->pid, 0);
+    ASSERT_EQUAL_INT(slot->requests, 1);
+    munmap((void *)board, size);
+    qfcgi_free(fcgi);
+    unlink(scorepath);
+}
+
+#ifdef __linux__
+TEST("Test event loop")
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    server = qtest_fork(serve_loop, fcgi);
+
+    // a slow upload, records arrive in pieces
+    int slow = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(slow >= 0);
+    qtest_fcgi_begin(slow, 1, 1, true);
+    qtest_fcgi_param(slow, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(slow, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(slow, 1, "CONTENT_LENGTH", "10");
+    qtest_fcgi_record(slow, PARAMS, 1, NULL, 0);
+    unsigned char h[8] = { 1, STDIN, 0, 1, 0, 10, 0, 0 };
+    write(slow, h, 3);
+    usleep(10 * 1000);
+    write(slow, h + 3, 5);
+    write(slow, "a=sl", 4);
+
+    // served in the meantime on the same thread
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "GET");
+    qtest_fcgi_param(fd, 1, "QUERY_STRING", "a=fast&b=1");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+
+    char out[4096];
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=fast,b=1,method=GET"));
+    close(fd);
+
+    write(slow, "ow&b=2", 6);
+    qtest_fcgi_record(slow, STDIN, 1, NULL, 0);
+    len = qtest_fcgi_response(slow, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=slow,b=2,method=POST"));
+
+    // next request on the kept connection
+    qtest_fcgi_begin(slow, 2, 1, true);
+    qtest_fcgi_param(slow, 2, "REQUEST_METHOD", "GET");
+    qtest_fcgi_param(slow, 2, "QUERY_STRING", "a=again");
+    qtest_fcgi_record(slow, PARAMS, 2, NULL, 0);
+    qtest_fcgi_record(slow, STDIN, 2, NULL, 0);
+    len = qtest_fcgi_response(slow, 2, out, sizeof(out), &status);
+    ASSERT_NOT_NULL(strstr(out, "a=again"));
+
+    ASSERT_TRUE(qtest_stop(server));
+    close(slow);
+    qfcgi_free(fcgi);
+}
+
+TEST("Test event loop with async requests")
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    server = qtest_fork(serve_async, fcgi);
+
+    // headers are sent before the body arrives
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, true);
+    qtest_fcgi_param(fd, 1, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 1, "CONTENT_TYPE", "application/x-www-form-urlencoded");
+    qtest_fcgi_param(fd, 1, "CONTENT_LENGTH", "7");
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    unsigned char h[8];
+    ASSERT_EQUAL_INT(recv(fd, h, sizeof(h), MSG_WAITALL), 8);
+    ASSERT_EQUAL_INT(h[1], STDOUT);
+    char out[4096];
+    int clen = (h[4] << 8) | h[5];
+    ASSERT_EQUAL_INT(recv(fd, out, clen + h[6], MSG_WAITALL), clen + h[6]);
+    out[clen] = '\0';
+    ASSERT_NOT_NULL(strstr(out, "started"));
+
+    qtest_fcgi_record(fd, STDIN, 1, "a=1", 3);
+    qtest_fcgi_record(fd, STDIN, 1, "&b=2", 4);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=1,b=2"));
+
+    // aborted while waiting, the connection is kept
+    qtest_fcgi_begin(fd, 2, 1, true);
+    qtest_fcgi_param(fd, 2, "REQUEST_METHOD", "POST");
+    qtest_fcgi_param(fd, 2, "CONTENT_LENGTH", "10");
+    qtest_fcgi_record(fd, PARAMS, 2, NULL, 0);
+    qtest_fcgi_record(fd, 2, 2, NULL, 0);  // ABORT_REQUEST
+    len = qtest_fcgi_response(fd, 2, out, sizeof(out), &status);
+    ASSERT_NOT_NULL(strstr(out, "started"));
+    ASSERT_EQUAL_INT(status, 0);
+
+    qtest_fcgi_begin(fd, 3, 1, true);
+    qtest_fcgi_param(fd, 3, "REQUEST_METHOD", "GET");
+    qtest_fcgi_param(fd, 3, "QUERY_STRING", "a=3");
+    qtest_fcgi_record(fd, PARAMS, 3, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 3, NULL, 0);
+    len = qtest_fcgi_response(fd, 3, out, sizeof(out), &status);
+    ASSERT_NOT_NULL(strstr(out, "a=3,b=(null)"));
+    close(fd);
+
+    ASSERT_TRUE(qtest_stop(server));
+    qfcgi_free(fcgi);
+}
+#endif
+
+TEST("Test prefork process manager")
+{
+    fcgi = qfcgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(fcgi);
+    ASSERT_TRUE(qfcgi_setlimits(fcgi, 2, 0));
+    server = qtest_fork(serve_prefork, fcgi);
+
+    // recycled after 2 requests each
+    int pids[6], i, j, distinct = 0;
+    for (i = 0; i < 6; i++) {
+        pids[i] = get_pid();
+        ASSERT_TRUE(pids[i] > 0);
+        for (j = 0; j < i && pids[j] != pids[i]; j++);
+        if (j == i) distinct++;
+    }
+    ASSERT_TRUE(distinct >= 3);
+
+    // reloaded by new workers
+    kill(server, SIGHUP);
+    usleep(200 * 1000);
+    int pid = get_pid();
+    ASSERT_TRUE(pid > 0);
+    for (i = 0; i < 6; i++) {
+        ASSERT_TRUE(pid != pids[i]);
+    }
+
+    ASSERT_TRUE(qtest_stop(server));
+    qfcgi_free(fcgi);
+}
+
+TEST("Test prefork reload keeps waiting connections")
+{
+    // a free port
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int tmp = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQUAL_INT(0, bind(tmp, (struct sockaddr *)&sin, sizeof(sin)));
+    ASSERT_EQUAL_INT(0, getsockname(tmp, (struct sockaddr *)&sin, &sinlen));
+    int port = ntohs(sin.sin_port);
+    close(tmp);
+
+    // listens in the child only, the workers bind the port with SO_REUSEPORT
+    server = qtest_fork(serve_reload, &port);
+    usleep(200 * 1000);
+
+    // the only worker waits for the rest of a request
+    int busy = qtest_tcpconnect(port);
+    ASSERT_TRUE(busy >= 0);
+    qtest_fcgi_begin(busy, 1, 1, false);
+    usleep(100 * 1000);
+
+    // the next one waits to be accepted
+    int fd = qtest_tcpconnect(port);
+    ASSERT_TRUE(fd >= 0);
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+
+    // taken over by the new worker
+    kill(server, SIGHUP);
+    char out[256];
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "pid="));
+    close(fd);
+    close(busy);
+
+    ASSERT_TRUE(qtest_stop(server));
+}
+
+QUNIT_END();
+
+static int serve_accept(void *arg)
+{
+    qfcgi_t *fcgi = (qfcgi_t *)arg;
+    while (qfcgi_accept(fcgi) == true) {
+        qentry_t *req = qcgireq_parse(NULL, 0);
+        qcgires_setcontenttype(req, "text/plain");
+        printf("a=%s,b=%s", req->getstr(req, "a", false), req->getstr(req, "b", false));
+        if (getenv("QUERY_STRING") != NULL) {
+            printf(",method=%s", getenv("REQUEST_METHOD"));
+        }
+        req->free(req);
+    }
+    return 0;
+}
+
+static void pool_handler(qcgictx_t *ctx, void *arg)
+{
+    qentry_t *req = qcgireq_parse_ctx(ctx, NULL, 0);
+    qcgires_setcontenttype(req, "text/plain");
+    fprintf(ctx->out, "a=%s,b=%s,method=%s", req->getstr(req, "a", false),
+            req->getstr(req, "b", false), qcgireq_getenv(req, "REQUEST_METHOD"));
+    req->free(req);
+}
+
+static void pool_stop(int signo)
+{
+    qfcgi_stop(fcgi);
+}
+
+static int serve_pool(void *arg)
+{
+    signal(SIGTERM, pool_stop);
+    return (qfcgi_serve((qfcgi_t *)arg, 2, pool_handler, NULL) == true) ? 0 : 1;
+}
+
+static int serve_loop(void *arg)
+{
+    signal(SIGTERM, pool_stop);
+    return (qfcgi_loop((qfcgi_t *)arg, 0, pool_handler, NULL) == true) ? 0 : 1;
+}
+
+static void async_body(qfcgireq_t *req, void *arg)
+{
+    if (qfcgireq_aborted(req) == true) {
+        qfcgireq_end(req);
+        return;
+    }
+    qentry_t *form = qcgireq_parse_ctx(qfcgireq_getctx(req), NULL, 0);
+    fprintf(qfcgireq_getctx(req)->out, "a=%s,b=%s",
+            form->getstr(form, "a", false), form->getstr(form, "b", false));
+    form->free(form);
+    qfcgireq_end(req);
+}
+
+static void async_start(qfcgireq_t *req, void *arg)
+{
+    fprintf(qfcgireq_getctx(req)->out, "Content-Type: text/plain\r\n\r\nstarted,");
+    fflush(qfcgireq_getctx(req)->out);
+    qfcgireq_wait(req, Q_FCGIREQ_EOF, async_body, NULL);
+}
+
+static int serve_async(void *arg)
+{
+    signal(SIGTERM, pool_stop);
+    return (qfcgi_loop_async((qfcgi_t *)arg, 0, async_start, NULL) == true) ? 0 : 1;
+}
+
+static void prefork_worker(qfcgi_t *fcgi, void *arg)
+{
+    while (qfcgi_accept(fcgi) == true) {
+        printf("Content-Type: text/plain\r\n\r\npid=%d", getpid());
+    }
+}
+
+static int serve_prefork(void *arg)
+{
+    bool ret = qfcgi_prefork((qfcgi_t *)arg, 2, Q_FCGI_PINCPU, prefork_worker, NULL);
+    return (ret == true) ? 0 : 1;
+}
+
+// one worker on a TCP port, arg is the port
+static int serve_reload(void *arg)
+{
+    char addr[80];
+    snprintf(addr, sizeof(addr), "127.0.0.1:%d", *(int *)arg);
+    fcgi = qfcgi_listen(addr, 0);
+    if (fcgi == NULL) return 1;
+    return (qfcgi_prefork(fcgi, 1, 0, prefork_worker, NULL) == true) ? 0 : 1;
+}
+
+static const qfcgi_scoreslot_t *find_slot(const qfcgi_scoreboard_t *board,
+                                          Q_SCORE_T state)
+{
+    const qfcgi_scoreslot_t *slots = (const qfcgi_scoreslot_t *)(board + 1);
+    uint32_t i;
+    for (i = 0; i < board->nslots; i++) {
+        if (slots[i].pid != 0 && slots[i].state == state) return &slots[i];
+    }
+    return NULL;
+}
+
+// pid of the worker which served a request
+static int get_pid(void)
+{
+    int fd = qtest_connect(qtest_sockpath());
+    if (fd < 0) return -1;
+    qtest_fcgi_begin(fd, 1, 1, false);
+    qtest_fcgi_record(fd, PARAMS, 1, NULL, 0);
+    qtest_fcgi_record(fd, STDIN, 1, NULL, 0);
+
+    char out[256];
+    int status;
+    int len = qtest_fcgi_response(fd, 1, out, sizeof(out), &status);
+    close(fd);
+    char *p = (len > 0) ? strstr(out, "pid=") : NULL;
+    return (p != NULL) ? atoi(p + 4) : -1;
+}
@@ -0,0 +1,240 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qtestnet.h"
+#include "qdecoder.h"
+#include <unistd.h>
+
+static int serve(void *arg);
+static int read_response(int fd, char *out, size_t size);
+
+static qhttpd_t *httpd;
+static pid_t server;
+
+QUNIT_START("Test qhttpd.c");
+
+TEST("Test keep-alive and pipelining")
+{
+    httpd = qhttpd_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(httpd);
+    server = qtest_fork(serve, httpd);
+
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char *req = "GET /app?a=hello%20world&b=1 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                      "GET /app?a=second HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(fd, req, strlen(req));
+
+    char out[4096];
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 200 OK\r\n", 17);
+    ASSERT_NOT_NULL(strstr(out, "Connection: keep-alive"));
+    ASSERT_NOT_NULL(strstr(out, "Content-Type: text/plain"));
+    ASSERT_NOT_NULL(strstr(out, "a=hello world,b=1,method=GET"));
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=second,b=(null),method=GET"));
+
+    // same connection again
+    req = "POST /app HTTP/1.1\r\nHost: localhost\r\n"
+          "Content-Type: application/x-www-form-urlencoded\r\n"
+          "Content-Length: 11\r\n\r\na=post&b=xy";
+    write(fd, req, strlen(req));
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=post,b=xy,method=POST"));
+    close(fd);
+}
+
+TEST("Test chunked request body")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char *req = "POST /app HTTP/1.1\r\nHost: localhost\r\n"
+                      "Content-Type: application/x-www-form-urlencoded\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n"
+                      "5\r\na=chu\r\n6;ext=1\r\nnked&b\r\n2\r\n=3\r\n0\r\n\r\n";
+    write(fd, req, strlen(req));
+
+    char out[4096];
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=chunked,b=3,method=POST"));
+    close(fd);
+}
+
+TEST("Test unread body arriving in pieces")
+{
+    // the body looks like a request, it must be skipped as a whole
+    const char *part1 = "a=1&b=2&c=";
+    const char *part2 = "GET /app?a=smuggled HTTP/1.1\r\n\r\n";
+    char req[512];
+    snprintf(req, sizeof(req), "POST /nobody HTTP/1.1\r\nHost: localhost\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\n"
+             "Content-Length: %zu\r\n\r\n%s", strlen(part1) + strlen(part2), part1);
+
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    write(fd, req, strlen(req));
+    usleep(100 * 1000);  // let the server read the first piece alone
+    write(fd, part2, strlen(part2));
+    const char *next = "GET /app?a=after HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(fd, next, strlen(next));
+
+    char out[4096];
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=(null),b=(null),method=POST"));
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=after,b=(null),method=GET"));
+    close(fd);
+}
+
+TEST("Test status, redirect and HTTP/1.0")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char *req = "GET /redirect HTTP/1.0\r\n\r\n";
+    write(fd, req, strlen(req));
+
+    char out[4096];
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) >= 0);
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 302 Found\r\n", 20);
+    ASSERT_NOT_NULL(strstr(out, "Location: /app"));
+    ASSERT_NOT_NULL(strstr(out, "Connection: close"));
+    ASSERT_EQUAL_INT(read(fd, out, sizeof(out)), 0);  // closed
+    close(fd);
+
+    fd = qtest_connect(qtest_sockpath());
+    req = "GET HTTP/1.1\r\n\r\n";  // malformed
+    write(fd, req, strlen(req));
+    read_response(fd, out, sizeof(out));
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 400 Bad Request\r\n", 26);
+    close(fd);
+
+    // header names are rejected rather than cut short
+    char name[300];
+    memset(name, 'X', sizeof(name));
+    char longreq[512];
+    snprintf(longreq, sizeof(longreq), "GET /app HTTP/1.1\r\n%.250s: 1\r\n\r\n", name);
+    fd = qtest_connect(qtest_sockpath());
+    write(fd, longreq, strlen(longreq));
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 200 OK\r\n", 17);
+    close(fd);
+    snprintf(longreq, sizeof(longreq), "GET /app HTTP/1.1\r\n%.251s: 1\r\n\r\n", name);
+    fd = qtest_connect(qtest_sockpath());
+    write(fd, longreq, strlen(longreq));
+    read_response(fd, out, sizeof(out));
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 400 Bad Request\r\n", 26);
+    close(fd);
+}
+
+TEST("Test headers ending with LF alone")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char *req = "GET /headers HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(fd, req, strlen(req));
+
+    // each one grows by a byte on the way out
+    char out[8192];
+    ASSERT_EQUAL_INT(read_response(fd, out, sizeof(out)), 2);
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 200 OK\r\n", 17);
+    ASSERT_NOT_NULL(strstr(out, "X-A: 299\r\n\r\nok"));
+    close(fd);
+}
+
+TEST("Test error responses keep the server running")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char *req = "GET /missing?a=<b> HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                      "GET /app?a=after HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(fd, req, strlen(req));
+
+    char out[4096];
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_EQUAL_MEM(out, "HTTP/1.1 404 Not Found\r\n", 24);
+    ASSERT_NOT_NULL(strstr(out, "<h1>404 Not Found</h1>"));
+    ASSERT_NOT_NULL(strstr(out, "No such page: &lt;b&gt;"));
+    ASSERT_TRUE(read_response(fd, out, sizeof(out)) > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=after,b=(null),method=GET"));
+    close(fd);
+
+    qtest_stop(server);
+    qhttpd_free(httpd);  // removes the socket file
+}
+
+QUNIT_END();
+
+static int serve(void *arg)
+{
+    qhttpd_t *httpd = (qhttpd_t *)arg;
+    while (qhttpd_accept(httpd) == true) {
+        // "/nobody" leaves the request body unread
+        bool nobody = !strcmp(getenv("PATH_INFO"), "/nobody");
+        qentry_t *req = qcgireq_parse(NULL, nobody ? Q_CGI_GET : 0);
+        if (!strcmp(getenv("PATH_INFO"), "/redirect")) {
+            qcgires_redirect(req, "/app");
+        } else if (!strcmp(getenv("PATH_INFO"), "/headers")) {
+            int i;
+            for (i = 0; i < 300; i++) printf("X-A: %d\n", i);
+            printf("\nok");
+        } else if (!strcmp(getenv("PATH_INFO"), "/missing")) {
+            qcgires_senderror(req, 404, "No such page: %s",
+                              req->getstr(req, "a", false));
+        } else {
+            qcgires_setcontenttype(req, "text/plain");
+            printf("a=%s,b=%s,method=%s", req->getstr(req, "a", false),
+                   req->getstr(req, "b", false), getenv("REQUEST_METHOD"));
+        }
+        req->free(req);
+    }
+    return 0;
+}
+
+// reads one response, returns the length of its body.
+static int read_response(int fd, char *out, size_t size)
+{
+    size_t len = 0;
+    char *body = NULL;
+    while (body == NULL && len < size - 1) {
+        if (read(fd, out + len, 1) != 1) return -1;
+        out[++len] = '\0';
+        if (len >= 4 && !memcmp(out + len - 4, "\r\n\r\n", 4)) body = out + len;
+    }
+    char *cl = strstr(out, "Content-Length: ");
+    int bodylen = (cl != NULL) ? atoi(cl + 16) : 0;
+    if (bodylen < 0 || len + bodylen >= size) return -1;
+    int got = 0;
+    while (got < bodylen) {
+        ssize_t n = read(fd, body + got, bodylen - got);
+        if (n <= 0) return -1;
+        got += n;
+    }
+    body[got] = '\0';
+    return bodylen;
+}
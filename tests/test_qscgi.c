@@ -0,0 +1,148 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "qunit.h"
+#include "qtestnet.h"
+#include "qdecoder.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static int serve(void *arg);
+static int request(const char *headers, size_t hlen, const char *body,
+                   char *out, size_t size);
+
+static qscgi_t *scgi;
+static pid_t server;
+
+QUNIT_START("Test qscgi.c");
+
+TEST("Test GET request")
+{
+    scgi = qscgi_listen(qtest_sockaddr(), 0);
+    ASSERT_NOT_NULL(scgi);
+    server = qtest_fork(serve, scgi);
+
+    const char h[] = "CONTENT_LENGTH\0" "0\0" "SCGI\0" "1\0"
+                     "REQUEST_METHOD\0" "GET\0" "QUERY_STRING\0" "a=hello%20world&b=2\0";
+    char out[4096];
+    int len = request(h, sizeof(h) - 1, "", out, sizeof(out));
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "Content-Type: text/plain"));
+    ASSERT_NOT_NULL(strstr(out, "a=hello world,b=2,method=GET"));
+}
+
+TEST("Test POST request")
+{
+    const char h[] = "CONTENT_LENGTH\0" "11\0" "SCGI\0" "1\0" "REQUEST_METHOD\0" "POST\0"
+                     "CONTENT_TYPE\0" "application/x-www-form-urlencoded\0";
+    char out[4096];
+    int len = request(h, sizeof(h) - 1, "a=post&b=xy", out, sizeof(out));
+    ASSERT_TRUE(len > 0);
+    ASSERT_NOT_NULL(strstr(out, "a=post,b=xy,method=POST"));
+}
+
+TEST("Test web server gone before the response")
+{
+    int fd = qtest_connect(qtest_sockpath());
+    ASSERT_TRUE(fd >= 0);
+    const char h[] = "35:CONTENT_LENGTH\0" "0\0" "QUERY_STRING\0" "late\0,";
+    write(fd, h, sizeof(h) - 1);
+    close(fd);
+    usleep(300 * 1000);
+
+    // not killed by SIGPIPE
+    ASSERT_EQUAL_INT(waitpid(server, NULL, WNOHANG), 0);
+    const char h2[] = "CONTENT_LENGTH\0" "0\0" "SCGI\0" "1\0" "QUERY_STRING\0" "a=1\0";
+    char out[4096];
+    request(h2, sizeof(h2) - 1, "", out, sizeof(out));
+    ASSERT_NOT_NULL(strstr(out, "a=1,b=(null)"));
+}
+
+TEST("Test malformed header block")
+{
+    char out[4096];
+    int len = request("X\0", 2, "", out, sizeof(out));  // no CONTENT_LENGTH
+    ASSERT_EQUAL_INT(len, 0);
+
+    // the server goes on
+    const char h[] = "CONTENT_LENGTH\0" "0\0" "SCGI\0" "1\0" "QUERY_STRING\0" "a=1\0";
+    len = request(h, sizeof(h) - 1, "", out, sizeof(out));
+    ASSERT_NOT_NULL(strstr(out, "a=1,b=(null)"));
+
+    qtest_stop(server);
+    qscgi_free(scgi);  // removes the socket file
+}
+
+QUNIT_END();
+
+static int serve(void *arg)
+{
+    qscgi_t *scgi = (qscgi_t *)arg;
+    while (qscgi_accept(scgi) == true) {
+        const char *query = getenv("QUERY_STRING");
+        if (query != NULL && !strcmp(query, "late")) {
+            // written after the client went away
+            usleep(100 * 1000);
+            int i;
+            for (i = 0; i < 64 * 1024; i++) putchar('x');
+            continue;
+        }
+        qentry_t *req = qcgireq_parse(NULL, 0);
+        qcgires_setcontenttype(req, "text/plain");
+        printf("a=%s,b=%s", req->getstr(req, "a", false), req->getstr(req, "b", false));
+        if (getenv("REQUEST_METHOD") != NULL) {
+            printf(",method=%s", getenv("REQUEST_METHOD"));
+        }
+        req->free(req);
+    }
+    return 0;
+}
+
+// sends a request and returns the length of the response read until EOF.
+static int request(const char *headers, size_t hlen, const char *body,
+                   char *out, size_t size)
+{
+    int fd = qtest_connect(qtest_sockpath());
+    if (fd < 0) return -1;
+
+    char prefix[16];
+    int plen = snprintf(prefix, sizeof(prefix), "%zu:", hlen);
+    // the server may close early on a malformed request
+    send(fd, prefix, plen, MSG_NOSIGNAL);
+    send(fd, headers, hlen, MSG_NOSIGNAL);
+    send(fd, ",", 1, MSG_NOSIGNAL);
+    send(fd, body, strlen(body), MSG_NOSIGNAL);
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = read(fd, out + len, size - 1 - len)) > 0) len += n;
+    out[len] = '\0';
+    close(fd);
+    return len;
+}
@@ -0,0 +1,334 @@
+/******************************************************************************
+ * qDecoder
+ *
+ * Copyright (c) 2000-2022 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * Shows the scoreboard of qfcgi_setscoreboard(): what every worker is
+ * doing, and the throughput and latency of them all. The scoreboard is
+ * mapped read only, the workers are never waited for.
+ *
+ * Usage: qdecoder-stat [-a] [-i seconds [-c count]] scoreboard-file
+ *
+ *   -a     also list free slots
+ *   -i     print the throughput of every interval instead of a snapshot
+ *   -c     number of intervals, until interrupted by default
+ *
+ * @file qdecoder-stat.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "qdecoder.h"
+
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytesin;
+    uint64_t bytesout;
+    uint64_t latency;
+    uint64_t histogram[Q_SCORE_BUCKETS];
+    int workers;
+    int busy;
+    int active;
+} total_t;
+
+static const qfcgi_scoreboard_t *board;
+static size_t boardsize;
+static ino_t boardino;
+
+static bool map(const char *path);
+static const qfcgi_scoreslot_t *slotat(int i);
+static void readslot(const qfcgi_scoreslot_t *slot, qfcgi_scoreslot_t *copy);
+static bool alive(const qfcgi_scoreslot_t *slot);
+static void sum(total_t *total);
+static void snapshot(bool all);
+static void interval(const total_t *prev, const total_t *now, double secs);
+static const char *percentile(const uint64_t *histogram, uint64_t count,
+                              double p, char *buf, size_t size);
+static const char *bytes(uint64_t n, char *buf, size_t size);
+static int64_t wallms(void);
+
+int main(int argc, char **argv)
+{
+    bool all = false;
+    int seconds = 0;
+    long count = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "ai:c:")) != -1) {
+        if (opt == 'a') all = true;
+        else if (opt == 'i') seconds = atoi(optarg);
+        else if (opt == 'c') count = atol(optarg);
+        else optind = argc + 1;
+    }
+    if (optind != argc - 1 || seconds < 0) {
+        fprintf(stderr, "Usage: %s [-a] [-i seconds [-c count]] scoreboard-file\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *path = argv[optind];
+    if (map(path) == false) return EXIT_FAILURE;
+    if (seconds == 0) {
+        snapshot(all);
+        return EXIT_SUCCESS;
+    }
+
+    total_t prev, now;
+    sum(&prev);
+    printf("%8s %6s %7s %10s %10s %7s %7s %7s %7s\n", "TIME", "BUSY",
+           "REQ/S", "IN/S", "OUT/S", "ERR/S", "P50", "P90", "P99");
+    for (; count != 0; count--) {
+        sleep(seconds);
+        ino_t ino = boardino;
+        if (map(path) == false) return EXIT_FAILURE;
+        sum(&now);
+        if (boardino == ino) interval(&prev, &now, seconds);
+        else printf("(scoreboard replaced)\n");
+        prev = now;
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// maps the scoreboard, again when the file has been replaced.
+static bool map(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (board != NULL && st.st_ino == boardino) return true;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *p = MAP_FAILED;
+    if (st.st_size >= (off_t)sizeof(qfcgi_scoreboard_t)) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    const qfcgi_scoreboard_t *b = (const qfcgi_scoreboard_t *)p;
+    if (p == MAP_FAILED || memcmp(b->magic, Q_SCORE_MAGIC, sizeof(b->magic)) ||
+        b->version != Q_SCORE_VERSION || b->slotsize != sizeof(qfcgi_scoreslot_t) ||
+        (size_t)st.st_size < sizeof(qfcgi_scoreboard_t) +
+                             (size_t)b->nslots * b->slotsize) {
+        fprintf(stderr, "%s is not a scoreboard of this version.\n", path);
+        if (p != MAP_FAILED) munmap(p, st.st_size);
+        return false;
+    }
+
+    if (board != NULL) munmap((void *)board, boardsize);
+    board = b;
+    boardsize = st.st_size;
+    boardino = st.st_ino;
+    return true;
+}
+
+static const qfcgi_scoreslot_t *slotat(int i)
+{
+    return (const qfcgi_scoreslot_t *)(board + 1) + i;
+}
+
+// copies a slot, with the request fields of one moment.
+static void readslot(const qfcgi_scoreslot_t *slot, qfcgi_scoreslot_t *copy)
+{
+    int tries;
+    for (tries = 0; tries < 100; tries++) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(copy, slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0 && seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    copy->method[sizeof(copy->method) - 1] = '\0';
+    copy->uri[sizeof(copy->uri) - 1] = '\0';
+}
+
+static bool alive(const qfcgi_scoreslot_t *slot)
+{
+    return (slot->pid != 0 &&
+            (kill((pid_t)slot->pid, 0) == 0 || errno != ESRCH));
+}
+
+static void sum(total_t *total)
+{
+    memset(total, 0, sizeof(*total));
+    uint32_t i;
+    for (i = 0; i < board->nslots; i++) {
+        qfcgi_scoreslot_t s;
+        readslot(slotat(i), &s);
+        total->requests += s.requests;
+        total->errors += s.errors;
+        total->bytesin += s.bytesin;
+        total->bytesout += s.bytesout;
+        total->latency += s.latency;
+        int b;
+        for (b = 0; b < Q_SCORE_BUCKETS; b++) total->histogram[b] += s.histogram[b];
+        if (alive(&s) == false) continue;
+        total->workers++;
+        if (s.state == Q_SCORE_BUSY || s.active > 0) total->busy++;
+        total->active += s.active;
+    }
+}
+
+static void snapshot(bool all)
+{
+    static const char *states[] = { "free", "idle", "busy", "loop" };
+    int64_t now = wallms();
+    char in[16], out[16];
+
+    printf("%-7s %3s %-5s %6s %10s %7s %9s %9s %9s  %s\n", "PID", "THR",
+           "STATE", "ACTIVE", "REQUESTS", "ERRORS", "IN", "OUT", "AGE",
+           "REQUEST");
+    uint32_t i;
+    for (i = 0; i < board->nslots; i++) {
+        qfcgi_scoreslot_t s;
+        readslot(slotat(i), &s);
+        if (s.pid == 0 && (all == false || s.requests == 0)) continue;
+
+        const char *state = (s.state <= Q_SCORE_LOOP) ? states[s.state] : "?";
+        if (s.pid != 0 && alive(&s) == false) state = "dead";
+        char age[16] = "-";
+        if (s.since > 0 && now >= s.since) {
+            snprintf(age, sizeof(age), "%.1fs", (now - s.since) / 1000.0);
+        }
+        printf("%-7u %3u %-5s %6u %10llu %7llu %9s %9s %9s  %s %s\n",
+               s.pid, s.thread, state, s.active,
+               (unsigned long long)s.requests, (unsigned long long)s.errors,
+               bytes(s.bytesin, in, sizeof(in)), bytes(s.bytesout, out, sizeof(out)),
+               age, s.method, s.uri);
+    }
+
+    total_t t;
+    sum(&t);
+    printf("\n%d workers, %d busy, %d requests in progress\n",
+           t.workers, t.busy, t.active);
+    printf("%llu requests, %llu errors, %s in, %s out",
+           (unsigned long long)t.requests, (unsigned long long)t.errors,
+           bytes(t.bytesin, in, sizeof(in)), bytes(t.bytesout, out, sizeof(out)));
+    if (t.requests > 0) {
+        printf(", %.3fms average", t.latency / 1000.0 / t.requests);
+    }
+    printf("\n");
+    if (t.requests == 0) return;
+
+    uint64_t max = 0;
+    int b;
+    for (b = 0; b < Q_SCORE_BUCKETS; b++) {
+        if (t.histogram[b] > max) max = t.histogram[b];
+    }
+    printf("\nlatency\n");
+    for (b = 0; b < Q_SCORE_BUCKETS; b++) {
+        if (t.histogram[b] == 0) continue;
+        char label[16];
+        if (b < Q_SCORE_BUCKETS - 1) snprintf(label, sizeof(label), "< %dms", 1 << b);
+        else snprintf(label, sizeof(label), ">= %dms", 1 << (b - 1));
+        int width = (int)(t.histogram[b] * 50 / max);
+        printf("%10s %10llu %5.1f%% %.*s\n", label,
+               (unsigned long long)t.histogram[b],
+               t.histogram[b] * 100.0 / t.requests, (width > 0) ? width : 1,
+               "##################################################");
+    }
+}
+
+static void interval(const total_t *prev, const total_t *now, double secs)
+{
+    uint64_t histogram[Q_SCORE_BUCKETS];
+    uint64_t count = 0;
+    int b;
+    for (b = 0; b < Q_SCORE_BUCKETS; b++) {
+        // slots are never cleared, the counters only grow
+        histogram[b] = now->histogram[b] - prev->histogram[b];
+        count += histogram[b];
+    }
+
+    char timestr[16], in[16], out[16], p50[16], p90[16], p99[16];
+    time_t t = time(NULL);
+    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&t));
+    printf("%8s %6d %7.1f %10s %10s %7.1f %7s %7s %7s\n", timestr, now->busy,
+           (now->requests - prev->requests) / secs,
+           bytes((now->bytesin - prev->bytesin) / secs, in, sizeof(in)),
+           bytes((now->bytesout - prev->bytesout) / secs, out, sizeof(out)),
+           (now->errors - prev->errors) / secs,
+           percentile(histogram, count, 0.50, p50, sizeof(p50)),
+           percentile(histogram, count, 0.90, p90, sizeof(p90)),
+           percentile(histogram, count, 0.99, p99, sizeof(p99)));
+}
+
+// upper bound of the bucket holding the percentile.
+static const char *percentile(const uint64_t *histogram, uint64_t count,
+                              double p, char *buf, size_t size)
+{
+    if (count == 0) return "-";
+    uint64_t rank = (uint64_t)(count * p + 0.5), seen = 0;
+    if (rank == 0) rank = 1;
+    int b;
+    for (b = 0; b < Q_SCORE_BUCKETS - 1; b++) {
+        seen += histogram[b];
+        if (seen >= rank) break;
+    }
+    if (b < Q_SCORE_BUCKETS - 1) snprintf(buf, size, "<%dms", 1 << b);
+    else snprintf(buf, size, ">%dms", 1 << (b - 1));
+    return buf;
+}
+
+static const char *bytes(uint64_t n, char *buf, size_t size)
+{
+    const char *units = "BKMGTP";
+    double v = n;
+    while (v >= 1024 && units[1] != '\0') {
+        v /= 1024;
+        units++;
+    }
+    if (*units == 'B') snprintf(buf, size, "%llu", (unsigned long long)n);
+    else snprintf(buf, size, "%.1f%c", v, *units);
+    return buf;
+}
+
+static int64_t wallms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}